@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core widgets
+QT       += core widgets concurrent
 QT       -= gui
 
 VERSION = 6.4.0
@@ -26,6 +26,8 @@ SOURCES += \
     renderer_stretchminmax.cpp \
     renderer_stretchstddev.cpp \
     renderer.cpp \
+    batchrenderer.cpp \
+    tilerenderer.cpp \
     raster2png_interface.cpp
 
 HEADERS +=\
@@ -40,6 +42,9 @@ HEADERS +=\
     renderer_stretchstddev.h \
     renderer.h \
     raster2png_interface.h \
+    raster2png_batch.h \
+    batchrenderer.h \
+    tilerenderer.h \
     raster2png_exception.h
 
 CONFIG(release, debug|release): BUILD_TYPE = release
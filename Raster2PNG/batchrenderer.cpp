@@ -0,0 +1,312 @@
+#include "batchrenderer.h"
+#include "raster2png_interface.h"
+#include "raster2png_exception.h"
+#include "renderer_bytedata.h"
+#include "renderer_classified.h"
+#include "renderer_gcderror.h"
+#include "renderer_gcdptdens.h"
+#include "renderer_gcdslopedeg.h"
+#include "renderer_gcdslopeper.h"
+#include "renderer_stretchminmax.h"
+#include <QtConcurrent>
+namespace Raster2PNG {
+
+BatchRenderer::BatchRenderer(const char *manifestPath)
+{
+    readManifest(manifestPath);
+}
+
+int BatchRenderer::run()
+{
+    // Our own pool so every layer's row conversion still has the global pool to itself
+    QThreadPool pool;
+    QList< QFuture<void> > futures;
+
+    // Every distinct layer is rendered once, then every job stacks the ones it needs
+    for (int n=0; n<layers.size(); n++)
+    {
+        futures.append(QtConcurrent::run(&pool, this, &BatchRenderer::renderLayer, n));
+    }
+    for (int n=0; n<futures.size(); n++)
+    {
+        futures[n].waitForFinished();
+    }
+    futures.clear();
+
+    for (int n=0; n<jobs.size(); n++)
+    {
+        futures.append(QtConcurrent::run(&pool, this, &BatchRenderer::composeJob, n));
+    }
+    for (int n=0; n<futures.size(); n++)
+    {
+        futures[n].waitForFinished();
+    }
+
+    for (int n=0; n<jobs.size(); n++)
+    {
+        if (jobs[n].nErrorCode != PROCESS_OK)
+        {
+            return jobs[n].nErrorCode;
+        }
+    }
+    return PROCESS_OK;
+}
+
+int BatchRenderer::jobCount() const
+{
+    return jobs.size();
+}
+
+int BatchRenderer::failedJobCount() const
+{
+    int nFailed = 0;
+    for (int n=0; n<jobs.size(); n++)
+    {
+        if (jobs[n].nErrorCode != PROCESS_OK)
+        {
+            nFailed++;
+        }
+    }
+    return nFailed;
+}
+
+bool BatchRenderer::jobFailed(int nJob) const
+{
+    return jobs[nJob].nErrorCode != PROCESS_OK;
+}
+
+QString BatchRenderer::jobError(int nJob) const
+{
+    return jobs[nJob].pngPath + ": " + jobs[nJob].error;
+}
+
+Renderer *BatchRenderer::createRenderer(const char *inputRasterPath, const QString &style, int nTransparency)
+{
+    if (QString::compare(style, "DEM", Qt::CaseInsensitive) == 0)
+        return new Renderer_StretchMinMax(inputRasterPath, CR_DEM, nTransparency);
+    else if (QString::compare(style, "DoD", Qt::CaseInsensitive) == 0)
+        return new Renderer_StretchMinMax(inputRasterPath, CR_DoD, nTransparency, true);
+    else if (QString::compare(style, "HillShade", Qt::CaseInsensitive) == 0)
+        return new Renderer_ByteData(inputRasterPath, CR_BlackWhite, nTransparency);
+    else if (QString::compare(style, "Error", Qt::CaseInsensitive) == 0)
+        return new Renderer_GCDError(inputRasterPath, nTransparency);
+    else if (QString::compare(style, "PointDensity", Qt::CaseInsensitive) == 0)
+        return new Renderer_GCDPtDens(inputRasterPath, nTransparency);
+    else if (QString::compare(style, "SlopeDeg", Qt::CaseInsensitive) == 0)
+        return new Renderer_GCDSlopeDeg(inputRasterPath, nTransparency);
+    else if (QString::compare(style, "SlopePC", Qt::CaseInsensitive) == 0)
+        return new Renderer_GCDSlopePer(inputRasterPath, nTransparency);
+
+    // Anything else is a colour ramp name for a min-max stretch
+    QByteArray qbStyle = style.toUtf8();
+    return new Renderer_StretchMinMax(inputRasterPath, (ColorRamp) GetSymbologyStyleFromString(qbStyle.constData()), nTransparency);
+}
+
+void BatchRenderer::readManifest(const char *manifestPath)
+{
+    QFile manifest(QString::fromUtf8(manifestPath));
+    if (!manifest.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        throw Raster2PNGException(PNG_MANIFEST_ERROR, QString::fromUtf8(manifestPath));
+    }
+
+    // png_path,raster|style[|opacity];raster|style[|opacity]...,long_axis[,quality[,legend]]
+    QTextStream in(&manifest);
+    int nLine = 0;
+    while (!in.atEnd())
+    {
+        QString line = in.readLine().trimmed();
+        nLine++;
+        if (line.isEmpty() || line.startsWith("#"))
+        {
+            continue;
+        }
+
+        QStringList fields = line.split(",");
+        if (fields.size() < 3 || fields.size() > 5)
+        {
+            throw Raster2PNGException(PNG_MANIFEST_ERROR, QString("Line %1 needs a png path, layers and a long axis: %2").arg(nLine).arg(line));
+        }
+
+        bool bOk = false;
+        int nLength = fields[2].trimmed().toInt(&bOk);
+        if (!bOk || nLength <= 0)
+        {
+            throw Raster2PNGException(PNG_MANIFEST_ERROR, QString("Line %1 has an invalid long axis: %2").arg(nLine).arg(fields[2]));
+        }
+
+        BatchJob job;
+        job.pngPath = fields[0].trimmed();
+        job.nQuality = 100;
+        job.nErrorCode = PROCESS_OK;
+        if (fields.size() > 3)
+        {
+            job.nQuality = fields[3].trimmed().toInt(&bOk);
+            if (!bOk || job.nQuality < 0 || job.nQuality > 100)
+            {
+                throw Raster2PNGException(PNG_MANIFEST_ERROR, QString("Line %1 has an invalid quality: %2").arg(nLine).arg(fields[3]));
+            }
+        }
+        bool bLegend = fields.size() > 4 && fields[4].trimmed().toInt() > 0;
+
+        QStringList layerList = fields[1].split(";", QString::SkipEmptyParts);
+        if (layerList.isEmpty())
+        {
+            throw Raster2PNGException(PNG_MANIFEST_ERROR, QString("Line %1 has no layers").arg(nLine));
+        }
+        foreach (QString layerText, layerList)
+        {
+            QStringList parts = layerText.split("|");
+            QString style = (parts.size() > 1) ? parts[1].trimmed() : QString("HillShade");
+            int nOpacity = 100;
+            if (parts.size() > 2)
+            {
+                nOpacity = parts[2].trimmed().toInt(&bOk);
+                if (!bOk || nOpacity < 0 || nOpacity > 100)
+                {
+                    throw Raster2PNGException(PNG_MANIFEST_ERROR, QString("Line %1 has an invalid opacity: %2").arg(nLine).arg(parts[2]));
+                }
+            }
+            job.layers.append(addLayer(parts[0].trimmed(), style, nOpacity, nLength));
+        }
+
+        // The legend describes the top layer
+        if (bLegend)
+        {
+            QFileInfo pngInfo(job.pngPath);
+            layers[job.layers.last()].legendPaths.append(pngInfo.absolutePath() + "/" + pngInfo.baseName() + "_legend.png");
+        }
+
+        jobs.append(job);
+    }
+}
+
+int BatchRenderer::addLayer(const QString &rasterPath, const QString &style, int nOpacity, int nLength)
+{
+    QString key = QString("%1|%2|%3|%4").arg(QFileInfo(rasterPath).absoluteFilePath()).arg(style.toLower()).arg(nOpacity).arg(nLength);
+    if (layerIndex.contains(key))
+    {
+        return layerIndex.value(key);
+    }
+
+    BatchLayer layer;
+    layer.rasterPath = rasterPath;
+    layer.style = style;
+    layer.nOpacity = nOpacity;
+    layer.nLength = nLength;
+    layer.nErrorCode = PROCESS_OK;
+    layers.append(layer);
+    layerIndex.insert(key, layers.size() - 1);
+    return layers.size() - 1;
+}
+
+void BatchRenderer::renderLayer(int nLayer)
+{
+    BatchLayer &layer = layers[nLayer];
+
+    // The renderer keeps a pointer to the path so it has to outlive it
+    QByteArray qbRasterPath = layer.rasterPath.toUtf8();
+    Renderer *pRenderer = NULL;
+
+    try
+    {
+        if (!QFileInfo(layer.rasterPath).exists())
+        {
+            throw Raster2PNGException(PNG_INPUT_ERROR, layer.rasterPath);
+        }
+        pRenderer = createRenderer(qbRasterPath.constData(), layer.style, qRound(layer.nOpacity * 2.55));
+        layer.image = pRenderer->renderImage(layer.nLength, layer.transform);
+
+        // Drawing text needs a GUI application for its fonts
+        if (!layer.legendPaths.isEmpty() && qobject_cast<QGuiApplication *>(QCoreApplication::instance()) == NULL)
+        {
+            throw Raster2PNGException(PNG_OUTPUT_ERROR, "Legends can only be drawn from a GUI application");
+        }
+
+        // Every job that wants this layer's legend gets a copy of the same one
+        for (int i=0; i<layer.legendPaths.size(); i++)
+        {
+            if (i == 0)
+            {
+                pRenderer->printLegend(layer.legendPaths[0].toUtf8().constData());
+            }
+            else if (layer.legendPaths[i] != layer.legendPaths[0])
+            {
+                QFile::remove(layer.legendPaths[i]);
+                QFile::copy(layer.legendPaths[0], layer.legendPaths[i]);
+            }
+        }
+    }
+    catch (Raster2PNGException e)
+    {
+        layer.nErrorCode = e.GetErrorCode();
+        layer.error = e.GetReturnMsgAsString();
+    }
+
+    delete pRenderer;
+}
+
+void BatchRenderer::composeJob(int nJob)
+{
+    BatchJob &job = jobs[nJob];
+
+    for (int n=0; n<job.layers.size(); n++)
+    {
+        const BatchLayer &layer = layers[job.layers[n]];
+        if (layer.nErrorCode != PROCESS_OK)
+        {
+            job.nErrorCode = layer.nErrorCode;
+            job.error = layer.error;
+            return;
+        }
+    }
+
+    const BatchLayer &base = layers[job.layers[0]];
+    QImage image = base.image;
+
+    // Stack the layers in memory, bottom first, so the PNG is only encoded once.
+    // The base layer sets the frame and every other layer is placed by its own geotransform.
+    if (job.layers.size() > 1)
+    {
+        for (int n=1; n<job.layers.size(); n++)
+        {
+            const BatchLayer &layer = layers[job.layers[n]];
+            if (layer.transform[2] != 0.0 || layer.transform[4] != 0.0 || base.transform[2] != 0.0 || base.transform[4] != 0.0
+                    || layer.transform[1] * base.transform[1] <= 0.0 || layer.transform[5] * base.transform[5] <= 0.0)
+            {
+                job.nErrorCode = PNG_INPUT_ERROR;
+                job.error = QString("%1 can't be lined up with %2").arg(layer.rasterPath).arg(base.rasterPath);
+                return;
+            }
+        }
+
+        image = QImage(base.image.size(), QImage::Format_ARGB32);
+        image.fill(Qt::transparent);
+        QPainter painter(&image);
+        painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        for (int n=0; n<job.layers.size(); n++)
+        {
+            const BatchLayer &layer = layers[job.layers[n]];
+            QRectF target((layer.transform[0] - base.transform[0]) / base.transform[1],
+                          (layer.transform[3] - base.transform[3]) / base.transform[5],
+                          layer.image.width() * layer.transform[1] / base.transform[1],
+                          layer.image.height() * layer.transform[5] / base.transform[5]);
+            painter.drawImage(target, layer.image);
+        }
+        painter.end();
+    }
+
+    try
+    {
+        QByteArray qbPngPath = job.pngPath.toUtf8();
+        Renderer::savePNG(image, qbPngPath.constData(), job.nQuality, base.transform);
+    }
+    catch (Raster2PNGException e)
+    {
+        job.nErrorCode = e.GetErrorCode();
+        job.error = e.GetReturnMsgAsString();
+    }
+}
+
+}
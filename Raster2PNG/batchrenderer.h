@@ -0,0 +1,58 @@
+#ifndef BATCHRENDERER_H
+#define BATCHRENDERER_H
+
+#include "renderer.h"
+namespace Raster2PNG {
+
+/* One raster drawn in one style at one size. Jobs that stack the same layer share its image. */
+struct BatchLayer
+{
+    QString rasterPath;
+    QString style;
+    int nOpacity;
+    int nLength;
+    QStringList legendPaths;
+
+    QImage image;
+    double transform[6];
+    int nErrorCode;
+    QString error;
+};
+
+/* One output PNG. The first layer is drawn at the bottom. */
+struct BatchJob
+{
+    QString pngPath;
+    QList<int> layers;
+    int nQuality;
+    int nErrorCode;
+    QString error;
+};
+
+class RASTER2PNGSHARED_EXPORT BatchRenderer
+{
+public:
+    BatchRenderer(const char *manifestPath);
+
+    int run();
+    int jobCount() const;
+    int failedJobCount() const;
+    bool jobFailed(int nJob) const;
+    QString jobError(int nJob) const;
+
+    static Renderer *createRenderer(const char *inputRasterPath,
+                                    const QString &style,
+                                    int nTransparency);
+
+protected:
+    QList<BatchLayer> layers;
+    QList<BatchJob> jobs;
+    QHash<QString, int> layerIndex;
+
+    void readManifest(const char *manifestPath);
+    int addLayer(const QString &rasterPath, const QString &style, int nOpacity, int nLength);
+    void renderLayer(int nLayer);
+    void composeJob(int nJob);
+};
+}
+#endif // BATCHRENDERER_H
@@ -0,0 +1,46 @@
+#ifndef RASTER2PNG_BATCH_H
+#define RASTER2PNG_BATCH_H
+
+#include "raster2png_global.h"
+
+namespace Raster2PNG {
+
+// Same size as the error buffers RasterManager hands out
+const int R2PNG_ERRBUFFERSIZE = 1024;
+
+/**
+ * @brief CreatePNGBatch Render every PNG in a manifest in one process. Each line is
+ *        png_path,raster|style[|opacity];raster|style[|opacity]...,long_axis[,quality[,legend]]
+ *        Layers are listed bottom first and placed by their georeferencing within the first layer's
+ *        extent. Layers shared between lines are only rendered once.
+ *        It lives apart from raster2png_interface.h so it can be included next to
+ *        rastermanager_interface.h, which declares a different CreatePNG.
+ * @param psManifest
+ * @param sErr
+ * @return
+ */
+extern "C" R2PNG_DLL_API int CreatePNGBatch(const char * psManifest, char * sErr);
+
+/**
+ * @brief CreatePNGTiles Render a raster as a web mercator tile pyramid, <dir>/<z>/<x>/<y>.png.
+ *        The raster is only read for the most detailed zoom. Each zoom out is built from
+ *        2x2 blocks of the one below. Tiles that are all NoData aren't written.
+ * @param psInputRaster
+ * @param psOutputDir
+ * @param psStyle Same styles as the batch manifest
+ * @param nOpacity 0 to 100
+ * @param nMinZoom Least detailed zoom to build. Negative builds out until the raster fits on one tile.
+ * @param nTMS 0 numbers rows from the top (XYZ). Anything else numbers them from the bottom (TMS).
+ * @param sErr
+ * @return
+ */
+extern "C" R2PNG_DLL_API int CreatePNGTiles(const char * psInputRaster,
+                                            const char * psOutputDir,
+                                            const char * psStyle,
+                                            int nOpacity,
+                                            int nMinZoom,
+                                            int nTMS,
+                                            char * sErr);
+
+}
+#endif // RASTER2PNG_BATCH_H
@@ -8,6 +8,9 @@ namespace Raster2PNG {
 
 enum Raster2PNGOutputCodes {
     PROCESS_OK,
+    PNG_OUTPUT_ERROR,
+    PNG_INPUT_ERROR,
+    PNG_MANIFEST_ERROR,
 };
 class Raster2PNGException :public std::exception
 {
@@ -35,6 +38,15 @@ public:
         case PROCESS_OK:
             return "process completed successfully";
             break;
+        case PNG_OUTPUT_ERROR:
+            return "could not write the png";
+            break;
+        case PNG_INPUT_ERROR:
+            return "could not read the raster";
+            break;
+        case PNG_MANIFEST_ERROR:
+            return "invalid png batch manifest";
+            break;
 
         default:
             std::string errMsg = QString("Unhandled Raster Manager return code: ").arg(eErrorCode).toStdString();
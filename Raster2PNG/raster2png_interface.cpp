@@ -3,8 +3,12 @@
 #include "raster2png_interface.h"
 #include "raster2png_global.h"
 #include "raster2png_exception.h"
+#include "raster2png_batch.h"
 #include "renderer_bytedata.h"
+#include "batchrenderer.h"
+#include "tilerenderer.h"
 #include <QString>
+#include <cstring>
 namespace Raster2PNG {
 
 extern "C" R2PNG_DLL_API int CreatePNG(const char * psInputRaster,
@@ -29,6 +33,63 @@ extern "C" R2PNG_DLL_API int CreatePNG(const char * psInputRaster,
 
 }
 
+extern "C" R2PNG_DLL_API int CreatePNGBatch(const char * psManifest, char * sErr)
+{
+    try {
+        BatchRenderer batch(psManifest);
+        int eResult = batch.run();
+
+        // Say which PNG went wrong first. The rest of the batch still got rendered.
+        if (eResult != PROCESS_OK && sErr != NULL)
+        {
+            for (int n=0; n<batch.jobCount(); n++)
+            {
+                if (batch.jobFailed(n))
+                {
+                    QString sFailed = QString("%1 of %2 PNGs failed. %3").arg(batch.failedJobCount()).arg(batch.jobCount()).arg(batch.jobError(n));
+                    const QByteArray qbFailed = sFailed.toLocal8Bit();
+                    strncpy(sErr, qbFailed.constData(), R2PNG_ERRBUFFERSIZE - 1);
+                    sErr[R2PNG_ERRBUFFERSIZE - 1] = '\0';
+                    break;
+                }
+            }
+        }
+        return eResult;
+    }
+    catch (Raster2PNGException e){
+        if (sErr != NULL)
+        {
+            const QByteArray qbError = e.GetReturnMsgAsString().toLocal8Bit();
+            strncpy(sErr, qbError.constData(), R2PNG_ERRBUFFERSIZE - 1);
+            sErr[R2PNG_ERRBUFFERSIZE - 1] = '\0';
+        }
+        return e.GetErrorCode();
+    }
+}
+
+extern "C" R2PNG_DLL_API int CreatePNGTiles(const char * psInputRaster,
+                                            const char * psOutputDir,
+                                            const char * psStyle,
+                                            int nOpacity,
+                                            int nMinZoom,
+                                            int nTMS,
+                                            char * sErr)
+{
+    try {
+        TileRenderer tiles(psInputRaster, psOutputDir, QString::fromUtf8(psStyle), qRound(qBound(0, nOpacity, 100) * 2.55), nMinZoom, nTMS != 0);
+        return tiles.run();
+    }
+    catch (Raster2PNGException e){
+        if (sErr != NULL)
+        {
+            const QByteArray qbError = e.GetReturnMsgAsString().toLocal8Bit();
+            strncpy(sErr, qbError.constData(), R2PNG_ERRBUFFERSIZE - 1);
+            sErr[R2PNG_ERRBUFFERSIZE - 1] = '\0';
+        }
+        return e.GetErrorCode();
+    }
+}
+
 extern "C" R2PNG_DLL_API int GetSymbologyStyleFromString(const char * psStyle)
 {
     QString sStyle(psStyle);
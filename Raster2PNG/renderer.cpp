@@ -1,4 +1,7 @@
 #include "renderer.h"
+#include "raster2png_exception.h"
+#include <QtConcurrent>
+#include <algorithm>
 namespace Raster2PNG {
 
 Renderer::Renderer(const char *inputRasterPath,
@@ -7,12 +10,10 @@ Renderer::Renderer(const char *inputRasterPath,
                    bool zeroNoData)
 {
     pngOutPath = NULL;
+    bTableOnly = false;
 
     colorTable = new GDALColorTable(GPI_RGB);
 
-    pDriverTiff = GetGDALDriverManager()->GetDriverByName("GTiff");
-    pDriverPNG = GetGDALDriverManager()->GetDriverByName("PNG");
-
     setRendererColorTable(ramp, nTransparency);
     setupRaster(inputRasterPath);
     setZeroNoData(zeroNoData);
@@ -44,21 +45,116 @@ int Renderer::rasterToPNG(const char *pngPath, int nQuality, int nLength)
 {
     pngOutPath = pngPath;
 
+    double geoTransform[6];
+    QImage image = renderImage(nLength, geoTransform);
+
+    //compress. This is the only time it gets encoded.
+    savePNG(image, pngPath, nQuality, geoTransform);
+
+    return 0;
+}
+
+QImage Renderer::renderImage(int nLength, double *geoTransform)
+{
+    setReadSize(nLength);
     setup();
 
-    createByteRaster();
+    try
+    {
+        createByteRaster();
+    }
+    catch (Raster2PNGException e)
+    {
+        cleanUp();
+        throw;
+    }
+
+    byteImage.setColorTable(imageColors());
 
-    pTempRaster->GetRasterBand(1)->SetColorTable(colorTable);
+    QImage image = byteImage;
+    for (int i=0; i<6; i++)
+    {
+        geoTransform[i] = transform[i];
+    }
 
-    pPngDS = pDriverPNG->CreateCopy(pngPath,pTempRaster,FALSE,NULL,NULL,NULL);
-    pPngDS->SetGeoTransform(transform);
+    // The byte image is already close to its final size. Only a last nudge is done here.
+    //determine if height or width is greater and rescale
+    int nLongest = (image.height() > image.width()) ? image.height() : image.width();
+    if (nLength > 0 && nLength != nLongest)
+    {
+        if (image.height() > image.width())
+        {
+            image = image.scaledToHeight(nLength, Qt::SmoothTransformation);
+        }
+        else
+        {
+            image = image.scaledToWidth(nLength, Qt::SmoothTransformation);
+        }
+        geoTransform[1] *= (double) byteImage.width() / image.width();
+        geoTransform[5] *= (double) byteImage.height() / image.height();
+    }
 
     cleanUp();
 
-    //resize and compress
-    resizeAndCompressPNG(pngPath, nLength, nQuality);
+    return image;
+}
 
-    return 0;
+void Renderer::prepareByteTable()
+{
+    // The renderers fill in the table then convert. Stop them before the conversion.
+    bTableOnly = true;
+    try
+    {
+        createByteRaster();
+    }
+    catch (Raster2PNGException e)
+    {
+        bTableOnly = false;
+        throw;
+    }
+    bTableOnly = false;
+}
+
+QVector<QRgb> Renderer::imageColors() const
+{
+    QVector<QRgb> colors(256, qRgba(255, 255, 255, 0));
+    GDALColorEntry entry;
+    for (int i=0; i<colorTable->GetColorEntryCount() && i<256; i++)
+    {
+        colorTable->GetColorEntryAsRGB(i, &entry);
+        colors[i] = qRgba(entry.c1, entry.c2, entry.c3, entry.c4);
+    }
+    return colors;
+}
+
+CPLErr Renderer::renderWindow(GDALRasterBand *pBand, int nXOff, int nYOff, int nXSize, int nYSize,
+                              uchar *pOut, int nBufCols, int nBufRows) const
+{
+    // A buffer smaller than the window is read decimated, the same way readRow does it
+    bool bLookup = byteTable.eMode == ByteTable::BT_LOOKUP;
+    GDALRasterIOExtraArg sExtraArg;
+    INIT_RASTERIO_EXTRA_ARG(sExtraArg);
+    sExtraArg.eResampleAlg = bLookup ? GRIORA_NearestNeighbour : GRIORA_Average;
+
+    qint64 nCells = (qint64) nBufCols * nBufRows;
+    float *pIn = bLookup ? NULL : (float*) CPLMalloc(sizeof(float) * nCells);
+    unsigned char *pInBytes = bLookup ? (unsigned char*) CPLMalloc(nCells) : NULL;
+
+    CPLErr err = pBand->RasterIO(GF_Read, nXOff, nYOff, nXSize, nYSize,
+                                 bLookup ? (void*) pInBytes : (void*) pIn, nBufCols, nBufRows,
+                                 bLookup ? GDT_Byte : GDT_Float32, 0, 0, &sExtraArg);
+    if (err != CE_Failure && err != CE_Fatal)
+    {
+        for (int i=0; i<nBufRows; i++)
+        {
+            qint64 nOffset = (qint64) i * nBufCols;
+            mapRow(bLookup ? NULL : pIn + nOffset, bLookup ? pInBytes + nOffset : NULL, pOut + nOffset, nBufCols);
+        }
+    }
+
+    CPLFree(pIn);
+    CPLFree(pInBytes);
+    return err;
 }
 
 void Renderer::setPrecision(int prec)
@@ -294,36 +390,25 @@ void Renderer::stackImages(const char *inputList, const char *outputImage, int n
 
 void Renderer::cleanUp()
 {
-    GDALClose(pTempRaster);
-    GDALClose(pPngDS);
-    pDriverTiff->Delete(tempRasterPath.toStdString().c_str());
-
-    CPLFree(oldRow);
-    CPLFree(newRow);
-    oldRow = NULL;
-    newRow = NULL;
+    byteImage = QImage();
 }
 
 
 
-int Renderer::resizeAndCompressPNG(const char *inputImage, int nLength, int nQuality)
+void Renderer::savePNG(const QImage &image, const char *pngPath, int nQuality, const double *geoTransform)
 {
-    QImage image = QImage(QString::fromUtf8(inputImage));
-
-    //determine if height or width is greater and rescale
-    if (image.height() > image.width())
+    if (!image.save(QString::fromUtf8(pngPath), "PNG", nQuality))
     {
-        image = image.scaledToHeight(nLength, Qt::SmoothTransformation);
+        throw Raster2PNGException(PNG_OUTPUT_ERROR, QString::fromUtf8(pngPath));
     }
-    else
+
+    // GDAL keeps the georeferencing in a sidecar next to the PNG
+    GDALDataset *pPngDS = (GDALDataset*) GDALOpen(pngPath, GA_ReadOnly);
+    if (pPngDS != NULL)
     {
-        image = image.scaledToWidth(nLength, Qt::SmoothTransformation);
+        pPngDS->SetGeoTransform((double *) geoTransform);
+        GDALClose(pPngDS);
     }
-
-    //save and compress the image
-    image.save(QString::fromUtf8(inputImage), 0, nQuality);
-
-    return 0;
 }
 
 void Renderer::setLegendPath()
@@ -389,27 +474,210 @@ void Renderer::setPrecision()
     }
 }
 
-int Renderer::setTempRasterPath(const char *rasterPath)
+CPLErr Renderer::readRow(GDALRasterBand *pBand, int nRow, void *pBuffer, GDALDataType eType)
 {
-    QDateTime dtCurrent = QDateTime::currentDateTime();
-    QString name, dirName;
-    QFileInfo fileInfo(QString::fromUtf8(rasterPath));
-    dirName = fileInfo.absolutePath();
-    name = fileInfo.baseName();
-    name = name + "_" + dtCurrent.toString("yyyyMMddhhmmss") + ".tif";
-    tempRasterPath = dirName + "/" + name;
+    // Output row nRow covers this band of rows in the full resolution raster
+    int nSrcTop = (int) ((double) nRow * nSrcRows / nRows);
+    int nSrcBottom = (int) ((double) (nRow + 1) * nSrcRows / nRows);
+    if (nSrcBottom <= nSrcTop)
+        nSrcBottom = nSrcTop + 1;
+
+    // When the buffer is smaller than the window GDAL reads from the closest overview.
+    // Byte rasters are usually categories so we don't average them.
+    GDALRasterIOExtraArg sExtraArg;
+    INIT_RASTERIO_EXTRA_ARG(sExtraArg);
+    sExtraArg.eResampleAlg = (eType == GDT_Byte) ? GRIORA_NearestNeighbour : GRIORA_Average;
+
+    return pBand->RasterIO(GF_Read, 0, nSrcTop, nSrcCols, nSrcBottom - nSrcTop,
+                           pBuffer, nCols, 1, eType, 0, 0, &sExtraArg);
+}
 
-    return 0;
+void Renderer::setReadSize(int nLength)
+{
+    nRows = nSrcRows, nCols = nSrcCols;
+    pRaster->GetGeoTransform(transform);
+
+    int nLongest = (nSrcRows > nSrcCols) ? nSrcRows : nSrcCols;
+    if (nLength <= 0 || nLength >= nLongest)
+        return;
+
+    // There's no point rendering more pixels than the final PNG has
+    double dFactor = (double) nLongest / nLength;
+    nRows = qMax(1, qRound(nSrcRows / dFactor));
+    nCols = qMax(1, qRound(nSrcCols / dFactor));
+
+    transform[1] *= (double) nSrcCols / nCols;
+    transform[5] *= (double) nSrcRows / nRows;
 }
 
 void Renderer::setup()
 {
-    pTempRaster = pDriverTiff->Create(tempRasterPath.toStdString().c_str(), nCols, nRows, 1, GDT_Byte, NULL);
-    pTempRaster->GetRasterBand(1)->SetNoDataValue(0);
-    pTempRaster->GetRasterBand(1)->SetColorInterpretation(GCI_PaletteIndex);
+    // Palette indexes go straight into memory. Index 0 is NoData and stays transparent.
+    byteImage = QImage(nCols, nRows, QImage::Format_Indexed8);
+    if (byteImage.isNull())
+    {
+        throw Raster2PNGException(PNG_OUTPUT_ERROR, QString("%1 is too large to render at %2 x %3").arg(QString::fromUtf8(rasterPath)).arg(nCols).arg(nRows));
+    }
+}
+
+/* Linear stretches have no branches but the clamp so the compiler can vectorize them.
+ * NaN gets through both clamps, so it's mapped to NoData before the cast. */
+static void mapLinearRow(const ByteTable &table, const float *pIn, unsigned char *pOut, int nCols,
+                         double noData, double noData2)
+{
+    for (int j=0; j<nCols; j++)
+    {
+        double value = pIn[j];
+        double index = value * table.fScale + table.fOffset;
+        index = (index < 1.0) ? 1.0 : index;
+        index = (index > 255.0) ? 255.0 : index;
+        pOut[j] = (value == noData || value == noData2 || value != value) ? 0 : (unsigned char) index;
+    }
+}
+
+/* Classes are found with a binary search of the breaks instead of walking them */
+static void mapBreaksRow(const ByteTable &table, const float *pIn, unsigned char *pOut, int nCols,
+                         double noData, double noData2)
+{
+    const double *pBreaksBegin = table.breaks.constData();
+    const double *pBreaksEnd = pBreaksBegin + table.breaks.size();
+    int nLastClass = table.classBytes.size() - 1;
+
+    for (int j=0; j<nCols; j++)
+    {
+        double value = pIn[j];
+        if (value == noData || value == noData2 || value != value)
+        {
+            pOut[j] = 0;
+        }
+        else if (value >= table.fHigh)
+        {
+            pOut[j] = 255;
+        }
+        else if (value <= table.fLow)
+        {
+            pOut[j] = 1;
+        }
+        else
+        {
+            int nClass = (int) (std::upper_bound(pBreaksBegin, pBreaksEnd, value) - pBreaksBegin) - 1;
+            pOut[j] = table.classBytes[qBound(0, nClass, nLastClass)];
+        }
+    }
+}
+
+void Renderer::convertRows()
+{
+    if (bTableOnly)
+    {
+        return;
+    }
+
+    // Detach here, once, and hand the workers the pointer. bits() from each worker would race to detach.
+    uchar *pBits = byteImage.bits();
+    int nStride = byteImage.bytesPerLine();
+
+    // Bands are small so slow and fast parts of the raster even out across threads
+    int nBandRows = 16;
+    int nBands = (nRows + nBandRows - 1) / nBandRows;
+    int nWorkers = qMax(1, qMin(QThread::idealThreadCount(), nBands));
+
+    QAtomicInt nextBand(0);
+    QVector<int> errorCodes(nWorkers, PROCESS_OK);
+    QList< QFuture<void> > futures;
+    for (int w=0; w<nWorkers; w++)
+    {
+        futures.append(QtConcurrent::run(this, &Renderer::convertRowBand, pBits, nStride, &nextBand, nBandRows, &errorCodes[w]));
+    }
+    for (int w=0; w<futures.size(); w++)
+    {
+        futures[w].waitForFinished();
+    }
+
+    for (int w=0; w<nWorkers; w++)
+    {
+        if (errorCodes[w] != PROCESS_OK)
+        {
+            throw Raster2PNGException(errorCodes[w], QString::fromUtf8(rasterPath));
+        }
+    }
+}
+
+void Renderer::convertRowBand(uchar *pBits, int nStride, QAtomicInt *pNextBand, int nBandRows, int *pErrorCode)
+{
+    // Every worker gets its own handle. GDAL datasets can't be shared between threads.
+    GDALDataset *pWorkerDS = (GDALDataset*) GDALOpen(rasterPath, GA_ReadOnly);
+    if (pWorkerDS == NULL)
+    {
+        *pErrorCode = PNG_INPUT_ERROR;
+        return;
+    }
+    GDALRasterBand *pBand = pWorkerDS->GetRasterBand(1);
+
+    bool bLookup = byteTable.eMode == ByteTable::BT_LOOKUP;
+    float *pInRow = (float*) CPLMalloc(sizeof(float)*nCols);
+    unsigned char *pByteRow = (unsigned char*) CPLMalloc(sizeof(unsigned char)*nCols);
+
+    for (int nBand = pNextBand->fetchAndAddOrdered(1); nBand * nBandRows < nRows; nBand = pNextBand->fetchAndAddOrdered(1))
+    {
+        int nLastRow = qMin(nRows, (nBand + 1) * nBandRows);
+        for (int i=nBand * nBandRows; i<nLastRow; i++)
+        {
+            unsigned char *pOut = pBits + (qint64) i * nStride;
+            CPLErr err = readRow(pBand, i, bLookup ? (void*) pByteRow : (void*) pInRow, bLookup ? GDT_Byte : GDT_Float32);
+            if (err == CE_Failure || err == CE_Fatal)
+            {
+                *pErrorCode = PNG_INPUT_ERROR;
+                break;
+            }
+
+            mapRow(pInRow, pByteRow, pOut, nCols);
+        }
+        if (*pErrorCode != PROCESS_OK)
+        {
+            break;
+        }
+    }
+
+    CPLFree(pInRow);
+    CPLFree(pByteRow);
+    GDALClose(pWorkerDS);
+}
+
+void Renderer::mapRow(const float *pIn, const unsigned char *pInBytes, unsigned char *pOut, int nCount) const
+{
+    switch (byteTable.eMode)
+    {
+    case ByteTable::BT_LINEAR:
+        mapLinearRow(byteTable, pIn, pOut, nCount, noData, noData2);
+        break;
+    case ByteTable::BT_BREAKS:
+        mapBreaksRow(byteTable, pIn, pOut, nCount, noData, noData2);
+        break;
+    case ByteTable::BT_LOOKUP:
+        for (int j=0; j<nCount; j++)
+        {
+            pOut[j] = byteTable.lookup[pInBytes[j]];
+        }
+        break;
+    }
+}
 
-    oldRow = (float*) CPLMalloc(sizeof(float)*nCols);
-    newRow = (unsigned char*) CPLMalloc(sizeof(int)*nCols);
+void Renderer::setLinearStretch(double fLow, double fHigh, double fShift)
+{
+    // index = qRound((value + fShift - fLow) / (fHigh - fLow) * 254) + 1 folded into one multiply and add
+    byteTable.eMode = ByteTable::BT_LINEAR;
+    if (fHigh > fLow)
+    {
+        byteTable.fScale = 254.0 / (fHigh - fLow);
+        byteTable.fOffset = (fShift - fLow) * byteTable.fScale + 1.5;
+    }
+    else
+    {
+        // Every cell has the same value
+        byteTable.fScale = 0.0;
+        byteTable.fOffset = 1.0;
+    }
 }
 
 int Renderer::setupRaster(const char *inputRasterPath)
@@ -423,10 +691,9 @@ int Renderer::setupRaster(const char *inputRasterPath)
     rasterType = pRaster->GetRasterBand(1)->GetRasterDataType();
     nRows = pRaster->GetRasterBand(1)->GetYSize();
     nCols = pRaster->GetRasterBand(1)->GetXSize();
+    nSrcRows = nRows, nSrcCols = nCols;
     noData = pRaster->GetRasterBand(1)->GetNoDataValue();
 
-    setTempRasterPath(rasterPath);
-
     return 0;
 }
 
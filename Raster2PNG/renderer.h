@@ -20,6 +20,27 @@ enum ColorRamp{
 };
 
 namespace Raster2PNG {
+
+/* How a renderer turns cell values into palette indexes. Each renderer fills one in
+ * once and the row bands only ever read it, so they can all be converted at once. */
+struct ByteTable
+{
+    enum Mode { BT_LINEAR, BT_BREAKS, BT_LOOKUP };
+    Mode eMode;
+
+    // BT_LINEAR: index = value * fScale + fOffset, clamped to 1-255
+    double fScale, fOffset;
+
+    // BT_BREAKS: at or below fLow is 1, at or above fHigh is 255 and everything
+    // in between takes the index of the class whose lower break it's at or above
+    QVector<double> breaks;
+    QVector<unsigned char> classBytes;
+    double fLow, fHigh;
+
+    // BT_LOOKUP: Byte rasters are read as bytes and go through a 256 entry table
+    unsigned char lookup[256];
+};
+
 class RASTER2PNGSHARED_EXPORT Renderer
 {
 public:
@@ -34,39 +55,55 @@ public:
     int rasterToPNG(const char *pngPath,
                     int nQuality,
                     int nLength);
+    QImage renderImage(int nLength,
+                       double *geoTransform);
+
+    // Piecewise rendering. prepareByteTable() works out the palette mapping without
+    // rendering anything, then any thread can render windows through its own band.
+    void prepareByteTable();
+    QVector<QRgb> imageColors() const;
+    CPLErr renderWindow(GDALRasterBand *pBand, int nXOff, int nYOff, int nXSize, int nYSize,
+                        uchar *pOut, int nBufCols, int nBufRows) const;
     int setRendererColorTable(ColorRamp rampStyle,
                       int nTransparency);
     void setPrecision(int prec);
     void setZeroNoData(bool bValue);
 
     static void stackImages(const char *inputList, const char *outputImage, int nQuality);
+    static void savePNG(const QImage &image,
+                        const char *pngPath,
+                        int nQuality,
+                        const double *geoTransform);
 
 protected:
     const char *rasterPath;
     const char *pngOutPath;
-    float *oldRow;
-    unsigned char *newRow;
-    QString tempRasterPath, legendPath;
-    GDALDataset *pRaster, *pTempRaster, *pPngDS;
-    GDALDriver *pDriverPNG, *pDriverTiff;
+    QString legendPath;
+    GDALDataset *pRaster;
     GDALColorTable *colorTable;
+    QImage byteImage;
+    ByteTable byteTable;
     GDALDataType rasterType;
     int nRows, nCols, precision;
+    int nSrcRows, nSrcCols;
     double min, max, mean, stdev, noData, noData2;
     double adjMin, adjMax, adjMean, range;
     double transform[6];
     bool zeroNoData, zeroCenter;
+    bool bTableOnly;
 
     void cleanUp();
+    void convertRows();
+    void convertRowBand(uchar *pBits, int nStride, QAtomicInt *pNextBand, int nBandRows, int *pErrorCode);
+    void mapRow(const float *pIn, const unsigned char *pInBytes, unsigned char *pOut, int nCount) const;
     virtual void createByteRaster() = 0;
+    CPLErr readRow(GDALRasterBand *pBand, int nRow, void *pBuffer, GDALDataType eType);
+    void setLinearStretch(double fLow, double fHigh, double fShift);
     virtual void createLegend() = 0;
-    int resizeAndCompressPNG(const char *inputImage,
-                             int nLength,
-                             int nQuality);
     void setLegendPath();
     void setLegendPath(const char *path);
     void setPrecision();
-    int setTempRasterPath(const char *rasterPath);
+    void setReadSize(int nLength);
     void setup();
     int setupRaster(const char *inputRasterPath);
 };
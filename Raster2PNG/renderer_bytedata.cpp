@@ -10,25 +10,13 @@ Renderer_ByteData::Renderer_ByteData(const char *inputRasterPath,
 
 void Renderer_ByteData::createByteRaster()
 {
-    unsigned char *byteRow = (unsigned char*) CPLMalloc(sizeof(int)*nCols);
-    for (int i=0; i<nRows; i++)
+    // Byte values are already palette indexes. 0 and 255 are treated as NoData.
+    byteTable.eMode = ByteTable::BT_LOOKUP;
+    for (int i=0; i<256; i++)
     {
-        pRaster->GetRasterBand(1)->RasterIO(GF_Read, 0, i, nCols, 1, byteRow, nCols, 1, GDT_Byte, 0, 0);
-
-        for (int j=0; j<nCols; j++)
-        {
-            if (byteRow[j] <= 0 || byteRow[j] >= 255)
-            {
-                newRow[j] = 0;
-            }
-            else
-            {
-                newRow[j] = byteRow[j];
-            }
-        }
-        pTempRaster->GetRasterBand(1)->RasterIO(GF_Write, 0, i, nCols, 1, newRow, nCols, 1, GDT_Byte, 0, 0);
+        byteTable.lookup[i] = (i <= 0 || i >= 255) ? 0 : i;
     }
-    CPLFree(byteRow);
+    convertRows();
 }
 
 }
@@ -19,49 +19,18 @@ Renderer_Classified::Renderer_Classified(const char *rasterPath,
 
 void Renderer_Classified::classifyRaster()
 {
-    for (int i=0; i<nRows; i++)
+    // Each class's palette index only depends on its position so work them all out up front
+    byteTable.eMode = ByteTable::BT_BREAKS;
+    byteTable.breaks = classBreaks;
+    byteTable.classBytes.resize(nClasses);
+    for (int count=0; count<nClasses; count++)
     {
-        pRaster->GetRasterBand(1)->RasterIO(GF_Read, 0, i, nCols, 1, oldRow, nCols, 1, rasterType, 0, 0);
-
-        for (int j=0; j<nCols; j++)
-        {
-            if (oldRow[j] == noData || oldRow[j] == noData2)
-            {
-                newRow[j] = 0;
-            }
-            else
-            {
-                if (oldRow[j] >= adjMax)
-                {
-                    newRow[j] = 255;
-                }
-                else if (oldRow[j] <= adjMin && oldRow[j] > (adjMin - 1.0))
-                {
-                    newRow[j] = 1;
-                }
-                else
-                {
-                    int count = 0;
-                    bool found = false;
-                    while (!found && count < nClasses)
-                    {
-                        if (oldRow[j] >= classBreaks[count] && oldRow[j] < classBreaks[count+1])
-                        {
-                            newRow[j] = floor(((count*1.0) / ((nClasses-1)*1.0)) * 254) + 1;
-                            found = true;
-                        }
-                        else
-                        {
-                            count++;
-                        }
-                    }
-                }
-            }
-        }
-
-        pTempRaster->GetRasterBand(1)->RasterIO(GF_Write, 0, i, nCols, 1, newRow, nCols, 1, GDT_Byte, 0, 0);
-
+        byteTable.classBytes[count] = floor(((count*1.0) / ((nClasses-1)*1.0)) * 254) + 1;
     }
+    byteTable.fLow = adjMin;
+    byteTable.fHigh = adjMax;
+
+    convertRows();
 }
 
 void Renderer_Classified::createByteRaster()
@@ -12,27 +12,9 @@ Renderer_StretchMinMax::Renderer_StretchMinMax(const char *inputRasterPath,
 
 void Renderer_StretchMinMax::createByteRaster()
 {
-    double scaled, byte;
-
-    for (int i=0; i<nRows; i++)
-    {
-        pRaster->GetRasterBand(1)->RasterIO(GF_Read, 0, i, nCols, 1, oldRow, nCols, 1, rasterType, 0, 0);
-
-        for (int j=0; j<nCols; j++)
-        {
-            if (oldRow[j] == noData || oldRow[j] == noData2)
-            {
-                newRow[j] = 0;
-            }
-            else
-            {
-                scaled = fabs(1.0-(maxCalc-(oldRow[j]+corVal)) / (range));
-                byte = qRound(scaled * 254) + 1;
-                newRow[j] = byte;
-            }
-        }
-        pTempRaster->GetRasterBand(1)->RasterIO(GF_Write, 0, i, nCols, 1, newRow, nCols, 1, GDT_Byte, 0, 0);
-    }
+    // maxCalc - range up to maxCalc is stretched over the whole ramp
+    setLinearStretch(maxCalc - range, maxCalc, corVal);
+    convertRows();
 }
 
 void Renderer_StretchMinMax::createLegend()
@@ -27,38 +27,8 @@ Renderer_StretchStdDev::Renderer_StretchStdDev(const char *inputRasterPath,
 
 void Renderer_StretchStdDev::createByteRaster()
 {
-    double scaled;
-    int byte;
-
-    for (int i=0; i<nRows; i++)
-    {
-        pRaster->GetRasterBand(1)->RasterIO(GF_Read, 0, i, nCols, 1, oldRow, nCols, 1, rasterType, 0, 0);
-
-        for (int j=0; j<nCols; j++)
-        {
-            if (oldRow[j] == noData || oldRow[j] == noData2)
-            {
-                newRow[j] = 0;
-            }
-
-            else if (oldRow[j]+corVal <= sdMin)
-            {
-                newRow[j] = 1;
-            }
-            else if (oldRow[j]+corVal >= sdMax)
-            {
-                newRow[j] = 255;
-            }
-            else
-            {
-                scaled = 1.0 - fabs(((sdMax) - (oldRow[j]+corVal)) / range);
-                byte = qRound(scaled * 254) + 1;
-                newRow[j] = byte;
-            }
-        }
-
-        pTempRaster->GetRasterBand(1)->RasterIO(GF_Write, 0, i, nCols, 1, newRow, nCols, 1, GDT_Byte, 0, 0);
-    }
+    setLinearStretch(sdMin, sdMax, corVal);
+    convertRows();
 }
 
 void Renderer_StretchStdDev::createLegend()
@@ -0,0 +1,557 @@
+#include "tilerenderer.h"
+#include "batchrenderer.h"
+#include "raster2png_exception.h"
+#include "ogr_spatialref.h"
+#include <QtConcurrent>
+#include <cmath>
+namespace Raster2PNG {
+
+// Web mercator runs from -MERC_EXTENT to MERC_EXTENT metres both ways
+const double MERC_EXTENT = 20037508.342789244;
+const int TILE_SIZE = 256;
+const int TILE_MAX_ZOOM = 24;
+
+// Points along each edge of the raster when its extent is projected into mercator
+const int EDGE_SAMPLES = 32;
+
+// Longest side of the window read for one base tile. Anything bigger is read decimated.
+const int TILE_READ_LIMIT = 1024;
+
+static inline qint64 tileKey(int nX, int nY)
+{
+    return ((qint64) nX << 32) | (quint32) nY;
+}
+
+static void setTraditionalAxisOrder(OGRSpatialReference &srs)
+{
+#if GDAL_VERSION_NUM >= 3000000
+    srs.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+#else
+    Q_UNUSED(srs);
+#endif
+}
+
+/* What one thread needs to build its branches. GDAL datasets and coordinate transformations
+ * can't be shared between threads. The first error stops the branch and is kept here. */
+struct TileWorker
+{
+    GDALDataset *pDS;
+    GDALRasterBand *pBand;
+    OGRCoordinateTransformation *pCT;
+    QVector<double> cols, rows;
+    QVector<uchar> window;
+    int nErrorCode;
+    QString sError;
+
+    TileWorker()
+    {
+        pDS = NULL;
+        pBand = NULL;
+        pCT = NULL;
+        nErrorCode = PROCESS_OK;
+    }
+
+    ~TileWorker()
+    {
+        if (pCT != NULL)
+        {
+            OGRCoordinateTransformation::DestroyCT(pCT);
+        }
+        if (pDS != NULL)
+        {
+            GDALClose(pDS);
+        }
+    }
+};
+
+// Each parent pixel is the mean of a 2x2 block of one of its four children. Null if they all are.
+static QImage reduceTile(const QImage *pChildren)
+{
+    int nHalf = TILE_SIZE / 2;
+    QImage image;
+
+    for (int dy=0; dy<2; dy++)
+    {
+        for (int dx=0; dx<2; dx++)
+        {
+            if (pChildren[dy * 2 + dx].isNull())
+            {
+                continue;
+            }
+            if (image.isNull())
+            {
+                image = QImage(TILE_SIZE, TILE_SIZE, QImage::Format_ARGB32_Premultiplied);
+                image.fill(0);
+            }
+
+            // Premultiplied so transparent NoData doesn't bleed white into the edges
+            QImage child = pChildren[dy * 2 + dx].convertToFormat(QImage::Format_ARGB32_Premultiplied);
+            for (int i=0; i<nHalf; i++)
+            {
+                const QRgb *pTop = (const QRgb*) child.constScanLine(i * 2);
+                const QRgb *pBottom = (const QRgb*) child.constScanLine(i * 2 + 1);
+                QRgb *pOut = (QRgb*) image.scanLine(dy * nHalf + i) + dx * nHalf;
+                for (int j=0; j<nHalf; j++)
+                {
+                    QRgb a = pTop[j * 2], b = pTop[j * 2 + 1], c = pBottom[j * 2], d = pBottom[j * 2 + 1];
+                    pOut[j] = qRgba((qRed(a) + qRed(b) + qRed(c) + qRed(d) + 2) / 4,
+                                    (qGreen(a) + qGreen(b) + qGreen(c) + qGreen(d) + 2) / 4,
+                                    (qBlue(a) + qBlue(b) + qBlue(c) + qBlue(d) + 2) / 4,
+                                    (qAlpha(a) + qAlpha(b) + qAlpha(c) + qAlpha(d) + 2) / 4);
+                }
+            }
+        }
+    }
+
+    return image;
+}
+
+TileRenderer::TileRenderer(const char *inputRasterPath,
+                           const char *outputDir,
+                           const QString &style,
+                           int nTransparency,
+                           int nMinZoom,
+                           bool bTMS)
+{
+    rasterPath = QByteArray(inputRasterPath);
+    outDir = QString::fromUtf8(outputDir);
+    this->style = style;
+    this->nTransparency = nTransparency;
+    this->nMinZoom = nMinZoom;
+    this->bTMS = bTMS;
+    nBaseZoom = 0;
+    nSplitZoom = 0;
+    nSrcCols = 0, nSrcRows = 0;
+    pRenderer = NULL;
+    nTilesWritten.store(0);
+}
+
+TileRenderer::~TileRenderer()
+{
+    delete pRenderer;
+}
+
+int TileRenderer::run()
+{
+    openSource();
+    setZoomRange();
+
+    // Split the pyramid into enough branches to keep every thread busy. Each branch is built
+    // depth first from the base zoom up to its top tile at the split zoom.
+    int nThreads = QThread::idealThreadCount();
+    nSplitZoom = nMinZoom;
+    while (nSplitZoom < nBaseZoom && levelTiles(nSplitZoom).size() < 4 * nThreads)
+    {
+        nSplitZoom++;
+    }
+
+    // Branch tops are only kept when there are zooms above the split still to build
+    QVector<QPoint> splitTiles = levelTiles(nSplitZoom);
+    QVector<QImage> splitImages;
+    if (nMinZoom < nSplitZoom)
+    {
+        splitImages.resize(splitTiles.size());
+    }
+
+    int nWorkers = qMax(1, qMin(nThreads, splitTiles.size()));
+    QAtomicInt nextTile(0);
+    QVector<int> errorCodes(nWorkers, PROCESS_OK);
+    QVector<QString> errors(nWorkers);
+    QList< QFuture<void> > futures;
+    for (int w=0; w<nWorkers; w++)
+    {
+        futures.append(QtConcurrent::run(this, &TileRenderer::buildSubtrees, &splitTiles,
+                                         splitImages.isEmpty() ? (QVector<QImage>*) NULL : &splitImages,
+                                         &nextTile, &errorCodes[w], &errors[w]));
+    }
+    for (int w=0; w<futures.size(); w++)
+    {
+        futures[w].waitForFinished();
+    }
+
+    for (int w=0; w<nWorkers; w++)
+    {
+        if (errorCodes[w] != PROCESS_OK)
+        {
+            throw Raster2PNGException(errorCodes[w], errors[w]);
+        }
+    }
+
+    if (nMinZoom < nSplitZoom)
+    {
+        QHash<qint64, QImage> splitIndex;
+        for (int n=0; n<splitTiles.size(); n++)
+        {
+            if (!splitImages[n].isNull())
+            {
+                splitIndex.insert(tileKey(splitTiles[n].x(), splitTiles[n].y()), splitImages[n]);
+            }
+        }
+        splitImages.clear();
+
+        // The few zooms above the split are built from the branch tops. The raster isn't needed.
+        TileWorker worker;
+        QVector<QPoint> topTiles = levelTiles(nMinZoom);
+        for (int n=0; n<topTiles.size(); n++)
+        {
+            buildTile(nMinZoom, topTiles[n], &worker, &splitIndex);
+            if (worker.nErrorCode != PROCESS_OK)
+            {
+                throw Raster2PNGException(worker.nErrorCode, worker.sError);
+            }
+        }
+    }
+
+    return PROCESS_OK;
+}
+
+int TileRenderer::baseZoom() const
+{
+    return nBaseZoom;
+}
+
+int TileRenderer::minZoom() const
+{
+    return nMinZoom;
+}
+
+int TileRenderer::tileCount() const
+{
+    return nTilesWritten.load();
+}
+
+void TileRenderer::openSource()
+{
+    GDALDataset *pDS = (GDALDataset*) GDALOpen(rasterPath.constData(), GA_ReadOnly);
+    if (pDS == NULL)
+    {
+        throw Raster2PNGException(PNG_INPUT_ERROR, QString::fromUtf8(rasterPath));
+    }
+    sourceWkt = QString(pDS->GetProjectionRef());
+    nSrcCols = pDS->GetRasterXSize();
+    nSrcRows = pDS->GetRasterYSize();
+    pDS->GetGeoTransform(sourceTransform);
+    GDALClose(pDS);
+
+    if (sourceWkt.isEmpty())
+    {
+        throw Raster2PNGException(PNG_INPUT_ERROR, QString("%1 has no coordinate system to tile in").arg(QString::fromUtf8(rasterPath)));
+    }
+    if (!GDALInvGeoTransform(sourceTransform, invTransform))
+    {
+        throw Raster2PNGException(PNG_INPUT_ERROR, QString("%1 has a geotransform that can't be inverted").arg(QString::fromUtf8(rasterPath)));
+    }
+
+    // Only the palette mapping is worked out here. Cells are read when a tile needs them.
+    pRenderer = BatchRenderer::createRenderer(rasterPath.constData(), style, nTransparency);
+    pRenderer->prepareByteTable();
+    palette = pRenderer->imageColors();
+}
+
+void TileRenderer::setZoomRange()
+{
+    QByteArray qbWkt = sourceWkt.toLatin1();
+    char *psWkt = qbWkt.data();
+    OGRSpatialReference srcSRS, mercSRS;
+    if (srcSRS.importFromWkt(&psWkt) != OGRERR_NONE || mercSRS.importFromEPSG(3857) != OGRERR_NONE)
+    {
+        throw Raster2PNGException(PNG_INPUT_ERROR, QString("%1 can't be projected to web mercator").arg(QString::fromUtf8(rasterPath)));
+    }
+    setTraditionalAxisOrder(srcSRS);
+    setTraditionalAxisOrder(mercSRS);
+
+    OGRCoordinateTransformation *pCT = OGRCreateCoordinateTransformation(&srcSRS, &mercSRS);
+    if (pCT == NULL)
+    {
+        throw Raster2PNGException(PNG_INPUT_ERROR, QString("%1 can't be projected to web mercator").arg(QString::fromUtf8(rasterPath)));
+    }
+
+    // Project points all the way round the edge since straight edges don't stay straight
+    int nCols = nSrcCols, nRows = nSrcRows;
+    QVector<double> x, y;
+    for (int i=0; i<=EDGE_SAMPLES; i++)
+    {
+        double fCol = (double) nCols * i / EDGE_SAMPLES;
+        double fRow = (double) nRows * i / EDGE_SAMPLES;
+        double pixels[8] = { fCol, 0.0, fCol, (double) nRows, 0.0, fRow, (double) nCols, fRow };
+        for (int p=0; p<8; p+=2)
+        {
+            x.append(sourceTransform[0] + pixels[p] * sourceTransform[1] + pixels[p+1] * sourceTransform[2]);
+            y.append(sourceTransform[3] + pixels[p] * sourceTransform[4] + pixels[p+1] * sourceTransform[5]);
+        }
+    }
+    pCT->Transform(x.size(), x.data(), y.data());
+    OGRCoordinateTransformation::DestroyCT(pCT);
+
+    mercBounds[0] = MERC_EXTENT, mercBounds[1] = MERC_EXTENT;
+    mercBounds[2] = -MERC_EXTENT, mercBounds[3] = -MERC_EXTENT;
+    for (int i=0; i<x.size(); i++)
+    {
+        if (!std::isfinite(x[i]) || !std::isfinite(y[i]) || fabs(x[i]) > 1e300 || fabs(y[i]) > 1e300)
+        {
+            continue;
+        }
+        mercBounds[0] = qMin(mercBounds[0], qMax(x[i], -MERC_EXTENT));
+        mercBounds[1] = qMin(mercBounds[1], qMax(y[i], -MERC_EXTENT));
+        mercBounds[2] = qMax(mercBounds[2], qMin(x[i], MERC_EXTENT));
+        mercBounds[3] = qMax(mercBounds[3], qMin(y[i], MERC_EXTENT));
+    }
+    if (mercBounds[2] <= mercBounds[0] || mercBounds[3] <= mercBounds[1])
+    {
+        throw Raster2PNGException(PNG_INPUT_ERROR, QString("%1 is outside web mercator").arg(QString::fromUtf8(rasterPath)));
+    }
+
+    // The base zoom is the first one with pixels at least as fine as the raster's cells
+    double fCellSize = qMin((mercBounds[2] - mercBounds[0]) / nCols, (mercBounds[3] - mercBounds[1]) / nRows);
+    double fZoom = log(2.0 * MERC_EXTENT / TILE_SIZE / fCellSize) / log(2.0);
+    nBaseZoom = qBound(0, (int) ceil(fZoom - 1e-6), TILE_MAX_ZOOM);
+
+    // By default keep going until the whole raster fits on one tile
+    if (nMinZoom < 0)
+    {
+        nMinZoom = nBaseZoom;
+        QPoint topLeft, bottomRight;
+        tileRange(nMinZoom, topLeft, bottomRight);
+        while (nMinZoom > 0 && topLeft != bottomRight)
+        {
+            nMinZoom--;
+            tileRange(nMinZoom, topLeft, bottomRight);
+        }
+    }
+    nMinZoom = qMin(nMinZoom, nBaseZoom);
+}
+
+void TileRenderer::buildSubtrees(const QVector<QPoint> *pTiles, QVector<QImage> *pImages, QAtomicInt *pNextTile,
+                                 int *pErrorCode, QString *pError)
+{
+    TileWorker worker;
+    worker.pDS = (GDALDataset*) GDALOpen(rasterPath.constData(), GA_ReadOnly);
+    if (worker.pDS == NULL)
+    {
+        *pErrorCode = PNG_INPUT_ERROR;
+        *pError = QString::fromUtf8(rasterPath);
+        return;
+    }
+    worker.pBand = worker.pDS->GetRasterBand(1);
+
+    QByteArray qbWkt = sourceWkt.toLatin1();
+    char *psWkt = qbWkt.data();
+    OGRSpatialReference srcSRS, mercSRS;
+    srcSRS.importFromWkt(&psWkt);
+    mercSRS.importFromEPSG(3857);
+    setTraditionalAxisOrder(srcSRS);
+    setTraditionalAxisOrder(mercSRS);
+    worker.pCT = OGRCreateCoordinateTransformation(&mercSRS, &srcSRS);
+    if (worker.pCT == NULL)
+    {
+        *pErrorCode = PNG_INPUT_ERROR;
+        *pError = QString("%1 can't be projected to web mercator").arg(QString::fromUtf8(rasterPath));
+        return;
+    }
+    worker.cols.resize(TILE_SIZE * TILE_SIZE);
+    worker.rows.resize(TILE_SIZE * TILE_SIZE);
+
+    for (int n = pNextTile->fetchAndAddOrdered(1); n < pTiles->size(); n = pNextTile->fetchAndAddOrdered(1))
+    {
+        QImage image = buildTile(nSplitZoom, pTiles->at(n), &worker, NULL);
+        if (worker.nErrorCode != PROCESS_OK)
+        {
+            *pErrorCode = worker.nErrorCode;
+            *pError = worker.sError;
+            return;
+        }
+        if (pImages != NULL)
+        {
+            (*pImages)[n] = image;
+        }
+    }
+}
+
+QImage TileRenderer::buildTile(int nZoom, const QPoint &tile, TileWorker *pWorker, const QHash<qint64, QImage> *pSplitImages)
+{
+    QPoint topLeft, bottomRight;
+    tileRange(nZoom, topLeft, bottomRight);
+    if (pWorker->nErrorCode != PROCESS_OK
+            || tile.x() < topLeft.x() || tile.x() > bottomRight.x()
+            || tile.y() < topLeft.y() || tile.y() > bottomRight.y())
+    {
+        return QImage();
+    }
+
+    // Branch tops were written by the worker that built them
+    if (pSplitImages != NULL && nZoom == nSplitZoom)
+    {
+        return pSplitImages->value(tileKey(tile.x(), tile.y()));
+    }
+
+    QImage image;
+    if (nZoom == nBaseZoom)
+    {
+        image = renderTile(tile, pWorker);
+    }
+    else
+    {
+        // Children are written on the way back up, so only these four are held here
+        QImage children[4];
+        for (int dy=0; dy<2; dy++)
+        {
+            for (int dx=0; dx<2; dx++)
+            {
+                children[dy * 2 + dx] = buildTile(nZoom + 1, QPoint(tile.x() * 2 + dx, tile.y() * 2 + dy), pWorker, pSplitImages);
+            }
+        }
+        image = reduceTile(children);
+    }
+
+    // Nothing but NoData. Leave it out rather than write a transparent tile.
+    if (!image.isNull() && pWorker->nErrorCode == PROCESS_OK)
+    {
+        writeTile(nZoom, tile, image, pWorker);
+    }
+    return image;
+}
+
+QImage TileRenderer::renderTile(const QPoint &tile, TileWorker *pWorker)
+{
+    double fPixelSize = 2.0 * MERC_EXTENT / TILE_SIZE / (1 << nBaseZoom);
+    double *pCols = pWorker->cols.data(), *pRows = pWorker->rows.data();
+
+    // Centre of every pixel in the tile, taken back into the raster's cells. The ones that land
+    // on the raster give the window that has to be read.
+    double fMinCol = nSrcCols, fMinRow = nSrcRows, fMaxCol = -1.0, fMaxRow = -1.0;
+    for (int i=0; i<TILE_SIZE; i++)
+    {
+        double *x = pCols + i * TILE_SIZE, *y = pRows + i * TILE_SIZE;
+        double fY = MERC_EXTENT - ((double) tile.y() * TILE_SIZE + i + 0.5) * fPixelSize;
+        for (int j=0; j<TILE_SIZE; j++)
+        {
+            x[j] = -MERC_EXTENT + ((double) tile.x() * TILE_SIZE + j + 0.5) * fPixelSize;
+            y[j] = fY;
+        }
+        pWorker->pCT->Transform(TILE_SIZE, x, y);
+
+        for (int j=0; j<TILE_SIZE; j++)
+        {
+            double fCol = invTransform[0] + x[j] * invTransform[1] + y[j] * invTransform[2];
+            double fRow = invTransform[3] + x[j] * invTransform[4] + y[j] * invTransform[5];
+            x[j] = fCol, y[j] = fRow;
+            if (fCol >= 0.0 && fCol < nSrcCols && fRow >= 0.0 && fRow < nSrcRows)
+            {
+                fMinCol = qMin(fMinCol, fCol), fMaxCol = qMax(fMaxCol, fCol);
+                fMinRow = qMin(fMinRow, fRow), fMaxRow = qMax(fMaxRow, fRow);
+            }
+        }
+    }
+    if (fMaxCol < 0.0)
+    {
+        return QImage();
+    }
+
+    int nXOff = (int) fMinCol, nYOff = (int) fMinRow;
+    int nXSize = (int) fMaxCol - nXOff + 1, nYSize = (int) fMaxRow - nYOff + 1;
+    int nBufCols = qMin(nXSize, TILE_READ_LIMIT), nBufRows = qMin(nYSize, TILE_READ_LIMIT);
+    pWorker->window.resize(nBufCols * nBufRows);
+    CPLErr err = pRenderer->renderWindow(pWorker->pBand, nXOff, nYOff, nXSize, nYSize,
+                                         pWorker->window.data(), nBufCols, nBufRows);
+    if (err == CE_Failure || err == CE_Fatal)
+    {
+        pWorker->nErrorCode = PNG_INPUT_ERROR;
+        pWorker->sError = QString::fromUtf8(rasterPath);
+        return QImage();
+    }
+
+    // Nearest cell. Palette indexes can't be averaged and the base zoom is finer than the raster anyway.
+    const uchar *pWindow = pWorker->window.constData();
+    double fColScale = (double) nBufCols / nXSize, fRowScale = (double) nBufRows / nYSize;
+    QImage image(TILE_SIZE, TILE_SIZE, QImage::Format_Indexed8);
+    image.setColorTable(palette);
+    bool bEmpty = true;
+    for (int i=0; i<TILE_SIZE; i++)
+    {
+        const double *pCol = pCols + i * TILE_SIZE, *pRow = pRows + i * TILE_SIZE;
+        uchar *pOut = image.scanLine(i);
+        for (int j=0; j<TILE_SIZE; j++)
+        {
+            if (pCol[j] >= 0.0 && pCol[j] < nSrcCols && pRow[j] >= 0.0 && pRow[j] < nSrcRows)
+            {
+                int nBufCol = qMin(nBufCols - 1, (int) ((pCol[j] - nXOff) * fColScale));
+                int nBufRow = qMin(nBufRows - 1, (int) ((pRow[j] - nYOff) * fRowScale));
+                pOut[j] = pWindow[nBufRow * nBufCols + nBufCol];
+                bEmpty = bEmpty && pOut[j] == 0;
+            }
+            else
+            {
+                pOut[j] = 0;
+            }
+        }
+    }
+
+    return bEmpty ? QImage() : image;
+}
+
+void TileRenderer::writeTile(int nZoom, const QPoint &tile, const QImage &image, TileWorker *pWorker)
+{
+    // Neighbouring branches share columns, so each folder is only made once
+    QString columnDir = QString("%1/%2/%3").arg(outDir).arg(nZoom).arg(tile.x());
+    bool bDir;
+    {
+        QMutexLocker lock(&mxDirs);
+        bDir = createdDirs.contains(columnDir) || QDir().mkpath(columnDir);
+        if (bDir)
+        {
+            createdDirs.insert(columnDir);
+        }
+    }
+    if (!bDir)
+    {
+        pWorker->nErrorCode = PNG_OUTPUT_ERROR;
+        pWorker->sError = columnDir;
+        return;
+    }
+
+    QString path = tilePath(nZoom, tile);
+    if (!image.save(path, "PNG"))
+    {
+        pWorker->nErrorCode = PNG_OUTPUT_ERROR;
+        pWorker->sError = path;
+        return;
+    }
+    nTilesWritten.fetchAndAddOrdered(1);
+}
+
+QVector<QPoint> TileRenderer::levelTiles(int nZoom) const
+{
+    QPoint topLeft, bottomRight;
+    tileRange(nZoom, topLeft, bottomRight);
+
+    QVector<QPoint> tiles;
+    for (int nY=topLeft.y(); nY<=bottomRight.y(); nY++)
+    {
+        for (int nX=topLeft.x(); nX<=bottomRight.x(); nX++)
+        {
+            tiles.append(QPoint(nX, nY));
+        }
+    }
+    return tiles;
+}
+
+void TileRenderer::tileRange(int nZoom, QPoint &topLeft, QPoint &bottomRight) const
+{
+    int nTiles = 1 << nZoom;
+    double fTileSize = 2.0 * MERC_EXTENT / nTiles;
+
+    // Tiles count from the top left corner of the world. A bound right on a tile edge doesn't take the next one.
+    topLeft.setX(qBound(0, (int) floor((mercBounds[0] + MERC_EXTENT) / fTileSize), nTiles - 1));
+    topLeft.setY(qBound(0, (int) floor((MERC_EXTENT - mercBounds[3]) / fTileSize), nTiles - 1));
+    bottomRight.setX(qBound(0, (int) ceil((mercBounds[2] + MERC_EXTENT) / fTileSize) - 1, nTiles - 1));
+    bottomRight.setY(qBound(0, (int) ceil((MERC_EXTENT - mercBounds[1]) / fTileSize) - 1, nTiles - 1));
+}
+
+QString TileRenderer::tilePath(int nZoom, const QPoint &tile) const
+{
+    // TMS counts rows up from the bottom of the world instead of down from the top
+    int nY = bTMS ? (1 << nZoom) - 1 - tile.y() : tile.y();
+    return QString("%1/%2/%3/%4.png").arg(outDir).arg(nZoom).arg(tile.x()).arg(nY);
+}
+
+}
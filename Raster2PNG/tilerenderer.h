@@ -0,0 +1,63 @@
+#ifndef TILERENDERER_H
+#define TILERENDERER_H
+
+#include "renderer.h"
+namespace Raster2PNG {
+
+struct TileWorker;
+
+/* Web mercator tiles, 256 pixels square, written as <dir>/<z>/<x>/<y>.png.
+ * Base zoom tiles are rendered one at a time from a window of the raster. Every zoom above
+ * that is built from 2x2 blocks of the zoom below, one branch of the quadtree at a time,
+ * so only the tiles on the way down to the one being rendered are ever held. */
+class RASTER2PNGSHARED_EXPORT TileRenderer
+{
+public:
+    TileRenderer(const char *inputRasterPath,
+                 const char *outputDir,
+                 const QString &style,
+                 int nTransparency = 255,
+                 int nMinZoom = -1,
+                 bool bTMS = false);
+    ~TileRenderer();
+
+    int run();
+    int baseZoom() const;
+    int minZoom() const;
+    int tileCount() const;
+
+protected:
+    QByteArray rasterPath;
+    QString outDir;
+    QString style;
+    int nTransparency;
+    int nMinZoom, nBaseZoom, nSplitZoom;
+    bool bTMS;
+    QAtomicInt nTilesWritten;
+
+    // The renderer only holds the palette mapping. Cells are read a tile's window at a time.
+    Renderer *pRenderer;
+    QVector<QRgb> palette;
+    int nSrcCols, nSrcRows;
+    double sourceTransform[6];
+    double invTransform[6];
+    QString sourceWkt;
+    double mercBounds[4];
+
+    QMutex mxDirs;
+    QSet<QString> createdDirs;
+
+    void openSource();
+    void setZoomRange();
+    void buildSubtrees(const QVector<QPoint> *pTiles, QVector<QImage> *pImages, QAtomicInt *pNextTile,
+                       int *pErrorCode, QString *pError);
+    QImage buildTile(int nZoom, const QPoint &tile, TileWorker *pWorker, const QHash<qint64, QImage> *pSplitImages);
+    QImage renderTile(const QPoint &tile, TileWorker *pWorker);
+    void writeTile(int nZoom, const QPoint &tile, const QImage &image, TileWorker *pWorker);
+
+    QVector<QPoint> levelTiles(int nZoom) const;
+    void tileRange(int nZoom, QPoint &topLeft, QPoint &bottomRight) const;
+    QString tilePath(int nZoom, const QPoint &tile) const;
+};
+}
+#endif // TILERENDERER_H
@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core xml
+QT       += core xml concurrent
 QT       -= gui widgets
 
 VERSION = 6.4.0
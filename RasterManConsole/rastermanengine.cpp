@@ -5,6 +5,16 @@
 #include <QFileInfo>
 #include <cstring>
 #include <QDebug>
+#include <QTextStream>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QtConcurrent>
+#include <iostream>
+#include <streambuf>
+#include <string>
 #include "raster.h"
 #include "rastermanager.h"
 #include "rastermanager_interface.h"
@@ -12,14 +22,24 @@
 #include "raster_pitremove.h"
 #include "raster_gutpolygon.h"
 #include "histogramsclass.h"
+#include "dodraster.h"
+#include "raster2png_batch.h"
 
 namespace RasterManager {
 
 RasterManEngine::RasterManEngine()
 {
+    m_bInBatch = false;
+    m_nBatchJobs = 0;
     CheckRasterManVersion();
 }
 
+int RasterManEngine::Usage(){
+    if (m_bInBatch)
+        throw RasterManagerException(ARGUMENT_VALIDATION, "Wrong arguments for this command. Run it on its own to see its usage.");
+    return PROCESS_OK;
+}
+
 void RasterManEngine::CheckRasterManVersion(){
 
     QString sVersion = QString(EXEVERSION);
@@ -47,18 +67,50 @@ int RasterManEngine::Run(int argc, char * argv[])
         RasterManager::ProcessTimer benchProcess(sProcname);
         // ---------------------------------------------------
 
-        RasterManager::RegisterGDAL();
+        // A batch registers GDAL once for every command it runs
+        if (!m_bInBatch)
+            RasterManager::RegisterGDAL();
         QString sCommand(argv[1]);
 
+        // "--profile <name>" anywhere after the command picks how outputs are created.
+        // It's taken out so the commands see the arguments they expect.
+        for (int a = 2; a < argc - 1; a++){
+            if (QString::compare(argv[a], "--profile", Qt::CaseInsensitive) == 0){
+                // The profile is global so it would change under commands already running
+                if (m_bInBatch && m_nBatchJobs > 1)
+                    throw RasterManagerException(ARGUMENT_VALIDATION, "--profile can't be given to a command in a concurrent batch. Give it to the batch command instead.");
+                char sErr[ERRBUFFERSIZE];
+                int eProfileResult = RasterManager::SetCreateProfile(argv[a + 1], sErr);
+                if (eProfileResult != PROCESS_OK)
+                    throw RasterManager::RasterManagerException(eProfileResult, sErr);
+                for (int b = a; b + 2 < argc; b++)
+                    argv[b] = argv[b + 2];
+                argc -= 2;
+                break;
+            }
+        }
+
+        // Setting RASTERMAN_OVERVIEWS (e.g. to "average") builds overviews on every output raster.
+        // A batch has already read it before its commands start.
+        QByteArray qbOverviews = qgetenv("RASTERMAN_OVERVIEWS");
+        if (!qbOverviews.isEmpty() && !m_bInBatch)
+            RasterManager::SetCreateOverviews(qbOverviews.data());
+
         if (QString::compare(sCommand, "Raster", Qt::CaseInsensitive) == 0)
             eResult = RasterProperties(argc, argv);
 
         else if (QString::compare(sCommand, "BiLinear", Qt::CaseInsensitive) == 0)
             eResult = BiLinearResample(argc, argv);
 
+        else if (QString::compare(sCommand, "resample", Qt::CaseInsensitive) == 0)
+            eResult = Resample(argc, argv);
+
         else if (QString::compare(sCommand, "Copy", Qt::CaseInsensitive) == 0)
             eResult = RasterCopy(argc, argv);
 
+        else if (QString::compare(sCommand, "overviews", Qt::CaseInsensitive) == 0)
+            eResult = Overviews(argc, argv);
+
         else if (QString::compare(sCommand, "Delete", Qt::CaseInsensitive) == 0)
             eResult = RasterDelete(argc, argv);
 
@@ -95,6 +147,11 @@ int RasterManEngine::Run(int argc, char * argv[])
         else if (QString::compare(sCommand, "PNG", Qt::CaseInsensitive) == 0)
             eResult = PNG(argc, argv);
 
+        else if (QString::compare(sCommand, "pngbatch", Qt::CaseInsensitive) == 0)
+            eResult = PNGBatch(argc, argv);
+        else if (QString::compare(sCommand, "pngtiles", Qt::CaseInsensitive) == 0)
+            eResult = PNGTiles(argc, argv);
+
         else if (QString::compare(sCommand, "invert", Qt::CaseInsensitive) == 0)
             eResult = invert(argc, argv);
         else if (QString::compare(sCommand, "extractpoints", Qt::CaseInsensitive) == 0)
@@ -125,6 +182,9 @@ int RasterManEngine::Run(int argc, char * argv[])
         else if (QString::compare(sCommand, "stats", Qt::CaseInsensitive) == 0)
             eResult = Stats(argc, argv);
 
+        else if (QString::compare(sCommand, "zonalstats", Qt::CaseInsensitive) == 0)
+            eResult = ZonalStats(argc, argv);
+
         else if (QString::compare(sCommand, "compare", Qt::CaseInsensitive) == 0)
             eResult = Compare(argc, argv);
 
@@ -137,6 +197,9 @@ int RasterManEngine::Run(int argc, char * argv[])
         else if (QString::compare(sCommand, "histogram", Qt::CaseInsensitive) == 0)
             eResult = Histogram(argc, argv);
 
+        else if (QString::compare(sCommand, "budget", Qt::CaseInsensitive) == 0)
+            eResult = Budget(argc, argv);
+
         else if (QString::compare(sCommand, "gutpoly", Qt::CaseInsensitive) == 0)
             eResult = GutPoly(argc, argv);
 
@@ -148,10 +211,18 @@ int RasterManEngine::Run(int argc, char * argv[])
             eResult = CompareRef(argc, argv);
 
 
+        else if (QString::compare(sCommand, "batch", Qt::CaseInsensitive) == 0)
+            eResult = Batch(argc, argv);
+
         else
             bRecognizedCommand = false;
 
-        RasterManager::DestroyGDAL();
+        // Nobody sees the usage in a batch so an unknown command has to be an error
+        if (!bRecognizedCommand && m_bInBatch)
+            throw RasterManagerException(ARGUMENT_VALIDATION, QString("Unknown command: %1").arg(sCommand));
+
+        if (!m_bInBatch)
+            RasterManager::DestroyGDAL();
 
         // For Debug only! ----------------------------------
         benchProcess.Output();
@@ -170,10 +241,13 @@ int RasterManEngine::Run(int argc, char * argv[])
         std::cout << "\n Commands (type rasterman followed by the command to retrieve parameter information):\n";
         std::cout << "\n    raster          Display basic properties (rows, cols etc) for a raster.";
         std::cout << "\n    stats           Display specific statistics (mean, max, min, etc) for a raster.";
+        std::cout << "\n    zonalstats      Statistics of a raster for every zone of a zone raster or polygon layer.";
         std::cout << "\n    compare         Compare two rasters: check divisible, orthogonal, concurrent and by cell";
         std::cout << "\n    delete          Delete a dataset. Useful for cleaning up auxiliary files";
+        std::cout << "\n    overviews       Build internal overviews (image pyramid) for a raster.";
         std::cout << "\n";
         std::cout << "\n    bilinear        Bilinear resample of a raster to produce a new raster.";
+        std::cout << "\n    resample        Resample a raster (nearest, cubic, lanczos, average, mode etc.)";
         std::cout << "\n    copy            Copy a raster to produce a new raster with the specified extent.";
         std::cout << "\n    mosaic          Stitch two or more overlappint rasters.";
         std::cout << "\n    combine         Combine multiple rasters using one or more methods.";
@@ -198,14 +272,22 @@ int RasterManEngine::Run(int argc, char * argv[])
         std::cout << "\n    hillshade    Create a hillshade raster.";
         std::cout << "\n    slope        Create a slope raster.";
         std::cout << "\n    png          Create a PNG image copy of a raster.";
+        std::cout << "\n    pngbatch     Create many PNGs, stacked or not, from a manifest.";
+        std::cout << "\n    pngtiles     Create XYZ or TMS web map tiles from a raster.";
         std::cout << "\n    histogram    Create a histogram for a specific raster.";
+        std::cout << "\n    budget       DoD change budgets for one or more thresholds, optionally by zone.";
         std::cout << "\n ";
         std::cout << "\n    csv2raster      Create a raster from a .csv file";
-        std::cout << "\n    raster2csv      Create a raster from a .csv file";
+        std::cout << "\n    raster2csv      Create a .csv file from a raster";
 //        std::cout << "\n    vector2raster   Create a raster from a vector file.";
         std::cout << "\n ";
         std::cout << "\n    extractpoints   Extract point values from a raster using a csv.";
         std::cout << "\n ";
+        std::cout << "\n    batch           Run a script or NDJSON stream of commands in one process.";
+        std::cout << "\n ";
+        std::cout << "\n Output creation profile: add --profile <default|fast|compact|cog> to any command";
+        std::cout << "\n or set the RASTERMAN_PROFILE environment variable.";
+        std::cout << "\n ";
     }
     return PROCESS_OK;
 }
@@ -220,7 +302,7 @@ int RasterManEngine::RasterProperties(int argc, char * argv[])
         std::cout << "\n Arguments:";
         std::cout << "\n    raster_file_path: Absolute full path to existing raster file.";
         std::cout << "\n";
-        return PROCESS_OK;
+        return Usage();
     }
 
     RasterManager::PrintRasterProperties(argv[2]);
@@ -238,7 +320,7 @@ int RasterManEngine::RasterDelete(int argc, char * argv[])
         std::cout << "\n Arguments: ";
         std::cout << "\n    raster_file_path: Absolute full path to existing raster file. ";
         std::cout << "\n";
-        return eResult;
+        return Usage();
     }
 
     eResult = RasterManager::Raster::Delete(argv[2]);
@@ -246,6 +328,31 @@ int RasterManEngine::RasterDelete(int argc, char * argv[])
 
 }
 
+int RasterManEngine::Overviews(int argc, char * argv[])
+{
+    if (argc != 3 && argc != 4)
+    {
+        std::cout << "\n Overviews Usage:";
+        std::cout << "\n    Syntax: rasterman overviews <raster_file_path> [resampling]";
+        std::cout << "\n   Command: overviews";
+        std::cout << "\n";
+        std::cout << "\n Arguments:";
+        std::cout << "\n    raster_file_path: Absolute full path to existing raster file.";
+        std::cout << "\n    resampling: (optional) average (default), nearest, mode, cubic, gauss or lanczos.";
+        std::cout << "\n";
+        std::cout << "\n    Set the RASTERMAN_OVERVIEWS environment variable to one of the resampling";
+        std::cout << "\n    methods above to build overviews for every raster rasterman creates.";
+        std::cout << "\n";
+        return Usage();
+    }
+
+    const char * psResampling = NULL;
+    if (argc == 4)
+        psResampling = argv[3];
+
+    return RasterManager::Raster::BuildOverviews(argv[2], psResampling);
+}
+
 int RasterManEngine::BiLinearResample(int argc, char * argv[])
 {
     if (argc != 9)
@@ -263,7 +370,7 @@ int RasterManEngine::BiLinearResample(int argc, char * argv[])
         std::cout << "\n    cols: Number of columns in the output raster.";
         std::cout << "\n    cell_size: Cell size for the output raster.";
         std::cout << "\n";
-        return PROCESS_OK;
+        return Usage();
     }
 
     std::cout << "\n\n --  Bilinear Resampling --";
@@ -287,6 +394,51 @@ int RasterManEngine::BiLinearResample(int argc, char * argv[])
 
 }
 
+int RasterManEngine::Resample(int argc, char * argv[])
+{
+    if (argc != 10)
+    {
+        std::cout << "\n Resample Usage:";
+        std::cout << "\n    Syntax: rasterman resample <raster_file_path> <output_file_path> <method> <left> <top> <rows> <cols> <cell_size>";
+        std::cout << "\n   Command: resample";
+        std::cout << "\n";
+        std::cout << "\n Arguments:";
+        std::cout << "\n    raster_file_path: Absolute full path to existing raster file.";
+        std::cout << "\n    output_file_path: Absolute full path to output, resampled raster file.";
+        std::cout << "\n    method: nearest, bilinear, cubic, lanczos, average or mode.";
+        std::cout << "\n            average and mode weight every input cell by the area it shares with the output cell.";
+        std::cout << "\n    left: Left coordinate of the output raster extent.";
+        std::cout << "\n    top: Top coordinate of the output raster extent.";
+        std::cout << "\n    rows: Number of rows in the output raster.";
+        std::cout << "\n    cols: Number of columns in the output raster.";
+        std::cout << "\n    cell_size: Cell size for the output raster.";
+        std::cout << "\n";
+        return Usage();
+    }
+
+    int eMethod = RasterManager::GetResampleMethodFromString(argv[4]);
+    if (eMethod < 0)
+        throw RasterManagerException(ARGUMENT_VALIDATION, QString("Resample method was invalid: %1").arg(argv[4]));
+
+    std::cout << "\n\n --  Resampling (" << argv[4] << ") --";
+
+    double fLeft, fTop, fCellSize;
+    int nRows, nCols;
+    int eResult = PROCESS_OK;
+
+    GetOutputRasterProperties(fLeft, fTop, nRows, nCols, fCellSize, argc, argv, 5);
+
+    RasterManager::Raster rOriginal(argv[2]);
+    eResult = rOriginal.ReSample(argv[3], fCellSize, fLeft, fTop, nRows, nCols, (Raster_Resample_Method) eMethod);
+
+    std::cout << "\n\n Input Raster: --------------------\n";
+    PrintRasterProperties(argv[2]);
+    std::cout << "\n\n Output Raster: --------------------\n";
+    PrintRasterProperties(argv[3]);
+
+    return eResult;
+}
+
 int RasterManEngine::RasterCopy(int argc, char * argv[])
 {
     if (argc != 9)
@@ -303,7 +455,7 @@ int RasterManEngine::RasterCopy(int argc, char * argv[])
         std::cout << "\n               cols: Number of columns in the output raster.";
         std::cout << "\n          cell_size: Cell size for the output raster.";
         std::cout << "\n";
-        return PROCESS_OK;
+        return Usage();
     }
 
         double fLeft, fTop, fCellSize;
@@ -348,7 +500,7 @@ int RasterManEngine::RasterMath(int argc, char * argv[])
         std::cout << "\n      Notes: power cannot use two rasters.";
         std::cout << "\n             sqrt only takes raster1 as an argument";
         std::cout << "\n ";
-        return eResult;
+        return Usage();
     }
 
     QString sOperator = argv[2];
@@ -403,7 +555,7 @@ int RasterManEngine::Histogram(int argc, char * argv[])
         std::cout << "\n             bin_increment: Bin increment (float).";
 
         std::cout << "\n ";
-        return PROCESS_OK;
+        return Usage();
     }
 
     int eResult = PROCESS_OK;
@@ -431,6 +583,50 @@ int RasterManEngine::Histogram(int argc, char * argv[])
 
 }
 
+int RasterManEngine::Budget(int argc, char * argv[])
+{
+    if (argc < 6)
+    {
+        std::cout << "\n DoD change budgets (areas and volumes of erosion and deposition).";
+        std::cout << "\n    Usage: rasterman budget <raw_dod_path> <output_csv_path> <zone_raster_path> <threshold> [<threshold>...]";
+        std::cout << "\n ";
+        std::cout << "\n Arguments:";
+        std::cout << "\n        raw_dod_path: Absolute full path to the raw DoD raster.";
+        std::cout << "\n     output_csv_path: Absolute full path to the desired output csv file.";
+        std::cout << "\n    zone_raster_path: Raster of integer classes to segregate the budget by, or \"none\".";
+        std::cout << "\n           threshold: Either a MinLoD value or the path to a propagated error raster.";
+        std::cout << "\n                      Every threshold is calculated in the same pass over the DoD.";
+        std::cout << "\n ";
+        return Usage();
+    }
+
+    CheckFile(argv[2], true);
+    CheckFile(argv[3], false);
+
+    RasterManager::DoDBudgetEngine engine(argv[2]);
+
+    if (QString::compare(argv[4], "none", Qt::CaseInsensitive) != 0){
+        CheckFile(argv[4], true);
+        engine.SetZones(argv[4]);
+    }
+
+    for (int i = 5; i < argc; i++){
+        bool bIsNumber = false;
+        double fThreshold = QString(argv[i]).toDouble(&bIsNumber);
+        if (bIsNumber)
+            engine.AddMinLoD(fThreshold);
+        else {
+            CheckFile(argv[i], true);
+            engine.AddPropagatedError(argv[i]);
+        }
+    }
+
+    engine.Calculate();
+    engine.WriteCSV(argv[3]);
+
+    return PROCESS_OK;
+}
+
 int RasterManEngine::Mosaic(int argc, char * argv[])
 {
     if (argc != 4)
@@ -442,7 +638,7 @@ int RasterManEngine::Mosaic(int argc, char * argv[])
         std::cout << "\n    raster_file_paths: two or more raster file paths; semicolon delimited.";
         std::cout << "\n     output_file_path: Absolute full path to desired output raster file.";
         std::cout << "\n ";
-        return PROCESS_OK;
+        return Usage();
     }
 
     int eResult = PROCESS_OK;
@@ -473,7 +669,7 @@ int RasterManEngine::Combine(int argc, char * argv[])
         std::cout << "\n               range: max - min of all the rasters.";
         std::cout << "\n                mean: Mean values over all rasters.";
         std::cout << "\n ";
-        return PROCESS_OK;
+        return Usage();
     }
 
     int eResult = PROCESS_OK;
@@ -497,7 +693,7 @@ int RasterManEngine::MakeConcurrent(int argc, char * argv[])
         std::cout << "\n    raster_output_paths: two or more raster file paths; semicolon delimited.";
         std::cout << "\n                         Must match raster_input_paths.";
         std::cout << "\n ";
-        return PROCESS_OK;
+        return Usage();
     }
 
     int eResult = Raster::MakeRasterConcurrent(argv[2], argv[3]);
@@ -520,7 +716,7 @@ int RasterManEngine::Mask(int argc, char * argv[])
         std::cout << "\n    raster_mask_path: A raster to be used as a mask. Mask will be created from NoDataValues.";
         std::cout << "\n    output_file_path: Absolute full path to desired output raster file.";
         std::cout << "\n ";
-        return PROCESS_OK;
+        return Usage();
     }
 
     eResult =  Raster::RasterMask(
@@ -553,7 +749,7 @@ int RasterManEngine::SetNull(int argc, char * argv[])
         std::cout << "\n                 arg: Value to threshold below or above. Use for \"above\", \"below\" and \"value\"";
         std::cout << "\n    lowval & highval: Low / high value. Use for \"above\" and \"below\"";
         std::cout << "\n ";
-        return PROCESS_OK;
+        return Usage();
     }
 
     if (argc == 4){
@@ -594,7 +790,7 @@ int RasterManEngine::MaskVal(int argc, char * argv[])
         std::cout << "\n          mask_Value: (optional) Select mask value. Anything not equal to this value will be set to NoDataVal.";
         std::cout << "\n                      If not used, cells with a mask equal to 'Nodataval' will be masked out.";
         std::cout << "\n ";
-        return PROCESS_OK;
+        return Usage();
     }
 
     double dMaskVal = GetDouble(argc, argv, 4);
@@ -616,7 +812,7 @@ int RasterManEngine::Uniform(int argc, char * argv[])
         std::cout << "\n    output_file_path: Absolute full path to output, slope raster.";
         std::cout << "\n               value: Value to use.";
         std::cout << "\n";
-        return PROCESS_OK;
+        return Usage();
     }
 
     RasterManager::Raster rOriginal(argv[2]);
@@ -640,7 +836,7 @@ int RasterManEngine::Slope(int argc, char * argv[])
         std::cout << "\n    raster_file_path: Absolute full path to existing raster file.";
         std::cout << "\n    output_file_path: Absolute full path to output, slope raster.";
         std::cout << "\n";
-        return PROCESS_OK;
+        return Usage();
     }
 
     RasterManager::Raster rOriginal(argv[3]);
@@ -661,7 +857,7 @@ int RasterManEngine::Hillshade(int argc, char * argv[])
         std::cout << "\n    raster_file_path: Absolute full path to existing raster file.";
         std::cout << "\n    output_file_path: Absolute full path to output, hillshade raster file.";
         std::cout << "\n";
-        return PROCESS_OK;
+        return Usage();
     }
 
     RasterManager::Raster rOriginal(argv[2]);
@@ -694,7 +890,7 @@ int RasterManEngine::PNG(int argc, char * argv[])
 //        std::cout << "\n                      Valid Options: DEM, DoD, Error, HillShade, PointDensity, SlopeDeg, SlopePC";
         std::cout << "\n                      Valid Options: DEM, HillShade";
         std::cout << "\n";
-        return eResult;
+        return Usage();
         break;
     }
 
@@ -709,12 +905,398 @@ int RasterManEngine::PNG(int argc, char * argv[])
     return eResult;
 }
 
+int RasterManEngine::PNGBatch(int argc, char * argv[])
+{
+    if (argc != 3)
+    {
+        std::cout << "\n Create PNG Image Files from a manifest:";
+        std::cout << "\n    Syntax: rasterman pngbatch <manifest_path>";
+        std::cout << "\n";
+        std::cout << "\n Arguments:";
+        std::cout << "\n    manifest_path: Text file with one PNG per line:";
+        std::cout << "\n                   <png_path>,<layers>,<long_axis>[,<quality>[,<legend>]]";
+        std::cout << "\n                   layers: raster|style[|opacity] separated by ; bottom layer first.";
+        std::cout << "\n                           e.g. C:/dem_hs.tif|HillShade;C:/dod.tif|DoD|60";
+        std::cout << "\n                   style: DEM, DoD, Error, HillShade, PointDensity, SlopeDeg, SlopePC or a colour ramp.";
+        std::cout << "\n                   opacity: 0 to 100. Default is 100.";
+        std::cout << "\n                   quality: 0 to 100. Default is 100.";
+        std::cout << "\n                   legend: 1 for a legend of the top layer. Not available from the console.";
+        std::cout << "\n                   Lines starting with # are ignored.";
+        std::cout << "\n";
+        return Usage();
+    }
+
+    char sErr[ERRBUFFERSIZE];
+    sErr[0] = '\0';
+    if (Raster2PNG::CreatePNGBatch(argv[2], sErr) != 0)
+        throw RasterManagerException(OUTPUT_FILE_ERROR, QString(sErr));
+
+    return PROCESS_OK;
+}
+
+int RasterManEngine::PNGTiles(int argc, char * argv[])
+{
+    if (argc < 5 || argc > 8)
+    {
+        std::cout << "\n Create Web Map Tiles:";
+        std::cout << "\n    Syntax: rasterman pngtiles <raster_file_path> <output_folder> <style> [<opacity>] [<min_zoom>] [<scheme>]";
+        std::cout << "\n";
+        std::cout << "\n Arguments:";
+        std::cout << "\n    raster_file_path: Absolute full path to existing raster file. It needs a coordinate system.";
+        std::cout << "\n       output_folder: Tiles are written to output_folder/z/x/y.png in web mercator.";
+        std::cout << "\n               style: DEM, DoD, Error, HillShade, PointDensity, SlopeDeg, SlopePC or a colour ramp.";
+        std::cout << "\n             opacity: (optional) 0 to 100. Default is 100.";
+        std::cout << "\n            min_zoom: (optional) Least detailed zoom level to build.";
+        std::cout << "\n                      Default builds out until the raster fits on one tile.";
+        std::cout << "\n              scheme: (optional) xyz numbers tile rows from the top, tms from the bottom. Default is xyz.";
+        std::cout << "\n";
+        std::cout << "\n The most detailed zoom is the first one as fine as the raster's cells. Tiles that are all NoData are skipped.";
+        std::cout << "\n";
+        return Usage();
+    }
+
+    int nOpacity = 100;
+    int nMinZoom = -1;
+    int nTMS = 0;
+    if (argc > 5)
+        nOpacity = GetInteger(argc, argv, 5);
+    if (argc > 6)
+        nMinZoom = GetInteger(argc, argv, 6);
+    if (argc > 7)
+    {
+        if (QString::compare(argv[7], "tms", Qt::CaseInsensitive) == 0)
+            nTMS = 1;
+        else if (QString::compare(argv[7], "xyz", Qt::CaseInsensitive) != 0)
+            throw RasterManagerException(ARGUMENT_VALIDATION, QString("Unknown tile scheme: %1").arg(argv[7]));
+    }
+
+    char sErr[ERRBUFFERSIZE];
+    sErr[0] = '\0';
+    if (Raster2PNG::CreatePNGTiles(argv[2], argv[3], argv[4], nOpacity, nMinZoom, nTMS, sErr) != 0)
+        throw RasterManagerException(OUTPUT_FILE_ERROR, QString(sErr));
+
+    return PROCESS_OK;
+}
+
+/* One line of a batch. "wait" on its own is a barrier. */
+struct BatchCommand
+{
+    QJsonValue id;
+    QStringList args;
+    QString error; // The line couldn't be parsed
+};
+
+/* Installed on std::cout for the length of a batch so stdout only ever gets result lines.
+ * Whatever a command prints is kept for the thread running it and goes into its result.
+ * Anything printed from other threads goes to stderr. */
+class BatchOutputBuffer : public std::streambuf
+{
+public:
+    BatchOutputBuffer(std::streambuf * pOut, std::streambuf * pErr) : m_pOut(pOut), m_pErr(pErr) {}
+
+    void Begin(){
+        QMutexLocker lock(&m_mxOutput);
+        m_hCaptured.insert(QThread::currentThreadId(), std::string());
+    }
+
+    std::string End(){
+        QMutexLocker lock(&m_mxOutput);
+        return m_hCaptured.take(QThread::currentThreadId());
+    }
+
+    void WriteLine(const QByteArray & baLine){
+        QMutexLocker lock(&m_mxOutput);
+        m_pOut->sputn(baLine.constData(), baLine.size());
+        m_pOut->sputc('\n');
+        m_pOut->pubsync();
+    }
+
+protected:
+    int overflow(int c){
+        if (c != traits_type::eof()){
+            char ch = traits_type::to_char_type(c);
+            xsputn(&ch, 1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char * psText, std::streamsize nCount){
+        QMutexLocker lock(&m_mxOutput);
+        QHash<Qt::HANDLE, std::string>::iterator it = m_hCaptured.find(QThread::currentThreadId());
+        if (it != m_hCaptured.end())
+            it->append(psText, (size_t) nCount);
+        else
+            m_pErr->sputn(psText, nCount);
+        return nCount;
+    }
+
+    int sync(){
+        QMutexLocker lock(&m_mxOutput);
+        return m_pErr->pubsync();
+    }
+
+private:
+    std::streambuf * m_pOut;
+    std::streambuf * m_pErr;
+    QMutex m_mxOutput;
+    QHash<Qt::HANDLE, std::string> m_hCaptured;
+};
+
+/* Split on whitespace. Double quotes keep paths with spaces together. */
+static QStringList SplitCommandLine(const QString & sLine)
+{
+    QStringList lArgs;
+    QString sArg;
+    bool bQuoted = false;
+    bool bHasArg = false;
+    for (int i = 0; i < sLine.length(); i++){
+        QChar c = sLine.at(i);
+        if (c == '"'){
+            bQuoted = !bQuoted;
+            bHasArg = true;
+        }
+        else if (c.isSpace() && !bQuoted){
+            if (bHasArg)
+                lArgs.append(sArg);
+            sArg.clear();
+            bHasArg = false;
+        }
+        else{
+            sArg.append(c);
+            bHasArg = true;
+        }
+    }
+    if (bHasArg)
+        lArgs.append(sArg);
+    return lArgs;
+}
+
+/* A plain command line, or {"id": ..., "command": "math", "args": [...]} or {"wait": true} */
+static BatchCommand ParseBatchLine(const QString & sLine, int nLine)
+{
+    BatchCommand command;
+    command.id = QJsonValue(nLine);
+
+    if (!sLine.startsWith("{")){
+        command.args = SplitCommandLine(sLine);
+        return command;
+    }
+
+    QJsonParseError jsonError;
+    QJsonDocument doc = QJsonDocument::fromJson(sLine.toUtf8(), &jsonError);
+    if (jsonError.error != QJsonParseError::NoError || !doc.isObject()){
+        command.error = QString("Line %1 is not a JSON object: %2").arg(nLine).arg(jsonError.errorString());
+        return command;
+    }
+
+    QJsonObject obj = doc.object();
+    if (obj.contains("id"))
+        command.id = obj.value("id");
+    if (obj.value("wait").toBool()){
+        command.args.append("wait");
+        return command;
+    }
+    if (obj.contains("command"))
+        command.args.append(obj.value("command").toString());
+    foreach (QJsonValue arg, obj.value("args").toArray())
+        command.args.append(arg.isString() ? arg.toString() : arg.toVariant().toString());
+
+    if (command.args.isEmpty())
+        command.error = QString("Line %1 has no command").arg(nLine);
+    return command;
+}
+
+/* Run one batch command and print its result, and anything it printed, as a line of JSON */
+static int RunBatchCommand(RasterManEngine * pEngine, BatchOutputBuffer * pOutput, BatchCommand command)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    int eResult = PROCESS_OK;
+    QString sMessage;
+    QString sPrinted;
+
+    if (!command.error.isEmpty()){
+        eResult = ARGUMENT_VALIDATION;
+        sMessage = command.error;
+    }
+    else{
+        // Run wants a normal command line, program name first
+        QList<QByteArray> lArgs;
+        lArgs.append(QByteArray("rasterman"));
+        foreach (QString sArg, command.args)
+            lArgs.append(sArg.toLocal8Bit());
+        QVector<char *> vArgv;
+        for (int a = 0; a < lArgs.size(); a++)
+            vArgv.append(lArgs[a].data());
+        vArgv.append(NULL);
+
+        pOutput->Begin();
+        try{
+            eResult = pEngine->Run(lArgs.size(), vArgv.data());
+            if (eResult != PROCESS_OK)
+                sMessage = RasterManagerException::GetReturnCodeOnlyAsString(eResult);
+        }
+        catch (RasterManagerException & e){
+            eResult = e.GetErrorCode();
+            sMessage = e.GetReturnMsgAsString();
+            if (sMessage.isEmpty())
+                sMessage = RasterManagerException::GetReturnCodeOnlyAsString(eResult);
+        }
+        catch (std::exception & e){
+            eResult = OTHER_ERROR;
+            sMessage = e.what();
+        }
+        sPrinted = QString::fromLocal8Bit(pOutput->End().c_str()).trimmed();
+    }
+
+    QJsonObject result;
+    result.insert("id", command.id);
+    result.insert("command", command.args.isEmpty() ? QString() : command.args.first());
+    result.insert("status", QString(eResult == PROCESS_OK ? "ok" : "error"));
+    result.insert("code", eResult);
+    if (!sMessage.isEmpty())
+        result.insert("message", sMessage);
+    if (!sPrinted.isEmpty())
+        result.insert("output", sPrinted);
+    result.insert("ms", (double) timer.elapsed());
+
+    pOutput->WriteLine(QJsonDocument(result).toJson(QJsonDocument::Compact));
+    return eResult;
+}
+
+/* Wait for every command queued so far and count the ones that failed */
+static void CollectBatchResults(QList< QFuture<int> > & futures, int & nFailed, int & eFirstError)
+{
+    for (int f = 0; f < futures.size(); f++){
+        int eResult = futures[f].result();
+        if (eResult != PROCESS_OK){
+            nFailed++;
+            if (eFirstError == PROCESS_OK)
+                eFirstError = eResult;
+        }
+    }
+    futures.clear();
+}
+
+int RasterManEngine::Batch(int argc, char * argv[])
+{
+    if (argc < 3 || argc > 4)
+    {
+        std::cout << "\n Run many commands in one process:";
+        std::cout << "\n    Syntax: rasterman batch <script_path> [<jobs>]";
+        std::cout << "\n";
+        std::cout << "\n Arguments:";
+        std::cout << "\n    script_path: Text file with one command per line, or - to read them from stdin.";
+        std::cout << "\n                 A line is either a command as it would follow \"rasterman\", e.g.";
+        std::cout << "\n                     math add \"C:/my dems/a.tif\" C:/b.tif C:/sum.tif";
+        std::cout << "\n                 or a JSON object, e.g.";
+        std::cout << "\n                     {\"id\": 7, \"command\": \"math\", \"args\": [\"add\", \"C:/a.tif\", \"C:/b.tif\", \"C:/sum.tif\"]}";
+        std::cout << "\n                 Blank lines and lines starting with # are ignored.";
+        std::cout << "\n           jobs: (optional) How many commands can run at once. Default is 1.";
+        std::cout << "\n                 Commands only run together up to a \"wait\" line (or {\"wait\": true}).";
+        std::cout << "\n                 Put one between a command and anything that reads its output.";
+        std::cout << "\n";
+        std::cout << "\n Every command prints one JSON line when it finishes and nothing else goes to stdout:";
+        std::cout << "\n    {\"id\":7,\"command\":\"math\",\"status\":\"ok\",\"code\":0,\"ms\":152}";
+        std::cout << "\n The id is the line number unless the JSON gave one. Failed commands add a message.";
+        std::cout << "\n Anything the command printed, like raster properties, is in \"output\".";
+        std::cout << "\n Wrong arguments are an error rather than a usage message.";
+        std::cout << "\n With 1 job --profile carries on for every command after the one it's on.";
+        std::cout << "\n With more it can only be given to the batch command itself.";
+        std::cout << "\n";
+        return Usage();
+    }
+
+    if (m_bInBatch)
+        throw RasterManagerException(ARGUMENT_VALIDATION, "A batch can't start another batch.");
+
+    int nJobs = 1;
+    if (argc > 3){
+        nJobs = GetInteger(argc, argv, 3);
+        if (nJobs < 1)
+            throw RasterManagerException(ARGUMENT_VALIDATION, QString("Jobs must be at least 1: %1").arg(nJobs));
+    }
+
+    QFile scriptFile;
+    bool bOpen = false;
+    if (strcmp(argv[2], "-") == 0)
+        bOpen = scriptFile.open(stdin, QIODevice::ReadOnly | QIODevice::Text);
+    else{
+        CheckFile(argv[2], true);
+        scriptFile.setFileName(argv[2]);
+        bOpen = scriptFile.open(QIODevice::ReadOnly | QIODevice::Text);
+    }
+    if (!bOpen)
+        throw RasterManagerException(INPUT_FILE_ERROR, QString("Could not open the batch script: %1").arg(argv[2]));
+
+    // GDAL stays registered and raster headers stay cached until the last command is done
+    m_bInBatch = true;
+    m_nBatchJobs = nJobs;
+    SetHeaderCache(true);
+
+    BatchOutputBuffer output(std::cout.rdbuf(), std::cerr.rdbuf());
+    std::cout.flush();
+    std::streambuf * pStdout = std::cout.rdbuf(&output);
+
+    // Commands get a pool of their own. The kernels they run share the global one.
+    QThreadPool pool;
+    pool.setMaxThreadCount(nJobs);
+    QList< QFuture<int> > futures;
+    int nCommands = 0;
+    int nFailed = 0;
+    int eFirstError = PROCESS_OK;
+
+    // Lines are run as they arrive so a caller can keep stdin open and feed it
+    QTextStream in(&scriptFile);
+    int nLine = 0;
+    while (true){
+        QString sLine = in.readLine();
+        if (sLine.isNull())
+            break;
+        nLine++;
+
+        sLine = sLine.trimmed();
+        if (sLine.isEmpty() || sLine.startsWith("#"))
+            continue;
+
+        BatchCommand command = ParseBatchLine(sLine, nLine);
+        if (command.args.size() == 1 && QString::compare(command.args.first(), "wait", Qt::CaseInsensitive) == 0){
+            CollectBatchResults(futures, nFailed, eFirstError);
+            continue;
+        }
+
+        nCommands++;
+        if (nJobs == 1){
+            int eResult = RunBatchCommand(this, &output, command);
+            if (eResult != PROCESS_OK){
+                nFailed++;
+                if (eFirstError == PROCESS_OK)
+                    eFirstError = eResult;
+            }
+        }
+        else
+            futures.append(QtConcurrent::run(&pool, RunBatchCommand, this, &output, command));
+    }
+    CollectBatchResults(futures, nFailed, eFirstError);
+
+    std::cout.rdbuf(pStdout);
+    SetHeaderCache(false);
+    m_bInBatch = false;
+    m_nBatchJobs = 0;
+
+    if (nFailed > 0)
+        throw RasterManagerException(eFirstError, QString("%1 of %2 batch commands failed.").arg(nFailed).arg(nCommands));
+
+    return PROCESS_OK;
+}
+
 int RasterManEngine::CSVToRaster(int argc, char * argv[])
 {
-    if (argc != 8 && argc != 13)
+    if (argc < 8 || argc > 16 || (argc > 11 && argc < 13))
     {
         std::cout << "\n Convert a CSV file into a raster.";
-        std::cout << "\n    Usage: rasterman csv2raster <csv_file_path> <output_raster_path> <XField> <YField> <DataField> [<top> <left> <rows> <cols> <cell_size> <no_data_val>] | <raster_template>";
+        std::cout << "\n    Usage: rasterman csv2raster <csv_file_path> <output_raster_path> <XField> <YField> <DataField> [<top> <left> <rows> <cols> <cell_size> <no_data_val>] | <raster_template> [<method> [<idw_radius> [<idw_power>]]]";
         std::cout << "\n ";
         std::cout << "\n Arguments:";
         std::cout << "\n       csv_file_path: Absolute full path to existing .csv file.";
@@ -737,13 +1319,33 @@ int RasterManEngine::CSVToRaster(int argc, char * argv[])
         std::cout << "\n      Or pass in a raster file with extent, cellsize and projection set correctly.";
         std::cout << "\n";
         std::cout << "\n    raster_template: Path to template raster file.";
+        std::cout << "\n";
+        std::cout << "\n         method: (optional) How points in the same cell are combined: last (default), mean, min, max, count or idw.";
+        std::cout << "\n     idw_radius: (optional) Search radius for idw in map units. 0 (default) uses only the points in each cell.";
+        std::cout << "\n      idw_power: (optional) Distance exponent for idw. Default is 2.";
         std::cout << "\n\n";
-        return PROCESS_OK;
+        return Usage();
     }
     int eResult = PROCESS_OK;
 
+    // Gridding options follow the template or the extents
+    int nMethodArg = argc >= 13 ? 13 : 8;
+    Raster_Grid_Method eMethod = GRID_LAST;
+    double fIDWRadius = 0;
+    double fIDWPower = 2;
+    if (argc > nMethodArg){
+        int nMethod = GetGridMethodFromString(argv[nMethodArg]);
+        if (nMethod < 0)
+            throw RasterManagerException(ARGUMENT_VALIDATION, QString("Unknown gridding method: %1").arg(argv[nMethodArg]));
+        eMethod = (Raster_Grid_Method) nMethod;
+    }
+    if (argc > nMethodArg + 1)
+        fIDWRadius = GetDouble(argc, argv, nMethodArg + 1);
+    if (argc > nMethodArg + 2)
+        fIDWPower = GetDouble(argc, argv, nMethodArg + 2);
+
     // Either all
-    if (argc == 13){
+    if (argc >= 13){
 
         double dLeft, dTop, dCellSize, dNoDataVal;
         int nRows, nCols;
@@ -762,16 +1364,18 @@ int RasterManEngine::CSVToRaster(int argc, char * argv[])
                 dCellSize, dNoDataVal,
                 argv[4],
                 argv[5],
-                argv[6] );
+                argv[6],
+                eMethod, fIDWRadius, fIDWPower );
     }
     // Otherwise a csv file is used
-    else if (argc == 8){
+    else {
         eResult = RasterManager::Raster::CSVtoRaster(argv[2],
                 argv[3],
                 argv[7],
                 argv[4],
                 argv[5],
-                argv[6] );
+                argv[6],
+                eMethod, fIDWRadius, fIDWPower );
 
     }
     PrintRasterProperties(argv[3]);
@@ -783,20 +1387,29 @@ int RasterManEngine::CSVToRaster(int argc, char * argv[])
 
 int RasterManEngine::RasterToCSV(int argc, char * argv[])
 {
-    if (argc != 4)
+    if (argc != 4 && argc != 5)
     {
-        std::cout << "\n Convert a CSV file into a raster.";
-        std::cout << "\n    Usage: rasterman raster2csv <input_raster_path> <csv_file_path>";
+        std::cout << "\n Convert a raster into a CSV file.";
+        std::cout << "\n    Usage: rasterman raster2csv <input_raster_path> <csv_file_path> [nodata]";
         std::cout << "\n ";
         std::cout << "\n Arguments:";
         std::cout << "\n   input_raster_path: Absolute full path to existing raster file.";
-        std::cout << "\n       csv_file_path: Absolute full path to desired output .csv file.";
+        std::cout << "\n       csv_file_path: Absolute full path to desired output .csv file. Use a .bin extension";
+        std::cout << "\n                      for columnar binary (header, then all X, all Y, all values as float64).";
+        std::cout << "\n              nodata: (Optional) Write NoData cells too. They are skipped by default.";
         std::cout << "\n\n";
-        return PROCESS_OK;
+        return Usage();
     }
     int eResult = PROCESS_OK;
 
-    eResult = RasterManager::Raster::RasterToCSV( argv[2], argv[3] );
+    bool bSkipNoData = true;
+    if (argc == 5){
+        if (QString::compare(argv[4], "nodata", Qt::CaseInsensitive) != 0)
+            throw RasterManagerException(ARGUMENT_VALIDATION, QString("Unknown option: %1").arg(argv[4]));
+        bSkipNoData = false;
+    }
+
+    eResult = RasterManager::Raster::RasterToCSV( argv[2], argv[3], bSkipNoData );
 
     return eResult;
 
@@ -815,7 +1428,7 @@ int RasterManEngine::invert(int argc, char * argv[])
         std::cout << "\n  output_raster_path: Absolute full path to desired output raster file.";
         std::cout << "\n               value: (optional) The value to use. 1 is the default";
         std::cout << "\n\n";
-        return PROCESS_OK;
+        return Usage();
     }
     int eResult = PROCESS_OK;
     double dValue = 1;
@@ -852,7 +1465,7 @@ int RasterManEngine::fill(int argc, char * argv[])
         std::cout << "\n                        cut: for Cut Only";
         std::cout << "\n\n";
 
-        return PROCESS_OK;
+        return Usage();
     }
     int eResult = PROCESS_OK;
 
@@ -887,7 +1500,7 @@ int RasterManEngine::CreateDrain(int argc, char * argv[])
         std::cout << "\n           ";
         std::cout << "\n\n";
 
-        return PROCESS_OK;
+        return Usage();
     }
     int eResult = PROCESS_OK;
 
@@ -921,7 +1534,7 @@ int RasterManEngine::filter(int argc, char * argv[])
         std::cout << "\n                NOTE: The maximum widths allowed are 15 cells";
         std::cout << "\n\n";
 
-        return PROCESS_OK;
+        return Usage();
     }
     int eResult = PROCESS_OK;
 
@@ -949,22 +1562,38 @@ int RasterManEngine::filter(int argc, char * argv[])
 }
 
 int RasterManEngine::extractpoints(int argc, char * argv[]){
+
+    // An interpolation method can go on the end of any form of the command
+    bool bBilinear = false;
+    if (argc > 5){
+        QString sLast(argv[argc - 1]);
+        if (QString::compare(sLast, "bilinear", Qt::CaseInsensitive) == 0){
+            bBilinear = true;
+            argc--;
+        }
+        else if (QString::compare(sLast, "nearest", Qt::CaseInsensitive) == 0)
+            argc--;
+    }
+
     if (argc < 5 || argc > 8)
     {
         std::cout << "\n Extract cell values from a raster.";
-        std::cout << "\n    Usage: rasterman extractpoints <input_csv_path> <input_raster_path> <output_csv_path> [<x_field> <y_field>] [<nodata>]";
+        std::cout << "\n    Usage: rasterman extractpoints <input_csv_path> <input_raster_path> <output_csv_path> [<x_field> <y_field>] [<nodata>] [nearest|bilinear]";
         std::cout << "\n               ";
         std::cout << "\n Arguments:    ";
         std::cout << "\n      input_csv_path: Absolute full path to existing csv file with points we want to extract.";
-        std::cout << "\n   input_raster_path: Absolute full path to existing input raster file.";
+        std::cout << "\n   input_raster_path: Absolute full path to existing input raster file. Separate several rasters";
+        std::cout << "\n                      with ';' to get one value column per raster in a single output csv.";
         std::cout << "\n     output_csv_path: Absolute full path to desired output csv file containing the extracted values.";
         std::cout << "\n               ";
         std::cout << "\n        x_field: If your CSV has a header row you can specify an X field name.";
         std::cout << "\n        y_field: If your CSV has a header row you can specify an Y field name.";
         std::cout << "\n         nodata: (Optional) The string to use for nodata. Default is \"-9999\" ";
+        std::cout << "\n  interpolation: (Optional) nearest (default) takes the cell's value. bilinear interpolates";
+        std::cout << "\n                 between the four nearest cell centres.";
         std::cout << "\n\n";
 
-        return PROCESS_OK;
+        return Usage();
     }
     int eResult = PROCESS_OK;
 
@@ -987,13 +1616,24 @@ int RasterManEngine::extractpoints(int argc, char * argv[]){
         Nodata = QString(argv[7]);
     }
 
-    eResult = RasterManager::Raster::ExtractPoints(
-                argv[2],
-            argv[3],
-            argv[4],
-            XField,
-            YField,
-            Nodata );
+    if (QString(argv[3]).contains(";"))
+        eResult = RasterManager::Raster::ExtractPointsMulti(
+                    argv[2],
+                argv[3],
+                argv[4],
+                XField,
+                YField,
+                Nodata,
+                bBilinear );
+    else
+        eResult = RasterManager::Raster::ExtractPoints(
+                    argv[2],
+                argv[3],
+                argv[4],
+                XField,
+                YField,
+                Nodata,
+                bBilinear );
 
     return eResult;
 }
@@ -1010,7 +1650,7 @@ int RasterManEngine::normalize(int argc, char * argv[])
         std::cout << "\n  output_raster_path: Absolute full path to desired output raster file.";
         std::cout << "\n\n";
 
-        return PROCESS_OK;
+        return Usage();
     }
     int eResult = PROCESS_OK;
     eResult = RasterManager::Raster::NormalizeRaster(
@@ -1038,7 +1678,7 @@ int RasterManEngine::dist(int argc, char * argv[])
         std::cout << "\n                      NOTE: non-square cells will produce non-exact distances";
         std::cout << "\n\n";
 
-        return PROCESS_OK;
+        return Usage();
     }
     int eResult = PROCESS_OK;
 
@@ -1057,7 +1697,7 @@ int RasterManEngine::VectorToRaster(int argc, char * argv[])
     if (argc < 5)
     {
         std::cout << "\n Convert a Vector file into a raster.";
-        std::cout << "\n    Usage: rasterman vector2raster <vector_file_path> <output_raster_path> <vector_field> [<cell_size> | <raster_template_path>]";
+        std::cout << "\n    Usage: rasterman vector2raster <vector_file_path> <output_raster_path> <vector_field> [<cell_size> | <raster_template_path>] [<mode>]";
         std::cout << "\n ";
         std::cout << "\n Arguments:";
         std::cout << "\n       vector_file_path: Absolute full path to existing .shp file.";
@@ -1067,11 +1707,23 @@ int RasterManEngine::VectorToRaster(int argc, char * argv[])
         std::cout << "\n      cell_size: Cell size for the output raster.";
         std::cout << "\n          OR";
         std::cout << "\n    raster_template_path: Path to template raster file. File will be used for extents, cell size etc.";
+        std::cout << "\n";
+        std::cout << "\n    mode: (optional) How cells are burned. center (default) burns cells whose centre is inside,";
+        std::cout << "\n          alltouched burns every cell a geometry touches, coverage writes the exact fraction";
+        std::cout << "\n          of each cell covered by the union of the polygons and coveragemean the coverage weighted field value.";
         std::cout << "\n\n";
-        return PROCESS_OK;
+        return Usage();
     }
     int eResult = PROCESS_OK;
 
+    Raster_Rasterize_Mode eMode = RASTERIZE_CENTER;
+    if (argc > 6){
+        int nMode = GetRasterizeModeFromString(argv[6]);
+        if (nMode < 0)
+            throw RasterManagerException(ARGUMENT_VALIDATION, QString("Unknown rasterize mode: %1").arg(argv[6]));
+        eMode = (Raster_Rasterize_Mode) nMode;
+    }
+
     // Either the last parameter is a double which indicates we are being given cell size.
     QString sArg2 = argv[5];
 
@@ -1082,7 +1734,8 @@ int RasterManEngine::VectorToRaster(int argc, char * argv[])
         eResult = RasterManager::Raster::VectortoRaster( argv[2],    // sVectorSourcePath
                 argv[3],    // sRasterOutputPath
                 dCellSize,  // dCellWidth
-                argv[4]     // FieldName
+                argv[4],    // FieldName
+                eMode
                 );
     }
     // Or we are using a template raster for the bounds
@@ -1090,7 +1743,8 @@ int RasterManEngine::VectorToRaster(int argc, char * argv[])
         eResult = RasterManager::Raster::VectortoRaster( argv[2],  // sVectorSourcePath
                 argv[3],  // sRasterOutputPath
                 argv[5],  // sRasterTemplate
-                argv[4]   // FieldNAme
+                argv[4],  // FieldNAme
+                eMode
                 );
     }
 
@@ -1109,20 +1763,20 @@ int RasterManEngine::Stats(int argc, char * argv[])
         std::cout << "\n Arguments:";
         std::cout << "\n    operation:";
         std::cout << "\n              mean: Mean (average) of the inputs";
-//        std::cout << "\n          majority: Value that occurs most often";
+        std::cout << "\n          majority: Value that occurs most often";
         std::cout << "\n           maximum: determines the largest value";
-//        std::cout << "\n            median: Median of inputs";
+        std::cout << "\n            median: Median of inputs";
         std::cout << "\n           minimum: Smallest non-nodata vlaue of hte inputs";
-//        std::cout << "\n          minority: Value that occurs the most often";
+        std::cout << "\n          minority: Value that occurs the least often";
         std::cout << "\n             range: distance between max and min";
         std::cout << "\n               std: Calculates the standard deviation of the inpluts";
-//        std::cout << "\n               sum: Total of all values";
-//        std::cout << "\n             count: number of cells with values.";
-//        std::cout << "\n           variety: Number of unique Values";
+        std::cout << "\n               sum: Total of all values";
+        std::cout << "\n             count: number of cells with values.";
+        std::cout << "\n           variety: Number of unique Values";
         std::cout << "\n                                                     ";
         std::cout << "\n    raster: Absolute full path to an existing raster.";
         std::cout << "\n";
-        return PROCESS_OK;
+        return Usage();
     }
 
     RasterManager::Raster rRaster(argv[3]);
@@ -1137,6 +1791,34 @@ int RasterManEngine::Stats(int argc, char * argv[])
 }
 
 
+int RasterManEngine::ZonalStats(int argc, char * argv[])
+{
+    if (argc != 5 && argc != 6)
+    {
+        std::cout << "\n Zonal Statistics:";
+        std::cout << "\n    Usage: rasterman zonalstats <raster> <zones> <output> [percentiles]";
+        std::cout << "\n";
+        std::cout << "\n Arguments:";
+        std::cout << "\n         raster: Absolute full path to the raster to summarize.";
+        std::cout << "\n          zones: Raster of integer zones (same size as raster) or a polygon";
+        std::cout << "\n                 layer. Each polygon is a zone identified by its FID. Where";
+        std::cout << "\n                 polygons overlap, the cell goes to the last one in the layer.";
+        std::cout << "\n         output: Absolute full path to an output csv. Use the path of the polygon";
+        std::cout << "\n                 layer itself to append the statistics as attributes instead.";
+        std::cout << "\n    percentiles: (optional) comma separated list of percentiles. e.g. 10,50,90";
+        std::cout << "\n";
+        std::cout << "\n    Every zone gets count, sum, mean, min, max and std (plus any percentiles).";
+        std::cout << "\n";
+        return Usage();
+    }
+
+    const char * psPercentiles = NULL;
+    if (argc == 6)
+        psPercentiles = argv[5];
+
+    return RasterManager::Raster::ZonalStats(argv[2], argv[3], argv[4], psPercentiles);
+}
+
 int RasterManEngine::CompareRef(int argc, char * argv[])
 {
 
@@ -1154,21 +1836,31 @@ int RasterManEngine::CompareRef(int argc, char * argv[])
 
 int RasterManEngine::Compare(int argc, char * argv[])
 {
-    if (argc != 4)
+    if (argc < 4 || argc > 6)
     {
         std::cout << "\n Raster Compare: check rasters for orthogonality, divisibility, concurrency.";
-        std::cout << "\n    Usage: rasterman compare <raster1> <raster2>";
+        std::cout << "\n    Usage: rasterman compare <raster1> <raster2> [<tolerance>] [<diff_raster>]";
         std::cout << "\n";
         std::cout << "\n Arguments:";
         std::cout << "\n    operation:";
         std::cout << "\n              raster1: Path to first raster";
         std::cout << "\n              raster2: Path to second raster";
+        std::cout << "\n            tolerance: (optional) Largest difference still counted as equal. Default is a fuzzy compare.";
+        std::cout << "\n          diff_raster: (optional) Path for a raster1 - raster2 difference raster";
         std::cout << "\n";
-        return PROCESS_OK;
+        return Usage();
     }
 
-    RasterManager::RasterArray raRaster1(argv[2]);
-    RasterManager::RasterArray raRaster2(argv[3]);
+    double fTolerance = 0;
+    if (argc > 4)
+        fTolerance = GetDouble(argc, argv, 4);
+    const char * psDiffRaster = NULL;
+    if (argc > 5)
+        psDiffRaster = argv[5];
+
+    // Only the metadata gets loaded. The cells are streamed by CompareRasters.
+    RasterManager::RasterMeta rmRaster1(argv[2]);
+    RasterManager::RasterMeta rmRaster2(argv[3]);
 
     const QString sFalse = "False";
     const QString sTrue = "True";
@@ -1179,15 +1871,17 @@ int RasterManEngine::Compare(int argc, char * argv[])
     QString sConcurrent = sFalse;
     QString sCellCompare = "Cells are not the same";
 
-    if (raRaster1.IsDivisible())
+    if (rmRaster1.IsDivisible())
         sDivisible1 = sTrue;
-    if (raRaster2.IsDivisible())
+    if (rmRaster2.IsDivisible())
         sDivisible2 = sTrue;
-    if (raRaster1.IsOrthogonal(&raRaster2))
+    if (rmRaster1.IsOrthogonal(&rmRaster2))
         sOrthogonal = sTrue;
-    if (raRaster1.IsConcurrent(&raRaster2))
+    if (rmRaster1.IsConcurrent(&rmRaster2))
         sConcurrent = sTrue;
-    if (raRaster1.CellCompare(&raRaster2))
+
+    RasterManager::RasterDiffReport report;
+    if (RasterManager::Raster::CompareRasters(argv[2], argv[3], fTolerance, psDiffRaster, true, &report) == PROCESS_OK)
         sCellCompare = "Cells are the same";
 
     RasterManager::printLine( QString(" Raster: %1").arg(argv[2]));
@@ -1200,6 +1894,13 @@ int RasterManEngine::Compare(int argc, char * argv[])
     RasterManager::printLine( QString("             Orthogonal: %1").arg(sOrthogonal));
     RasterManager::printLine( QString("             Concurrent: %1").arg(sConcurrent));
     RasterManager::printLine( QString("            CellCompare: %1").arg(sCellCompare));
+    if (report.bConcurrent){
+        RasterManager::printLine( QString("         Cells Compared: %1").arg(report.nCellsCompared));
+        RasterManager::printLine( QString("        Differing Cells: %1").arg(report.nDiffCells));
+        RasterManager::printLine( QString("           Max Abs Diff: %1").arg(report.fMaxAbsDiff));
+        if (report.nDiffCells > 0)
+            RasterManager::printLine( QString("   First Diff (row,col): %1,%2").arg(report.nFirstDiffRow).arg(report.nFirstDiffCol));
+    }
 
     return PROCESS_OK;
 }
@@ -1225,7 +1926,7 @@ int RasterManEngine::LinThresh(int argc, char * argv[])
         std::cout << "\n            - Set min_thresh = max_thresh to get a straight dropoff";
         std::cout << "\n            - min_thresh must be less than or equal to max_thresh";
         std::cout << "\n";
-        return PROCESS_OK;
+        return Usage();
     }
 
     double dMinThresh = GetDouble(argc, argv, 4);
@@ -1261,7 +1962,7 @@ int RasterManEngine::GutPoly(int argc, char * argv[]){
         std::cout << "\n        Note: This interface is EXPERIMENTAL and used for testing only.";
         std::cout << "\n              what could possibleye go wrong?";
         std::cout << "\n ";
-        return PROCESS_OK;
+        return Usage();
     }
 
     int eResult = Raster2Polygon::AddGut(argv[2], argv[3], argv[4], argv[5]);
@@ -1283,7 +1984,7 @@ int RasterManEngine::AreaThresh(int argc, char * argv[])
         std::cout << "\n    raster_output_path: Path to the desired output raster file.";
         std::cout << "\n           area_thresh: Area below which a feature will be excluded.";
         std::cout << "\n ";
-        return PROCESS_OK;
+        return Usage();
     }
 
     double dAreaThresh = GetDouble(argc, argv, 4);
@@ -1310,7 +2011,7 @@ int RasterManEngine::SmoothEdges(int argc, char * argv[])
         std::cout << "\n    raster_output_path: Path to the desired output raster file.";
         std::cout << "\n                 cells: Number of cells (pixels) to remove and then add back.";
         std::cout << "\n ";
-        return PROCESS_OK;
+        return Usage();
     }
 
     int nCells = GetInteger(argc, argv, 4);
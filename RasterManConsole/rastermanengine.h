@@ -14,6 +14,18 @@ public:
 
 private:
 
+    // Set while a batch runs. GDAL stays registered and unknown commands are errors.
+    bool m_bInBatch;
+    // How many batch commands can run at once
+    int m_nBatchJobs;
+
+    /**
+     * @brief Usage Ends every usage block. Outside a batch it's PROCESS_OK. In a batch
+     *        nobody reads the usage so the wrong arguments are an ARGUMENT_VALIDATION error.
+     * @return
+     */
+    int Usage();
+
     /**
      * @brief CheckRasterManVersion
      */
@@ -59,6 +71,22 @@ private:
 
     int BiLinearResample(int argc, char * argv[]);
 
+    /**
+     * @brief Overviews
+     * @param argc
+     * @param argv
+     * @return
+     */
+    int Overviews(int argc, char * argv[]);
+
+    /**
+     * @brief Resample
+     * @param argc
+     * @param argv
+     * @return
+     */
+    int Resample(int argc, char * argv[]);
+
     /**
      * @brief Uniform
      * @param argc
@@ -116,6 +144,27 @@ private:
      */
     int PNG(int argc, char *argv[]);
 
+    /**
+     * @brief PNGBatch Render every PNG in a manifest in one go
+     * @param argc
+     * @param argv
+     */
+    int PNGBatch(int argc, char *argv[]);
+
+    /**
+     * @brief PNGTiles Render a raster as a web map tile pyramid
+     * @param argc
+     * @param argv
+     */
+    int PNGTiles(int argc, char *argv[]);
+
+    /**
+     * @brief Batch Run a script or NDJSON stream of commands in this one process
+     * @param argc
+     * @param argv
+     */
+    int Batch(int argc, char *argv[]);
+
     /**
      * @brief GetInteger
      * @param argc
@@ -214,6 +263,14 @@ private:
      */
     int Stats(int argc, char *argv[]);
 
+    /**
+     * @brief ZonalStats
+     * @param argc
+     * @param argv
+     * @return
+     */
+    int ZonalStats(int argc, char *argv[]);
+
     /**
      * @brief LinThresh
      * @param argc
@@ -293,6 +350,14 @@ private:
      */
     int Histogram(int argc, char *argv[]);
 
+    /**
+     * @brief Budget
+     * @param argc
+     * @param argv
+     * @return
+     */
+    int Budget(int argc, char *argv[]);
+
 };
 
 }
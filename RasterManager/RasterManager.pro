@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core
+QT       += core concurrent
 QT       -= gui widgets
 
 VERSION = 6.4.0
@@ -39,6 +39,8 @@ SOURCES += \
     raster_pitremove.cpp \
     raster_eucliddist.cpp \
     raster_stats.cpp \
+    raster_zonalstats.cpp \
+    raster_compare.cpp \
     raster_linthresh.cpp \
     rasterarray.cpp \
     raster_combine.cpp \
@@ -47,7 +49,8 @@ SOURCES += \
     raster_gutpolygon.cpp \
     raster_vector2raster.cpp \
     raster_setnull.cpp \
-    histogramsclass.cpp
+    histogramsclass.cpp \
+    rasterstream.cpp
 
 HEADERS +=\
     rastermanager_global.h \
@@ -62,7 +65,8 @@ HEADERS +=\
     benchmark.h \
     rasterarray.h \
     raster_gutpolygon.h \
-    histogramsclass.h
+    histogramsclass.h \
+    rasterstream.h
 
 CONFIG(release, debug|release): BUILD_TYPE = release
 else:CONFIG(debug, debug|release): BUILD_TYPE = debug
@@ -2,6 +2,17 @@
 
 #include "dodraster.h"
 #include "gdal_priv.h"
+#include "rastermanager_interface.h"
+#include "rastermanager_exception.h"
+#include <algorithm>
+#include <cstring>
+#include <QThread>
+#include <QtConcurrent>
+#include <QHash>
+#include <QMap>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
 
 namespace RasterManager {
 
@@ -156,253 +167,598 @@ void DoDRaster::GetChangeStats(Raster & pPropagatedError, double & fVolErosion,
 
 }
 
-} // Namespace
+/*******************************************************************************************************
+ * DoD Budget Engine
+ */
 
-extern "C" RM_DLL_API void GetDoDMinLoDStats(const char * ppszRawDoD, double fThreshold,
-                                                     double * fAreaErosionRaw, double * fAreaDepositonRaw,
-                                                     double * fAreaErosionThr, double * fAreaDepositionThr,
-                                                     double * fVolErosionRaw, double * fVolDepositionRaw,
-                                                     double * fVolErosionThr, double * fVolDepositionThr,
-                                                     double * fVolErosionErr, double * fVolDepositonErr)
+enum DoDBudgetType {
+    BUDGET_MINLOD,
+    BUDGET_PROPAGATED,
+    BUDGET_PROBABILISTIC,
+};
+
+/* Compensated running sum so adding millions of small cell values doesn't drift */
+struct KahanSum
 {
-    // Set the output values to zero
-    *fAreaErosionRaw = 0;
-    *fAreaDepositonRaw = 0,
-    *fAreaErosionThr = 0;
-    *fAreaDepositionThr = 0;
-    *fVolErosionRaw = 0;
-    *fVolDepositionRaw = 0;
-    *fVolErosionThr = 0;
-    *fVolDepositionThr = 0;
-    *fVolErosionErr = 0;
-    *fVolDepositonErr = 0;
-
-    long nRawErosionCount = 0;
-    long nRawDepositionCount = 0;
-    long nThrErosionCount = 0;
-    long nThrDepositionCount = 0;
-
-
-    GDALDataset * ds = (GDALDataset*) GDALOpen(ppszRawDoD, GA_ReadOnly);
-    if (ds == NULL)
-        return;
+    double fSum;
+    double fComp;
 
-    GDALRasterBand * pRB = ds->GetRasterBand(1);
-    double GetCols = pRB->GetXSize();
-    double GetRows = pRB->GetYSize();
+    KahanSum() : fSum(0), fComp(0) {}
 
-    // Get the dataset cell size;
-    double transform[6];
-    ds->GetGeoTransform(transform);
-    //double cellHeight = transform[5];
-    double cellWidth = transform[1];
-    double cellArea = cellWidth * cellWidth; //sqrt(pow(cellWidth, 2) + pow(cellHeight, 2));
+    inline void Add(double fValue){
+        double y = fValue - fComp;
+        double t = fSum + y;
+        fComp = (t - fSum) - y;
+        fSum = t;
+    }
 
-    int nSuccess;
-    double fNoData = pRB->GetNoDataValue(&nSuccess);
+    void Merge(const KahanSum & other){
+        Add(other.fSum);
+        Add(-other.fComp);
+    }
+};
 
-    int i, j;
-    double *pafScanline;
-    pafScanline = (double *) CPLMalloc(sizeof(double)*GetCols);
-    double fDoDValue = 0;
+struct BudgetSums
+{
+    long long nRawErosion;
+    long long nRawDeposition;
+    long long nThrErosion;
+    long long nThrDeposition;
+    KahanSum fRawErosion;
+    KahanSum fRawDeposition;
+    KahanSum fThrErosion;
+    KahanSum fThrDeposition;
+    KahanSum fErrErosion;
+    KahanSum fErrDeposition;
+
+    BudgetSums() : nRawErosion(0), nRawDeposition(0), nThrErosion(0), nThrDeposition(0) {}
+
+    void Merge(const BudgetSums & other){
+        nRawErosion += other.nRawErosion;
+        nRawDeposition += other.nRawDeposition;
+        nThrErosion += other.nThrErosion;
+        nThrDeposition += other.nThrDeposition;
+        fRawErosion.Merge(other.fRawErosion);
+        fRawDeposition.Merge(other.fRawDeposition);
+        fThrErosion.Merge(other.fThrErosion);
+        fThrDeposition.Merge(other.fThrDeposition);
+        fErrErosion.Merge(other.fErrErosion);
+        fErrDeposition.Merge(other.fErrDeposition);
+    }
+};
 
-    for (i = 0; i < GetRows; i++)
-    {
-        pRB->RasterIO(GF_Read, 0, i, GetCols, 1, pafScanline, GetCols, 1, GDT_Float64, 0, 0);
+/*
+ * One worker's rows. Every worker opens its own handles since GDAL datasets can't be
+ * shared across threads. Zones get a slot the first time the worker sees them and the
+ * sums are kept per budget, per slot.
+ */
+struct DoDBudgetPartial
+{
+    int nFirstRow;
+    int nLastRow;
+    QHash<int, int> hZoneSlots;
+    std::vector<int> vSlotZones;
+    std::vector< std::vector<BudgetSums> > vSums;
+    int nErrorCode;
+    QString sError;
+};
+
+struct BudgetInput
+{
+    GDALDataset * pDS;
+    GDALRasterBand * pRB;
+    bool bHasNoData;
+    double fNoData;
+    double * pData;
+};
+
+static void OpenBudgetInput(const std::string & sPath, int nCells, BudgetInput & input){
+    input.pData = NULL;
+    input.pDS = (GDALDataset*) GDALOpen(sPath.c_str(), GA_ReadOnly);
+    if (input.pDS == NULL)
+        throw RasterManagerException(INPUT_FILE_ERROR, CPLGetLastErrorMsg());
+    input.pRB = input.pDS->GetRasterBand(1);
+    int bHasNoData = FALSE;
+    input.fNoData = input.pRB->GetNoDataValue(&bHasNoData);
+    input.bHasNoData = bHasNoData == TRUE;
+    input.pData = (double *) CPLMalloc(sizeof(double) * nCells);
+}
 
-        for (j = 0; j < GetCols; j++)
-        {
-            fDoDValue = pafScanline[j];
-            if (fDoDValue != fNoData)
-            {
-                // Deposition
-                if (fDoDValue > 0)
-                {
-                    // Raw Deposition
-                    *fVolDepositionRaw += fDoDValue ;
-                    nRawDepositionCount += 1;
+static void CloseBudgetInput(BudgetInput & input){
+    if (input.pData != NULL)
+        CPLFree(input.pData);
+    if (input.pDS != NULL)
+        GDALClose(input.pDS);
+}
 
-                    if (fDoDValue > fThreshold)
-                    {
-                        // Thresholded Deposition
-                        *fVolDepositionThr += fDoDValue;
-                        nThrDepositionCount += 1;
-                    }
-                }
+static inline bool BudgetValid(const BudgetInput & input, double fValue){
+    return !(input.bHasNoData && fValue == input.fNoData);
+}
 
-                // Erosion
-                if (fDoDValue < 0)
-                {
-                    // Raw Erosion
-                    *fVolErosionRaw += fDoDValue * -1;
-                    nRawErosionCount += 1;
+/* Turn accumulated cell sums into areas and volumes */
+static DoDBudget MakeBudget(const BudgetSums & sums, int eType, double fThreshold, double cellArea){
 
-                    if (fDoDValue < (fThreshold * -1))
-                    {
-                        // Thresholded Erosion
-                        *fVolErosionThr += fDoDValue * -1;
-                        nThrErosionCount += 1;
-                    }
-                }
-            }
-        }
-    }
+    DoDBudget budget;
 
     // Areas are the count of cells multipled by the area of one cell
-    *fAreaErosionRaw = nRawErosionCount * cellArea;
-    *fAreaDepositonRaw  = nRawDepositionCount * cellArea;
-    *fAreaErosionThr = nThrErosionCount * cellArea;
-    *fAreaDepositionThr = nThrDepositionCount * cellArea;
+    budget.fAreaErosionRaw = sums.nRawErosion * cellArea;
+    budget.fAreaDepositionRaw = sums.nRawDeposition * cellArea;
+    budget.fAreaErosionThr = sums.nThrErosion * cellArea;
+    budget.fAreaDepositionThr = sums.nThrDeposition * cellArea;
 
     // Volumes are the accumulated change multiplied by the area of one cell
-   *fVolErosionRaw = *fVolErosionRaw * cellArea;
-   *fVolDepositionRaw = *fVolDepositionRaw * cellArea;
-   *fVolErosionThr = *fVolErosionThr * cellArea;
-   *fVolDepositionThr = *fVolDepositionThr * cellArea;
+    budget.fVolErosionRaw = sums.fRawErosion.fSum * cellArea;
+    budget.fVolDepositionRaw = sums.fRawDeposition.fSum * cellArea;
+    budget.fVolErosionThr = sums.fThrErosion.fSum * cellArea;
+    budget.fVolDepositionThr = sums.fThrDeposition.fSum * cellArea;
+
+    if (eType == BUDGET_MINLOD){
+        // Error volumes are the area of change multipled by the Threshold
+        budget.fVolErosionErr = budget.fAreaErosionThr * fThreshold;
+        budget.fVolDepositionErr = budget.fAreaDepositionThr * fThreshold;
+    }
+    else {
+        budget.fVolErosionErr = sums.fErrErosion.fSum * cellArea;
+        budget.fVolDepositionErr = sums.fErrDeposition.fSum * cellArea;
+    }
+    return budget;
+}
 
-    // Error volumes are the area of change multipled by the Threshold
-    *fVolErosionErr = *fAreaErosionThr * fThreshold;
-    *fVolDepositonErr = *fAreaDepositionThr * fThreshold;
+DoDBudgetEngine::DoDBudgetEngine(const char * psRawDoD)
+{
+    m_sRawDoD = std::string(psRawDoD);
+    m_nZoneRaster = -1;
+    m_nCols = 0;
+    m_nStripRows = 1;
+}
 
-    CPLFree(pafScanline);
+int DoDBudgetEngine::AddRaster(const char * psPath)
+{
+    std::string sPath(psPath);
+    for (size_t r = 0; r < m_vRasters.size(); r++){
+        if (m_vRasters[r] == sPath)
+            return (int) r;
+    }
+    m_vRasters.push_back(sPath);
+    return (int) m_vRasters.size() - 1;
+}
 
-    GDALClose(ds);
+int DoDBudgetEngine::AddMinLoD(double fThreshold)
+{
+    BudgetSpec spec;
+    spec.eType = BUDGET_MINLOD;
+    spec.fThreshold = fThreshold;
+    spec.nThrRaster = -1;
+    spec.nErrRaster = -1;
+    spec.sLabel = QString("MinLoD %1").arg(fThreshold);
+    m_vSpecs.push_back(spec);
+    return (int) m_vSpecs.size() - 1;
+}
 
+int DoDBudgetEngine::AddPropagatedError(const char * psPropError)
+{
+    BudgetSpec spec;
+    spec.eType = BUDGET_PROPAGATED;
+    spec.fThreshold = 0;
+    spec.nThrRaster = -1;
+    spec.nErrRaster = AddRaster(psPropError);
+    spec.sLabel = QFileInfo(psPropError).fileName();
+    m_vSpecs.push_back(spec);
+    return (int) m_vSpecs.size() - 1;
 }
 
-extern "C" RM_DLL_API void GetDoDPropStats(const char * ppszRawDoD, const char * ppszPropError,
-                                                     double * fAreaErosionRaw, double * fAreaDepositonRaw,
-                                                     double * fAreaErosionThr, double * fAreaDepositionThr,
-                                                     double * fVolErosionRaw, double * fVolDepositionRaw,
-                                                     double * fVolErosionThr, double * fVolDepositionThr,
-                                                     double * fVolErosionErr, double * fVolDepositonErr)
+int DoDBudgetEngine::AddProbabilistic(const char * psThrDoD, const char * psPropError)
 {
-    // Set the output values to zero
-    *fAreaErosionRaw = 0;
-    *fAreaDepositonRaw = 0,
-    *fAreaErosionThr = 0;
-    *fAreaDepositionThr = 0;
-    *fVolErosionRaw = 0;
-    *fVolDepositionRaw = 0;
-    *fVolErosionThr = 0;
-    *fVolDepositionThr = 0;
-    *fVolErosionErr = 0;
-    *fVolDepositonErr = 0;
-
-    long nRawErosionCount = 0;
-    long nRawDepositionCount = 0;
-    long nThrErosionCount = 0;
-    long nThrDepositionCount = 0;
-
-    // Open the raw DoD raster and determine it's size.
-    GDALDataset * dsDod = (GDALDataset*) GDALOpen(ppszRawDoD, GA_ReadOnly);
-    if (dsDod == NULL)
-        return;
-    GDALRasterBand * pRBDoD = dsDod->GetRasterBand(1);
-    double GetCols = pRBDoD->GetXSize();
-    double GetRows = pRBDoD->GetYSize();
-    // Get the dataset cell size;
-    double transform[6];
-    dsDod->GetGeoTransform(transform);
-    //double cellHeight = transform[5];
-    double cellWidth = transform[1];
-    double cellArea = cellWidth * cellWidth;
+    BudgetSpec spec;
+    spec.eType = BUDGET_PROBABILISTIC;
+    spec.fThreshold = 0;
+    spec.nThrRaster = AddRaster(psThrDoD);
+    spec.nErrRaster = AddRaster(psPropError);
+    spec.sLabel = QFileInfo(psThrDoD).fileName();
+    m_vSpecs.push_back(spec);
+    return (int) m_vSpecs.size() - 1;
+}
 
-    // Open the propagated Error Raster and make sure the size matches the DoD
-    GDALDataset * dsErr = (GDALDataset*) GDALOpen(ppszPropError, GA_ReadOnly);
-    if (dsErr == NULL)
-        return;
+void DoDBudgetEngine::SetZones(const char * psZoneRaster)
+{
+    m_nZoneRaster = AddRaster(psZoneRaster);
+}
 
-    GDALRasterBand * pRBErr = dsErr->GetRasterBand(1);
-    double GetColsErr = pRBErr->GetXSize();
-    double GetRowsErr = pRBErr->GetYSize();
+void DoDBudgetEngine::CalculatePartial(DoDBudgetPartial * pPartial) const
+{
+    std::vector<BudgetInput> vInputs(m_vRasters.size() + 1);
+    for (size_t r = 0; r < vInputs.size(); r++){
+        vInputs[r].pDS = NULL;
+        vInputs[r].pData = NULL;
+    }
 
-    if ((GetCols != GetColsErr) || (GetRows != GetRowsErr))
-        return;
+    int nStripCells = m_nCols * m_nStripRows;
+    std::vector<int> vSlots(nStripCells, 0);
 
-    int nSuccess;
-    double fNoDataDoD = pRBDoD->GetNoDataValue(&nSuccess);
-    double fNoDataErr = pRBErr->GetNoDataValue(&nSuccess);
+    pPartial->nErrorCode = PROCESS_OK;
+    pPartial->vSums.assign(m_vSpecs.size(), std::vector<BudgetSums>());
 
-    int i, j;
-    double * pafScanlineDoD = (double *) CPLMalloc(sizeof(double)*GetCols);
-    double * pafScanlineErr = (double *) CPLMalloc(sizeof(double)*GetColsErr);
+    // Without zones everything goes in the one slot
+    if (m_nZoneRaster < 0){
+        pPartial->vSlotZones.push_back(0);
+        for (size_t b = 0; b < m_vSpecs.size(); b++)
+            pPartial->vSums[b].resize(1);
+    }
 
-    double fDoDValue = 0;
-    double fPropErr = 0;
+    try {
+        OpenBudgetInput(m_sRawDoD, nStripCells, vInputs[0]);
+        for (size_t r = 0; r < m_vRasters.size(); r++)
+            OpenBudgetInput(m_vRasters[r], nStripCells, vInputs[r + 1]);
 
-    for (i = 0; i < GetRows; i++)
-    {
-        pRBDoD->RasterIO(GF_Read, 0, i, GetCols, 1, pafScanlineDoD, GetCols, 1, GDT_Float64, 0, 0);
-        pRBErr->RasterIO(GF_Read, 0, i, GetCols, 1, pafScanlineErr, GetCols, 1, GDT_Float64, 0, 0);
+        const BudgetInput & dod = vInputs[0];
 
-        for (j = 0; j < GetCols; j++)
-        {
-            fDoDValue = pafScanlineDoD[j];
-            fPropErr = pafScanlineErr[j];
+        for (int nRow = pPartial->nFirstRow; nRow < pPartial->nLastRow; nRow += m_nStripRows){
 
-            if ((fDoDValue != fNoDataDoD) && (fPropErr != fNoDataErr))
-            {
-                // Deposition
-                if (fDoDValue > 0)
-                {
-                    // Raw Deposition
-                    *fVolDepositionRaw += fDoDValue;
-                    nRawDepositionCount += 1;
+            int nRows = std::min(m_nStripRows, pPartial->nLastRow - nRow);
+            int nCells = nRows * m_nCols;
 
-                    if (fDoDValue > fPropErr)
-                    {
-                        // Thresholded Deposition
-                        *fVolDepositionThr += fDoDValue;
-                        *fVolDepositonErr += fPropErr;
-                        nThrDepositionCount += 1;
+            for (size_t r = 0; r < vInputs.size(); r++){
+                CPLErr err = vInputs[r].pRB->RasterIO(GF_Read, 0, nRow, m_nCols, nRows, vInputs[r].pData, m_nCols, nRows, GDT_Float64, 0, 0);
+                if (err == CE_Failure || err == CE_Fatal)
+                    throw RasterManagerException(INPUT_FILE_ERROR, CPLGetLastErrorMsg());
+            }
+
+            // Look up the slot for every cell once so the budgets below just index with it.
+            // Zones come in runs so remembering the last one saves most of the hash lookups.
+            if (m_nZoneRaster >= 0){
+                const BudgetInput & zones = vInputs[m_nZoneRaster + 1];
+                int nLastZone = 0;
+                int nLastSlot = -1;
+                for (int i = 0; i < nCells; i++){
+                    double fZone = zones.pData[i];
+                    if (!BudgetValid(zones, fZone) || CPLIsNan(fZone)){
+                        vSlots[i] = -1;
+                        continue;
                     }
+                    int nZone = (int) fZone;
+                    if (nLastSlot < 0 || nZone != nLastZone){
+                        QHash<int, int>::const_iterator it = pPartial->hZoneSlots.constFind(nZone);
+                        if (it == pPartial->hZoneSlots.constEnd()){
+                            nLastSlot = (int) pPartial->vSlotZones.size();
+                            pPartial->hZoneSlots.insert(nZone, nLastSlot);
+                            pPartial->vSlotZones.push_back(nZone);
+                            for (size_t b = 0; b < m_vSpecs.size(); b++)
+                                pPartial->vSums[b].push_back(BudgetSums());
+                        }
+                        else
+                            nLastSlot = it.value();
+                        nLastZone = nZone;
+                    }
+                    vSlots[i] = nLastSlot;
                 }
+            }
 
-                // Erosion
-                if (fDoDValue < 0)
-                {
-                    // Raw Erosion
-                    *fVolErosionRaw += fDoDValue * -1;
-                    nRawErosionCount += 1;
-
-                    if (fDoDValue < (fPropErr * -1))
-                    {
-                        // Thresholded Erosion
-                        *fVolErosionThr += fDoDValue * -1;
-                        *fVolErosionErr += fPropErr;
-                        nThrErosionCount += 1;
+            // Budgets are the outer loop so each one streams through the strip on its own
+            for (size_t b = 0; b < m_vSpecs.size(); b++){
+                const BudgetSpec & spec = m_vSpecs[b];
+                BudgetSums * pSums = pPartial->vSums[b].empty() ? NULL : &pPartial->vSums[b][0];
+
+                if (spec.eType == BUDGET_MINLOD){
+                    double fThreshold = spec.fThreshold;
+                    for (int i = 0; i < nCells; i++){
+                        double fDoD = dod.pData[i];
+                        if (vSlots[i] < 0 || !BudgetValid(dod, fDoD))
+                            continue;
+                        BudgetSums & sums = pSums[vSlots[i]];
+                        if (fDoD > 0){
+                            sums.fRawDeposition.Add(fDoD);
+                            sums.nRawDeposition++;
+                            if (fDoD > fThreshold){
+                                sums.fThrDeposition.Add(fDoD);
+                                sums.nThrDeposition++;
+                            }
+                        }
+                        else if (fDoD < 0){
+                            sums.fRawErosion.Add(-fDoD);
+                            sums.nRawErosion++;
+                            if (fDoD < -fThreshold){
+                                sums.fThrErosion.Add(-fDoD);
+                                sums.nThrErosion++;
+                            }
+                        }
+                    }
+                }
+                else if (spec.eType == BUDGET_PROPAGATED){
+                    const BudgetInput & err = vInputs[spec.nErrRaster + 1];
+                    for (int i = 0; i < nCells; i++){
+                        double fDoD = dod.pData[i];
+                        double fErr = err.pData[i];
+                        if (vSlots[i] < 0 || !BudgetValid(dod, fDoD) || !BudgetValid(err, fErr))
+                            continue;
+                        BudgetSums & sums = pSums[vSlots[i]];
+                        if (fDoD > 0){
+                            sums.fRawDeposition.Add(fDoD);
+                            sums.nRawDeposition++;
+                            if (fDoD > fErr){
+                                sums.fThrDeposition.Add(fDoD);
+                                sums.fErrDeposition.Add(fErr);
+                                sums.nThrDeposition++;
+                            }
+                        }
+                        else if (fDoD < 0){
+                            sums.fRawErosion.Add(-fDoD);
+                            sums.nRawErosion++;
+                            if (fDoD < -fErr){
+                                sums.fThrErosion.Add(-fDoD);
+                                sums.fErrErosion.Add(fErr);
+                                sums.nThrErosion++;
+                            }
+                        }
+                    }
+                }
+                else {
+                    const BudgetInput & thr = vInputs[spec.nThrRaster + 1];
+                    const BudgetInput & err = vInputs[spec.nErrRaster + 1];
+                    for (int i = 0; i < nCells; i++){
+                        if (vSlots[i] < 0)
+                            continue;
+                        BudgetSums & sums = pSums[vSlots[i]];
+
+                        double fDoD = dod.pData[i];
+                        if (BudgetValid(dod, fDoD)){
+                            if (fDoD > 0){
+                                sums.fRawDeposition.Add(fDoD);
+                                sums.nRawDeposition++;
+                            }
+                            else if (fDoD < 0){
+                                sums.fRawErosion.Add(-fDoD);
+                                sums.nRawErosion++;
+                            }
+                        }
+
+                        double fThr = thr.pData[i];
+                        if (!BudgetValid(thr, fThr))
+                            continue;
+                        // Only positive error values count. See DoDRaster::GetChangeStats
+                        double fErr = err.pData[i];
+                        if (fThr > 0){
+                            sums.fThrDeposition.Add(fThr);
+                            sums.nThrDeposition++;
+                            if (fErr > 0)
+                                sums.fErrDeposition.Add(fErr);
+                        }
+                        else if (fThr < 0){
+                            sums.fThrErosion.Add(-fThr);
+                            sums.nThrErosion++;
+                            if (fErr > 0)
+                                sums.fErrErosion.Add(fErr);
+                        }
                     }
                 }
             }
         }
     }
+    catch (RasterManagerException e){
+        pPartial->nErrorCode = e.GetErrorCode();
+        pPartial->sError = e.GetEvidence();
+    }
 
-    // Areas are the count of cells multipled by the area of one cell
-    *fAreaErosionRaw = nRawErosionCount * cellArea;
-    *fAreaDepositonRaw  = nRawDepositionCount * cellArea;
-    *fAreaErosionThr = nThrErosionCount * cellArea;
-    *fAreaDepositionThr = nThrDepositionCount * cellArea;
+    for (size_t r = 0; r < vInputs.size(); r++)
+        CloseBudgetInput(vInputs[r]);
+}
+
+void DoDBudgetEngine::Calculate()
+{
+    GDALDataset * ds = (GDALDataset*) GDALOpen(m_sRawDoD.c_str(), GA_ReadOnly);
+    if (ds == NULL)
+        throw RasterManagerException(INPUT_FILE_ERROR, CPLGetLastErrorMsg());
+
+    int nCols = ds->GetRasterXSize();
+    int nRows = ds->GetRasterYSize();
+
+    double transform[6];
+    ds->GetGeoTransform(transform);
+    double cellWidth = transform[1];
+    double cellArea = cellWidth * cellWidth;
+
+    int nBlockX, nBlockY;
+    ds->GetRasterBand(1)->GetBlockSize(&nBlockX, &nBlockY);
+    GDALClose(ds);
+
+    // Everything gets read cell for cell against the DoD so the sizes have to line up
+    for (size_t r = 0; r < m_vRasters.size(); r++){
+        GDALDataset * dsOther = (GDALDataset*) GDALOpen(m_vRasters[r].c_str(), GA_ReadOnly);
+        if (dsOther == NULL)
+            throw RasterManagerException(INPUT_FILE_ERROR, CPLGetLastErrorMsg());
+        int nOtherCols = dsOther->GetRasterXSize();
+        int nOtherRows = dsOther->GetRasterYSize();
+        GDALClose(dsOther);
+
+        if (nOtherCols != nCols)
+            throw RasterManagerException(COLS_ERROR, QString("%1 does not have the same number of columns as the DoD").arg(m_vRasters[r].c_str()));
+        if (nOtherRows != nRows)
+            throw RasterManagerException(ROWS_ERROR, QString("%1 does not have the same number of rows as the DoD").arg(m_vRasters[r].c_str()));
+    }
+
+    // Hand out whole strips of block rows, one run per thread
+    m_nCols = nCols;
+    m_nStripRows = std::max(1, std::min(nBlockY, nRows));
+    int nStrips = (nRows + m_nStripRows - 1) / m_nStripRows;
+    int nWorkers = std::max(1, std::min(QThread::idealThreadCount(), nStrips));
+
+    std::vector<DoDBudgetPartial> vPartials(nWorkers);
+    QList< QFuture<void> > futures;
+    for (int w = 0; w < nWorkers; w++){
+        vPartials[w].nFirstRow = std::min(nRows, (int) ((long long) nStrips * w / nWorkers) * m_nStripRows);
+        vPartials[w].nLastRow = std::min(nRows, (int) ((long long) nStrips * (w + 1) / nWorkers) * m_nStripRows);
+        futures.append(QtConcurrent::run(this, &DoDBudgetEngine::CalculatePartial, &vPartials[w]));
+    }
+    for (int w = 0; w < futures.size(); w++)
+        futures[w].waitForFinished();
+
+    for (int w = 0; w < nWorkers; w++){
+        if (vPartials[w].nErrorCode != PROCESS_OK)
+            throw RasterManagerException(vPartials[w].nErrorCode, vPartials[w].sError);
+    }
+
+    // Every worker numbered its zones as it found them so line them up by zone id
+    QMap<int, int> mZones;
+    for (int w = 0; w < nWorkers; w++){
+        for (size_t slot = 0; slot < vPartials[w].vSlotZones.size(); slot++)
+            mZones.insert(vPartials[w].vSlotZones[slot], 0);
+    }
+    m_vZoneIds.clear();
+    for (QMap<int, int>::iterator it = mZones.begin(); it != mZones.end(); ++it){
+        it.value() = (int) m_vZoneIds.size();
+        m_vZoneIds.push_back(it.key());
+    }
+
+    m_vBudgets.resize(m_vSpecs.size());
+    m_vZoneBudgets.assign(m_vSpecs.size(), std::vector<DoDBudget>());
+
+    for (size_t b = 0; b < m_vSpecs.size(); b++){
+
+        std::vector<BudgetSums> vZoneTotals(m_vZoneIds.size());
+        for (int w = 0; w < nWorkers; w++){
+            for (size_t slot = 0; slot < vPartials[w].vSlotZones.size(); slot++)
+                vZoneTotals[mZones.value(vPartials[w].vSlotZones[slot])].Merge(vPartials[w].vSums[b][slot]);
+        }
+
+        BudgetSums total;
+        for (size_t z = 0; z < vZoneTotals.size(); z++){
+            total.Merge(vZoneTotals[z]);
+            if (m_nZoneRaster >= 0)
+                m_vZoneBudgets[b].push_back(MakeBudget(vZoneTotals[z], m_vSpecs[b].eType, m_vSpecs[b].fThreshold, cellArea));
+        }
+        m_vBudgets[b] = MakeBudget(total, m_vSpecs[b].eType, m_vSpecs[b].fThreshold, cellArea);
+    }
+
+    // The single slot we used without zones isn't a real zone
+    if (m_nZoneRaster < 0)
+        m_vZoneIds.clear();
+}
+
+void DoDBudgetEngine::WriteCSV(const char * psCSVPath) const
+{
+    QFile csvFile(psCSVPath);
+    if (!csvFile.open(QFile::WriteOnly|QFile::Truncate))
+        throw RasterManagerException(OUTPUT_FILE_ERROR, QString("Could not open output CSV: %1").arg(psCSVPath));
+
+    QTextStream stream(&csvFile);
+    bool bZones = m_nZoneRaster >= 0;
+
+    stream << "Budget,";
+    if (bZones)
+        stream << "Zone,";
+    stream << "AreaErosionRaw,AreaDepositionRaw,AreaErosionThr,AreaDepositionThr,"
+           << "VolErosionRaw,VolDepositionRaw,VolErosionThr,VolDepositionThr,"
+           << "VolErosionErr,VolDepositionErr" << "\n";
+
+    for (size_t b = 0; b < m_vSpecs.size(); b++){
+        int nLines = bZones ? (int) m_vZoneIds.size() : 1;
+        for (int z = 0; z < nLines; z++){
+            const DoDBudget & budget = bZones ? m_vZoneBudgets[b][z] : m_vBudgets[b];
+            stream << "\"" << m_vSpecs[b].sLabel << "\",";
+            if (bZones)
+                stream << m_vZoneIds[z] << ",";
+            stream << QString("%1,%2,%3,%4,%5,%6,%7,%8,%9,%10")
+                      .arg(budget.fAreaErosionRaw, 0, 'f', 3)
+                      .arg(budget.fAreaDepositionRaw, 0, 'f', 3)
+                      .arg(budget.fAreaErosionThr, 0, 'f', 3)
+                      .arg(budget.fAreaDepositionThr, 0, 'f', 3)
+                      .arg(budget.fVolErosionRaw, 0, 'f', 3)
+                      .arg(budget.fVolDepositionRaw, 0, 'f', 3)
+                      .arg(budget.fVolErosionThr, 0, 'f', 3)
+                      .arg(budget.fVolDepositionThr, 0, 'f', 3)
+                      .arg(budget.fVolErosionErr, 0, 'f', 3)
+                      .arg(budget.fVolDepositionErr, 0, 'f', 3)
+                   << "\n";
+        }
+    }
+    csvFile.close();
+}
 
-     // Volumes are the accumulated change multiplied by the area of one cell
-    *fVolErosionRaw = *fVolErosionRaw * cellArea;
-    *fVolDepositionRaw = *fVolDepositionRaw * cellArea;
-    *fVolErosionThr = *fVolErosionThr * cellArea;
-    *fVolDepositionThr = *fVolDepositionThr * cellArea;
+} // Namespace
 
-    // Error volumes are the area of change multipled by the Threshold
-    *fVolErosionErr = *fVolErosionErr * cellArea;
-    *fVolDepositonErr = *fVolDepositonErr * cellArea;
+/* Copy a budget out to the separate output pointers the original C interface uses */
+static void SetDoDStatsOutputs(const RasterManager::DoDBudget & budget,
+                               double * fAreaErosionRaw, double * fAreaDepositonRaw,
+                               double * fAreaErosionThr, double * fAreaDepositionThr,
+                               double * fVolErosionRaw, double * fVolDepositionRaw,
+                               double * fVolErosionThr, double * fVolDepositionThr,
+                               double * fVolErosionErr, double * fVolDepositonErr)
+{
+    *fAreaErosionRaw = budget.fAreaErosionRaw;
+    *fAreaDepositonRaw = budget.fAreaDepositionRaw;
+    *fAreaErosionThr = budget.fAreaErosionThr;
+    *fAreaDepositionThr = budget.fAreaDepositionThr;
+    *fVolErosionRaw = budget.fVolErosionRaw;
+    *fVolDepositionRaw = budget.fVolDepositionRaw;
+    *fVolErosionThr = budget.fVolErosionThr;
+    *fVolDepositionThr = budget.fVolDepositionThr;
+    *fVolErosionErr = budget.fVolErosionErr;
+    *fVolDepositonErr = budget.fVolDepositionErr;
+}
 
-    CPLFree(pafScanlineDoD);
-    CPLFree(pafScanlineErr);
+static void SetDoDBudgetResults(const RasterManager::DoDBudgetEngine & engine, double * pResults)
+{
+    for (int b = 0; b < engine.GetBudgetCount(); b++){
+        double * pOut = pResults + (b * 10);
+        SetDoDStatsOutputs(engine.GetBudget(b), &pOut[0], &pOut[1], &pOut[2], &pOut[3], &pOut[4],
+                           &pOut[5], &pOut[6], &pOut[7], &pOut[8], &pOut[9]);
+    }
+}
 
-    GDALClose(dsDod);
-    GDALClose(dsErr);
+extern "C" RM_DLL_API int GetDoDMinLoDStats(const char * ppszRawDoD, double fThreshold,
+                                                     double * fAreaErosionRaw, double * fAreaDepositonRaw,
+                                                     double * fAreaErosionThr, double * fAreaDepositionThr,
+                                                     double * fVolErosionRaw, double * fVolDepositionRaw,
+                                                     double * fVolErosionThr, double * fVolDepositionThr,
+                                                     double * fVolErosionErr, double * fVolDepositonErr)
+{
+    // Set the output values to zero
+    RasterManager::DoDBudget zero = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    SetDoDStatsOutputs(zero, fAreaErosionRaw, fAreaDepositonRaw, fAreaErosionThr, fAreaDepositionThr,
+                       fVolErosionRaw, fVolDepositionRaw, fVolErosionThr, fVolDepositionThr,
+                       fVolErosionErr, fVolDepositonErr);
+    try {
+        RasterManager::DoDBudgetEngine engine(ppszRawDoD);
+        engine.AddMinLoD(fThreshold);
+        engine.Calculate();
+        SetDoDStatsOutputs(engine.GetBudget(0), fAreaErosionRaw, fAreaDepositonRaw, fAreaErosionThr, fAreaDepositionThr,
+                           fVolErosionRaw, fVolDepositionRaw, fVolErosionThr, fVolDepositionThr,
+                           fVolErosionErr, fVolDepositonErr);
+        return RasterManager::PROCESS_OK;
+    }
+    catch (RasterManager::RasterManagerException e){
+        // The outputs stay at zero. The code is the first error any of the engine's workers hit.
+        return e.GetErrorCode();
+    }
+}
 
+extern "C" RM_DLL_API int GetDoDPropStats(const char * ppszRawDoD, const char * ppszPropError,
+                                                     double * fAreaErosionRaw, double * fAreaDepositonRaw,
+                                                     double * fAreaErosionThr, double * fAreaDepositionThr,
+                                                     double * fVolErosionRaw, double * fVolDepositionRaw,
+                                                     double * fVolErosionThr, double * fVolDepositionThr,
+                                                     double * fVolErosionErr, double * fVolDepositonErr)
+{
+    // Set the output values to zero
+    RasterManager::DoDBudget zero = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    SetDoDStatsOutputs(zero, fAreaErosionRaw, fAreaDepositonRaw, fAreaErosionThr, fAreaDepositionThr,
+                       fVolErosionRaw, fVolDepositionRaw, fVolErosionThr, fVolDepositionThr,
+                       fVolErosionErr, fVolDepositonErr);
+    try {
+        RasterManager::DoDBudgetEngine engine(ppszRawDoD);
+        engine.AddPropagatedError(ppszPropError);
+        engine.Calculate();
+        SetDoDStatsOutputs(engine.GetBudget(0), fAreaErosionRaw, fAreaDepositonRaw, fAreaErosionThr, fAreaDepositionThr,
+                           fVolErosionRaw, fVolDepositionRaw, fVolErosionThr, fVolDepositionThr,
+                           fVolErosionErr, fVolDepositonErr);
+        return RasterManager::PROCESS_OK;
+    }
+    catch (RasterManager::RasterManagerException e){
+        // The outputs stay at zero. The code is the first error any of the engine's workers hit.
+        return e.GetErrorCode();
+    }
 }
 
-extern "C" RM_DLL_API void GetDoDProbStats(const char * ppszRawDoD, const char * ppszThrDod,
+extern "C" RM_DLL_API int GetDoDProbStats(const char * ppszRawDoD, const char * ppszThrDod,
                                                       const char * ppszPropError,
                                                       double * fAreaErosionRaw, double * fAreaDepositonRaw,
                                                       double * fAreaErosionThr, double * fAreaDepositionThr,
@@ -410,16 +766,83 @@ extern "C" RM_DLL_API void GetDoDProbStats(const char * ppszRawDoD, const char *
                                                       double * fVolErosionThr, double * fVolDepositionThr,
                                                       double * fVolErosionErr, double * fVolDepositonErr)
 {
-    // Get the area and volumes from the raw DoD
-   RasterManager::DoDRaster raw(ppszRawDoD);
-   raw.GetChangeStats(*fAreaErosionRaw, *fAreaDepositonRaw, *fVolErosionRaw, *fVolDepositionRaw);
-
-   // Get the area and volumes from the thresholded DoD
-   RasterManager::DoDRaster thr(ppszThrDod);
-   thr.GetChangeStats(*fAreaErosionThr, *fAreaDepositionThr, *fVolErosionThr, *fVolDepositionThr);
-
-   // Get the volume of error from the propagated error surface using the thresholded DoD as a mask
-   RasterManager::DoDRaster err(ppszPropError);
-   RasterManager::Raster thrTest(ppszThrDod);
-   err.GetChangeStats(thrTest, *fVolErosionErr, *fVolDepositonErr);
+    // Set the output values to zero
+    RasterManager::DoDBudget zero = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    SetDoDStatsOutputs(zero, fAreaErosionRaw, fAreaDepositonRaw, fAreaErosionThr, fAreaDepositionThr,
+                       fVolErosionRaw, fVolDepositionRaw, fVolErosionThr, fVolDepositionThr,
+                       fVolErosionErr, fVolDepositonErr);
+    try {
+        // Raw DoD, thresholded DoD and the propagated error masked by it all come from one pass
+        RasterManager::DoDBudgetEngine engine(ppszRawDoD);
+        engine.AddProbabilistic(ppszThrDod, ppszPropError);
+        engine.Calculate();
+        SetDoDStatsOutputs(engine.GetBudget(0), fAreaErosionRaw, fAreaDepositonRaw, fAreaErosionThr, fAreaDepositionThr,
+                           fVolErosionRaw, fVolDepositionRaw, fVolErosionThr, fVolDepositionThr,
+                           fVolErosionErr, fVolDepositonErr);
+        return RasterManager::PROCESS_OK;
+    }
+    catch (RasterManager::RasterManagerException e){
+        // The outputs stay at zero. The code is the first error any of the engine's workers hit.
+        return e.GetErrorCode();
+    }
+}
+
+extern "C" RM_DLL_API int GetDoDMinLoDBudgets(const char * ppszRawDoD, int nThresholds,
+                                              const double * pThresholds, double * pResults,
+                                              char * sErr)
+{
+    RasterManager::InitCInterfaceError(sErr);
+    try {
+        RasterManager::DoDBudgetEngine engine(ppszRawDoD);
+        for (int t = 0; t < nThresholds; t++)
+            engine.AddMinLoD(pThresholds[t]);
+        engine.Calculate();
+        SetDoDBudgetResults(engine, pResults);
+        return RasterManager::PROCESS_OK;
+    }
+    catch (RasterManager::RasterManagerException e){
+        RasterManager::SetCInterfaceError(e, sErr);
+        return e.GetErrorCode();
+    }
+}
+
+extern "C" RM_DLL_API int GetDoDPropBudgets(const char * ppszRawDoD, int nSurfaces,
+                                            const char ** ppszPropErrors, double * pResults,
+                                            char * sErr)
+{
+    RasterManager::InitCInterfaceError(sErr);
+    try {
+        RasterManager::DoDBudgetEngine engine(ppszRawDoD);
+        for (int s = 0; s < nSurfaces; s++)
+            engine.AddPropagatedError(ppszPropErrors[s]);
+        engine.Calculate();
+        SetDoDBudgetResults(engine, pResults);
+        return RasterManager::PROCESS_OK;
+    }
+    catch (RasterManager::RasterManagerException e){
+        RasterManager::SetCInterfaceError(e, sErr);
+        return e.GetErrorCode();
+    }
+}
+
+extern "C" RM_DLL_API int GetDoDZonalBudgets(const char * ppszRawDoD, const char * ppszZoneRaster,
+                                             double fThreshold, const char * ppszPropError,
+                                             const char * ppszOutputCSV, char * sErr)
+{
+    RasterManager::InitCInterfaceError(sErr);
+    try {
+        RasterManager::DoDBudgetEngine engine(ppszRawDoD);
+        if (ppszPropError != NULL && strlen(ppszPropError) > 0)
+            engine.AddPropagatedError(ppszPropError);
+        else
+            engine.AddMinLoD(fThreshold);
+        engine.SetZones(ppszZoneRaster);
+        engine.Calculate();
+        engine.WriteCSV(ppszOutputCSV);
+        return RasterManager::PROCESS_OK;
+    }
+    catch (RasterManager::RasterManagerException e){
+        RasterManager::SetCInterfaceError(e, sErr);
+        return e.GetErrorCode();
+    }
 }
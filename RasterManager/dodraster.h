@@ -3,6 +3,9 @@
 
 #include "rastermanager_global.h"
 #include "raster.h"
+#include <string>
+#include <vector>
+#include <QString>
 
 namespace RasterManager {
 
@@ -57,14 +60,141 @@ public:
     void GetChangeStats(Raster & pMask, double & fVolErosion, double & fVolDeposition);
 };
 
+/**
+ * @brief Area and volume totals for one way of thresholding a DoD.
+ *
+ * Same units as the DoD raster: areas in linear units squared, volumes in linear units cubed.
+ */
+struct RM_DLL_API DoDBudget
+{
+    double fAreaErosionRaw;
+    double fAreaDepositionRaw;
+    double fAreaErosionThr;
+    double fAreaDepositionThr;
+    double fVolErosionRaw;
+    double fVolDepositionRaw;
+    double fVolErosionThr;
+    double fVolDepositionThr;
+    double fVolErosionErr;
+    double fVolDepositionErr;
+};
+
+struct DoDBudgetPartial;
+
+/**
+ * @brief Computes any number of DoD budgets in a single parallel pass over the DoD.
+ *
+ * Each budget is one thresholding of the raw DoD: a minimum level of detection (MinLoD),
+ * a propagated error surface or a probabilistic thresholded DoD with its error surface.
+ * The raw DoD and every other raster involved are read once, a strip of block rows at a
+ * time, and all the budgets are accumulated together with compensated (Kahan) sums. A
+ * threshold sensitivity analysis therefore costs one read of the DoD instead of one per
+ * threshold.
+ *
+ * Budgets can also be segregated by a zone raster. Every class gets its own totals from
+ * the same single pass.
+ */
+class RM_DLL_API DoDBudgetEngine
+{
+public:
+    /**
+     * @brief DoDBudgetEngine
+     * @param psRawDoD Full, absolute path to the raw DoD raster.
+     */
+    DoDBudgetEngine(const char * psRawDoD);
+
+    /**
+     * @brief AddMinLoD Threshold the DoD with a single minimum level of detection.
+     * @param fThreshold
+     * @return index of the budget
+     */
+    int AddMinLoD(double fThreshold);
+
+    /**
+     * @brief AddPropagatedError Threshold the DoD with a propagated error surface.
+     *        Cells where the error surface is NoData are left out entirely.
+     * @param psPropError
+     * @return index of the budget
+     */
+    int AddPropagatedError(const char * psPropError);
+
+    /**
+     * @brief AddProbabilistic Take the thresholded values from an already thresholded DoD
+     *        and the error from a propagated error surface masked by it.
+     * @param psThrDoD
+     * @param psPropError
+     * @return index of the budget
+     */
+    int AddProbabilistic(const char * psThrDoD, const char * psPropError);
+
+    /**
+     * @brief SetZones Segregate every budget by the classes of a zone raster (e.g. geomorphic units).
+     *
+     * Zone values are truncated to integers and the zone raster must be the same size as the DoD.
+     * Cells where the zone raster is NoData are left out of every budget.
+     *
+     * @param psZoneRaster
+     */
+    void SetZones(const char * psZoneRaster);
+
+    /**
+     * @brief Calculate Read the rasters and fill in every budget.
+     */
+    void Calculate();
+
+    int GetBudgetCount() const { return (int) m_vSpecs.size(); }
+
+    /**
+     * @brief GetBudget Totals for one budget. With zones this is the sum over all zones.
+     */
+    const DoDBudget & GetBudget(int nIndex) const { return m_vBudgets.at(nIndex); }
+
+    int GetZoneCount() const { return (int) m_vZoneIds.size(); }
+    int GetZoneId(int nZone) const { return m_vZoneIds.at(nZone); }
+    const DoDBudget & GetZoneBudget(int nIndex, int nZone) const { return m_vZoneBudgets.at(nIndex).at(nZone); }
+
+    /**
+     * @brief WriteCSV One line per budget, or per budget and zone when zones are set.
+     * @param psCSVPath
+     */
+    void WriteCSV(const char * psCSVPath) const;
+
+private:
+    struct BudgetSpec
+    {
+        int eType;
+        double fThreshold;
+        int nThrRaster;
+        int nErrRaster;
+        QString sLabel;
+    };
+
+    int AddRaster(const char * psPath);
+    void CalculatePartial(DoDBudgetPartial * pPartial) const;
+
+    std::string m_sRawDoD;
+    std::vector<std::string> m_vRasters;
+    std::vector<BudgetSpec> m_vSpecs;
+    int m_nZoneRaster;
+
+    // Filled in by Calculate()
+    int m_nCols;
+    int m_nStripRows;
+    std::vector<DoDBudget> m_vBudgets;
+    std::vector<int> m_vZoneIds;
+    std::vector< std::vector<DoDBudget> > m_vZoneBudgets;
+};
+
 }
 
 /*******************************************************************************************************
  *******************************************************************************************************
  * DoD Change Statistics Methods
+ *
+ * Each returns PROCESS_OK, or the error code of the first worker that failed with every output left at zero.
  */
 
-extern "C" RM_DLL_API void GetDoDMinLoDStats(const char * ppszRawDoD, double fThreshold,
+extern "C" RM_DLL_API int GetDoDMinLoDStats(const char * ppszRawDoD, double fThreshold,
                                                      double * fAreaErosionRaw, double * fAreaDepositonRaw,
                                                      double * fAreaErosionThr, double * fAreaDepositionThr,
                                                      double * fVolErosionRaw, double * fVolDepositionRaw,
@@ -72,7 +202,7 @@ extern "C" RM_DLL_API void GetDoDMinLoDStats(const char * ppszRawDoD, double fTh
                                                      double * fVolErosionErr, double * fVolDepositonErr);
 
 
-extern "C" RM_DLL_API void GetDoDPropStats(const char * ppszRawDoD, const char * ppszPropError,
+extern "C" RM_DLL_API int GetDoDPropStats(const char * ppszRawDoD, const char * ppszPropError,
                                                      double * fAreaErosionRaw, double * fAreaDepositonRaw,
                                                      double * fAreaErosionThr, double * fAreaDepositionThr,
                                                      double * fVolErosionRaw, double * fVolDepositionRaw,
@@ -81,7 +211,48 @@ extern "C" RM_DLL_API void GetDoDPropStats(const char * ppszRawDoD, const char *
 
 
 
-extern "C" RM_DLL_API void GetDoDProbStats(const char * ppszRawDoD, const char * ppszThrDod,
+/**
+ * @brief GetDoDMinLoDBudgets Budgets for several MinLoD thresholds from one pass over the DoD.
+ * @param ppszRawDoD
+ * @param nThresholds
+ * @param pThresholds
+ * @param pResults Caller allocated array of nThresholds * 10 values. Each threshold gets the same
+ *        ten values, in the same order, as the outputs of GetDoDMinLoDStats.
+ * @param sErr
+ * @return
+ */
+extern "C" RM_DLL_API int GetDoDMinLoDBudgets(const char * ppszRawDoD, int nThresholds,
+                                              const double * pThresholds, double * pResults,
+                                              char * sErr);
+
+/**
+ * @brief GetDoDPropBudgets Budgets for several propagated error surfaces from one pass over the DoD.
+ * @param ppszRawDoD
+ * @param nSurfaces
+ * @param ppszPropErrors
+ * @param pResults Caller allocated array of nSurfaces * 10 values, laid out like GetDoDMinLoDBudgets.
+ * @param sErr
+ * @return
+ */
+extern "C" RM_DLL_API int GetDoDPropBudgets(const char * ppszRawDoD, int nSurfaces,
+                                            const char ** ppszPropErrors, double * pResults,
+                                            char * sErr);
+
+/**
+ * @brief GetDoDZonalBudgets Budget segregation: DoD change per class of a zone raster, written to CSV.
+ * @param ppszRawDoD
+ * @param ppszZoneRaster Raster of integer class (zone) ids. Must be the same size as the DoD.
+ * @param fThreshold MinLoD threshold. Ignored if ppszPropError is given.
+ * @param ppszPropError Optional propagated error surface to threshold with instead (NULL for none).
+ * @param ppszOutputCSV
+ * @param sErr
+ * @return
+ */
+extern "C" RM_DLL_API int GetDoDZonalBudgets(const char * ppszRawDoD, const char * ppszZoneRaster,
+                                             double fThreshold, const char * ppszPropError,
+                                             const char * ppszOutputCSV, char * sErr);
+
+extern "C" RM_DLL_API int GetDoDProbStats(const char * ppszRawDoD, const char * ppszThrDod,
                                                       const char * ppszPropError,
                                                       double * fAreaErosionRaw, double * fAreaDepositonRaw,
                                                       double * fAreaErosionThr, double * fAreaDepositionThr,
@@ -72,18 +72,14 @@ void ExtentRectangle::Load(const char * psFilePath){
     CheckFile(psFilePath, true);
 
     // Check Valid Data Set
-    GDALDataset * pDS = (GDALDataset*) GDALOpen(psFilePath, GA_ReadOnly);
-    if (pDS == NULL)
-        throw RasterManagerException(INPUT_FILE_NOT_VALID, CPLGetLastErrorMsg());
+    RasterHeader header;
+    ReadRasterHeader(psFilePath, header);
 
-    GDALRasterBand * pBand = pDS->GetRasterBand(1);
+    cols = header.nCols;
+    rows = header.nRows;
 
-    cols = pBand->GetXSize();
-    rows = pBand->GetYSize();
-
-    pDS->GetGeoTransform(m_GeoTransform);
-
-    GDALClose(pDS);
+    for (int i = 0; i < 6; i++)
+        m_GeoTransform[i] = header.adfGeoTransform[i];
 
 }
 
@@ -3,6 +3,10 @@
 #include "rastermanager_exception.h"
 #include "raster.h"
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <QThread>
+#include <QtConcurrent>
 
 namespace RasterManager {
 
@@ -105,102 +109,149 @@ HistogramsClass::~HistogramsClass(void)
 }
 
 /*
-     * Calculate histograms.
+     * One worker's share of the histogram. Each worker reads its own rows through
+     * its own dataset handle and bins into private arrays so nothing is shared
+     * until the final reduction.
      */
-bool HistogramsClass::calculate(void)
+struct HistogramPartial
 {
-    GDALDataset* ds = NULL;
-    float* data = NULL;
-    try
+    int firstRow;
+    int lastRow;
+    std::vector<long> counts;
+    std::vector<double> absSums;
+    std::string error;
+};
+
+static void calculatePartial(const std::string& filename, int numBins, double minBin, double binSize,
+                             HistogramPartial* partial)
+{
+    GDALDataset* ds = (GDALDataset*)GDALOpen(filename.c_str(), GA_ReadOnly);
+    if (ds == NULL)
     {
-        ds = (GDALDataset*)GDALOpen(filename.c_str(), GA_ReadOnly);
-        if (ds == NULL)
-            throw RasterManagerException(INPUT_FILE_ERROR, CPLGetLastErrorMsg());
-        GDALRasterBand* band = ds->GetRasterBand(1);
-
-        double transform[6];
-        ds->GetGeoTransform(transform);
-        double cellArea = fabs(transform[1] * transform[5]);
-        int yRasterSize = ds->GetRasterYSize();
-        int xRasterSize = ds->GetRasterXSize();
-
-        int xBlockSize, yBlockSize;
-        band->GetBlockSize(&xBlockSize, &yBlockSize);
-        data = (float*)CPLMalloc(sizeof(float) * xBlockSize * yBlockSize);
-
-        int hasNoData;
-        float noData = (float)band->GetNoDataValue(&hasNoData);
-
-        int xOffset, yOffset, xValid, yValid, x, y, i, bin;
-        for (yOffset=0; yOffset<yRasterSize; yOffset+=yBlockSize)
+        partial->error = CPLGetLastErrorMsg();
+        return;
+    }
+    GDALRasterBand* band = ds->GetRasterBand(1);
+    int xRasterSize = ds->GetRasterXSize();
+
+    int xBlockSize, yBlockSize;
+    band->GetBlockSize(&xBlockSize, &yBlockSize);
+    float* data = (float*)CPLMalloc(sizeof(float) * xBlockSize * yBlockSize);
+    int* bins = (int*)CPLMalloc(sizeof(int) * xBlockSize * yBlockSize);
+
+    int hasNoData;
+    float noData = (float)band->GetNoDataValue(&hasNoData);
+
+    partial->counts.assign(numBins, 0);
+    partial->absSums.assign(numBins, 0);
+    long* counts = &partial->counts[0];
+    double* absSums = &partial->absSums[0];
+
+    int xOffset, yOffset, xValid, yValid, i, cells;
+    for (yOffset=partial->firstRow; yOffset<partial->lastRow; yOffset+=yBlockSize)
+    {
+        yValid = std::min(yBlockSize, partial->lastRow - yOffset);
+        for (xOffset=0; xOffset<xRasterSize; xOffset+=xBlockSize)
         {
-            if (yOffset + yBlockSize < yRasterSize)
-                yValid = yBlockSize;
-            else
-                yValid = yRasterSize - yOffset;
-            for (xOffset=0; xOffset<xRasterSize; xOffset+=xBlockSize)
+            xValid = std::min(xBlockSize, xRasterSize - xOffset);
+            cells = xValid * yValid;
+
+            if (band->RasterIO(GF_Read, xOffset, yOffset, xValid, yValid, data, xValid,
+                               yValid, GDT_Float32, 0, 0) == CE_Failure)
+            {
+                partial->error = CPLGetLastErrorMsg();
+                break;
+            }
+
+            // Work out every bin index up front. Out of range values and NaN are marked -1
+            // while still a double; casting them to int first would be undefined.
+            for (i=0; i<cells; i++)
             {
-                if (xOffset + xBlockSize < xRasterSize)
-                    xValid = xBlockSize;
-                else
-                    xValid = xRasterSize - xOffset;
+                double bin = (data[i] - minBin) / binSize;
+                bins[i] = (bin >= 0 && bin < numBins) ? (int)bin : -1;
+            }
 
-                if (band->RasterIO(GF_Read, xOffset, yOffset, xValid, yValid, data, xValid,
-                                   yValid, GDT_Float32, 0, 0) == CE_Failure)
-                {
-                    throw RasterManagerException(OTHER_ERROR, CPLGetLastErrorMsg());
-                }
+            if (hasNoData)
+            {
+                for (i=0; i<cells; i++)
+                    if (data[i] == noData)
+                        bins[i] = -1;
+            }
 
-                if (hasNoData)
-                {
-                    for (y=0; y<yValid; y++)
-                    {
-                        i = y * xBlockSize;
-                        for (x=0; x<xValid; x++)
-                        {
-                            if (data[i] != noData)
-                            {
-                                bin = (int)((data[i] - minBin) / binSize);
-                                if (bin < this->numBins && bin >= 0){
-                                    countHistogram[bin]++;
-                                    areaHistogram[bin] += cellArea;
-                                    volumeHistogram[bin] += cellArea * fabs(data[i]);
-                                }
-                            }
-                            i++;
-                        }
-                    }
-                }
-                else
+            // One index per cell feeds the count and volume histograms. Area is just
+            // count * cellArea so it gets added in when the partials are reduced.
+            for (i=0; i<cells; i++)
+            {
+                int bin = bins[i];
+                if (bin >= 0 && bin < numBins)
                 {
-                    for (y=0; y<yValid; y++)
-                    {
-                        i = y * xBlockSize;
-                        for (x=0; x<xValid; x++)
-                        {
-                            bin = (int)((data[i] - minBin) / binSize);
-                            countHistogram[bin]++;
-                            areaHistogram[bin] += cellArea;
-                            volumeHistogram[bin] += cellArea * fabs(data[i]);
-                            i++;
-                        }
-                    }
+                    counts[bin]++;
+                    absSums[bin] += fabs(data[i]);
                 }
             }
         }
-        GDALClose(ds);
-        CPLFree(data);
-        return true;
+        if (!partial->error.empty())
+            break;
+    }
+
+    CPLFree(bins);
+    CPLFree(data);
+    GDALClose(ds);
+}
+
+/*
+     * Calculate histograms.
+     */
+bool HistogramsClass::calculate(void)
+{
+    GDALDataset* ds = (GDALDataset*)GDALOpen(filename.c_str(), GA_ReadOnly);
+    if (ds == NULL)
+    {
+        std::cout << CPLGetLastErrorMsg() << std::endl;
+        return setErrorMsg(CPLGetLastErrorMsg());
+    }
+
+    double transform[6];
+    ds->GetGeoTransform(transform);
+    double cellArea = fabs(transform[1] * transform[5]);
+    int yRasterSize = ds->GetRasterYSize();
+
+    int xBlockSize, yBlockSize;
+    ds->GetRasterBand(1)->GetBlockSize(&xBlockSize, &yBlockSize);
+    GDALClose(ds);
+
+    // Split the rows into one run of whole block-rows per thread
+    int blockRows = (yRasterSize + yBlockSize - 1) / yBlockSize;
+    int numWorkers = std::max(1, std::min(QThread::idealThreadCount(), blockRows));
+    std::vector<HistogramPartial> partials(numWorkers);
+    QList< QFuture<void> > futures;
+
+    for (int w=0; w<numWorkers; w++)
+    {
+        partials[w].firstRow = std::min(yRasterSize, (int)((long long)blockRows * w / numWorkers) * yBlockSize);
+        partials[w].lastRow = std::min(yRasterSize, (int)((long long)blockRows * (w+1) / numWorkers) * yBlockSize);
+        futures.append(QtConcurrent::run(calculatePartial, filename, numBins, minBin, binSize, &partials[w]));
     }
-    catch (RasterManagerException e)
+
+    for (int w=0; w<futures.size(); w++)
+        futures[w].waitForFinished();
+
+    for (int w=0; w<numWorkers; w++)
     {
-        std::cout << e.what() << std::endl;
-        if (ds != NULL)
-            GDALClose(ds);
-        if (data != NULL)
-            CPLFree(data);
-        return false;
+        if (!partials[w].error.empty())
+        {
+            std::cout << partials[w].error << std::endl;
+            return setErrorMsg(partials[w].error);
+        }
+        for (int i=0; i<numBins; i++)
+        {
+            countHistogram[i] += partials[w].counts[i];
+            areaHistogram[i] += cellArea * partials[w].counts[i];
+            volumeHistogram[i] += cellArea * partials[w].absSums[i];
+        }
     }
+
+    return true;
 }
 
 /*
@@ -2,6 +2,7 @@
 
 #include "raster.h"
 #include "rastermanager.h"
+#include "rasterstream.h"
 #include "rastermanager_interface.h"
 #include "gdal_priv.h"
 #include "rastermanager_exception.h"
@@ -169,6 +170,26 @@ int Raster::Delete(const char * pDeleteRaster){
     return pDR->Delete(pDeleteRaster) == CE_Failure ? INPUT_FILE_ERROR : PROCESS_OK;
 }
 
+int Raster::BuildOverviews(const char * psRaster, const char * psResampling){
+
+    CheckFile(psRaster, true);
+
+    GDALDataset * pDS = (GDALDataset*) GDALOpen(psRaster, GA_Update);
+    if (pDS == NULL)
+        throw RasterManagerException(INPUT_FILE_ERROR, "Could not open raster for update.");
+
+    try {
+        BuildDatasetOverviews(pDS, psResampling);
+    }
+    catch (RasterManagerException e){
+        GDALClose(pDS);
+        throw;
+    }
+
+    GDALClose(pDS);
+    return PROCESS_OK;
+}
+
 
 /*
  * Copy the object. (Note that this simply copies the member properties
@@ -275,6 +296,9 @@ int Raster::Copy(const char * pOutputRaster,
     int nRowTrans = GetRowTranslation(&OutputMeta);
     int nColTrans = GetColTranslation(&OutputMeta);
 
+    StatsAccumulator outputStats(pDSOutput->GetRasterBand(1));
+    RasterWriter outputWriter(pDSOutput->GetRasterBand(1), &outputStats);
+
     /*
     * Loop over the raster rows. Note that geographic coordinate origin is bottom left. But
     * the GDAL image anchor is top left. The cell height is negative.
@@ -323,20 +347,17 @@ int Raster::Copy(const char * pOutputRaster,
                 pOutputLine[j] = GetNoDataValue();
             }
         }
-        pDSOutput->GetRasterBand(1)->RasterIO(GF_Write, 0, i,
-                                              pDSOutput->GetRasterBand(1)->GetXSize(), 1,
-                                              pOutputLine,
-                                              pDSOutput->GetRasterBand(1)->GetXSize(), 1,
-                                              GDT_Float64, 0, 0);
+        outputWriter.WriteRow(i, pOutputLine);
     }
 
     CPLFree(pInputLine);
     CPLFree(pOutputLine);
 
-    CalculateStats(pDSOutput->GetRasterBand(1));
+    outputWriter.Finish();
+    CalculateStats(pDSOutput->GetRasterBand(1), &outputStats);
 
     GDALClose(pDSOld);
-    GDALClose(pDSOutput);
+    CloseOutputDS(pDSOutput);
 
     GDALDumpOpenDatasets(stderr);
 
@@ -356,9 +377,12 @@ int Raster::Uniform(const char * pOutputRaster, double fValue)
     GDALRasterBand * pRBInput = pInputDS->GetRasterBand(1);
 
     // Create the output dataset for writing
-    GDALDataset * pOutputDS = CreateOutputDS(pOutputRaster, this);
+    GDALDataset * pOutputDS = CreateOutputDS(pOutputRaster, this, true);
     GDALRasterBand * pOutputRB = pOutputDS->GetRasterBand(1);
 
+    StatsAccumulator outputStats(pOutputRB);
+    RasterWriter outputWriter(pOutputRB, &outputStats);
+
     // Assign our buffers
     double * pInputLine = (double*) CPLMalloc(sizeof(double) * GetCols());
     double * pOutputLine = (double*) CPLMalloc(sizeof(double) * GetCols());
@@ -381,18 +405,19 @@ int Raster::Uniform(const char * pOutputRaster, double fValue)
 
         }
         // Write the row
-        pOutputRB->RasterIO(GF_Write, 0, i, GetCols(), 1, pOutputLine, GetCols(), 1, GDT_Float64, 0, 0 );
+        outputWriter.WriteRow(i, pOutputLine);
     }
 
     CPLFree(pOutputLine);
     CPLFree(pInputLine);
 
-    CalculateStats(pOutputDS->GetRasterBand(1));
+    outputWriter.Finish();
+    CalculateStats(pOutputRB, &outputStats);
 
     if ( pInputDS != NULL)
         GDALClose(pInputDS);
     if ( pOutputDS != NULL)
-        GDALClose(pOutputDS);
+        CloseOutputDS(pOutputDS);
 
     return PROCESS_OK;
 
@@ -404,6 +429,13 @@ int Raster::Uniform(const char * pOutputRaster, double fValue)
 */
 int Raster::ReSample(const char * pOutputRaster, double fNewCellSize,
                      double fNewLeft, double fNewTop, int nNewRows, int nNewCols)
+{
+    return ReSample(pOutputRaster, fNewCellSize, fNewLeft, fNewTop, nNewRows, nNewCols, RESAMPLE_BILINEAR);
+}
+
+int Raster::ReSample(const char * pOutputRaster, double fNewCellSize,
+                     double fNewLeft, double fNewTop, int nNewRows, int nNewCols,
+                     Raster_Resample_Method eMethod)
 {
     if (fNewCellSize <= 0)
         return CELL_SIZE_ERROR;
@@ -432,24 +464,13 @@ int Raster::ReSample(const char * pOutputRaster, double fNewCellSize,
 
     /*************************************************************************************************
      * Create the new dataset. Determine the driver from the output file extension.
-     * Enforce LZW compression for TIFs. The predictor 3 is used for floating point prediction.
-     * Not using this value defaults the LZW to prediction to 1 which causes striping.
+     * The compression, tiling and so on come from the creation profile.
      */
-    char **papszOptions = NULL;
-    GDALDriver * pDR = NULL;
-
-    pDR = GetGDALDriverManager()->GetDriverByName(GetDriverFromFileName(pOutputRaster));
-    if (strcmp( pDR->GetDescription() , "GTiff") == 0){
-        papszOptions = CSLSetNameValue(papszOptions, "COMPRESS", "LZW");
-    }
-    else {
-        papszOptions = CSLSetNameValue(papszOptions, "COMPRESS", "PACKBITS");
-    }
-
-    GDALDataset * pDSOutput = pDR->Create(pOutputRaster, nNewCols, nNewRows, 1,  *GetGDALDataType(), papszOptions);
-    CSLDestroy( papszOptions );
-    if (pDSOutput == NULL)
+    GDALDataset * pDSOutput = CreateProfiledDS(pOutputRaster, nNewCols, nNewRows, *GetGDALDataType());
+    if (pDSOutput == NULL){
+        GDALClose(pDSOld);
         return OUTPUT_FILE_ERROR;
+    }
 
     GDALRasterBand * pRBOutput = pDSOutput->GetRasterBand(1);
 
@@ -470,12 +491,31 @@ int Raster::ReSample(const char * pOutputRaster, double fNewCellSize,
     pDSOutput->SetGeoTransform(newTransform);
     pDSOutput->SetProjection(GetProjectionRef());
 
-    ReSampleRaster(pRBInput, pRBOutput, fNewCellSize, fNewLeft, fNewTop, nNewRows, nNewCols);
+    StatsAccumulator outputStats(pRBOutput);
+
+    switch (eMethod) {
+    case RESAMPLE_BILINEAR:
+        ReSampleRaster(pRBInput, pRBOutput, fNewCellSize, fNewLeft, fNewTop, nNewRows, nNewCols, &outputStats);
+        break;
+    case RESAMPLE_NEAREST:
+    case RESAMPLE_CUBIC:
+    case RESAMPLE_LANCZOS:
+        ReSampleKernel(pRBInput, pRBOutput, eMethod, fNewCellSize, fNewLeft, fNewTop, nNewRows, nNewCols, &outputStats);
+        break;
+    case RESAMPLE_AVERAGE:
+    case RESAMPLE_MODE:
+        ReSampleAggregate(pRBInput, pRBOutput, eMethod, fNewCellSize, fNewLeft, fNewTop, nNewRows, nNewCols, &outputStats);
+        break;
+    default:
+        GDALClose(pDSOld);
+        CloseOutputDS(pDSOutput);
+        throw RasterManagerException(ARGUMENT_VALIDATION, "Unknown resample method.");
+    }
 
-    CalculateStats(pDSOutput->GetRasterBand(1));
+    CalculateStats(pRBOutput, &outputStats);
 
     GDALClose(pDSOld);
-    GDALClose(pDSOutput);
+    CloseOutputDS(pDSOutput);
 
     return PROCESS_OK;
 }
@@ -6,6 +6,8 @@
 #include "rastermanager_interface.h"
 #include <ogrsf_frmts.h>
 #include <QString>
+#include <QStringList>
+#include <QMap>
 #include <QFile>
 #include <string>
 
@@ -13,6 +15,8 @@ class GDALRasterBand;
 
 namespace RasterManager {
 
+class StatsAccumulator;
+
 // When comparing floats we need a number that is "close enough"
 // to zero for comparison purposes
 static const double OMEGA = 0.0000001;
@@ -20,6 +24,23 @@ static const double OMEGA = 0.0000001;
 // Two doubles off by this much are considered equal in isEqual function
 const double DOUBLECOMPARE = 0.00000001;
 
+/**
+ * @brief What Raster::CompareRasters found. The counts only cover every cell when a full
+ *        report was asked for. Otherwise they stop at the first difference.
+ */
+struct RasterDiffReport
+{
+    bool bConcurrent;
+    long long nCellsCompared;
+    long long nDiffCells;
+    // Largest difference between two cells that both have data
+    double fMaxAbsDiff;
+    // First differing cell in row order, -1 if there wasn't one. Without a full
+    // report it's the first one the workers came across.
+    int nFirstDiffRow;
+    int nFirstDiffCol;
+};
+
 /**
  * @brief Represents a [GDAL](http://www.gdal.org/) compatible raster on disk
  *
@@ -127,6 +148,21 @@ public:
     int ReSample(const char * pOutputRaster, double fNewCellSize,
                  double fNewLeft, double fNewTop, int nNewRows, int nNewCols);
 
+    /**
+     * @brief ReSample using a specific resampling method
+     * @param pOutputRaster
+     * @param fNewCellSize
+     * @param fNewLeft
+     * @param fNewTop
+     * @param nNewRows
+     * @param nNewCols
+     * @param eMethod nearest, bilinear, cubic, lanczos, average or mode
+     * @return
+     */
+    int ReSample(const char * pOutputRaster, double fNewCellSize,
+                 double fNewLeft, double fNewTop, int nNewRows, int nNewCols,
+                 Raster_Resample_Method eMethod);
+
     /**
      * @brief Copy
      * @param pOutputRaster
@@ -146,6 +182,46 @@ public:
      */
     static int Delete(const char * pDeleteRaster);
 
+    /**
+     * @brief ZonalStats Summarize a raster by zone (count, sum, mean, min, max, std and
+     *        percentiles) in one parallel pass, or two when big zones need percentiles.
+     * @param psValueRaster
+     * @param psZones Either a raster of integer zones the same size as the value raster or
+     *        a polygon layer. Polygons are rasterized a strip at a time and keyed by FID.
+     *        Where polygons overlap, each cell belongs only to the last of them in the layer.
+     * @param psOutput Path to a CSV. Passing the polygon layer's own path appends the stats
+     *        to it as attributes instead.
+     * @param psPercentiles Comma separated percentiles (e.g. "10,50,90"). NULL or "" for none.
+     *        They are exact for zones of up to 4096 cells. Bigger zones take a second pass
+     *        and interpolate inside a 1024 bin histogram over the zone's own range.
+     * @return
+     */
+    static int ZonalStats(const char * psValueRaster, const char * psZones,
+                          const char * psOutput, const char * psPercentiles);
+
+    /**
+     * @brief CompareRasters Compare two rasters block by block in parallel without loading
+     *        either into memory. The extents and cell sizes are checked first. Cells match
+     *        when both are NoData or they are within the tolerance of each other.
+     * @param psRaster1
+     * @param psRaster2
+     * @param fTolerance Largest difference still counted as equal. 0 means a fuzzy compare.
+     * @param psDiffRaster Optional. Writes raster1 - raster2 here. Implies a full report.
+     * @param bFullReport Keep going after the first difference to count all of them
+     * @param pReport Filled in with the result
+     * @return PROCESS_OK if they match, RASTER_COMPARISON if they don't
+     */
+    static int CompareRasters(const char * psRaster1, const char * psRaster2, double fTolerance,
+                              const char * psDiffRaster, bool bFullReport, RasterDiffReport * pReport);
+
+    /**
+     * @brief BuildOverviews Add internal overviews to an existing raster
+     * @param psRaster
+     * @param psResampling GDAL overview resampling (AVERAGE, NEAREST, MODE...). NULL means AVERAGE
+     * @return
+     */
+    static int BuildOverviews(const char * psRaster, const char * psResampling);
+
     /**
      * @brief CSVCellClean
      * @param value
@@ -159,6 +235,25 @@ public:
      */
     static void CSVWriteLine(QFile *csvFile, QString sCSVLine);
 
+    /**
+     * @brief CSVParseField Parse a number straight out of a CSV line. The field is trimmed
+     *        the same way CSVCellClean does it.
+     * @param p Start of the field
+     * @param pEnd One past the end of the field
+     * @param fValue
+     * @return false for blank or non-numeric fields
+     */
+    static bool CSVParseField(const char * p, const char * pEnd, double & fValue);
+
+    /**
+     * @brief CSVAppendFixed Append a value with a fixed number of decimals. The text is the
+     *        same as QString::arg(fValue, 0, 'f', nPrecision) without building a QString.
+     * @param baLine
+     * @param fValue
+     * @param nPrecision
+     */
+    static void CSVAppendFixed(QByteArray & baLine, double fValue, int nPrecision);
+
     /**
      * @brief CSVtoRaster
      * @param sCSVSourcePath
@@ -167,13 +262,19 @@ public:
      * @param sYField
      * @param sDataField
      * @param p_rastermeta
+     * @param eMethod How points sharing a cell are combined. GRID_LAST keeps the last one.
+     * @param fIDWRadius Search radius for GRID_IDW. 0 means a point only feeds the cell it falls in.
+     * @param fIDWPower Distance exponent for GRID_IDW
      */
     static int CSVtoRaster(const char * sCSVSourcePath,
                            const char * psOutput,
                            const char * sXField,
                            const char * sYField,
                            const char * sDataField,
-                           RasterMeta * p_rastermeta );
+                           RasterMeta * p_rastermeta,
+                           Raster_Grid_Method eMethod = GRID_LAST,
+                           double fIDWRadius = 0,
+                           double fIDWPower = 2);
 
     /**
      * @brief CSVtoRaster
@@ -183,13 +284,19 @@ public:
      * @param sXField
      * @param sYField
      * @param sDataField
+     * @param eMethod
+     * @param fIDWRadius
+     * @param fIDWPower
      */
     static int CSVtoRaster(const char * sCSVSourcePath,
                            const char * psOutput,
                            const char * sRasterTemplate,
                            const char * sXField,
                            const char * sYField,
-                           const char * sDataField );
+                           const char * sDataField,
+                           Raster_Grid_Method eMethod = GRID_LAST,
+                           double fIDWRadius = 0,
+                           double fIDWPower = 2);
 
     /**
      * @brief CSVtoRaster
@@ -204,6 +311,9 @@ public:
      * @param sXField
      * @param sYField
      * @param sDataField
+     * @param eMethod
+     * @param fIDWRadius
+     * @param fIDWPower
      */
     static int CSVtoRaster(const char * sCSVSourcePath,
                            const char * sOutput,
@@ -214,21 +324,40 @@ public:
                            double dCellWidth, double dNoDataVal,
                            const char * sXField,
                            const char * sYField,
-                           const char * sDataField);
+                           const char * sDataField,
+                           Raster_Grid_Method eMethod = GRID_LAST,
+                           double fIDWRadius = 0,
+                           double fIDWPower = 2);
 
     /**
      * @brief RasterToCSV
      * @param sRasterSourcePath
-     * @param sOutputCSVPath
+     * @param sOutputCSVPath A path ending in .bin gets columnar binary: "RMXYV001", a uint64
+     *        point count and the float64 NoData value, then every X, every Y and every value as float64. All little endian.
+     * @param bSkipNoData Leave NoData cells out of the output
      * @return
      */
     static int RasterToCSV(const char * sRasterSourcePath,
-                           const char * sOutputCSVPath);
+                           const char * sOutputCSVPath,
+                           bool bSkipNoData = true);
 
 
+    /**
+     * @brief VectortoRaster
+     * @param sVectorSourcePath
+     * @param sRasterOutputPath
+     * @param FieldName
+     * @param p_rastermeta
+     * @param eMode How cells are burned. The coverage modes only burn polygons:
+     *        RASTERIZE_COVERAGE writes the exact fraction of each cell covered by the
+     *        union of the polygons (overlaps count once) and
+     *        RASTERIZE_COVERAGE_MEAN the coverage weighted mean of the field.
+     * @return
+     */
     static int VectortoRaster(const char * sVectorSourcePath,
                               const char * sRasterOutputPath, const char *FieldName,
-                              RasterMeta * p_rastermeta );
+                              RasterMeta * p_rastermeta,
+                              Raster_Rasterize_Mode eMode = RASTERIZE_CENTER);
 
     /**
      * @brief VectortoRaster convenience method that takes a raster template
@@ -240,7 +369,8 @@ public:
      */
     static int VectortoRaster(const char * sVectorSourcePath,
                               const char * sRasterOutputPath,
-                              const char * sRasterTemplate, const char *psFieldName);
+                              const char * sRasterTemplate, const char *psFieldName,
+                              Raster_Rasterize_Mode eMode = RASTERIZE_CENTER);
 
 
     /**
@@ -253,7 +383,8 @@ public:
      */
     static int VectortoRaster(const char * sVectorSourcePath,
                               const char * sRasterOutputPath,
-                              double dCellWidth, const char *psFieldName);
+                              double dCellWidth, const char *psFieldName,
+                              Raster_Rasterize_Mode eMode = RASTERIZE_CENTER);
 
 
 
@@ -391,13 +522,35 @@ public:
       * @param sCSVOutputPath
       * @param sXField
       * @param sYField
+      * @param sNoData
+      * @param bBilinear Interpolate between the four nearest cell centres instead of taking the cell's value
       * @return
       */
      static int ExtractPoints(const char * sCSVInputSourcePath,
                        const char * sRasterInputSourcePath,
                        const char * sCSVOutputPath,
                        QString sXField,
-                       QString sYField, QString sNoData);
+                       QString sYField, QString sNoData,
+                       bool bBilinear = false);
+
+     /**
+      * @brief ExtractPointsMulti Sample the same points from several rasters in one pass.
+      *        The output CSV has X, Y and one value column per raster, named after the file.
+      * @param sCSVInputSourcePath
+      * @param psRasters Semicolon delimited list of rasters
+      * @param sCSVOutputPath
+      * @param sXField
+      * @param sYField
+      * @param sNoData
+      * @param bBilinear
+      * @return
+      */
+     static int ExtractPointsMulti(const char * sCSVInputSourcePath,
+                       const char * psRasters,
+                       const char * sCSVOutputPath,
+                       QString sXField,
+                       QString sYField, QString sNoData,
+                       bool bBilinear = false);
 
      /**
       * @brief RasterPitRemoval
@@ -520,7 +673,26 @@ private:
      */
     int ReSampleRaster(GDALRasterBand * pRBInput, GDALRasterBand * pRBOutput,
                        double fNewCellSize, double fNewLeft, double fNewTop,
-                       int nNewRows, int nNewCols);
+                       int nNewRows, int nNewCols, StatsAccumulator * pStats);
+
+    /**
+     * @brief ReSampleKernel Separable convolution resampling (nearest, cubic, lanczos).
+     *        Each input row is read and filtered horizontally once, then kept in a small
+     *        ring of rows for the vertical pass.
+     */
+    int ReSampleKernel(GDALRasterBand * pRBInput, GDALRasterBand * pRBOutput,
+                       Raster_Resample_Method eMethod,
+                       double fNewCellSize, double fNewLeft, double fNewTop,
+                       int nNewRows, int nNewCols, StatsAccumulator * pStats);
+
+    /**
+     * @brief ReSampleAggregate Area-weighted aggregation (average, mode). Every input
+     *        cell is weighted by the fraction of it that falls inside the output cell.
+     */
+    int ReSampleAggregate(GDALRasterBand * pRBInput, GDALRasterBand * pRBOutput,
+                          Raster_Resample_Method eMethod,
+                          double fNewCellSize, double fNewLeft, double fNewTop,
+                          int nNewRows, int nNewCols, StatsAccumulator * pStats);
 
 
     /**
@@ -532,13 +704,18 @@ private:
      */
     static int ResizeAndCompressImage(const char* inputImage, int nLongLength, int nQuality);
 
-    // The following Stats functions are designed to work over all cells on a single raster.
-    static double RasterStatMedian(std::vector<double> * RasterArray);
-    static double RasterStatMajority(std::vector<double> * RasterArray);
-    static double RasterStatMinority(std::vector<double> * RasterArray);
-    static double RasterStatSum(std::vector<double> * RasterArray);
-    static double RasterStatVariety(std::vector<double> * RasterArray);
-    static double RasterStatRange(std::vector<double> * RasterArray);
+    static void ZonalStatsWriteCSV(const char * psOutput, const QStringList & lColumns,
+                                   const QMap<qint64, std::vector<double> > & mResults);
+    static void ZonalStatsAppendFields(const char * psZones, const QStringList & lColumns,
+                                       const QMap<qint64, std::vector<double> > & mResults);
+
+    // The following Stats functions stream over all cells on a single raster in strips
+    // so memory stays bounded no matter how big the raster is.
+    static double RasterStatSum(GDALRasterBand * pRB, bool bCount);
+    static double RasterStatMedian(GDALRasterBand * pRB);
+    static double RasterStatRank(GDALRasterBand * pRB, long long nRank, double dMin, double dMax);
+    static double RasterStatCount(GDALRasterBand * pRB, Raster_Stats_Operation eOperation);
+    static double RasterStatCountSpilled(GDALRasterBand * pRB, Raster_Stats_Operation eOperation);
 
     /**
      * @brief CombineRasterValues helper function for the combine RM operation
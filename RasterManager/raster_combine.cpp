@@ -4,6 +4,7 @@
 #include "raster.h"
 #include "rastermeta.h"
 #include "rastermanager.h"
+#include "rasterstream.h"
 #include "gdal.h"
 #include "gdal_priv.h"
 
@@ -62,7 +63,7 @@ int Raster::CombineRaster(
     OutputMeta.SetNoDataValue(&dOutputNoDataVal);
 
     // Create the output dataset for writing
-    GDALDataset * pOutputDS = CreateOutputDS(psOutputRaster, &OutputMeta);
+    GDALDataset * pOutputDS = CreateOutputDS(psOutputRaster, &OutputMeta, true);
 
     int sRasterRows = OutputMeta.GetRows();
     int sRasterCols = OutputMeta.GetCols();
@@ -71,10 +72,14 @@ int Raster::CombineRaster(
     GDALRasterBand * pOutputRB = pOutputDS->GetRasterBand(1);
     double * pReadBuffer = (double*) CPLMalloc(sizeof(double) * sRasterCols);
 
-    // We store all the datasets in a hash
-    QHash<int, GDALRasterBand *> dDatasets;
+    StatsAccumulator outputStats(pOutputRB);
+    RasterWriter outputWriter(pOutputRB, &outputStats);
+
+    // We store all the datasets in a hash. Each one is read ahead by its own reader.
+    QHash<int, GDALDataset *> dDatasets;
+    QHash<int, RasterReader *> dReaders;
     QHash<int, double> dNoDataVals;
-    QHash<int, double *> dInBuffers;
+    QHash<int, const double *> dInBuffers;
 
     // Populate the hashes with enough buffers and datasets
     int counter = 0;
@@ -85,12 +90,10 @@ int Raster::CombineRaster(
         GDALDataset * pInputDS = (GDALDataset*) GDALOpen( sHSIOutputQB.data(), GA_ReadOnly);
         GDALRasterBand * pInputRB = pInputDS->GetRasterBand(1);
 
-        // Add a buffer for reading this input
-        double * pReadBuffer = (double*) CPLMalloc(sizeof(double) * sRasterCols);
-
         // Notice these get the same keys.
-        dDatasets.insert(counter, pInputRB);
-        dInBuffers.insert(counter, pReadBuffer);
+        dDatasets.insert(counter, pInputDS);
+        dReaders.insert(counter, new RasterReader(pInputRB));
+        dInBuffers.insert(counter, NULL);
         dNoDataVals.insert(counter, pInputRB->GetNoDataValue());
     }
 
@@ -98,19 +101,18 @@ int Raster::CombineRaster(
     for (int i=0; i < sRasterRows; i++)
     {
         // Populate the buffers with a new line from each file.
-        QHashIterator<int, GDALRasterBand *> dDatasetIterator(dDatasets);
-        while (dDatasetIterator.hasNext()) {
-            dDatasetIterator.next();
+        QHashIterator<int, RasterReader *> dReaderIterator(dReaders);
+        while (dReaderIterator.hasNext()) {
+            dReaderIterator.next();
             // Read the row
-            dDatasetIterator.value()->RasterIO(GF_Read, 0,  i, sRasterCols, 1, dInBuffers.value(dDatasetIterator.key()),
-                                               sRasterCols, 1, GDT_Float64, 0, 0);
+            dInBuffers.insert(dReaderIterator.key(), dReaderIterator.value()->ReadRow(i));
         }
         // Loop over columns
         for (int j=0; j < sRasterCols; j++)
         {
             bool bDisqualify = false; // if one value is nodata then that's all we do.
             QHash<int, double> dCellContents;
-            QHashIterator<int, double *> QHIBIterator(dInBuffers);
+            QHashIterator<int, const double *> QHIBIterator(dInBuffers);
             while (QHIBIterator.hasNext()) {
                 QHIBIterator.next();
                 if (QHIBIterator.value()[j] == dNoDataVals.value(QHIBIterator.key()) )
@@ -123,27 +125,31 @@ int Raster::CombineRaster(
                 pReadBuffer[j] = dOutputNoDataVal;
         }
         // Write the row
-        pOutputRB->RasterIO(GF_Write, 0, i, sRasterCols, 1, pReadBuffer, sRasterCols, 1, GDT_Float64, 0, 0 );
+        outputWriter.WriteRow(i, pReadBuffer);
     }
 
+    outputWriter.Finish();
+    CalculateStats(pOutputRB, &outputStats);
+
     if ( pOutputDS != NULL)
-        GDALClose(pOutputDS);
+        CloseOutputDS(pOutputDS);
     CPLFree(pReadBuffer);
     pReadBuffer = NULL;
 
-    // Let's remember to clean up the inputs
-    QHashIterator<int, GDALRasterBand *> qhds(dDatasets);
+    // Let's remember to clean up the inputs. Readers go first since they hold the bands.
+    QHashIterator<int, RasterReader *> qhreader(dReaders);
+    while (qhreader.hasNext()) {
+        qhreader.next();
+        delete qhreader.value();
+    }
+    dReaders.clear();
+    dInBuffers.clear();
+    QHashIterator<int, GDALDataset *> qhds(dDatasets);
     while (qhds.hasNext()) {
         qhds.next();
         GDALClose(qhds.value());
     }
     dDatasets.clear();
-    QHashIterator<int, double *> qhbuff(dInBuffers);
-    while (qhbuff.hasNext()) {
-        qhbuff.next();
-        CPLFree(qhbuff.value());
-    }
-    dInBuffers.clear();
 
     return PROCESS_OK;
 }
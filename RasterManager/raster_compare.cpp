@@ -0,0 +1,313 @@
+#define MY_DLL_EXPORT
+/*
+ * Raster Compare -- Stream two rasters block by block and report where they differ
+ *
+*/
+#include "raster.h"
+#include "rastermanager.h"
+#include "rastermanager_interface.h"
+#include "rastermanager_exception.h"
+#include "gdal_priv.h"
+
+#include <QMutex>
+#include <QThread>
+#include <QtConcurrent>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+namespace RasterManager {
+
+// Strips are whole blocks and at least this many rows tall so the workers aren't
+// fighting over the strip counter on rasters with one row blocks
+const int COMPARE_MIN_STRIP_ROWS = 64;
+
+/* What the compare workers share. Everything but the write lock and the two counters is read-only. */
+struct CompareJob
+{
+    std::string sRaster1;
+    std::string sRaster2;
+    int nCols;
+    int nRows;
+    int nStripRows;
+    double fTolerance;
+    bool bFullReport;
+
+    bool bHasNoData1;
+    double fNoData1;
+    bool bHasNoData2;
+    double fNoData2;
+
+    // Only set when a difference raster was asked for
+    GDALRasterBand * pRBDiff;
+    double fDiffNoData;
+    QMutex * pWriteLock;
+
+    QAtomicInt * pNextStrip;
+    // Raised by whoever finds the first difference when there's no full report
+    QAtomicInt * pStop;
+};
+
+struct ComparePartial
+{
+    long long nCellsCompared;
+    long long nDiffCells;
+    double fMaxAbsDiff;
+    long long nFirstDiff;
+    StatsAccumulator * pStats;
+    int nErrorCode;
+    QString sError;
+};
+
+/* Two cells with data match if they're within the tolerance, or fuzzy equal with no tolerance */
+static inline bool CompareCellValues(double f1, double f2, double fTolerance){
+    if (fTolerance > 0)
+        return fabs(f1 - f2) <= fTolerance;
+    return f1 == f2 || qFuzzyCompare(f1, f2);
+}
+
+/* Worker: keep taking the next strip until there are none left or someone says stop */
+static void CompareRastersPartial(const CompareJob * pJob, ComparePartial * pPartial){
+
+    GDALDataset * pDS1 = NULL;
+    GDALDataset * pDS2 = NULL;
+    int nStripCells = pJob->nCols * pJob->nStripRows;
+    double * pStrip1 = (double *) CPLMalloc(sizeof(double) * nStripCells);
+    double * pStrip2 = (double *) CPLMalloc(sizeof(double) * nStripCells);
+    double * pDiff = NULL;
+    if (pJob->pRBDiff != NULL)
+        pDiff = (double *) CPLMalloc(sizeof(double) * nStripCells);
+
+    pPartial->nErrorCode = PROCESS_OK;
+
+    try {
+        // Every worker gets its own handles. GDAL datasets can't be shared between threads.
+        pDS1 = (GDALDataset*) GDALOpen(pJob->sRaster1.c_str(), GA_ReadOnly);
+        if (pDS1 == NULL)
+            throw RasterManagerException(INPUT_FILE_ERROR, CPLGetLastErrorMsg());
+        pDS2 = (GDALDataset*) GDALOpen(pJob->sRaster2.c_str(), GA_ReadOnly);
+        if (pDS2 == NULL)
+            throw RasterManagerException(INPUT_FILE_ERROR, CPLGetLastErrorMsg());
+        GDALRasterBand * pRB1 = pDS1->GetRasterBand(1);
+        GDALRasterBand * pRB2 = pDS2->GetRasterBand(1);
+
+        int nStrips = (pJob->nRows + pJob->nStripRows - 1) / pJob->nStripRows;
+
+        for (int nStrip = pJob->pNextStrip->fetchAndAddOrdered(1); nStrip < nStrips && pJob->pStop->loadAcquire() == 0;
+             nStrip = pJob->pNextStrip->fetchAndAddOrdered(1)){
+
+            int nRow = nStrip * pJob->nStripRows;
+            int nRows = std::min(pJob->nStripRows, pJob->nRows - nRow);
+
+            CPLErr err = pRB1->RasterIO(GF_Read, 0, nRow, pJob->nCols, nRows, pStrip1, pJob->nCols, nRows, GDT_Float64, 0, 0);
+            if (err == CE_None)
+                err = pRB2->RasterIO(GF_Read, 0, nRow, pJob->nCols, nRows, pStrip2, pJob->nCols, nRows, GDT_Float64, 0, 0);
+            if (err == CE_Failure || err == CE_Fatal)
+                throw RasterManagerException(INPUT_FILE_ERROR, CPLGetLastErrorMsg());
+
+            long long nStripCellsRead = (long long) pJob->nCols * nRows;
+            for (long long n = 0; n < nStripCellsRead; n++){
+
+                double f1 = pStrip1[n];
+                double f2 = pStrip2[n];
+                bool bNoData1 = pJob->bHasNoData1 && f1 == pJob->fNoData1;
+                bool bNoData2 = pJob->bHasNoData2 && f2 == pJob->fNoData2;
+
+                bool bMatch;
+                if (bNoData1 || bNoData2){
+                    bMatch = bNoData1 && bNoData2;
+                    if (pDiff != NULL)
+                        pDiff[n] = pJob->fDiffNoData;
+                }
+                else {
+                    double fAbsDiff = fabs(f1 - f2);
+                    bMatch = CompareCellValues(f1, f2, pJob->fTolerance);
+                    if (fAbsDiff > pPartial->fMaxAbsDiff)
+                        pPartial->fMaxAbsDiff = fAbsDiff;
+                    if (pDiff != NULL)
+                        pDiff[n] = f1 - f2;
+                }
+
+                if (!bMatch){
+                    long long nCell = (long long) nRow * pJob->nCols + n;
+                    pPartial->nDiffCells++;
+                    if (pPartial->nFirstDiff < 0 || nCell < pPartial->nFirstDiff)
+                        pPartial->nFirstDiff = nCell;
+
+                    // One is enough unless someone wants the whole picture
+                    if (!pJob->bFullReport){
+                        pJob->pStop->storeRelease(1);
+                        pPartial->nCellsCompared += n + 1;
+                        break;
+                    }
+                }
+            }
+
+            if (!pJob->bFullReport && pPartial->nDiffCells > 0)
+                break;
+            pPartial->nCellsCompared += nStripCellsRead;
+
+            if (pDiff != NULL){
+                {
+                    QMutexLocker lock(pJob->pWriteLock);
+                    err = pJob->pRBDiff->RasterIO(GF_Write, 0, nRow, pJob->nCols, nRows, pDiff, pJob->nCols, nRows, GDT_Float64, 0, 0);
+                }
+                if (err == CE_Failure || err == CE_Fatal)
+                    throw RasterManagerException(OUTPUT_FILE_ERROR, CPLGetLastErrorMsg());
+
+                for (int i = 0; i < nRows; i++)
+                    pPartial->pStats->AddLine(pDiff + (qint64) i * pJob->nCols, pJob->nCols);
+            }
+        }
+    }
+    catch (RasterManagerException e){
+        pPartial->nErrorCode = e.GetErrorCode();
+        pPartial->sError = e.GetEvidence();
+        // Nobody else needs to keep going either
+        pJob->pStop->storeRelease(1);
+    }
+
+    CPLFree(pStrip1);
+    CPLFree(pStrip2);
+    if (pDiff != NULL)
+        CPLFree(pDiff);
+    if (pDS1 != NULL)
+        GDALClose(pDS1);
+    if (pDS2 != NULL)
+        GDALClose(pDS2);
+}
+
+int Raster::CompareRasters(const char * psRaster1, const char * psRaster2, double fTolerance,
+                           const char * psDiffRaster, bool bFullReport, RasterDiffReport * pReport){
+
+    CheckFile(psRaster1, true);
+    CheckFile(psRaster2, true);
+
+    if (pReport == NULL)
+        throw RasterManagerException(MISSING_ARGUMENT, "A report is required.");
+    if (fTolerance < 0)
+        throw RasterManagerException(ARGUMENT_VALIDATION, QString("Invalid tolerance: %1").arg(fTolerance));
+
+    bool bDiffRaster = psDiffRaster != NULL && psDiffRaster[0] != '\0';
+    if (bDiffRaster){
+        CheckFile(psDiffRaster, false);
+        bFullReport = true;
+    }
+
+    pReport->bConcurrent = false;
+    pReport->nCellsCompared = 0;
+    pReport->nDiffCells = 0;
+    pReport->fMaxAbsDiff = 0;
+    pReport->nFirstDiffRow = -1;
+    pReport->nFirstDiffCol = -1;
+
+    // The metadata is cheap so check it before touching any cells
+    RasterMeta meta1(psRaster1);
+    RasterMeta meta2(psRaster2);
+    if (!meta1.IsConcurrent(&meta2))
+        return RASTER_COMPARISON;
+    pReport->bConcurrent = true;
+
+    CompareJob job;
+    job.sRaster1 = std::string(psRaster1);
+    job.sRaster2 = std::string(psRaster2);
+    job.nCols = meta1.GetCols();
+    job.nRows = meta1.GetRows();
+    job.fTolerance = fTolerance;
+    job.bFullReport = bFullReport;
+    job.bHasNoData1 = meta1.HasNoDataValue();
+    job.fNoData1 = meta1.GetNoDataValue();
+    job.bHasNoData2 = meta2.HasNoDataValue();
+    job.fNoData2 = meta2.GetNoDataValue();
+
+    GDALDataset * pDS1 = (GDALDataset*) GDALOpen(psRaster1, GA_ReadOnly);
+    if (pDS1 == NULL)
+        throw RasterManagerException(INPUT_FILE_ERROR, CPLGetLastErrorMsg());
+    int nBlockX, nBlockY;
+    pDS1->GetRasterBand(1)->GetBlockSize(&nBlockX, &nBlockY);
+    GDALClose(pDS1);
+
+    job.nStripRows = std::max(1, nBlockY);
+    while (job.nStripRows < COMPARE_MIN_STRIP_ROWS)
+        job.nStripRows += std::max(1, nBlockY);
+    job.nStripRows = std::max(1, std::min(job.nStripRows, job.nRows));
+
+    // The difference raster is written a strip at a time so there's no pre-fill
+    GDALDataset * pDSDiff = NULL;
+    job.pRBDiff = NULL;
+    job.fDiffNoData = (double) -std::numeric_limits<float>::max();
+    if (bDiffRaster){
+        RasterMeta diffMeta(psRaster1);
+        GDALDataType diffDataType = GDT_Float64;
+        diffMeta.SetGDALDataType(&diffDataType);
+        diffMeta.SetNoDataValue(&job.fDiffNoData);
+        pDSDiff = CreateOutputDS(psDiffRaster, &diffMeta, true);
+        job.pRBDiff = pDSDiff->GetRasterBand(1);
+    }
+
+    // Strips go to whichever worker is free next, top to bottom
+    QMutex writeLock;
+    QAtomicInt nextStrip(0);
+    QAtomicInt stop(0);
+    job.pWriteLock = &writeLock;
+    job.pNextStrip = &nextStrip;
+    job.pStop = &stop;
+
+    int nStrips = (job.nRows + job.nStripRows - 1) / job.nStripRows;
+    int nWorkers = std::max(1, std::min(QThread::idealThreadCount(), nStrips));
+    std::vector<ComparePartial> partials(nWorkers);
+    QList< QFuture<void> > lFutures;
+    for (int w = 0; w < nWorkers; w++){
+        partials[w].nCellsCompared = 0;
+        partials[w].nDiffCells = 0;
+        partials[w].fMaxAbsDiff = 0;
+        partials[w].nFirstDiff = -1;
+        partials[w].pStats = job.pRBDiff != NULL ? new StatsAccumulator(job.pRBDiff) : NULL;
+        lFutures.append(QtConcurrent::run(CompareRastersPartial, &job, &partials[w]));
+    }
+    for (int w = 0; w < lFutures.size(); w++)
+        lFutures[w].waitForFinished();
+
+    StatsAccumulator * pDiffStats = job.pRBDiff != NULL ? new StatsAccumulator(job.pRBDiff) : NULL;
+    int nErrorCode = PROCESS_OK;
+    QString sError;
+    long long nFirstDiff = -1;
+    for (int w = 0; w < nWorkers; w++){
+        if (partials[w].nErrorCode != PROCESS_OK && nErrorCode == PROCESS_OK){
+            nErrorCode = partials[w].nErrorCode;
+            sError = partials[w].sError;
+        }
+        pReport->nCellsCompared += partials[w].nCellsCompared;
+        pReport->nDiffCells += partials[w].nDiffCells;
+        pReport->fMaxAbsDiff = std::max(pReport->fMaxAbsDiff, partials[w].fMaxAbsDiff);
+        if (partials[w].nFirstDiff >= 0 && (nFirstDiff < 0 || partials[w].nFirstDiff < nFirstDiff))
+            nFirstDiff = partials[w].nFirstDiff;
+        if (pDiffStats != NULL){
+            pDiffStats->Merge(*partials[w].pStats);
+            delete partials[w].pStats;
+        }
+    }
+
+    if (nFirstDiff >= 0){
+        pReport->nFirstDiffRow = (int) (nFirstDiff / job.nCols);
+        pReport->nFirstDiffCol = (int) (nFirstDiff % job.nCols);
+    }
+
+    if (pDSDiff != NULL){
+        if (nErrorCode == PROCESS_OK)
+            CalculateStats(job.pRBDiff, pDiffStats);
+        CloseOutputDS(pDSDiff);
+        delete pDiffStats;
+    }
+
+    if (nErrorCode != PROCESS_OK)
+        throw RasterManagerException(nErrorCode, sError);
+
+    if (pReport->nDiffCells > 0)
+        return RASTER_COMPARISON;
+
+    return PROCESS_OK;
+}
+
+}
@@ -89,8 +89,9 @@ int Raster::MakeRasterConcurrent(const char * csRasters, const char * csRasterOu
         sOutputFileName = sRasterOutputTokens.substr(0,sRasterOutputTokens.find_first_of(";"));
         sRasterOutputTokens = sRasterOutputTokens.substr(sRasterOutputTokens.find_first_of(";") + 1);
 
-        // Create the output dataset for writing
-        GDALDataset * pDSOutput = CreateOutputDS(sOutputFileName.c_str(), &MasterMeta);
+        // Create the output dataset for writing. Every row is written once below so there's no pre-fill.
+        GDALDataset * pDSOutput = CreateOutputDS(sOutputFileName.c_str(), &MasterMeta, true);
+        GDALRasterBand * pRBOutput = pDSOutput->GetRasterBand(1);
         double * pOutputLine = (double *) CPLMalloc(sizeof(double)*MasterMeta.GetCols());
 
         GDALDataset * pDS = (GDALDataset*) GDALOpen(sInPutFileName.c_str(), GA_ReadOnly);
@@ -98,49 +99,45 @@ int Raster::MakeRasterConcurrent(const char * csRasters, const char * csRasterOu
 
         RasterMeta inputMeta (sInPutFileName.c_str());
 
-        /*****************************************************************************************
-         * Loop over the output file to make sure every cell gets a value of fNoDataValue
-         * Every line is the same so we can have the for loops adjacent
-         */
-        for (int outj = 0; outj < MasterMeta.GetCols(); outj++){
-            pOutputLine[outj] = dNoDataValue;
-        }
-        for (int outi = 0; outi < MasterMeta.GetRows(); outi++){
-            pDSOutput->GetRasterBand(1)->RasterIO(GF_Write, 0,  outi, MasterMeta.GetCols(), 1, pOutputLine, MasterMeta.GetCols(), 1, GDT_Float64, 0, 0);
-        }
-
         // We need to figure out where in the output the input lives.
         int trans_i = MasterMeta.GetRowTranslation(&inputMeta);
         int trans_j = MasterMeta.GetColTranslation(&inputMeta);
 
         double * pInputLine = (double *) CPLMalloc(sizeof(double)*pRBInput->GetXSize());
 
-        for (i = 0; i < pRBInput->GetYSize(); i++){
-            if (i - trans_i <= MasterMeta.GetRows() ){
-                pRBInput->RasterIO(GF_Read, 0,  i, pRBInput->GetXSize(), 1, pInputLine, pRBInput->GetXSize(), 1, GDT_Float64, 0, 0);
-                // here's where we need to get the correct row of the output. Replace
-                pDSOutput->GetRasterBand(1)->RasterIO(GF_Read, 0,  i- trans_i, MasterMeta.GetCols(), 1, pOutputLine, MasterMeta.GetCols(), 1, GDT_Float64, 0, 0);
+        StatsAccumulator outputStats(pRBOutput);
+
+        /*****************************************************************************************
+         * Build each output row from NoData and whatever part of the input reaches it
+         */
+        for (i = 0; i < MasterMeta.GetRows(); i++){
+
+            for (j = 0; j < MasterMeta.GetCols(); j++)
+                pOutputLine[j] = dNoDataValue;
+
+            int nInputRow = i + trans_i;
+            if (nInputRow >= 0 && nInputRow < pRBInput->GetYSize()){
+                pRBInput->RasterIO(GF_Read, 0,  nInputRow, pRBInput->GetXSize(), 1, pInputLine, pRBInput->GetXSize(), 1, GDT_Float64, 0, 0);
 
                 for (j = 0; j < pRBInput->GetXSize(); j++){
-                    // If the input line is empty then do nothing
-                    if ( trans_j+j <= MasterMeta.GetCols()
-                         && pInputLine[j] != inputMeta.GetNoDataValue()
-                         && pOutputLine[trans_j+j] ==  MasterMeta.GetNoDataValue() )
+                    // If the input cell is empty then do nothing
+                    if ( trans_j+j >= 0 && trans_j+j < MasterMeta.GetCols()
+                         && pInputLine[j] != inputMeta.GetNoDataValue() )
                     {
                         pOutputLine[trans_j+j] = pInputLine[j];
                     }
                 }
-                // here's where we need to get the correct row of the output. Replace
-                pDSOutput->GetRasterBand(1)->RasterIO(GF_Write, 0,  i - trans_i, MasterMeta.GetCols(), 1, pOutputLine, MasterMeta.GetCols(), 1, GDT_Float64, 0, 0);
             }
 
+            pRBOutput->RasterIO(GF_Write, 0,  i, MasterMeta.GetCols(), 1, pOutputLine, MasterMeta.GetCols(), 1, GDT_Float64, 0, 0);
+            outputStats.AddLine(pOutputLine, MasterMeta.GetCols());
         }
         CPLFree(pOutputLine);
         CPLFree(pInputLine);
 
-        CalculateStats(pDSOutput->GetRasterBand(1));
+        CalculateStats(pRBOutput, &outputStats);
         GDALClose(pDS);
-        GDALClose(pDSOutput);
+        CloseOutputDS(pDSOutput);
     }
     return PROCESS_OK;
 }
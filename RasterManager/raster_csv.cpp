@@ -9,13 +9,544 @@
 
 #include <limits>
 #include <math.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
 #include <QFile>
 #include <QStringList>
 #include <QTextStream>
 #include <QFileInfo>
+#include <QTemporaryFile>
+#include <QtEndian>
+#include <QThread>
+#include <QtConcurrent>
 
 namespace RasterManager {
 
+// Bytes of CSV text each parser task gets. Chunks always end on a line break.
+const qint64 CSV_CHUNK_BYTES = 8 * 1024 * 1024;
+
+// Output strips we hold in memory before the least recently used get parked in a
+// scratch file. Parked strips come back before they are written so each one still
+// hits the raster exactly once.
+const qint64 CSV_STRIP_CACHE_BYTES = (qint64) 1024 * 1024 * 1024;
+
+// Strips are whole block rows but never thinner than this
+const int CSV_MIN_STRIP_ROWS = 64;
+
+// Exported strips never hold more cells than this. Rasters with taller blocks (e.g. a
+// striped GeoTIFF that is one block) get read a few rows at a time inside the block.
+const qint64 CSV_MAX_STRIP_CELLS = 4 * 1024 * 1024;
+
+// Rough length of one formatted line. Only used to size the text buffer up front.
+const qint64 CSV_EXPORT_LINE_BYTES = 24;
+
+/* What the parsers need to turn a line into a cell. Shared read-only. */
+struct CSVParseJob
+{
+    int nXCol;
+    int nYCol;
+    int nZCol;
+    int nMaxCol;
+    double fLeft;
+    double fTop;
+    double fCellWidth;
+    double fCellHeight;
+    int nRows;
+    int nCols;
+    double fNoData;
+    int eMethod;
+    double fRadius;
+    double fPower;
+};
+
+/* One point near enough to the raster to matter. nCell is -1 for points
+ * outside it that are still within the IDW radius of its edge. */
+struct CSVPoint
+{
+    qint64 nCell;
+    double fX;
+    double fY;
+    double fValue;
+};
+
+/* A run of whole lines and the points parsed out of it */
+struct CSVChunk
+{
+    QByteArray baText;
+    std::vector<CSVPoint> vPoints;
+};
+
+/* Hands out the CSV in line-aligned chunks. When the file can be memory mapped
+ * the chunks point straight into the mapping so nothing gets copied. */
+class CSVChunkReader {
+public:
+    CSVChunkReader(QFile * pFile) : m_pFile(pFile), m_pMap(NULL), m_nPos(0) {
+        m_nSize = pFile->size();
+        if (m_nSize > 0)
+            m_pMap = pFile->map(0, m_nSize);
+    }
+
+    void ReadHeader(QString & sHeader){
+        if (m_pMap == NULL){
+            sHeader = QString::fromUtf8(m_pFile->readLine());
+            return;
+        }
+        const char * pStart = (const char *) m_pMap;
+        const char * pEOL = (const char *) memchr(pStart, '\n', (size_t) m_nSize);
+        m_nPos = pEOL == NULL ? m_nSize : (pEOL - pStart) + 1;
+        sHeader = QString::fromUtf8(pStart, (int) (pEOL == NULL ? m_nSize : pEOL - pStart));
+    }
+
+    bool Next(QByteArray & baChunk){
+        if (m_pMap == NULL){
+            baChunk = m_pFile->read(CSV_CHUNK_BYTES);
+            if (baChunk.isEmpty())
+                return false;
+            if (!baChunk.endsWith('\n') && !m_pFile->atEnd())
+                baChunk += m_pFile->readLine();
+            return true;
+        }
+
+        if (m_nPos >= m_nSize)
+            return false;
+
+        qint64 nEnd = std::min(m_nSize, m_nPos + CSV_CHUNK_BYTES);
+        if (nEnd < m_nSize){
+            const uchar * pEOL = (const uchar *) memchr(m_pMap + nEnd, '\n', (size_t) (m_nSize - nEnd));
+            nEnd = pEOL == NULL ? m_nSize : (pEOL - m_pMap) + 1;
+        }
+        baChunk = QByteArray::fromRawData((const char *) m_pMap + m_nPos, (int) (nEnd - m_nPos));
+        m_nPos = nEnd;
+        return true;
+    }
+
+private:
+    QFile * m_pFile;
+    uchar * m_pMap;
+    qint64 m_nSize;
+    qint64 m_nPos;
+};
+
+static const double CSV_POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+/* Parse a plain decimal number that fills [p, pEnd) exactly.
+ * A mantissa under 2^53 scaled by at most 10^22 needs only one rounding so it
+ * matches strtod bit for bit. Everything else (long mantissas, big exponents,
+ * nan, inf) is handed to CPLStrtod, which ignores the locale like toDouble did. */
+static bool CSVParseDouble(const char * p, const char * pEnd, double & fValue){
+
+    const char * pStart = p;
+    bool bNegative = false;
+    if (p < pEnd && (*p == '-' || *p == '+')){
+        bNegative = *p == '-';
+        p++;
+    }
+
+    quint64 nMantissa = 0;
+    int nDigits = 0;
+    int nExponent = 0;
+    bool bDigits = false;
+    bool bTruncated = false;
+
+    for (; p < pEnd && *p >= '0' && *p <= '9'; p++){
+        bDigits = true;
+        if (nDigits < 19){
+            nMantissa = nMantissa * 10 + (*p - '0');
+            if (nMantissa > 0)
+                nDigits++;
+        }
+        else{
+            nExponent++;
+            bTruncated = bTruncated || *p != '0';
+        }
+    }
+    if (p < pEnd && *p == '.'){
+        for (p++; p < pEnd && *p >= '0' && *p <= '9'; p++){
+            bDigits = true;
+            if (nDigits < 19){
+                nMantissa = nMantissa * 10 + (*p - '0');
+                if (nMantissa > 0)
+                    nDigits++;
+                nExponent--;
+            }
+            else
+                bTruncated = bTruncated || *p != '0';
+        }
+    }
+    if (bDigits && p < pEnd && (*p == 'e' || *p == 'E')){
+        p++;
+        bool bNegExp = false;
+        if (p < pEnd && (*p == '-' || *p == '+')){
+            bNegExp = *p == '-';
+            p++;
+        }
+        if (p == pEnd || *p < '0' || *p > '9')
+            return false;
+        int nExp = 0;
+        for (; p < pEnd && *p >= '0' && *p <= '9'; p++)
+            if (nExp < 100000)
+                nExp = nExp * 10 + (*p - '0');
+        nExponent += bNegExp ? -nExp : nExp;
+    }
+
+    if (bDigits && p == pEnd && !bTruncated
+            && nMantissa <= ((quint64) 1 << 53) && nExponent >= -22 && nExponent <= 22){
+        fValue = (double) nMantissa;
+        fValue = nExponent < 0 ? fValue / CSV_POW10[-nExponent] : fValue * CSV_POW10[nExponent];
+        if (bNegative)
+            fValue = -fValue;
+        return true;
+    }
+
+    // Slow path. CPLStrtod needs a terminated string.
+    QByteArray baField(pStart, (int) (pEnd - pStart));
+    char * pParsed = NULL;
+    fValue = CPLStrtod(baField.constData(), &pParsed);
+    return pParsed != baField.constData() && *pParsed == '\0';
+}
+
+static inline bool CSVSpace(char c){
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/* Same trimming as CSVCellClean: whitespace, then one pair of quotes, then whitespace */
+bool Raster::CSVParseField(const char * p, const char * pEnd, double & fValue){
+    while (p < pEnd && CSVSpace(*p))
+        p++;
+    while (pEnd > p && CSVSpace(pEnd[-1]))
+        pEnd--;
+    if (pEnd - p >= 2 && *p == '"' && pEnd[-1] == '"'){
+        p++;
+        pEnd--;
+        while (p < pEnd && CSVSpace(*p))
+            p++;
+        while (pEnd > p && CSVSpace(pEnd[-1]))
+            pEnd--;
+    }
+    if (p == pEnd)
+        return false;
+    return CSVParseDouble(p, pEnd, fValue);
+}
+
+/* Worker: turn a chunk of lines into points. Lines that miss the raster or
+ * don't have a usable X and Y are dropped. A blank or unreadable value is NoData. */
+static void CSVParseChunk(CSVChunk * pChunk, const CSVParseJob * pJob){
+
+    const char * p = pChunk->baText.constData();
+    const char * pEnd = p + pChunk->baText.size();
+    pChunk->vPoints.reserve(pChunk->baText.size() / 32);
+
+    while (p < pEnd){
+        const char * pEOL = (const char *) memchr(p, '\n', pEnd - p);
+        if (pEOL == NULL)
+            pEOL = pEnd;
+
+        double fX = 0, fY = 0;
+        double fZ = pJob->fNoData;
+        bool bX = false, bY = false;
+
+        const char * pField = p;
+        for (int nField = 0; nField <= pJob->nMaxCol; nField++){
+            const char * pComma = (const char *) memchr(pField, ',', pEOL - pField);
+            const char * pFieldEnd = pComma == NULL ? pEOL : pComma;
+
+            if (nField == pJob->nXCol)
+                bX = Raster::CSVParseField(pField, pFieldEnd, fX);
+            else if (nField == pJob->nYCol)
+                bY = Raster::CSVParseField(pField, pFieldEnd, fY);
+            else if (nField == pJob->nZCol){
+                if (!Raster::CSVParseField(pField, pFieldEnd, fZ))
+                    fZ = pJob->fNoData;
+            }
+
+            if (pComma == NULL)
+                break;
+            pField = pComma + 1;
+        }
+
+        if (bX && bY){
+            double fCol = floor((fX - pJob->fLeft) / pJob->fCellWidth);
+            double fRow = floor((pJob->fTop - fY) / pJob->fCellHeight * -1);
+            bool bInside = fCol >= 0 && fCol < pJob->nCols && fRow >= 0 && fRow < pJob->nRows;
+            bool bNear = bInside;
+            if (!bInside && pJob->fRadius > 0){
+                // Outside points only matter if the radius reaches back over the edge
+                double fRight = pJob->fLeft + pJob->nCols * pJob->fCellWidth;
+                double fBottom = pJob->fTop - pJob->nRows * fabs(pJob->fCellHeight);
+                bNear = fX >= pJob->fLeft - pJob->fRadius && fX <= fRight + pJob->fRadius
+                        && fY >= fBottom - pJob->fRadius && fY <= pJob->fTop + pJob->fRadius;
+            }
+            if (bNear){
+                CSVPoint point;
+                point.nCell = bInside ? (qint64) fRow * pJob->nCols + (qint64) fCol : -1;
+                point.fX = fX;
+                point.fY = fY;
+                point.fValue = fZ;
+                pChunk->vPoints.push_back(point);
+            }
+        }
+        p = pEOL + 1;
+    }
+}
+
+/* In-memory output strips (whole block rows, full width). Strips are only
+ * created once a point lands in them. When too many are live the least
+ * recently touched one is parked in a scratch file until it's needed again.
+ *
+ * Each strip holds the accumulator planes for the gridding method back to
+ * back: the value (last, min, max), the count (count), sum and count (mean),
+ * or the weighted sum and the sum of weights (idw). Cell() points at the first
+ * plane and the second one is PlaneStride() further on. Cells are only turned
+ * into output values when their strip is flushed. */
+class CSVStripCache {
+public:
+    CSVStripCache(int nRows, int nCols, int nStripRows, double fNoData, int eMethod)
+        : m_nRows(nRows), m_nCols(nCols), m_nStripRows(nStripRows), m_fNoData(fNoData), m_eMethod(eMethod),
+          m_nLive(0), m_nClock(0), m_nLastStrip(-1), m_pLastStrip(NULL), m_pScratch(NULL) {
+        int nStrips = (nRows + nStripRows - 1) / nStripRows;
+        m_nStripCells = (qint64) nCols * nStripRows;
+        m_nPlanes = (eMethod == GRID_MEAN || eMethod == GRID_IDW) ? 2 : 1;
+        m_vStrips.assign(nStrips, (double *) NULL);
+        m_vLastUse.assign(nStrips, 0);
+        m_vParked.assign(nStrips, false);
+        m_nMaxLive = std::max((qint64) 1, CSV_STRIP_CACHE_BYTES / StripBytes());
+    }
+
+    ~CSVStripCache(){
+        for (size_t n = 0; n < m_vStrips.size(); n++)
+            if (m_vStrips[n] != NULL)
+                CPLFree(m_vStrips[n]);
+        delete m_pScratch;
+    }
+
+    inline double * Cell(qint64 nCell){
+        int nStrip = (int) (nCell / m_nStripCells);
+        if (nStrip != m_nLastStrip){
+            m_pLastStrip = Strip(nStrip);
+            m_nLastStrip = nStrip;
+        }
+        return m_pLastStrip + (nCell - (qint64) nStrip * m_nStripCells);
+    }
+
+    inline qint64 PlaneStride() const { return m_nStripCells; }
+
+    /* Write every strip top to bottom and free it. Strips no point reached just get NoData. */
+    void Flush(GDALRasterBand * pRB, StatsAccumulator * pStats){
+        for (int n = 0; n < (int) m_vStrips.size(); n++){
+            int nRow = n * m_nStripRows;
+            int nRows = std::min(m_nStripRows, m_nRows - nRow);
+            if (m_vStrips[n] == NULL && !m_vParked[n]){
+                FillOutputRows(pRB, nRow, nRows, m_fNoData);
+                continue;
+            }
+
+            double * pStrip = Strip(n);
+            Finalize(pStrip, (qint64) nRows * m_nCols);
+            if (pRB->RasterIO(GF_Write, 0, nRow, m_nCols, nRows, pStrip, m_nCols, nRows, GDT_Float64, 0, 0) != CE_None)
+                throw RasterManagerException(OUTPUT_FILE_ERROR, "Could not write to the output raster.");
+            for (int i = 0; i < nRows; i++)
+                pStats->AddLine(pStrip + (qint64) i * m_nCols, m_nCols);
+
+            CPLFree(pStrip);
+            m_vStrips[n] = NULL;
+            m_vParked[n] = false;
+            m_nLive--;
+        }
+        m_nLastStrip = -1;
+        m_pLastStrip = NULL;
+    }
+
+private:
+    inline qint64 StripBytes() const { return m_nPlanes * m_nStripCells * (qint64) sizeof(double); }
+
+    /* Turn the accumulators into output values in the first plane */
+    void Finalize(double * pStrip, qint64 nCells){
+        const double * pSecond = pStrip + m_nStripCells;
+        switch (m_eMethod){
+        case GRID_COUNT:
+            for (qint64 i = 0; i < nCells; i++)
+                if (pStrip[i] == 0)
+                    pStrip[i] = m_fNoData;
+            break;
+        case GRID_MEAN:
+        case GRID_IDW:
+            // Sum over count, or weighted sum over total weight
+            for (qint64 i = 0; i < nCells; i++)
+                pStrip[i] = pSecond[i] > 0 ? pStrip[i] / pSecond[i] : m_fNoData;
+            break;
+        default:
+            break;
+        }
+    }
+
+    double * Strip(int nStrip){
+        m_vLastUse[nStrip] = ++m_nClock;
+        if (m_vStrips[nStrip] != NULL)
+            return m_vStrips[nStrip];
+
+        if (m_nLive >= m_nMaxLive)
+            Park();
+
+        double * pStrip = (double *) CPLMalloc(StripBytes());
+        if (m_vParked[nStrip]){
+            qint64 nBytes = StripBytes();
+            if (!m_pScratch->seek(nStrip * nBytes) || m_pScratch->read((char *) pStrip, nBytes) != nBytes){
+                CPLFree(pStrip);
+                throw RasterManagerException(INPUT_FILE_ERROR, "Could not read back a parked raster strip: " + m_pScratch->errorString());
+            }
+        }
+        else if (m_eMethod == GRID_LAST || m_eMethod == GRID_MINIMUM || m_eMethod == GRID_MAXIMUM)
+            std::fill(pStrip, pStrip + m_nStripCells, m_fNoData);
+        else
+            std::fill(pStrip, pStrip + m_nPlanes * m_nStripCells, 0.0);
+
+        m_vStrips[nStrip] = pStrip;
+        m_nLive++;
+        return pStrip;
+    }
+
+    void Park(){
+        int nOldest = -1;
+        for (int n = 0; n < (int) m_vStrips.size(); n++)
+            if (m_vStrips[n] != NULL && (nOldest < 0 || m_vLastUse[n] < m_vLastUse[nOldest]))
+                nOldest = n;
+
+        if (m_pScratch == NULL){
+            m_pScratch = new QTemporaryFile();
+            if (!m_pScratch->open())
+                throw RasterManagerException(OUTPUT_FILE_ERROR, "Could not create a temporary file for raster strips.");
+        }
+
+        qint64 nBytes = StripBytes();
+        if (!m_pScratch->seek(nOldest * nBytes) || m_pScratch->write((const char *) m_vStrips[nOldest], nBytes) != nBytes)
+            throw RasterManagerException(OUTPUT_FILE_ERROR, "Could not park a raster strip: " + m_pScratch->errorString());
+
+        CPLFree(m_vStrips[nOldest]);
+        m_vStrips[nOldest] = NULL;
+        m_vParked[nOldest] = true;
+        m_nLive--;
+        if (nOldest == m_nLastStrip){
+            m_nLastStrip = -1;
+            m_pLastStrip = NULL;
+        }
+    }
+
+    int m_nRows;
+    int m_nCols;
+    int m_nStripRows;
+    double m_fNoData;
+    int m_eMethod;
+    int m_nPlanes;
+    qint64 m_nStripCells;
+    qint64 m_nMaxLive;
+    qint64 m_nLive;
+    qint64 m_nClock;
+    int m_nLastStrip;
+    double * m_pLastStrip;
+    std::vector<double *> m_vStrips;
+    std::vector<qint64> m_vLastUse;
+    std::vector<bool> m_vParked;
+    QTemporaryFile * m_pScratch;
+};
+
+/* Feed one IDW point to every cell centre within the search radius */
+static void CSVAccumulateIDW(CSVStripCache & cache, const CSVPoint & point, const CSVParseJob & job){
+
+    double fCellHeight = fabs(job.fCellHeight);
+    int nColMin = std::max(0, (int) floor((point.fX - job.fRadius - job.fLeft) / job.fCellWidth));
+    int nColMax = std::min(job.nCols - 1, (int) floor((point.fX + job.fRadius - job.fLeft) / job.fCellWidth));
+    int nRowMin = std::max(0, (int) floor((job.fTop - point.fY - job.fRadius) / fCellHeight));
+    int nRowMax = std::min(job.nRows - 1, (int) floor((job.fTop - point.fY + job.fRadius) / fCellHeight));
+
+    // A point sitting right on a centre still needs a finite weight
+    double fMinDistance = job.fCellWidth * 1e-6;
+    double fRadius2 = job.fRadius * job.fRadius;
+
+    for (int i = nRowMin; i <= nRowMax; i++){
+        double fDY = job.fTop - (i + 0.5) * fCellHeight - point.fY;
+        for (int j = nColMin; j <= nColMax; j++){
+            double fDX = job.fLeft + (j + 0.5) * job.fCellWidth - point.fX;
+            double fDist2 = fDX * fDX + fDY * fDY;
+            if (fDist2 > fRadius2)
+                continue;
+            double fWeight = pow(std::max(sqrt(fDist2), fMinDistance), -job.fPower);
+            double * pCell = cache.Cell((qint64) i * job.nCols + j);
+            pCell[0] += fWeight * point.fValue;
+            pCell[cache.PlaneStride()] += fWeight;
+        }
+    }
+}
+
+/* Points whose value is NoData or NaN don't feed any of the accumulators */
+static inline bool CSVHasValue(double fValue, const CSVParseJob & job){
+    return fValue == fValue && fValue != job.fNoData;
+}
+
+/* Apply one chunk of points to the accumulators. Called in file order. */
+static void CSVAccumulate(CSVStripCache & cache, const std::vector<CSVPoint> & vPoints, const CSVParseJob & job){
+
+    qint64 nStride = cache.PlaneStride();
+    size_t nPoints = vPoints.size();
+
+    switch (job.eMethod){
+    case GRID_LAST:
+        // A point without a value still wins, it just leaves NoData behind
+        for (size_t i = 0; i < nPoints; i++)
+            *cache.Cell(vPoints[i].nCell) = CSVHasValue(vPoints[i].fValue, job) ? vPoints[i].fValue : job.fNoData;
+        break;
+    case GRID_COUNT:
+        for (size_t i = 0; i < nPoints; i++){
+            if (CSVHasValue(vPoints[i].fValue, job))
+                *cache.Cell(vPoints[i].nCell) += 1;
+        }
+        break;
+    case GRID_MEAN:
+        for (size_t i = 0; i < nPoints; i++){
+            if (!CSVHasValue(vPoints[i].fValue, job))
+                continue;
+            double * pCell = cache.Cell(vPoints[i].nCell);
+            pCell[0] += vPoints[i].fValue;
+            pCell[nStride] += 1;
+        }
+        break;
+    case GRID_MINIMUM:
+    case GRID_MAXIMUM:
+        for (size_t i = 0; i < nPoints; i++){
+            double fValue = vPoints[i].fValue;
+            if (!CSVHasValue(fValue, job))
+                continue;
+            double * pCell = cache.Cell(vPoints[i].nCell);
+            if (*pCell == job.fNoData
+                    || (job.eMethod == GRID_MINIMUM && fValue < *pCell)
+                    || (job.eMethod == GRID_MAXIMUM && fValue > *pCell))
+                *pCell = fValue;
+        }
+        break;
+    case GRID_IDW:
+        for (size_t i = 0; i < nPoints; i++){
+            if (!CSVHasValue(vPoints[i].fValue, job))
+                continue;
+            if (job.fRadius > 0)
+                CSVAccumulateIDW(cache, vPoints[i], job);
+            else{
+                // No radius: a point only feeds the cell it falls in
+                double fCellHeight = fabs(job.fCellHeight);
+                qint64 nRow = vPoints[i].nCell / job.nCols;
+                qint64 nCol = vPoints[i].nCell % job.nCols;
+                double fDX = job.fLeft + (nCol + 0.5) * job.fCellWidth - vPoints[i].fX;
+                double fDY = job.fTop - (nRow + 0.5) * fCellHeight - vPoints[i].fY;
+                double fWeight = pow(std::max(sqrt(fDX * fDX + fDY * fDY), job.fCellWidth * 1e-6), -job.fPower);
+                double * pCell = cache.Cell(vPoints[i].nCell);
+                pCell[0] += fWeight * vPoints[i].fValue;
+                pCell[nStride] += fWeight;
+            }
+        }
+        break;
+    }
+}
+
 int Raster::CSVtoRaster(const char * sCSVSourcePath,
                          const char * sOutput,
                          double dTop,
@@ -26,7 +557,10 @@ int Raster::CSVtoRaster(const char * sCSVSourcePath,
                          double dNoDataVal,
                          const char * sXField,
                          const char * sYField,
-                         const char * sDataField){
+                         const char * sDataField,
+                         Raster_Grid_Method eMethod,
+                         double fIDWRadius,
+                         double fIDWPower){
 
     double dCellHeight = dCellWidth * -1;
     const char * psDriver = GetDriverFromFileName(sOutput);
@@ -34,7 +568,8 @@ int Raster::CSVtoRaster(const char * sCSVSourcePath,
     RasterMeta inputRasterMeta(dTop, dLeft, nRows, nCols, &dCellHeight, &dCellWidth,
                                &dNoDataVal, psDriver, &nDType, NULL, NULL);
 
-    CSVtoRaster(sCSVSourcePath, sOutput, sXField, sYField, sDataField, &inputRasterMeta);
+    CSVtoRaster(sCSVSourcePath, sOutput, sXField, sYField, sDataField, &inputRasterMeta,
+                eMethod, fIDWRadius, fIDWPower);
 
     return PROCESS_OK;
 }
@@ -44,11 +579,15 @@ int Raster::CSVtoRaster(const char * sCSVSourcePath,
                          const char * sRasterTemplate,
                          const char * sXField,
                          const char * sYField,
-                         const char * sDataField ){
+                         const char * sDataField,
+                         Raster_Grid_Method eMethod,
+                         double fIDWRadius,
+                         double fIDWPower){
 
     RasterMeta inputRasterMeta(sRasterTemplate);
 
-    int eResult = CSVtoRaster(sCSVSourcePath, psOutput, sXField, sYField, sDataField, &inputRasterMeta);
+    int eResult = CSVtoRaster(sCSVSourcePath, psOutput, sXField, sYField, sDataField, &inputRasterMeta,
+                              eMethod, fIDWRadius, fIDWPower);
 
     return eResult;
 
@@ -59,113 +598,284 @@ int Raster::CSVtoRaster(const char * sCSVSourcePath,
                          const char * sXField,
                          const char * sYField,
                          const char * sDataField,
-                         RasterMeta * p_rastermeta ){
+                         RasterMeta * p_rastermeta,
+                         Raster_Grid_Method eMethod,
+                         double fIDWRadius,
+                         double fIDWPower){
+
+    if (eMethod < GRID_LAST || eMethod > GRID_IDW)
+        throw RasterManagerException(ARGUMENT_VALIDATION, "Unknown gridding method.");
+    if (eMethod == GRID_IDW && fIDWPower <= 0)
+        throw RasterManagerException(ARGUMENT_VALIDATION, "The IDW power must be greater than zero.");
 
     // Validate that the files are there
     CheckFile(sCSVSourcePath, true);
     CheckFile(psOutput, false);
 
+    QFile file(sCSVSourcePath);
+    if (!file.open(QIODevice::ReadOnly))
+        throw RasterManagerException(INPUT_FILE_ERROR, "Couldn't open input csv file.");
+
+    CSVChunkReader reader(&file);
+
+    // First line is the header
+    CSVParseJob job;
+    job.nXCol = -1;
+    job.nYCol = -1;
+    job.nZCol = -1;
+
+    QString sHeader;
+    reader.ReadHeader(sHeader);
+    QStringList lstHeader = sHeader.split(",");
+    for (int ncolnumber = 0; ncolnumber < lstHeader.size(); ncolnumber++){
+        QString csvItem = lstHeader.at(ncolnumber);
+        CSVCellClean(csvItem);
+        if (csvItem.compare(sXField) == 0){
+            job.nXCol = ncolnumber;
+        }
+        else if (csvItem.compare(sYField) == 0){
+            job.nYCol = ncolnumber;
+        }
+        else if (csvItem.compare(sDataField) == 0){
+            job.nZCol = ncolnumber;
+        }
+    }
+
+    // Basic checking to make sure we have parameters
+    if (job.nXCol == -1){
+        QString sErr = QString("X Field '%1' not found").arg(sXField);
+        throw RasterManagerException(MISSING_ARGUMENT, sErr);
+    }
+    else if (job.nYCol == -1){
+        QString sErr = QString("Y Column '%1' not found").arg(sYField);
+        throw RasterManagerException(MISSING_ARGUMENT, sErr);
+    }
+    else if (job.nZCol == -1){
+        QString sErr = QString("Data Column '%1' not found").arg(sDataField);
+        throw RasterManagerException(MISSING_ARGUMENT, sErr);
+    }
+
+    job.nMaxCol = std::max(job.nXCol, std::max(job.nYCol, job.nZCol));
+    job.fLeft = p_rastermeta->GetLeft();
+    job.fTop = p_rastermeta->GetTop();
+    job.fCellWidth = p_rastermeta->GetCellWidth();
+    job.fCellHeight = p_rastermeta->GetCellHeight();
+    job.nRows = p_rastermeta->GetRows();
+    job.nCols = p_rastermeta->GetCols();
+    job.fNoData = p_rastermeta->GetNoDataValue();
+    job.eMethod = eMethod;
+    job.fRadius = eMethod == GRID_IDW ? std::max(0.0, fIDWRadius) : 0;
+    job.fPower = fIDWPower;
+
     // Create the output dataset for writing
-    GDALDataset * pDSOutput = CreateOutputDS(psOutput, p_rastermeta);
+    // The strip cache writes every row itself
+    GDALDataset * pDSOutput = CreateOutputDS(psOutput, p_rastermeta, true);
+    if (pDSOutput == NULL)
+        throw RasterManagerException(OUTPUT_FILE_ERROR, "Could not create the output raster.");
+    GDALRasterBand * pRBOutput = pDSOutput->GetRasterBand(1);
 
-    int xcol=-1, ycol=-1, zcol=-1;
+    // Work in whole block rows so every strip we write lines up with what's on disk
+    int nBlockX, nBlockY;
+    pRBOutput->GetBlockSize(&nBlockX, &nBlockY);
+    int nStripRows = std::max(1, nBlockY);
+    while (nStripRows < CSV_MIN_STRIP_ROWS)
+        nStripRows += std::max(1, nBlockY);
+    nStripRows = std::max(1, std::min(nStripRows, job.nRows));
 
-    // Read CSV file into 3 different arrays
-    int nlinenumber = 0;
-    QFile file(sCSVSourcePath);
-    if (file.open(QIODevice::ReadOnly | QIODevice::Text))
-    {
-        LoopTimer LineLoop("CSV Line");  //DEBUG Only
-        LoopTimer cellLoop("ProcessCell");  //DEBUG Only
-
-        while (!file.atEnd())
-        {
-            nlinenumber++;
-            QString csvline = file.readLine();
-            QStringList lstLine = csvline.split(",");
-
-            // prepare our buffers
-            int csvX = -1;
-            int csvY = -1;
-            double csvDataVal = p_rastermeta->GetNoDataValue();
-
-            for (int ncolnumber = 0; ncolnumber < lstLine.size(); ncolnumber++){
-
-                QString csvItem = lstLine.at(ncolnumber);
-                CSVCellClean(csvItem);
-
-                //Strip the quotes off the
-                // First line is the header
-                if (nlinenumber == 1){
-                    if (csvItem.compare(sXField) == 0){
-                        xcol = ncolnumber;
-                    }
-                    else if (csvItem.compare(sYField) == 0){
-                        ycol = ncolnumber;
-                    }
-                    else if (csvItem.compare(sDataField) == 0){
-                        zcol = ncolnumber;
-                    }
-                }
-                // Not the first line read values if they apply
-                else{
-                    // Basic checking to make sure we have parameters
-                    if (xcol == -1){
-                        QString sErr = QString("X Field '%1' not found").arg(sXField);
-                        throw RasterManagerException(MISSING_ARGUMENT, sErr);
-                    }
-                    else if (ycol == -1){
-                        QString sErr = QString("Y Column '%1' not found").arg(sYField);
-                        throw RasterManagerException(MISSING_ARGUMENT, sErr);
-                    }
-                    else if (zcol == -1){
-                        QString sErr = QString("Data Column '%1' not found").arg(sDataField);
-                        throw RasterManagerException(MISSING_ARGUMENT, sErr);
-                    }
-
-                    // Assign our CSV values to an appropriate place in the raster
-                    double dVal = csvItem.toDouble();
-                    if (xcol == ncolnumber){
-                        csvX = (int) floor((dVal - p_rastermeta->GetLeft() ) / p_rastermeta->GetCellWidth());
-                    }
-                    else if (ycol == ncolnumber){
-                        csvY = (int) floor((p_rastermeta->GetTop() - dVal) / p_rastermeta->GetCellHeight() * -1);
-                    }
-                    else if (zcol == ncolnumber){
-                        if (csvItem.length() == 0)
-                            csvDataVal = p_rastermeta->GetNoDataValue();
-                        else
-                            csvDataVal = dVal;
-                    }
-                }
-                cellLoop.Tick(); //DEBUG Only
-            }
-            // here's where we need to get the correct row of the output. Replace
-            if (csvX >= 0 && csvX < p_rastermeta->GetCols()
-                    && csvY >=0 && csvY < p_rastermeta->GetRows() ){
-                pDSOutput->GetRasterBand(1)->RasterIO(GF_Write, csvX,  csvY, 1, 1, &csvDataVal, 1, 1, GDT_Float64, 0, 0);
-            }
+    CSVStripCache cache(job.nRows, job.nCols, nStripRows, job.fNoData, eMethod);
+
+    /* Parse chunks on every core but apply them strictly in file order so
+     * the last value for a cell still wins just like it always has and the
+     * sums come out the same on every run. */
+    int nWindow = 2 * std::max(1, QThread::idealThreadCount());
+    std::vector<CSVChunk> vChunks(nWindow);
+    std::vector< QFuture<void> > vFutures(nWindow);
+    long long nQueued = 0;
+    long long nDone = 0;
 
-            LineLoop.Tick(); //DEBUG Only
+    while (nQueued - nDone < nWindow && reader.Next(vChunks[nQueued % nWindow].baText)){
+        vFutures[nQueued % nWindow] = QtConcurrent::run(CSVParseChunk, &vChunks[nQueued % nWindow], &job);
+        nQueued++;
+    }
+
+    try {
+        while (nDone < nQueued){
+            int nSlot = (int) (nDone % nWindow);
+            vFutures[nSlot].waitForFinished();
+
+            CSVAccumulate(cache, vChunks[nSlot].vPoints, job);
+
+            vChunks[nSlot].vPoints.clear();
+            vChunks[nSlot].baText.clear();
+            nDone++;
+
+            if (reader.Next(vChunks[nQueued % nWindow].baText)){
+                vFutures[nQueued % nWindow] = QtConcurrent::run(CSVParseChunk, &vChunks[nQueued % nWindow], &job);
+                nQueued++;
+            }
         }
-        file.close();
 
-        LineLoop.Output();  //DEBUG Only
-        cellLoop.Output();  //DEBUG Only
+        // Every strip that got a point is finalized and goes to disk exactly once
+        StatsAccumulator outputStats(pRBOutput);
+        cache.Flush(pRBOutput, &outputStats);
+        CalculateStats(pRBOutput, &outputStats);
     }
-    else{
-        throw RasterManagerException(INPUT_FILE_ERROR, "Couldn't open input csv file.");
+    catch (...){
+        // Don't pull the chunks out from under workers that are still parsing
+        for (long long n = nDone; n < nQueued; n++)
+            vFutures[n % nWindow].waitForFinished();
+        CloseOutputDS(pDSOutput);
+        throw;
     }
 
-    CalculateStats(pDSOutput->GetRasterBand(1));
-    GDALClose(pDSOutput);
+    vChunks.clear();
+    file.close();
+    CloseOutputDS(pDSOutput);
 
     return PROCESS_OK;
 
 }
 
+/* One formatter thread's share of a strip of rows */
+struct CSVExportTask
+{
+    const double * pStrip;
+    int nStripRow;          // Raster row of the first row in pStrip
+    int nFirstRow;          // Rows of the strip this task formats
+    int nLastRow;
+    int nCols;
+    const std::vector<QByteArray> * pXText;
+    double fTop;
+    double fCellHeight;
+    int nYPrecision;
+    double fNoData;
+    bool bSkipNoData;
+    QByteArray baText;
+};
+
+/* Worker: format rows as X,Y,Value lines. The X text is the same for every
+ * row so it's made once up front and Y once per row. Only values get formatted per cell. */
+static void CSVExportRows(CSVExportTask * pTask){
+
+    pTask->baText.clear();
+    qint64 nReserve = (qint64) (pTask->nLastRow - pTask->nFirstRow) * pTask->nCols * CSV_EXPORT_LINE_BYTES;
+    pTask->baText.reserve((int) std::min(nReserve, CSV_MAX_STRIP_CELLS * CSV_EXPORT_LINE_BYTES));
+
+    QByteArray baY;
+    for (int i = pTask->nFirstRow; i < pTask->nLastRow; i++){
+        int nRow = pTask->nStripRow + i;
+        double dY = ( nRow * pTask->fCellHeight ) + pTask->fTop + pTask->fCellHeight/2;
+        baY.clear();
+        baY.append(',');
+        Raster::CSVAppendFixed(baY, dY, pTask->nYPrecision);
+        baY.append(',');
+
+        const double * pLine = pTask->pStrip + (qint64) i * pTask->nCols;
+        for (int j = 0; j < pTask->nCols; j++){
+            if (pTask->bSkipNoData && pLine[j] == pTask->fNoData)
+                continue;
+            pTask->baText.append(pTask->pXText->at(j));
+            pTask->baText.append(baY);
+            Raster::CSVAppendFixed(pTask->baText, pLine[j], 10);
+            pTask->baText.append('\n');
+        }
+    }
+}
+
+static void CSVExportWrite(QFile * pFile, const char * pData, qint64 nBytes){
+    if (pFile->write(pData, nBytes) != nBytes)
+        throw RasterManagerException(OUTPUT_FILE_ERROR, "Could not write to the output file: " + pFile->errorString());
+}
+
+/* The columnar file is little endian whatever machine wrote it */
+static void ToLittleEndian(double * pValues, size_t nValues){
+    for (size_t i = 0; i < nValues; i++){
+        quint64 nBits;
+        memcpy(&nBits, &pValues[i], sizeof(nBits));
+        nBits = qToLittleEndian(nBits);
+        memcpy(&pValues[i], &nBits, sizeof(nBits));
+    }
+}
+
+/* Columnar binary layout: the header, then every X, then every Y, then every value,
+ * all little endian float64. Y and the values go through scratch files until
+ * we know how many points there are. */
+static void RasterToColumns(GDALRasterBand * pRBInput, RasterMeta & rmRasterMeta, QFile * pOutput,
+                            int nStripRows, bool bSkipNoData){
+
+    int nCols = rmRasterMeta.GetCols();
+    int nRows = rmRasterMeta.GetRows();
+    double fNoData = rmRasterMeta.GetNoDataValue();
+
+    QTemporaryFile fileY, fileValues;
+    if (!fileY.open() || !fileValues.open())
+        throw RasterManagerException(OUTPUT_FILE_ERROR, "Could not create a temporary file for the point columns.");
+
+    // Header: magic, point count (patched at the end), nodata value
+    const char psMagic[8] = { 'R', 'M', 'X', 'Y', 'V', '0', '0', '1' };
+    CSVExportWrite(pOutput, psMagic, 8);
+    quint64 nPoints = 0;
+    CSVExportWrite(pOutput, (const char *) &nPoints, sizeof(nPoints));
+    double fNoDataLE = fNoData;
+    ToLittleEndian(&fNoDataLE, 1);
+    CSVExportWrite(pOutput, (const char *) &fNoDataLE, sizeof(fNoDataLE));
+
+    std::vector<double> vStrip((size_t) nStripRows * nCols);
+    std::vector<double> vX, vY, vValues;
+    vX.reserve(vStrip.size());
+    vY.reserve(vStrip.size());
+    vValues.reserve(vStrip.size());
+
+    for (int nRow = 0; nRow < nRows; nRow += nStripRows){
+        int nStrip = std::min(nStripRows, nRows - nRow);
+        if (pRBInput->RasterIO(GF_Read, 0, nRow, nCols, nStrip, &vStrip[0], nCols, nStrip, GDT_Float64, 0, 0) != CE_None)
+            throw RasterManagerException(INPUT_FILE_ERROR, "Could not read the input raster.");
+
+        vX.clear();
+        vY.clear();
+        vValues.clear();
+        for (int i = 0; i < nStrip; i++){
+            double dY = ( (nRow + i) * rmRasterMeta.GetCellHeight() ) + rmRasterMeta.GetTop() + rmRasterMeta.GetCellHeight()/2;
+            const double * pLine = &vStrip[(size_t) i * nCols];
+            for (int j = 0; j < nCols; j++){
+                if (bSkipNoData && pLine[j] == fNoData)
+                    continue;
+                vX.push_back(( j * rmRasterMeta.GetCellWidth() ) + rmRasterMeta.GetLeft() + rmRasterMeta.GetCellWidth()/2);
+                vY.push_back(dY);
+                vValues.push_back(pLine[j]);
+            }
+        }
+        if (vX.empty())
+            continue;
+
+        ToLittleEndian(&vX[0], vX.size());
+        ToLittleEndian(&vY[0], vY.size());
+        ToLittleEndian(&vValues[0], vValues.size());
+        qint64 nBytes = (qint64) (vX.size() * sizeof(double));
+        CSVExportWrite(pOutput, (const char *) &vX[0], nBytes);
+        CSVExportWrite(&fileY, (const char *) &vY[0], nBytes);
+        CSVExportWrite(&fileValues, (const char *) &vValues[0], nBytes);
+        nPoints += vX.size();
+    }
+
+    // Tack the Y and value columns on after the X column
+    QTemporaryFile * pColumns[2] = { &fileY, &fileValues };
+    QByteArray baCopy;
+    for (int c = 0; c < 2; c++){
+        pColumns[c]->seek(0);
+        while (!(baCopy = pColumns[c]->read(CSV_CHUNK_BYTES)).isEmpty())
+            CSVExportWrite(pOutput, baCopy.constData(), baCopy.size());
+    }
+
+    if (!pOutput->seek(8))
+        throw RasterManagerException(OUTPUT_FILE_ERROR, "Could not write the point count to the output file.");
+    quint64 nPointsLE = qToLittleEndian(nPoints);
+    CSVExportWrite(pOutput, (const char *) &nPointsLE, sizeof(nPointsLE));
+}
+
 int Raster::RasterToCSV(const char * sRasterSourcePath,
-                       const char * sOutputCSVPath){
+                       const char * sOutputCSVPath,
+                       bool bSkipNoData){
 
     CheckFile(sRasterSourcePath, true);
     CheckFile(sOutputCSVPath, false);
@@ -176,49 +886,118 @@ int Raster::RasterToCSV(const char * sRasterSourcePath,
     if (pDSInput == NULL)
         throw RasterManagerException(INPUT_FILE_ERROR, "Could not open input Raster");
 
-
     GDALRasterBand * pRBInput = pDSInput->GetRasterBand(1);
 
-    double fNoDataValue;
-    if (rmRasterMeta.GetNoDataValuePtr() == NULL){
-        fNoDataValue = (double) -std::numeric_limits<float>::max();
+    int nCols = rmRasterMeta.GetCols();
+    int nRows = rmRasterMeta.GetRows();
+
+    // Whole block rows at a time, unless that blows the cell budget. Then as many
+    // rows as fit and GDAL hands them out of the block.
+    int nBlockX, nBlockY;
+    pRBInput->GetBlockSize(&nBlockX, &nBlockY);
+    int nStripRows = std::max(1, nBlockY);
+    while (nStripRows < CSV_MIN_STRIP_ROWS)
+        nStripRows += std::max(1, nBlockY);
+    qint64 nBudgetRows = std::max((qint64) 1, CSV_MAX_STRIP_CELLS / std::max(1, nCols));
+    if ((qint64) nStripRows > nBudgetRows)
+        nStripRows = (int) nBudgetRows;
+    nStripRows = std::max(1, std::min(nStripRows, nRows));
+
+    // A .bin output gets the columnar binary layout instead of text. It can't be opened
+    // for append since the point count is patched into the header at the end.
+    bool bColumns = QFileInfo(sOutputCSVPath).suffix().compare("bin", Qt::CaseInsensitive) == 0;
+
+    QFile CSVfile(sOutputCSVPath);
+    if ( !CSVfile.open(bColumns ? (QFile::WriteOnly|QFile::Truncate) : (QFile::WriteOnly|QFile::Append)) ){
+        GDALClose(pDSInput);
+        throw RasterManagerException(OUTPUT_FILE_ERROR, "Could not open output CSV");
     }
-    else {
-        fNoDataValue = rmRasterMeta.GetNoDataValue();
+
+    if (bColumns){
+        try {
+            RasterToColumns(pRBInput, rmRasterMeta, &CSVfile, nStripRows, bSkipNoData);
+        }
+        catch (RasterManagerException e){
+            GDALClose(pDSInput);
+            throw;
+        }
+        CSVfile.close();
+        GDALClose(pDSInput);
+        return PROCESS_OK;
     }
 
-    double * pInputLine = (double *) CPLMalloc(sizeof(double)*rmRasterMeta.GetCols());
+    // The X column's text is the same on every row
+    std::vector<QByteArray> vXText(nCols);
+    for (int j = 0; j < nCols; j++){
+        double dX = ( j * rmRasterMeta.GetCellWidth() ) + rmRasterMeta.GetLeft() + rmRasterMeta.GetCellWidth()/2;
+        CSVAppendFixed(vXText[j], dX, rmRasterMeta.GetHorizontalPrecision()+1);
+    }
 
-    QFile CSVfile(sOutputCSVPath);
-    if ( CSVfile.open(QFile::WriteOnly|QFile::Append) )
-    {
-        CSVWriteLine(&CSVfile, "X,Y,Value");
-
-        for (int i = 0; i < rmRasterMeta.GetRows(); i++)
-        {
-            pRBInput->RasterIO(GF_Read, 0,  i, rmRasterMeta.GetCols(), 1, pInputLine, rmRasterMeta.GetCols(), 1, GDT_Float64, 0, 0);
-            for (int j = 0; j < rmRasterMeta.GetCols(); j++)
-            {
-                if ( pInputLine[j] != rmRasterMeta.GetNoDataValue())
-                {
-                    double dX = ( j * rmRasterMeta.GetCellWidth() ) + rmRasterMeta.GetLeft() + rmRasterMeta.GetCellWidth()/2;
-                    double dY = ( i * rmRasterMeta.GetCellHeight() ) + rmRasterMeta.GetTop() + rmRasterMeta.GetCellHeight()/2;
-
-                    QString csvLine = QString("%1,%2,%3")
-                            .arg( dX, 0, 'f', rmRasterMeta.GetHorizontalPrecision()+1 )
-                            .arg( dY, 0, 'f', rmRasterMeta.GetVerticalPrecision()+1 )
-                            .arg( pInputLine[j], 0, 'f', 10, '0' );
-
-                    CSVWriteLine(&CSVfile, csvLine);
-                }
+    /* Two strip buffers: while the formatters work on one the next one is read into
+     * the other. The formatted text is written in row order. */
+    int nTasks = std::max(1, QThread::idealThreadCount());
+    std::vector<double> vStrips[2];
+    vStrips[0].resize((size_t) nStripRows * nCols);
+    vStrips[1].resize((size_t) nStripRows * nCols);
+    std::vector<CSVExportTask> vTasks(nTasks);
+
+    try {
+        CSVExportWrite(&CSVfile, "X,Y,Value\n", 10);
+
+        int nStrips = (nRows + nStripRows - 1) / nStripRows;
+        if (nStrips > 0 && pRBInput->RasterIO(GF_Read, 0, 0, nCols, std::min(nStripRows, nRows),
+                                              &vStrips[0][0], nCols, std::min(nStripRows, nRows), GDT_Float64, 0, 0) != CE_None)
+            throw RasterManagerException(INPUT_FILE_ERROR, "Could not read the input raster.");
+
+        for (int s = 0; s < nStrips; s++){
+            int nStripRow = s * nStripRows;
+            int nStrip = std::min(nStripRows, nRows - nStripRow);
+            int nTaskRows = (nStrip + nTasks - 1) / nTasks;
+
+            QList< QFuture<void> > lFutures;
+            for (int t = 0; t < nTasks; t++){
+                CSVExportTask & task = vTasks[t];
+                task.pStrip = &vStrips[s % 2][0];
+                task.nStripRow = nStripRow;
+                task.nFirstRow = std::min(nStrip, t * nTaskRows);
+                task.nLastRow = std::min(nStrip, (t + 1) * nTaskRows);
+                task.nCols = nCols;
+                task.pXText = &vXText;
+                task.fTop = rmRasterMeta.GetTop();
+                task.fCellHeight = rmRasterMeta.GetCellHeight();
+                task.nYPrecision = rmRasterMeta.GetVerticalPrecision()+1;
+                task.fNoData = rmRasterMeta.GetNoDataValue();
+                task.bSkipNoData = bSkipNoData;
+                if (task.nFirstRow < task.nLastRow)
+                    lFutures.append(QtConcurrent::run(CSVExportRows, &task));
+            }
+
+            CPLErr eReadErr = CE_None;
+            if (s + 1 < nStrips){
+                int nNextRow = nStripRow + nStripRows;
+                int nNext = std::min(nStripRows, nRows - nNextRow);
+                eReadErr = pRBInput->RasterIO(GF_Read, 0, nNextRow, nCols, nNext, &vStrips[(s + 1) % 2][0],
+                                              nCols, nNext, GDT_Float64, 0, 0);
+            }
+
+            for (int f = 0; f < lFutures.size(); f++)
+                lFutures[f].waitForFinished();
+            if (eReadErr != CE_None)
+                throw RasterManagerException(INPUT_FILE_ERROR, "Could not read the input raster.");
+
+            // Text goes out a strip at a time so it never holds more than one strip's worth
+            for (int t = 0; t < lFutures.size(); t++){
+                CSVExportWrite(&CSVfile, vTasks[t].baText.constData(), vTasks[t].baText.size());
+                vTasks[t].baText.clear();
             }
         }
-        CSVfile.close();
     }
-    else{
-        throw RasterManagerException(OUTPUT_FILE_ERROR, "Could not open output CSV");
+    catch (RasterManagerException e){
+        GDALClose(pDSInput);
+        throw;
     }
-    CPLFree(pInputLine);
+
+    CSVfile.close();
     GDALClose(pDSInput);
     return PROCESS_OK;
 }
@@ -234,6 +1013,47 @@ void Raster::CSVWriteLine(QFile * csvFile, QString sCSVLine){
 
 }
 
+void Raster::CSVAppendFixed(QByteArray & baLine, double fValue, int nPrecision){
+
+    /* Scale to an integer and round. v * 10^p is one correctly rounded multiply so
+     * it's within half an ulp of the exact product. As long as the fraction isn't
+     * within an ulp of a half the rounding direction is certain and the digits
+     * match printf. Anything else (big numbers, near ties, nan, inf) goes through
+     * CPLsnprintf, which always uses '.' no matter the locale. */
+    if (nPrecision >= 0 && nPrecision <= 17){
+        double fScaled = fabs(fValue) * CSV_POW10[nPrecision];
+        if (fScaled < 4503599627370496.0){   // 2^52
+            double fWhole = floor(fScaled);
+            double fFraction = fScaled - fWhole;
+            if (fabs(fFraction - 0.5) > fScaled * 2.3e-16 + 1e-300){
+                quint64 nDigits = (quint64) fWhole + (fFraction > 0.5 ? 1 : 0);
+
+                char pText[40];
+                char * p = pText + sizeof(pText);
+                for (int i = 0; i < nPrecision; i++){
+                    *--p = (char) ('0' + nDigits % 10);
+                    nDigits /= 10;
+                }
+                if (nPrecision > 0)
+                    *--p = '.';
+                do {
+                    *--p = (char) ('0' + nDigits % 10);
+                    nDigits /= 10;
+                } while (nDigits > 0);
+                if (signbit(fValue))
+                    *--p = '-';
+
+                baLine.append(p, (int) (pText + sizeof(pText) - p));
+                return;
+            }
+        }
+    }
+
+    char pText[400];
+    CPLsnprintf(pText, sizeof(pText), "%.*f", nPrecision, fValue);
+    baLine.append(pText);
+}
+
 void Raster::CSVCellClean(QString & value){
 
     // Strip whitespace outside the quotes
@@ -65,7 +65,7 @@ int Raster::EuclideanDistance(
     rmOutputMeta.SetNoDataValue(&fNoDataValue);
 
     // Create the output dataset for writing
-    GDALDataset * pDSOutput = CreateOutputDS(psOutputRaster, &rmRasterMeta);
+    GDALDataset * pDSOutput = CreateOutputDS(psOutputRaster, &rmRasterMeta, true);
     GDALRasterBand * pRBOutput = pDSOutput->GetRasterBand(1);
 
     double * pReadBuffer = (double*) CPLMalloc(sizeof(double) * nCols);
@@ -74,6 +74,8 @@ int Raster::EuclideanDistance(
     int * panNearX = (int *) CPLMalloc(sizeof(int) * nCols);
     int * panNearY = (int *) CPLMalloc(sizeof(int) * nCols);
 
+    StatsAccumulator outputStats(pRBOutput);
+
     // Read from top to bottom of file
     // ----------------------------------------------------
 
@@ -141,6 +143,7 @@ int Raster::EuclideanDistance(
 
         pDSOutput->GetRasterBand(1)->RasterIO(GF_Write, 0,  iLine, nCols, 1, pOutputBuffer,
                                               nCols, 1, GDT_Float64, 0, 0);
+        outputStats.AddLine(pOutputBuffer, nCols);
     }
 
     CPLFree(pReadBuffer);
@@ -149,10 +152,10 @@ int Raster::EuclideanDistance(
     CPLFree(panNearX);
     CPLFree(panNearY);
 
-    CalculateStats(pRBOutput);
+    CalculateStats(pRBOutput, &outputStats);
 
     GDALClose(pDSInput);
-    GDALClose(pDSOutput);
+    CloseOutputDS(pDSOutput);
 
     return PROCESS_OK;
 
@@ -8,20 +8,45 @@
 #include "rastermanager.h"
 
 #include <math.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <limits>
 #include <QFile>
+#include <QFileInfo>
 #include <QStringList>
+#include <QtConcurrent>
 
 namespace RasterManager {
 
 // Default nodata value (note it is a string)
 QString EXTRACT_NO_DATA = "-9999";
 
-int Raster::ExtractPoints(const char * sCSVInputSourcePath,
-                          const char * sRasterInputSourcePath,
-                          const char * sCSVOutputPath,
-                          QString sXField,
-                          QString sYField,
-                          QString sNoData){
+// Rasters whose own blocks are bigger than this (e.g. one block for the whole
+// image) get read through windows of EXTRACT_WINDOW x EXTRACT_WINDOW instead.
+const int EXTRACT_MAX_BLOCK_CELLS = 4 * 1024 * 1024;
+const int EXTRACT_WINDOW = 256;
+
+// Blocks we hold on to while walking the sorted points. Bilinear lookups on a
+// block edge reach into the neighbours so it has to be more than one.
+const int EXTRACT_CACHED_BLOCKS = 16;
+
+// Output is written in pieces about this big
+const int EXTRACT_WRITE_BUFFER = 4 * 1024 * 1024;
+
+/* The points from the input CSV, in file order */
+struct ExtractPointSet
+{
+    QString sXHeader;
+    QString sYHeader;
+    std::vector<double> vX;
+    std::vector<double> vY;
+    std::vector<bool> vValid;
+};
+
+/* Read every point in the CSV. Line one is a header unless one of its cells is numeric. */
+static void ReadExtractPoints(const char * sCSVInputSourcePath, QString sXField, QString sYField,
+                              ExtractPointSet & points){
 
     // "" is a special case here. We can opt not to have a header line
     bool bHasXYField = true;
@@ -29,13 +54,45 @@ int Raster::ExtractPoints(const char * sCSVInputSourcePath,
             sYField.compare("") == 0 )
         bHasXYField = false;
 
-    if (sNoData.compare("") == 0)
-        sNoData = EXTRACT_NO_DATA;
+    QFile file(sCSVInputSourcePath);
+    if (!file.open(QIODevice::ReadOnly))
+        throw RasterManagerException(INPUT_FILE_ERROR, "Couldn't open input csv file.");
+
+    // QByteArray stops at 2GB so the text is only ever handled through raw pointers
+    qint64 nSize = file.size();
+    std::vector<char> vText;
+    const char * p = "";
+    uchar * pMap = nSize > 0 ? file.map(0, nSize) : NULL;
+    if (pMap != NULL)
+        p = (const char *) pMap;
+    else if (nSize > 0){
+        vText.resize((size_t) nSize);
+        qint64 nRead = 0;
+        while (nRead < nSize){
+            qint64 nChunk = file.read(&vText[(size_t) nRead], nSize - nRead);
+            if (nChunk <= 0)
+                throw RasterManagerException(INPUT_FILE_ERROR, "Couldn't read input csv file: " + file.errorString());
+            nRead += nChunk;
+        }
+        p = &vText[0];
+    }
+    const char * pEnd = p + nSize;
 
-    // Validate that the files are there
-    CheckFile(sCSVInputSourcePath, true);
-    CheckFile(sRasterInputSourcePath, true);
-    CheckFile(sCSVOutputPath, false);
+    // Figure out if line one is a header line
+    const char * pEOL = (const char *) memchr(p, '\n', pEnd - p);
+    if (pEOL == NULL)
+        pEOL = pEnd;
+    QStringList lstHeader = QString::fromUtf8(p, (int) (pEOL - p)).split(",");
+
+    bool bHeaderRow = true;
+    for (int ncolnumber = 0; ncolnumber < lstHeader.size(); ncolnumber++){
+        bool isNumeric = false;
+        lstHeader.at(ncolnumber).toDouble(&isNumeric);
+        if (isNumeric){
+            bHeaderRow = false;
+            break;
+        }
+    }
 
     int xcol = -1;
     int ycol = -1;
@@ -44,148 +101,452 @@ int Raster::ExtractPoints(const char * sCSVInputSourcePath,
         xcol = 0;
         ycol = 1;
     }
+    else if (bHeaderRow){
+        for (int ncolnumber = 0; ncolnumber < lstHeader.size(); ncolnumber++){
+            QString csvItem = lstHeader.at(ncolnumber);
+            Raster::CSVCellClean(csvItem);
+            if (csvItem.compare(sXField) == 0){
+                xcol = ncolnumber;
+            }
+            else if (csvItem.compare(sYField) == 0){
+                ycol = ncolnumber;
+            }
+        }
+    }
 
-    // Set up our line buffer
-    int nlinenumber = 0;
+    // Basic checking to make sure we have parameters
+    if (xcol == -1){
+        QString sErr = QString("X Field '%1' not found").arg(sXField);
+        throw RasterManagerException(MISSING_ARGUMENT, sErr);
+    }
+    else if (ycol == -1){
+        QString sErr = QString("Y Column '%1' not found").arg(sYField);
+        throw RasterManagerException(MISSING_ARGUMENT, sErr);
+    }
 
-    // Open the input Raster
-    // --------------------------------------------------
-    RasterMeta rmRasterMeta(sRasterInputSourcePath);
+    points.sXHeader = bHasXYField ? sXField : QString("X");
+    points.sYHeader = bHasXYField ? sYField : QString("Y");
 
-    GDALDataset * pDS = (GDALDataset*) GDALOpen(sRasterInputSourcePath, GA_ReadOnly);
-    if (pDS == NULL)
-        throw RasterManagerException(INPUT_FILE_ERROR, "Couldn't open input raster file.");
+    if (bHeaderRow)
+        p = pEOL + 1;
 
-    GDALRasterBand * pRBInput = pDS->GetRasterBand(1);
+    int nMaxCol = std::max(xcol, ycol);
+    points.vX.reserve((pEnd - p) / 24);
+    points.vY.reserve((pEnd - p) / 24);
+    points.vValid.reserve((pEnd - p) / 24);
 
-    // Our buffer only has to be one pixel
-    double pInputPt;
+    while (p < pEnd){
+        pEOL = (const char *) memchr(p, '\n', pEnd - p);
+        if (pEOL == NULL)
+            pEOL = pEnd;
 
-    bool bHeaderRow = true;
+        // Blank lines (usually the last one) aren't points
+        const char * pText = p;
+        while (pText < pEOL && (*pText == ' ' || *pText == '\t' || *pText == '\r'))
+            pText++;
 
-    // Open the output file for writing
-    QFile CSVOutputfile(sCSVOutputPath);
-    if ( CSVOutputfile.open(QFile::WriteOnly|QFile::Append) )
-    {
-        // Write the header line output CSV
-        // --------------------------------------------------
-        if (bHasXYField){
-            CSVWriteLine(&CSVOutputfile, QString("%1,%2,Value")
-                         .arg(sXField)
-                         .arg(sYField) );
+        if (pText < pEOL){
+            double fX = 0, fY = 0;
+            bool bX = false, bY = false;
+
+            const char * pField = p;
+            for (int nField = 0; nField <= nMaxCol; nField++){
+                const char * pComma = (const char *) memchr(pField, ',', pEOL - pField);
+                const char * pFieldEnd = pComma == NULL ? pEOL : pComma;
+
+                if (nField == xcol)
+                    bX = Raster::CSVParseField(pField, pFieldEnd, fX);
+                else if (nField == ycol)
+                    bY = Raster::CSVParseField(pField, pFieldEnd, fY);
+
+                if (pComma == NULL)
+                    break;
+                pField = pComma + 1;
+            }
+            points.vX.push_back(bX ? fX : 0);
+            points.vY.push_back(bY ? fY : 0);
+            points.vValid.push_back(bX && bY);
         }
-        else {
-            CSVWriteLine(&CSVOutputfile, QString("X,Y,Value") );
+        p = pEOL + 1;
+    }
+}
+
+/* Samples one raster at a set of points. The points are visited in block order
+ * so every block that's needed is read once, no matter how the CSV is sorted. */
+class ExtractSampler {
+public:
+    ExtractSampler(const char * psRaster) : m_meta(psRaster), m_nNextSlot(0), m_nLastSlot(-1) {
+
+        m_pDS = (GDALDataset*) GDALOpen(psRaster, GA_ReadOnly);
+        if (m_pDS == NULL)
+            throw RasterManagerException(INPUT_FILE_ERROR, "Couldn't open input raster file.");
+        m_pRB = m_pDS->GetRasterBand(1);
+
+        int bHasNoData = 0;
+        m_fNoData = m_pRB->GetNoDataValue(&bHasNoData);
+        m_bHasNoData = bHasNoData != 0;
+
+        m_nCols = m_pRB->GetXSize();
+        m_nRows = m_pRB->GetYSize();
+        m_pRB->GetBlockSize(&m_nBlockX, &m_nBlockY);
+        if ((qint64) m_nBlockX * m_nBlockY > EXTRACT_MAX_BLOCK_CELLS){
+            m_nBlockX = std::min(m_nCols, EXTRACT_WINDOW);
+            m_nBlockY = std::min(m_nRows, EXTRACT_WINDOW);
         }
+        m_nBlocksX = (m_nCols + m_nBlockX - 1) / m_nBlockX;
 
+        m_vCacheKeys.assign(EXTRACT_CACHED_BLOCKS, -1);
+        m_vCacheData.assign(EXTRACT_CACHED_BLOCKS, (double *) NULL);
+    }
 
-        // Iterate over lines in the CSV
-        // --------------------------------------------------
-        QFile file(sCSVInputSourcePath);
-        if (file.open(QIODevice::ReadOnly | QIODevice::Text))
-        {
-
-            // Line loop
-            LoopTimer rowLoop("Row");
-            LoopTimer colLoop("Column");
-
-            while (!file.atEnd())
-            {
-                nlinenumber++;
-                QString csvline = file.readLine();
-                QStringList lstLine = csvline.split(",");
-
-                int csvX = -1;
-                int csvY = -1;
-
-                double dCSVX = -1;
-                double dCSVY = -1;
-
-                // Figure out if line one is a header line
-                if (nlinenumber == 1){
-                    for (int ncolnumber = 0; ncolnumber < lstLine.size(); ncolnumber++){
-                        bool isNumeric = false;
-                        QString sCell = lstLine.at(ncolnumber);
-                        sCell.toDouble(&isNumeric);
-                        if (isNumeric){
-                            bHeaderRow = false;
-                            break;
-                        }
-                    }
-                }
-                else {
-                    bHeaderRow = false;
-                }
-
-                // Loop over cells
-                for (int ncolnumber = 0; ncolnumber < lstLine.size(); ncolnumber++){
-
-                    QString csvItem = lstLine.at(ncolnumber);
-                    CSVCellClean(csvItem);
-
-                    // For the first line read values if they apply
-                    if ( bHeaderRow && nlinenumber == 1 ){
-                        if (csvItem.compare(sXField) == 0){
-                            xcol = ncolnumber;
-                        }
-                        else if (csvItem.compare(sYField) == 0){
-                            ycol = ncolnumber;
-                        };
-                    }
-
-                    // If it's not a header, just process it.
-                    if (!bHeaderRow){
-                        // Basic checking to make sure we have parameters
-                        if (xcol == -1){
-                            QString sErr = QString("X Field '%1' not found").arg(sXField);
-                            throw RasterManagerException(MISSING_ARGUMENT, sErr);
-                        }
-                        else if (ycol == -1){
-                            QString sErr = QString("Y Column '%1' not found").arg(sYField);
-                            throw RasterManagerException(MISSING_ARGUMENT, sErr);
-                        }
-
-                        double dVal = csvItem.toDouble();
-                        if (xcol == ncolnumber){
-                            dCSVX = dVal;
-                            csvX = (int) floor((dVal - rmRasterMeta.GetLeft() ) / rmRasterMeta.GetCellWidth());
-                        }
-                        else if (ycol == ncolnumber){
-                            dCSVY = dVal;
-                            csvY = (int) floor((rmRasterMeta.GetTop() - dVal) / rmRasterMeta.GetCellHeight() * -1);
-                        }
-
-                    }
-                    colLoop.Tick(); //DEBUG Only
-                }
-                if (!bHeaderRow){
-                    // here's where we need to get the correct row of the output. Replace
-                    pRBInput->RasterIO(GF_Read, csvX,  csvY, 1, 1, &pInputPt, 1, 1, GDT_Float64, 0, 0);
-                    QString value = sNoData;
-
-                    if (pInputPt != rmRasterMeta.GetNoDataValue() )
-                        value = QString("%1").arg(pInputPt, 0, 'f', 10, '0');
-
-                    CSVWriteLine( &CSVOutputfile, QString("%1,%2,%3")
-                                  .arg(dCSVX, 0, 'f', rmRasterMeta.GetHorizontalPrecision() )
-                                  .arg(dCSVY, 0, 'f', rmRasterMeta.GetHorizontalPrecision() )
-                                  .arg(value) );
-                }
-                rowLoop.Tick();
-            }
-            file.close();
+    ~ExtractSampler(){
+        for (size_t i = 0; i < m_vCacheData.size(); i++)
+            if (m_vCacheData[i] != NULL)
+                CPLFree(m_vCacheData[i]);
+        GDALClose(m_pDS);
+    }
+
+    RasterMeta & Meta() { return m_meta; }
+
+    /* Rasters on the same grid with the same blocks visit the points in the same order */
+    bool SameLayout(ExtractSampler & other){
+        return m_nCols == other.m_nCols && m_nRows == other.m_nRows
+                && m_nBlockX == other.m_nBlockX && m_nBlockY == other.m_nBlockY
+                && m_meta.GetLeft() == other.m_meta.GetLeft() && m_meta.GetTop() == other.m_meta.GetTop()
+                && m_meta.GetCellWidth() == other.m_meta.GetCellWidth()
+                && m_meta.GetCellHeight() == other.m_meta.GetCellHeight();
+    }
+
+    /* Fill pValues (one per point, in file order). NaN means NoData. */
+    void Sample(const ExtractPointSet & points, bool bBilinear, double * pValues){
+        std::vector< std::pair<qint64, int> > vOrder;
+        Order(points, vOrder);
+        Sample(points, vOrder, bBilinear, pValues);
+    }
+
+    /* The points that fall on this raster, sorted by the block they're in */
+    void Order(const ExtractPointSet & points, std::vector< std::pair<qint64, int> > & vOrder){
+
+        int nPoints = (int) points.vX.size();
+        vOrder.clear();
+        vOrder.reserve(nPoints);
+
+        for (int i = 0; i < nPoints; i++){
+            if (!points.vValid[i])
+                continue;
+
+            double fCol = floor((points.vX[i] - m_meta.GetLeft()) / m_meta.GetCellWidth());
+            double fRow = floor((m_meta.GetTop() - points.vY[i]) / m_meta.GetCellHeight() * -1);
+            if (!(fCol >= 0 && fCol < m_nCols && fRow >= 0 && fRow < m_nRows))
+                continue;
+
+            int nCol = (int) fCol;
+            int nRow = (int) fRow;
+            vOrder.push_back(std::make_pair((qint64) (nRow / m_nBlockY) * m_nBlocksX + nCol / m_nBlockX, i));
+        }
+        std::sort(vOrder.begin(), vOrder.end());
+    }
+
+    void Sample(const ExtractPointSet & points, const std::vector< std::pair<qint64, int> > & vOrder,
+                bool bBilinear, double * pValues){
+
+        std::fill(pValues, pValues + points.vX.size(), std::numeric_limits<double>::quiet_NaN());
+
+        for (size_t n = 0; n < vOrder.size(); n++){
+            int i = vOrder[n].second;
+            double fX = points.vX[i];
+            double fY = points.vY[i];
+            int nCol = (int) floor((fX - m_meta.GetLeft()) / m_meta.GetCellWidth());
+            int nRow = (int) floor((m_meta.GetTop() - fY) / m_meta.GetCellHeight() * -1);
+
+            double fValue;
+            if (!CellValue(nCol, nRow, fValue))
+                continue;
+
+            if (bBilinear)
+                fValue = Bilinear(fX, fY, fValue);
+            pValues[i] = fValue;
+        }
+    }
 
-            rowLoop.Output();
-            colLoop.Output();
+private:
+    /* Weighted by distance to the four nearest cell centres. NoData neighbours
+     * drop out and the rest are reweighted. */
+    double Bilinear(double fX, double fY, double fCellValue){
+
+        double fPX = (fX - m_meta.GetLeft()) / m_meta.GetCellWidth() - 0.5;
+        double fPY = (m_meta.GetTop() - fY) / m_meta.GetCellHeight() * -1 - 0.5;
+        int nCol0 = (int) floor(fPX);
+        int nRow0 = (int) floor(fPY);
+        double fDX = fPX - nCol0;
+        double fDY = fPY - nRow0;
+
+        double fSum = 0;
+        double fWeights = 0;
+        for (int k = 0; k < 4; k++){
+            int nCol = nCol0 + (k & 1);
+            int nRow = nRow0 + (k >> 1);
+            double fWeight = ((k & 1) ? fDX : 1 - fDX) * ((k >> 1) ? fDY : 1 - fDY);
+            double fValue;
+            if (fWeight > 0 && nCol >= 0 && nCol < m_nCols && nRow >= 0 && nRow < m_nRows
+                    && CellValue(nCol, nRow, fValue)){
+                fSum += fWeight * fValue;
+                fWeights += fWeight;
+            }
         }
-        else{
-            throw RasterManagerException(INPUT_FILE_ERROR, "Couldn't open input csv file.");
+        return fWeights > 0 ? fSum / fWeights : fCellValue;
+    }
+
+    inline bool CellValue(int nCol, int nRow, double & fValue){
+        const double * pBlock = Block(nCol / m_nBlockX, nRow / m_nBlockY);
+        fValue = pBlock[(qint64) (nRow % m_nBlockY) * m_nBlockX + nCol % m_nBlockX];
+        return fValue == fValue && !(m_bHasNoData && fValue == m_fNoData);
+    }
+
+    const double * Block(int nBlockCol, int nBlockRow){
+
+        qint64 nKey = (qint64) nBlockRow * m_nBlocksX + nBlockCol;
+        if (m_nLastSlot >= 0 && m_vCacheKeys[m_nLastSlot] == nKey)
+            return m_vCacheData[m_nLastSlot];
+
+        for (int i = 0; i < EXTRACT_CACHED_BLOCKS; i++){
+            if (m_vCacheKeys[i] == nKey){
+                m_nLastSlot = i;
+                return m_vCacheData[i];
+            }
         }
+
+        // Miss. Reuse the oldest slot.
+        int nSlot = m_nNextSlot;
+        m_nNextSlot = (m_nNextSlot + 1) % EXTRACT_CACHED_BLOCKS;
+        if (m_vCacheData[nSlot] == NULL)
+            m_vCacheData[nSlot] = (double *) CPLMalloc(sizeof(double) * m_nBlockX * m_nBlockY);
+
+        int nX = nBlockCol * m_nBlockX;
+        int nY = nBlockRow * m_nBlockY;
+        int nW = std::min(m_nBlockX, m_nCols - nX);
+        int nH = std::min(m_nBlockY, m_nRows - nY);
+        m_vCacheKeys[nSlot] = -1;
+        if (m_pRB->RasterIO(GF_Read, nX, nY, nW, nH, m_vCacheData[nSlot], nW, nH, GDT_Float64,
+                            0, sizeof(double) * m_nBlockX) != CE_None)
+            throw RasterManagerException(INPUT_FILE_ERROR, "Couldn't read from the input raster.");
+
+        m_vCacheKeys[nSlot] = nKey;
+        m_nLastSlot = nSlot;
+        return m_vCacheData[nSlot];
+    }
+
+    RasterMeta m_meta;
+    GDALDataset * m_pDS;
+    GDALRasterBand * m_pRB;
+    bool m_bHasNoData;
+    double m_fNoData;
+    int m_nCols;
+    int m_nRows;
+    int m_nBlockX;
+    int m_nBlockY;
+    int m_nBlocksX;
+    std::vector<qint64> m_vCacheKeys;
+    std::vector<double *> m_vCacheData;
+    int m_nNextSlot;
+    int m_nLastSlot;
+};
+
+/* One raster's column of a multi-raster extraction. Runs on its own thread. */
+struct ExtractColumn
+{
+    ExtractSampler * pSampler;
+    const std::vector< std::pair<qint64, int> > * pOrder;
+    std::vector<double> vValues;
+    int nErrorCode;
+    QString sError;
+};
+
+static void ExtractColumnValues(const ExtractPointSet * pPoints, bool bBilinear, ExtractColumn * pColumn){
+    try {
+        pColumn->vValues.resize(pPoints->vX.size());
+        if (!pColumn->vValues.empty())
+            pColumn->pSampler->Sample(*pPoints, *pColumn->pOrder, bBilinear, &pColumn->vValues[0]);
+    }
+    catch (RasterManagerException e){
+        pColumn->nErrorCode = e.GetErrorCode();
+        pColumn->sError = e.GetEvidence();
     }
-    else{
+}
+
+static void ExtractWrite(QFile & file, QByteArray & baBuffer){
+    if (file.write(baBuffer) != baBuffer.size())
+        throw RasterManagerException(OUTPUT_FILE_ERROR, "Couldn't write to output csv file.");
+    baBuffer.clear();
+}
+
+int Raster::ExtractPoints(const char * sCSVInputSourcePath,
+                          const char * sRasterInputSourcePath,
+                          const char * sCSVOutputPath,
+                          QString sXField,
+                          QString sYField,
+                          QString sNoData,
+                          bool bBilinear){
+
+    if (sNoData.compare("") == 0)
+        sNoData = EXTRACT_NO_DATA;
+
+    // Validate that the files are there
+    CheckFile(sCSVInputSourcePath, true);
+    CheckFile(sRasterInputSourcePath, true);
+    CheckFile(sCSVOutputPath, false);
+
+    ExtractPointSet points;
+    ReadExtractPoints(sCSVInputSourcePath, sXField, sYField, points);
+
+    ExtractSampler sampler(sRasterInputSourcePath);
+    std::vector<double> vValues(points.vX.size());
+    if (!vValues.empty())
+        sampler.Sample(points, bBilinear, &vValues[0]);
+
+    // Open the output file for writing
+    QFile CSVOutputfile(sCSVOutputPath);
+    if ( !CSVOutputfile.open(QFile::WriteOnly|QFile::Append) )
         throw RasterManagerException(OUTPUT_FILE_ERROR, "Couldn't open output csv file.");
+
+    int nPrecision = sampler.Meta().GetHorizontalPrecision();
+    QByteArray baNoData = sNoData.toUtf8();
+
+    QByteArray baBuffer;
+    baBuffer.reserve(EXTRACT_WRITE_BUFFER + 1024);
+    baBuffer.append(QString("%1,%2,Value\n").arg(points.sXHeader).arg(points.sYHeader).toUtf8());
+
+    for (size_t i = 0; i < vValues.size(); i++){
+        CSVAppendFixed(baBuffer, points.vX[i], nPrecision);
+        baBuffer.append(',');
+        CSVAppendFixed(baBuffer, points.vY[i], nPrecision);
+        baBuffer.append(',');
+        if (vValues[i] == vValues[i])
+            CSVAppendFixed(baBuffer, vValues[i], 10);
+        else
+            baBuffer.append(baNoData);
+        baBuffer.append('\n');
+
+        if (baBuffer.size() >= EXTRACT_WRITE_BUFFER)
+            ExtractWrite(CSVOutputfile, baBuffer);
     }
-    GDALClose(pDS);
+    ExtractWrite(CSVOutputfile, baBuffer);
+    CSVOutputfile.close();
+
+    return PROCESS_OK;
+}
+
+int Raster::ExtractPointsMulti(const char * sCSVInputSourcePath,
+                               const char * psRasters,
+                               const char * sCSVOutputPath,
+                               QString sXField,
+                               QString sYField,
+                               QString sNoData,
+                               bool bBilinear){
+
+    if (sNoData.compare("") == 0)
+        sNoData = EXTRACT_NO_DATA;
+
+    QList<QString> lRasters = RasterMeta::RasterUnDelimit(QString(psRasters), true, false, false);
+    if (lRasters.size() == 0)
+        throw RasterManagerException(MISSING_ARGUMENT, "No input rasters were given.");
+
+    CheckFile(sCSVInputSourcePath, true);
+    CheckFile(sCSVOutputPath, false);
+
+    // The point file is only parsed once for all the rasters
+    ExtractPointSet points;
+    ReadExtractPoints(sCSVInputSourcePath, sXField, sYField, points);
+
+    std::vector<ExtractSampler *> vSamplers;
+    std::vector< std::vector< std::pair<qint64, int> > > vOrders;
+    std::vector<ExtractColumn> vColumns(lRasters.size());
+
+    try {
+        // Sort the points once per raster layout. Rasters sharing a grid share the order.
+        std::vector<int> vLayout;
+        for (int r = 0; r < lRasters.size(); r++){
+            QByteArray baRaster = lRasters.at(r).toLocal8Bit();
+            vSamplers.push_back(new ExtractSampler(baRaster.constData()));
+
+            int nLayout = -1;
+            for (int l = 0; l < r && nLayout < 0; l++)
+                if (vSamplers[r]->SameLayout(*vSamplers[l]))
+                    nLayout = vLayout[l];
+            if (nLayout < 0){
+                nLayout = (int) vOrders.size();
+                vOrders.push_back(std::vector< std::pair<qint64, int> >());
+                vSamplers[r]->Order(points, vOrders.back());
+            }
+            vLayout.push_back(nLayout);
+        }
+
+        // Every raster gets its own thread. Each one owns its dataset and its column.
+        QList< QFuture<void> > lFutures;
+        for (int r = 0; r < lRasters.size(); r++){
+            vColumns[r].pSampler = vSamplers[r];
+            vColumns[r].pOrder = &vOrders[vLayout[r]];
+            vColumns[r].nErrorCode = PROCESS_OK;
+            lFutures.append(QtConcurrent::run(ExtractColumnValues, &points, bBilinear, &vColumns[r]));
+        }
+        for (int r = 0; r < lFutures.size(); r++)
+            lFutures[r].waitForFinished();
+
+        for (int r = 0; r < lRasters.size(); r++)
+            if (vColumns[r].nErrorCode != PROCESS_OK)
+                throw RasterManagerException(vColumns[r].nErrorCode, vColumns[r].sError);
+
+        QFile CSVOutputfile(sCSVOutputPath);
+        if ( !CSVOutputfile.open(QFile::WriteOnly|QFile::Append) )
+            throw RasterManagerException(OUTPUT_FILE_ERROR, "Couldn't open output csv file.");
+
+        // One column per raster, named after the file
+        QStringList lHeader;
+        lHeader << points.sXHeader << points.sYHeader;
+        for (int r = 0; r < lRasters.size(); r++){
+            QString sName = QFileInfo(lRasters.at(r)).completeBaseName();
+            QString sColumn = sName;
+            for (int n = 2; lHeader.contains(sColumn); n++)
+                sColumn = QString("%1_%2").arg(sName).arg(n);
+            lHeader << sColumn;
+        }
+
+        int nPrecision = vSamplers[0]->Meta().GetHorizontalPrecision();
+        QByteArray baNoData = sNoData.toUtf8();
+
+        QByteArray baBuffer;
+        baBuffer.reserve(EXTRACT_WRITE_BUFFER + 1024);
+        baBuffer.append(lHeader.join(",").toUtf8());
+        baBuffer.append('\n');
+
+        for (size_t i = 0; i < points.vX.size(); i++){
+            CSVAppendFixed(baBuffer, points.vX[i], nPrecision);
+            baBuffer.append(',');
+            CSVAppendFixed(baBuffer, points.vY[i], nPrecision);
+            for (size_t r = 0; r < vColumns.size(); r++){
+                double fValue = vColumns[r].vValues[i];
+                baBuffer.append(',');
+                if (fValue == fValue)
+                    CSVAppendFixed(baBuffer, fValue, 10);
+                else
+                    baBuffer.append(baNoData);
+            }
+            baBuffer.append('\n');
+
+            if (baBuffer.size() >= EXTRACT_WRITE_BUFFER)
+                ExtractWrite(CSVOutputfile, baBuffer);
+        }
+        ExtractWrite(CSVOutputfile, baBuffer);
+        CSVOutputfile.close();
+    }
+    catch (RasterManagerException e){
+        for (size_t r = 0; r < vSamplers.size(); r++)
+            delete vSamplers[r];
+        throw;
+    }
+
+    for (size_t r = 0; r < vSamplers.size(); r++)
+        delete vSamplers[r];
 
     return PROCESS_OK;
 }
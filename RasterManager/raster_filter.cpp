@@ -75,7 +75,7 @@ int Raster::FilterRaster(
     rmOutputMeta.SetNoDataValue(&fNoDataValue);
 
     // Create the output dataset for writing
-    GDALDataset * pDSOutput = CreateOutputDS(psOutputRaster, &rmOutputMeta);
+    GDALDataset * pDSOutput = CreateOutputDS(psOutputRaster, &rmOutputMeta, true);
 
     // Our Read Buffer is 2D: [nWindowHeight x entire row legnth]
     double * pInputWindow = (double *) CPLMalloc(sizeof(double)*rmRasterMeta.GetCols() * nWindowHeight);
@@ -83,6 +83,8 @@ int Raster::FilterRaster(
     // Our write buffer is a regular line
     double * pOutputLine = (double *) CPLMalloc(sizeof(double)*rmRasterMeta.GetCols());
 
+    StatsAccumulator outputStats(pDSOutput->GetRasterBand(1));
+
     // Specify the middle index of the window with these two coords
     int nWindowMiddleRow = (nWindowHeight / 2);
     int nWindowMiddleCol = (nWindowWidth / 2);
@@ -193,16 +195,17 @@ int Raster::FilterRaster(
                                               pOutputLine,
                                               rmOutputMeta.GetCols(), 1,
                                               GDT_Float64, 0, 0);
+        outputStats.AddLine(pOutputLine, rmOutputMeta.GetCols());
     }
 
     // Free our buffers
     CPLFree(pInputWindow);
     CPLFree(pOutputLine);
 
-    CalculateStats(pDSOutput->GetRasterBand(1));
+    CalculateStats(pDSOutput->GetRasterBand(1), &outputStats);
 
     GDALClose(pDSInput);
-    GDALClose(pDSOutput);
+    CloseOutputDS(pDSOutput);
 
     return PROCESS_OK;
 
@@ -20,7 +20,7 @@ int Raster::Hillshade(const char * psOutputHillshade){
     OutputRasterMeta.SetGDALDataType(&nDtype);
 
     GDALDataset * pDemDS = (GDALDataset*) GDALOpen(m_sFilePath, GA_ReadOnly);
-    GDALDataset * pHsDS = CreateOutputDS(psOutputHillshade, &OutputRasterMeta);
+    GDALDataset * pHsDS = CreateOutputDS(psOutputHillshade, &OutputRasterMeta, true);
 
     const double PI = 3.14159265;
     double dzdx, dzdy, azimuthRad, slopeRad, aspectRad;
@@ -43,6 +43,8 @@ int Raster::Hillshade(const char * psOutputHillshade){
     double *fElev = (double*) CPLMalloc(sizeof(double)*9);
     unsigned char *hlsd = (unsigned char*) CPLMalloc(sizeof(int)*GetCols());
 
+    StatsAccumulator outputStats(pHsDS->GetRasterBand(1));
+
     //loop through each DEM cell and do the hillshade calculation, do not loop through edge cells
     for (int i=1; i < GetRows() - 1; i++)
     {
@@ -100,13 +102,19 @@ int Raster::Hillshade(const char * psOutputHillshade){
             }
         }
         pHsDS->GetRasterBand(1)->RasterIO(GF_Write,0,i,GetCols(),1,hlsd,GetCols(),1,GDT_Byte,0,0);
+        for (int nStat = 0; nStat < GetCols(); nStat++)
+            outputStats.Add(hlsd[nStat]);
     }
 
-    CalculateStats(pHsDS->GetRasterBand(1));
+    // The edge rows are the only ones the loop doesn't write
+    FillOutputRows(pHsDS->GetRasterBand(1), 0, 1, OutputRasterMeta.GetNoDataValue());
+    FillOutputRows(pHsDS->GetRasterBand(1), GetRows() - 1, 1, OutputRasterMeta.GetNoDataValue());
+
+    CalculateStats(pHsDS->GetRasterBand(1), &outputStats);
 
     //close datasets
     GDALClose(pDemDS);
-    GDALClose(pHsDS);
+    CloseOutputDS(pHsDS);
 
     CPLFree(fElev);
     CPLFree(hlsd);
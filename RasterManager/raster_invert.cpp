@@ -11,6 +11,7 @@
 #include "gdal.h"
 #include "gdal_priv.h"
 #include "rastermanager.h"
+#include "rasterstream.h"
 
 namespace RasterManager {
 
@@ -46,10 +47,13 @@ int Raster::InvertRaster(const char * psInputRaster,
 
 
     // Create the output dataset for writing
-    GDALDataset * pDSOutput = CreateOutputDS(psOutputRaster, &rmOutputMeta);
+    GDALDataset * pDSOutput = CreateOutputDS(psOutputRaster, &rmOutputMeta, true);
 
     double * pOutputLine = (double *) CPLMalloc(sizeof(double)*rmOutputMeta.GetCols());
 
+    StatsAccumulator outputStats(pDSOutput->GetRasterBand(1));
+    RasterWriter outputWriter(pDSOutput->GetRasterBand(1), &outputStats);
+
     int i, j;
     for (i = 0; i < rmOutputMeta.GetRows(); i++)
     {
@@ -67,15 +71,16 @@ int Raster::InvertRaster(const char * psInputRaster,
             }
         }
 
-        pDSOutput->GetRasterBand(1)->RasterIO(GF_Write, 0,  i, rmOutputMeta.GetCols(), 1, pOutputLine, rmOutputMeta.GetCols(), 1, GDT_Float64, 0, 0);
+        outputWriter.WriteRow(i, pOutputLine);
     }
     CPLFree(pInputLine);
     CPLFree(pOutputLine);
 
-    CalculateStats(pDSOutput->GetRasterBand(1));
+    outputWriter.Finish();
+    CalculateStats(pDSOutput->GetRasterBand(1), &outputStats);
 
     GDALClose(pDSInput);
-    GDALClose(pDSOutput);
+    CloseOutputDS(pDSOutput);
 
     return PROCESS_OK;
 
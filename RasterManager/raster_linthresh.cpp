@@ -7,6 +7,7 @@
 #include "raster.h"
 #include "rastermeta.h"
 #include "rastermanager.h"
+#include "rasterstream.h"
 #include "rastermanager_interface.h"
 #include "rastermanager_exception.h"
 
@@ -51,11 +52,14 @@ int Raster::LinearThreshold(const char * psInputRaster,
     rmOutputMeta.SetNoDataValue(&fNoDataValue);
 
     // Create the output dataset for writing
-    GDALDataset * pDSOutput = CreateOutputDS(psOutputRaster, &rmRasterMeta);
+    GDALDataset * pDSOutput = CreateOutputDS(psOutputRaster, &rmRasterMeta, true);
 
     double * pInputLine = (double *) CPLMalloc(sizeof(double)*rmRasterMeta.GetCols());
     double * pOutputLine = (double *) CPLMalloc(sizeof(double)*rmRasterMeta.GetCols());
 
+    StatsAccumulator outputStats(pDSOutput->GetRasterBand(1));
+    RasterWriter outputWriter(pDSOutput->GetRasterBand(1), &outputStats);
+
     // REcall: y =mx +b  where m=slope
     double dSlope = 0;
 
@@ -89,16 +93,17 @@ int Raster::LinearThreshold(const char * psInputRaster,
                 pOutputLine[j] = ( pInputLine[j] * dSlope ) + dBparam;
             }
         }
-        pDSOutput->GetRasterBand(1)->RasterIO(GF_Write, 0,  i, rmRasterMeta.GetCols(), 1, pOutputLine, rmRasterMeta.GetCols(), 1, GDT_Float64, 0, 0);
+        outputWriter.WriteRow(i, pOutputLine);
     }
 
     CPLFree(pInputLine);
     CPLFree(pOutputLine);
 
-    CalculateStats(pDSOutput->GetRasterBand(1));
+    outputWriter.Finish();
+    CalculateStats(pDSOutput->GetRasterBand(1), &outputStats);
 
     GDALClose(pDSInput);
-    GDALClose(pDSOutput);
+    CloseOutputDS(pDSOutput);
 
     return PROCESS_OK;
 }
@@ -11,6 +11,7 @@
 #include "gdal.h"
 #include "gdal_priv.h"
 #include "rastermanager.h"
+#include "rasterstream.h"
 
 
 namespace RasterManager {
@@ -59,7 +60,10 @@ int Raster::RasterMask(const char * psInputRaster, const char * psMaskRaster, co
 
 
     // Create the output dataset for writing
-    GDALDataset * pDSOutput = CreateOutputDS(psOutput, &rmInputMeta);
+    GDALDataset * pDSOutput = CreateOutputDS(psOutput, &rmInputMeta, true);
+
+    StatsAccumulator outputStats(pDSOutput->GetRasterBand(1));
+    RasterWriter outputWriter(pDSOutput->GetRasterBand(1), &outputStats);
 
     double * pOutputLine = (double *) CPLMalloc(sizeof(double)*rmOutputMeta.GetCols());
 
@@ -109,16 +113,17 @@ int Raster::RasterMask(const char * psInputRaster, const char * psMaskRaster, co
             }
         }
 
-        pDSOutput->GetRasterBand(1)->RasterIO(GF_Write, 0,  i, rmOutputMeta.GetCols(), 1, pOutputLine, rmOutputMeta.GetCols(), 1, GDT_Float64, 0, 0);
+        outputWriter.WriteRow(i, pOutputLine);
     }
     CPLFree(pMaskline);
     CPLFree(pInputLine);
     CPLFree(pOutputLine);
 
-    CalculateStats(pDSOutput->GetRasterBand(1));
+    outputWriter.Finish();
+    CalculateStats(pDSOutput->GetRasterBand(1), &outputStats);
 
     GDALClose(pDSInput);
-    GDALClose(pDSOutput);
+    CloseOutputDS(pDSOutput);
     GDALClose(pDSMask);
 
     return PROCESS_OK;
@@ -167,7 +172,10 @@ int Raster::RasterMaskValue(const char * psInputRaster, const char * psOutput, d
     }
 
     // Create the output dataset for writing
-    GDALDataset * pDSOutput = CreateOutputDS(psOutput, &rmInputMeta);
+    GDALDataset * pDSOutput = CreateOutputDS(psOutput, &rmInputMeta, true);
+
+    StatsAccumulator outputStats(pDSOutput->GetRasterBand(1));
+    RasterWriter outputWriter(pDSOutput->GetRasterBand(1), &outputStats);
 
     double * pOutputLine = (double *) CPLMalloc(sizeof(double)*rmOutputMeta.GetCols());
 
@@ -186,15 +194,16 @@ int Raster::RasterMaskValue(const char * psInputRaster, const char * psOutput, d
             }
         }
 
-        pDSOutput->GetRasterBand(1)->RasterIO(GF_Write, 0,  i, rmOutputMeta.GetCols(), 1, pOutputLine, rmOutputMeta.GetCols(), 1, GDT_Float64, 0, 0);
+        outputWriter.WriteRow(i, pOutputLine);
     }
     CPLFree(pInputLine);
     CPLFree(pOutputLine);
 
-    CalculateStats(pDSOutput->GetRasterBand(1));
+    outputWriter.Finish();
+    CalculateStats(pDSOutput->GetRasterBand(1), &outputStats);
 
     GDALClose(pDSInput);
-    GDALClose(pDSOutput);
+    CloseOutputDS(pDSOutput);
 
     return PROCESS_OK;
 
@@ -11,6 +11,7 @@
 #include "gdal.h"
 #include "gdal_priv.h"
 #include "rastermanager.h"
+#include "rasterstream.h"
 
 #include <QtCore>
 #include <QString>
@@ -47,7 +48,8 @@ int Raster::RasterMath(const char * psRaster1,
 
     GDALRasterBand * pRBInput1 = pDS1->GetRasterBand(1);
 
-    double * pInputLine1 = (double *) CPLMalloc(sizeof(double)*rmRasterMeta1.GetCols());
+    // Rows come from a read-ahead reader so decoding overlaps the math
+    const double * pInputLine1 = NULL;
 
     /*****************************************************************************************
      * The default output type is 32 bit floating point.
@@ -63,10 +65,13 @@ int Raster::RasterMath(const char * psRaster1,
     rmOutputMeta.SetNoDataValue(&fNoDataValue);
 
     // Create the output dataset for writing
-    GDALDataset * pDSOutput = CreateOutputDS(psOutput, &rmOutputMeta);
+    GDALDataset * pDSOutput = CreateOutputDS(psOutput, &rmOutputMeta, true);
 
     double * pOutputLine = (double *) CPLMalloc(sizeof(double)*rmOutputMeta.GetCols());
 
+    StatsAccumulator outputStats(pDSOutput->GetRasterBand(1));
+    RasterWriter outputWriter(pDSOutput->GetRasterBand(1), &outputStats);
+
     /*****************************************************************************************
      * Raster 2 to be used
      */
@@ -95,13 +100,15 @@ int Raster::RasterMath(const char * psRaster1,
         if (psOutput == NULL)
             return OUTPUT_FILE_MISSING;
 
-        double * pInputLine2 = (double *) CPLMalloc(sizeof(double)*rmRasterMeta2.GetCols());
+        RasterReader reader1(pRBInput1);
+        RasterReader reader2(pRBInput2);
+        const double * pInputLine2 = NULL;
 
         int i, j;
         for (i = 0; i < rmOutputMeta.GetRows(); i++)
         {
-            pRBInput1->RasterIO(GF_Read, 0,  i, rmRasterMeta1.GetCols(), 1, pInputLine1, rmRasterMeta1.GetCols(), 1, GDT_Float64, 0, 0);
-            pRBInput2->RasterIO(GF_Read, 0,  i, rmRasterMeta2.GetCols(), 1, pInputLine2, rmRasterMeta2.GetCols(), 1, GDT_Float64, 0, 0);
+            pInputLine1 = reader1.ReadRow(i);
+            pInputLine2 = reader2.ReadRow(i);
 
             for (j = 0; j < rmOutputMeta.GetCols(); j++)
             {
@@ -138,9 +145,8 @@ int Raster::RasterMath(const char * psRaster1,
                 }
             }
 
-            pDSOutput->GetRasterBand(1)->RasterIO(GF_Write, 0,  i, rmOutputMeta.GetCols(), 1, pOutputLine, rmOutputMeta.GetCols(), 1, GDT_Float64, 0, 0);
+            outputWriter.WriteRow(i, pOutputLine);
         }
-        CPLFree(pInputLine2);
 
 
     }
@@ -149,10 +155,12 @@ int Raster::RasterMath(const char * psRaster1,
         * Numerical Value to be used
         */
 
+        RasterReader reader1(pRBInput1);
+
         int i, j;
         for (i = 0; i < rmOutputMeta.GetRows(); i++)
         {
-            pRBInput1->RasterIO(GF_Read, 0,  i, rmRasterMeta1.GetCols(), 1, pInputLine1, rmRasterMeta1.GetCols(), 1, GDT_Float64, 0, 0);
+            pInputLine1 = reader1.ReadRow(i);
 
             for (j = 0; j < pRBInput1->GetXSize(); j++)
             {
@@ -196,18 +204,16 @@ int Raster::RasterMath(const char * psRaster1,
                         return MISSING_ARGUMENT;
                 }
             }
-            pDSOutput->GetRasterBand(1)->RasterIO(GF_Write, 0,  i, rmOutputMeta.GetCols(), 1, pOutputLine,
-                                                  rmOutputMeta.GetCols(), 1,
-                                                  GDT_Float64, 0, 0);
+            outputWriter.WriteRow(i, pOutputLine);
         }
     }
-    CPLFree(pInputLine1);
     CPLFree(pOutputLine);
 
-    CalculateStats(pDSOutput->GetRasterBand(1));
+    outputWriter.Finish();
+    CalculateStats(pDSOutput->GetRasterBand(1), &outputStats);
 
     GDALClose(pDS1);
-    GDALClose(pDSOutput);
+    CloseOutputDS(pDSOutput);
 
 
     return PROCESS_OK;
@@ -11,11 +11,38 @@
 #include "gdal.h"
 #include "gdal_priv.h"
 #include "rastermanager.h"
+#include "rasterstream.h"
+#include <vector>
+#include <algorithm>
 
 
 
 namespace RasterManager {
 
+/* An input to the mosaic and where its rows and columns land in the output */
+struct MosaicInput
+{
+    GDALDataset * pDS;
+    GDALRasterBand * pRB;
+    RasterReader * pReader;
+    double fNoData;
+    int nRowOffset;
+    int nColOffset;
+};
+
+/* Owns the inputs so every reader and dataset is closed however the mosaic ends */
+struct MosaicInputs
+{
+    std::vector<MosaicInput> vInputs;
+
+    ~MosaicInputs(){
+        for (size_t n = 0; n < vInputs.size(); n++){
+            delete vInputs[n].pReader;
+            GDALClose(vInputs[n].pDS);
+        }
+    }
+};
+
 int Raster::RasterMosaic(const char * csRasters, const char * psOutput)
 {
     // Check for input and output files
@@ -31,57 +58,100 @@ int Raster::RasterMosaic(const char * csRasters, const char * psOutput)
      * The default output type is 32 bit floating point.
      */
 
-    // Create the output dataset for writing
-    GDALDataset * pDSOutput = CreateOutputDS(psOutput, OutputMeta);
+    // Create the output dataset for writing. Every row is written once below so there's no pre-fill.
+    GDALDataset * pDSOutput = CreateOutputDS(psOutput, OutputMeta, true);
+    GDALRasterBand * pRBOutput = pDSOutput->GetRasterBand(1);
 
     //projectionRef use from inputs.
 
-    double * pOutputLine = (double *) CPLMalloc(sizeof(double)*OutputMeta->GetCols());
+    int nCols = OutputMeta->GetCols();
 
-    /*****************************************************************************************
-     * Loop over the inputs and then the rows and columns
-     *
-     */
+    // Open everything up front so the output can be built a row at a time
+    MosaicInputs inputs;
+    std::vector<MosaicInput> & vInputs = inputs.vInputs;
     foreach(QString raster, slRasters){
 
         const QByteArray qbRasterFilePath = raster.toLocal8Bit();
-        GDALDataset * pDS = (GDALDataset*) GDALOpen(qbRasterFilePath.data(), GA_ReadOnly);
-        GDALRasterBand * pRBInput = pDS->GetRasterBand(1);
+        MosaicInput input;
+        input.pDS = (GDALDataset*) GDALOpen(qbRasterFilePath.data(), GA_ReadOnly);
+        if (input.pDS == NULL){
+            CloseOutputDS(pDSOutput);
+            delete OutputMeta;
+            throw RasterManagerException(INPUT_FILE_ERROR, raster);
+        }
+        input.pRB = input.pDS->GetRasterBand(1);
+        input.pReader = NULL;
+        vInputs.push_back(input);
 
         RasterMeta inputMeta (qbRasterFilePath.data());
+        vInputs.back().fNoData = inputMeta.GetNoDataValue();
         // We need to figure out where in the output the input lives.
-        int trans_i = OutputMeta->GetRowTranslation(&inputMeta);
-        int trans_j = OutputMeta->GetColTranslation(&inputMeta);
-
-        double * pInputLine = (double *) CPLMalloc(sizeof(double)*pRBInput->GetXSize());
-
-        for (int i = 0; i < pRBInput->GetYSize(); i++){
-            pRBInput->RasterIO(GF_Read, 0,  i, pRBInput->GetXSize(), 1, pInputLine, pRBInput->GetXSize(), 1, GDT_Float64, 0, 0);
-            // here's where we need to get the correct row of the output. Replace
-            pDSOutput->GetRasterBand(1)->RasterIO(GF_Read, 0,  trans_i+i, OutputMeta->GetCols(), 1, pOutputLine, OutputMeta->GetCols(), 1, GDT_Float64, 0, 0);
-
-            for (int j = 0; j < pRBInput->GetXSize(); j++){
-                // If the input line is empty then do nothing
-                if ( (pInputLine[j] != inputMeta.GetNoDataValue())
-                     && pOutputLine[trans_j+j] ==  OutputMeta->GetNoDataValue())
-                {
-                    pOutputLine[trans_j+j] = pInputLine[j];
+        vInputs.back().nRowOffset = -OutputMeta->GetRowTranslation(&inputMeta);
+        vInputs.back().nColOffset = OutputMeta->GetColTranslation(&inputMeta);
+    }
+
+    double * pOutputLine = (double *) CPLMalloc(sizeof(double) * nCols);
+
+    StatsAccumulator outputStats(pRBOutput);
+
+    /*****************************************************************************************
+     * Loop over the output rows and then the inputs that reach them. Earlier inputs win.
+     * An input only has a reader (and its read-ahead strips) while the output rows overlap it.
+     */
+    try {
+        RasterWriter outputWriter(pRBOutput, &outputStats);
+
+        for (int i = 0; i < OutputMeta->GetRows(); i++){
+
+            std::fill(pOutputLine, pOutputLine + nCols, OutputMeta->GetNoDataValue());
+
+            for (size_t n = 0; n < vInputs.size(); n++){
+                MosaicInput & input = vInputs[n];
+                int nInputRow = i - input.nRowOffset;
+                int nInputRows = input.pRB->GetYSize();
+                if (nInputRow < 0 || nInputRow >= nInputRows)
+                    continue;
+
+                if (input.pReader == NULL)
+                    input.pReader = new RasterReader(input.pRB);
+
+                int nInputCols = input.pReader->GetCols();
+                const double * pInputLine = input.pReader->ReadRow(nInputRow);
+
+                for (int j = 0; j < nInputCols; j++){
+                    int nOutputCol = input.nColOffset + j;
+                    // If the input cell is empty then do nothing
+                    if (nOutputCol >= 0 && nOutputCol < nCols
+                            && pInputLine[j] != input.fNoData
+                            && pOutputLine[nOutputCol] == OutputMeta->GetNoDataValue())
+                    {
+                        pOutputLine[nOutputCol] = pInputLine[j];
+                    }
+                }
+
+                if (nInputRow == nInputRows - 1){
+                    delete input.pReader;
+                    input.pReader = NULL;
                 }
             }
-            // here's where we need to get the correct row of the output. Replace
-            pDSOutput->GetRasterBand(1)->RasterIO(GF_Write, 0,  trans_i+i, OutputMeta->GetCols(), 1, pOutputLine, OutputMeta->GetCols(), 1, GDT_Float64, 0, 0);
 
+            outputWriter.WriteRow(i, pOutputLine);
         }
-        CPLFree(pInputLine);
+        outputWriter.Finish();
+    }
+    catch (RasterManagerException e){
+        CPLFree(pOutputLine);
+        CloseOutputDS(pDSOutput);
+        delete OutputMeta;
+        throw;
     }
-
 
     /*****************************************************************************************
      * Now Close everything and clean it all up
      */
     CPLFree(pOutputLine);
-    CalculateStats(pDSOutput->GetRasterBand(1));
-    GDALClose(pDSOutput);
+    CalculateStats(pRBOutput, &outputStats);
+    CloseOutputDS(pDSOutput);
 
     delete OutputMeta;
 
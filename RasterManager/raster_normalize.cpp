@@ -11,6 +11,7 @@
 #include "gdal.h"
 #include "gdal_priv.h"
 #include "rastermanager.h"
+#include "rasterstream.h"
 
 
 namespace RasterManager {
@@ -59,10 +60,13 @@ int Raster::NormalizeRaster(const char * psInputRaster,
     }
 
     // Create the output dataset for writing
-    GDALDataset * pDSOutput = CreateOutputDS(psOutputRaster, &rmRasterMeta);
+    GDALDataset * pDSOutput = CreateOutputDS(psOutputRaster, &rmRasterMeta, true);
 
     double * pOutputLine = (double *) CPLMalloc(sizeof(double)*rmOutputMeta.GetCols());
 
+    StatsAccumulator outputStats(pDSOutput->GetRasterBand(1));
+    RasterWriter outputWriter(pDSOutput->GetRasterBand(1), &outputStats);
+
     int i, j;
     for (i = 0; i < rmOutputMeta.GetRows(); i++)
     {
@@ -80,15 +84,16 @@ int Raster::NormalizeRaster(const char * psInputRaster,
             }
         }
 
-        pDSOutput->GetRasterBand(1)->RasterIO(GF_Write, 0,  i, rmOutputMeta.GetCols(), 1, pOutputLine, rmOutputMeta.GetCols(), 1, GDT_Float64, 0, 0);
+        outputWriter.WriteRow(i, pOutputLine);
     }
     CPLFree(pInputLine);
     CPLFree(pOutputLine);
 
-    CalculateStats(pDSOutput->GetRasterBand(1));
+    outputWriter.Finish();
+    CalculateStats(pDSOutput->GetRasterBand(1), &outputStats);
 
     GDALClose(pDSInput);
-    GDALClose(pDSOutput);
+    CloseOutputDS(pDSOutput);
 
     return PROCESS_OK;
 
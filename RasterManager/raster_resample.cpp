@@ -4,16 +4,195 @@
 #include "rastermanager_interface.h"
 #include "rastermanager_exception.h"
 #include "gdal_priv.h"
+#include "rastermanager.h"
 
 #include <limits>
 #include <math.h>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <QHash>
 
 namespace RasterManager {
 
+// Below this fraction of valid kernel weight a resampled cell is set to NoData
+static const double RESAMPLE_MIN_WEIGHT = 0.001;
+
+/**
+ * @brief The input cells (and their weights) that contribute to each output cell
+ *        along one axis. Both axes are built the same way which is what makes the
+ *        kernels separable.
+ */
+struct ResampleTaps {
+    std::vector<int> First;     // First input cell index
+    std::vector<int> Count;     // Number of input cells
+    std::vector<int> Offset;    // Offset of the first weight in Weights
+    std::vector<int> Nearest;   // Nearest input cell or -1 if it falls off the raster
+    std::vector<double> Weights;
+};
+
+static inline bool ResampleIsNoData(double dVal, bool bHasNoData, float fNoData)
+{
+    // Cast down to float for the same reason as in ReSampleRaster above
+    return bHasNoData && static_cast<float>(dVal) == fNoData;
+}
+
+static double ResampleKernelRadius(Raster_Resample_Method eMethod)
+{
+    switch (eMethod) {
+    case RESAMPLE_CUBIC:
+        return 2;
+    case RESAMPLE_LANCZOS:
+        return 3;
+    default:
+        return 0.5;
+    }
+}
+
+static double ResampleKernelWeight(Raster_Resample_Method eMethod, double dX)
+{
+    const double PI = 3.14159265358979;
+    dX = fabs(dX);
+
+    switch (eMethod) {
+    case RESAMPLE_CUBIC:
+        // Keys cubic convolution with a = -0.5
+        if (dX < 1)
+            return (1.5 * dX - 2.5) * dX * dX + 1;
+        else if (dX < 2)
+            return ((-0.5 * dX + 2.5) * dX - 4) * dX + 2;
+        return 0;
+    case RESAMPLE_LANCZOS:
+        // Lanczos windowed sinc with 3 lobes
+        if (dX < OMEGA)
+            return 1;
+        else if (dX < 3)
+            return 3 * sin(PI * dX) * sin(PI * dX / 3) / (PI * PI * dX * dX);
+        return 0;
+    default:
+        return dX <= 0.5 ? 1 : 0;
+    }
+}
+
+/**
+ * @brief ResampleSourceBand Pick the coarsest overview that is still at least as fine as the
+ *        output grid so that big reductions only read a fraction of the data. Only overviews
+ *        known to be averaged count, a decimated one would alias. Falls back to the full
+ *        resolution band when the raster has no suitable overviews.
+ * @param dFactor output cell size / input cell size
+ */
+static GDALRasterBand * ResampleSourceBand(GDALRasterBand * pRBInput, double dFactor)
+{
+    GDALRasterBand * pBest = pRBInput;
+    for (int n = 0; n < pRBInput->GetOverviewCount(); n++){
+        GDALRasterBand * pOverview = pRBInput->GetOverview(n);
+        if (pOverview == NULL || !OverviewIsAveraged(pRBInput, pOverview))
+            continue;
+
+        double dOverviewFactor = (double) pRBInput->GetXSize() / pOverview->GetXSize();
+        if (dOverviewFactor <= dFactor && pOverview->GetXSize() < pBest->GetXSize())
+            pBest = pOverview;
+    }
+    return pBest;
+}
+
+/**
+ * @brief BuildKernelTaps
+ * @param dOrigin position of the first output cell centre in input cell coordinates
+ *                (0 is the centre of the first input cell)
+ * @param dStep distance between output cell centres in input cells
+ */
+static void BuildKernelTaps(Raster_Resample_Method eMethod, double dOrigin, double dStep,
+                            int nOut, int nIn, ResampleTaps & taps)
+{
+    // When we downsample the kernel is stretched so that it covers the whole output cell.
+    double dScale = dStep > 1 ? dStep : 1;
+    double dRadius = ResampleKernelRadius(eMethod) * dScale;
+
+    taps.First.resize(nOut);
+    taps.Count.resize(nOut);
+    taps.Offset.resize(nOut);
+    taps.Nearest.resize(nOut);
+    taps.Weights.clear();
+
+    for (int k = 0; k < nOut; k++){
+        double dX = dOrigin + k * dStep;
+        int nNearest = (int) floor(dX + 0.5);
+        if (nNearest < 0 || nNearest >= nIn)
+            nNearest = -1;
+
+        int nLo, nHi;
+        if (eMethod == RESAMPLE_NEAREST){
+            nLo = nNearest;
+            nHi = nNearest < 0 ? -2 : nNearest;
+        }
+        else{
+            nLo = std::max(0, (int) ceil(dX - dRadius));
+            nHi = std::min(nIn - 1, (int) floor(dX + dRadius));
+        }
+
+        taps.Nearest[k] = nNearest;
+        taps.First[k] = nLo;
+        taps.Offset[k] = (int) taps.Weights.size();
+        taps.Count[k] = nHi >= nLo ? nHi - nLo + 1 : 0;
+
+        // Normalize so the weights along the axis sum to 1
+        double dSum = 0;
+        for (int n = nLo; n <= nHi; n++){
+            double dW = eMethod == RESAMPLE_NEAREST ? 1 : ResampleKernelWeight(eMethod, (n - dX) / dScale);
+            taps.Weights.push_back(dW);
+            dSum += dW;
+        }
+        if (fabs(dSum) > OMEGA){
+            for (int t = 0; t < taps.Count[k]; t++)
+                taps.Weights[taps.Offset[k] + t] /= dSum;
+        }
+    }
+}
+
+/**
+ * @brief BuildAggregateTaps weights are the fraction of each input cell covered by the output cell
+ * @param dOrigin position of the leading edge of the first output cell in input cells
+ * @param dStep size of an output cell in input cells
+ */
+static void BuildAggregateTaps(double dOrigin, double dStep, int nOut, int nIn, ResampleTaps & taps)
+{
+    taps.First.resize(nOut);
+    taps.Count.resize(nOut);
+    taps.Offset.resize(nOut);
+    taps.Nearest.resize(nOut);
+    taps.Weights.clear();
+
+    for (int k = 0; k < nOut; k++){
+        double dA = dOrigin + k * dStep;
+        double dB = dA + dStep;
+
+        int nLo = std::max(0, (int) floor(dA));
+        int nHi = std::min(nIn - 1, (int) ceil(dB) - 1);
+
+        taps.First[k] = nLo;
+        taps.Offset[k] = (int) taps.Weights.size();
+        taps.Nearest[k] = -1;
+
+        int nCount = 0;
+        for (int n = nLo; n <= nHi; n++){
+            double dW = std::min(dB, (double) n + 1) - std::max(dA, (double) n);
+            // Slivers from floating point edges are not real overlaps
+            if (dW <= OMEGA){
+                if (nCount == 0)
+                    taps.First[k] = n + 1;
+                continue;
+            }
+            taps.Weights.push_back(dW);
+            nCount++;
+        }
+        taps.Count[k] = nCount;
+    }
+}
+
 int Raster::ReSampleRaster(GDALRasterBand * pRBInput, GDALRasterBand * pRBOutput,
                            double fNewCellSize, double fNewLeft, double fNewTop,
-                           int nNewRows, int nNewCols)
+                           int nNewRows, int nNewCols, StatsAccumulator * pStats)
 {
     // The properties of the original raster.
     double fOldLeft = GetLeft();
@@ -132,6 +311,7 @@ int Raster::ReSampleRaster(GDALRasterBand * pRBInput, GDALRasterBand * pRBOutput
             }
         }
         pRBOutput->RasterIO(GF_Write, 0, i, pRBOutput->GetXSize(), 1, pOutputLine, pRBOutput->GetXSize(), 1, GDT_Float64, 0, 0);
+        pStats->AddLine(pOutputLine, pRBOutput->GetXSize());
     }
 
     CPLFree(pTopLine);
@@ -141,5 +321,241 @@ int Raster::ReSampleRaster(GDALRasterBand * pRBInput, GDALRasterBand * pRBOutput
     return PROCESS_OK;
 }
 
+int Raster::ReSampleKernel(GDALRasterBand * pRBInput, GDALRasterBand * pRBOutput,
+                           Raster_Resample_Method eMethod,
+                           double fNewCellSize, double fNewLeft, double fNewTop,
+                           int nNewRows, int nNewCols, StatsAccumulator * pStats)
+{
+    double dNoData = GetNoDataValue();
+    float fNoData = static_cast<float>(dNoData);
+    bool bHasNoData = HasNoDataValue();
+
+    // Read from an overview when there is one close to the output resolution. Nearest has to
+    // return real input values so it always reads the full resolution band.
+    if (eMethod != RESAMPLE_NEAREST)
+        pRBInput = ResampleSourceBand(pRBInput, fNewCellSize / GetCellWidth());
+
+    int nInCols = pRBInput->GetXSize();
+    int nInRows = pRBInput->GetYSize();
+    double dCellWidth = GetCellWidth() * GetCols() / nInCols;
+    double dCellHeight = GetCellHeight() * GetRows() / nInRows;
+
+    /*************************************************************************************************
+    * Work out which input cells feed each output column and row. Positions are in input cell
+    * units with 0 at the centre of the first input cell. Cell height is negative so the row
+    * step comes out positive.
+    */
+    ResampleTaps colTaps, rowTaps;
+    BuildKernelTaps(eMethod, (fNewLeft + fNewCellSize / 2 - GetLeft()) / dCellWidth - 0.5,
+                    fNewCellSize / dCellWidth, nNewCols, nInCols, colTaps);
+    BuildKernelTaps(eMethod, (fNewTop - fNewCellSize / 2 - GetTop()) / dCellHeight - 0.5,
+                    -fNewCellSize / dCellHeight, nNewRows, nInRows, rowTaps);
+
+    /*************************************************************************************************
+    * Each input row is read once and filtered horizontally into a ring of rows that is just deep
+    * enough for the vertical kernel. We keep the weighted sum and the valid weight separately so
+    * that NoData cells can be dropped and the remaining weights renormalized in the vertical pass.
+    */
+    int nRing = 1;
+    for (int i = 0; i < nNewRows; i++)
+        nRing = std::max(nRing, rowTaps.Count[i]);
+
+    double * pInputLine = (double *) CPLMalloc(sizeof(double) * nInCols);
+    double * pOutputLine = (double *) CPLMalloc(sizeof(double) * nNewCols);
+    double * pRingSum = (double *) CPLMalloc(sizeof(double) * nNewCols * nRing);
+    double * pRingWeight = (double *) CPLMalloc(sizeof(double) * nNewCols * nRing);
+    double * pRingCentre = (double *) CPLMalloc(sizeof(double) * nNewCols * nRing);
+    std::vector<int> vRingRow(nRing, -1);
+
+    for (int i = 0; i < nNewRows; i++)
+    {
+        if (rowTaps.Count[i] == 0 || rowTaps.Nearest[i] < 0){
+            for (int j = 0; j < nNewCols; j++)
+                pOutputLine[j] = dNoData;
+            pRBOutput->RasterIO(GF_Write, 0, i, nNewCols, 1, pOutputLine, nNewCols, 1, GDT_Float64, 0, 0);
+            pStats->AddLine(pOutputLine, nNewCols);
+            continue;
+        }
+
+        // Horizontal pass for any rows we haven't seen yet
+        for (int r = rowTaps.First[i]; r < rowTaps.First[i] + rowTaps.Count[i]; r++){
+            int nSlot = r % nRing;
+            if (vRingRow[nSlot] == r)
+                continue;
+
+            pRBInput->RasterIO(GF_Read, 0, r, nInCols, 1, pInputLine, nInCols, 1, GDT_Float64, 0, 0);
+
+            double * pSum = pRingSum + (size_t) nSlot * nNewCols;
+            double * pWeight = pRingWeight + (size_t) nSlot * nNewCols;
+            double * pCentre = pRingCentre + (size_t) nSlot * nNewCols;
+
+            for (int j = 0; j < nNewCols; j++){
+                double dSum = 0;
+                double dWeight = 0;
+                const double * pW = colTaps.Weights.data() + colTaps.Offset[j];
+                const double * pIn = pInputLine + colTaps.First[j];
+                for (int t = 0; t < colTaps.Count[j]; t++){
+                    if (!ResampleIsNoData(pIn[t], bHasNoData, fNoData)){
+                        dSum += pW[t] * pIn[t];
+                        dWeight += pW[t];
+                    }
+                }
+                pSum[j] = dSum;
+                pWeight[j] = dWeight;
+                pCentre[j] = colTaps.Nearest[j] >= 0 ? pInputLine[colTaps.Nearest[j]] : dNoData;
+            }
+            vRingRow[nSlot] = r;
+        }
+
+        // Vertical pass
+        const double * pCentre = pRingCentre + (size_t) (rowTaps.Nearest[i] % nRing) * nNewCols;
+        const double * pW = rowTaps.Weights.data() + rowTaps.Offset[i];
+
+        for (int j = 0; j < nNewCols; j++){
+            pOutputLine[j] = dNoData;
+
+            // Don't invent values inside NoData holes or off the edge of the input
+            if (colTaps.Nearest[j] < 0 || ResampleIsNoData(pCentre[j], bHasNoData, fNoData))
+                continue;
+
+            double dSum = 0;
+            double dWeight = 0;
+            for (int t = 0; t < rowTaps.Count[i]; t++){
+                size_t nOffset = (size_t) ((rowTaps.First[i] + t) % nRing) * nNewCols + j;
+                dSum += pW[t] * pRingSum[nOffset];
+                dWeight += pW[t] * pRingWeight[nOffset];
+            }
+
+            if (dWeight > RESAMPLE_MIN_WEIGHT)
+                pOutputLine[j] = dSum / dWeight;
+        }
+
+        pRBOutput->RasterIO(GF_Write, 0, i, nNewCols, 1, pOutputLine, nNewCols, 1, GDT_Float64, 0, 0);
+        pStats->AddLine(pOutputLine, nNewCols);
+    }
+
+    CPLFree(pInputLine);
+    CPLFree(pOutputLine);
+    CPLFree(pRingSum);
+    CPLFree(pRingWeight);
+    CPLFree(pRingCentre);
+
+    return PROCESS_OK;
+}
+
+int Raster::ReSampleAggregate(GDALRasterBand * pRBInput, GDALRasterBand * pRBOutput,
+                              Raster_Resample_Method eMethod,
+                              double fNewCellSize, double fNewLeft, double fNewTop,
+                              int nNewRows, int nNewCols, StatsAccumulator * pStats)
+{
+    double dNoData = GetNoDataValue();
+    float fNoData = static_cast<float>(dNoData);
+    bool bHasNoData = HasNoDataValue();
+
+    // Averaged overviews stand in for the average method but can't give the mode of the input
+    if (eMethod == RESAMPLE_AVERAGE)
+        pRBInput = ResampleSourceBand(pRBInput, fNewCellSize / GetCellWidth());
+
+    int nInCols = pRBInput->GetXSize();
+    int nInRows = pRBInput->GetYSize();
+    double dCellWidth = GetCellWidth() * GetCols() / nInCols;
+    double dCellHeight = GetCellHeight() * GetRows() / nInRows;
+
+    /*************************************************************************************************
+    * Positions here are cell edges (0 is the left/top edge of the input) and every weight is the
+    * overlap between an input cell and an output cell measured in input cells.
+    */
+    ResampleTaps colTaps, rowTaps;
+    BuildAggregateTaps((fNewLeft - GetLeft()) / dCellWidth,
+                       fNewCellSize / dCellWidth, nNewCols, nInCols, colTaps);
+    BuildAggregateTaps((fNewTop - GetTop()) / dCellHeight,
+                       -fNewCellSize / dCellHeight, nNewRows, nInRows, rowTaps);
+
+    double * pInputLine = (double *) CPLMalloc(sizeof(double) * nInCols);
+    double * pOutputLine = (double *) CPLMalloc(sizeof(double) * nNewCols);
+    double * pSum = (double *) CPLMalloc(sizeof(double) * nNewCols);
+    double * pWeight = (double *) CPLMalloc(sizeof(double) * nNewCols);
+
+    // For mode we keep the area of each distinct value for every cell in the output row
+    std::vector< QHash<double, double> > vModeAreas;
+    if (eMethod == RESAMPLE_MODE)
+        vModeAreas.resize(nNewCols);
+
+    /*************************************************************************************************
+    * Output rows are visited in order so consecutive rows only ever share the input row that
+    * straddles their boundary. Keeping that last row around means every input row is read
+    * exactly once when we downsample.
+    */
+    int nCachedRow = -1;
+
+    for (int i = 0; i < nNewRows; i++)
+    {
+        for (int j = 0; j < nNewCols; j++){
+            pSum[j] = 0;
+            pWeight[j] = 0;
+        }
+        if (eMethod == RESAMPLE_MODE){
+            for (int j = 0; j < nNewCols; j++)
+                vModeAreas[j].clear();
+        }
+
+        for (int t = 0; t < rowTaps.Count[i]; t++){
+            int r = rowTaps.First[i] + t;
+            double dWy = rowTaps.Weights[rowTaps.Offset[i] + t];
+
+            if (r != nCachedRow){
+                pRBInput->RasterIO(GF_Read, 0, r, nInCols, 1, pInputLine, nInCols, 1, GDT_Float64, 0, 0);
+                nCachedRow = r;
+            }
+
+            for (int j = 0; j < nNewCols; j++){
+                const double * pW = colTaps.Weights.data() + colTaps.Offset[j];
+                const double * pIn = pInputLine + colTaps.First[j];
+                for (int c = 0; c < colTaps.Count[j]; c++){
+                    if (ResampleIsNoData(pIn[c], bHasNoData, fNoData))
+                        continue;
+
+                    double dArea = dWy * pW[c];
+                    if (eMethod == RESAMPLE_MODE)
+                        vModeAreas[j][pIn[c]] += dArea;
+                    else
+                        pSum[j] += dArea * pIn[c];
+                    pWeight[j] += dArea;
+                }
+            }
+        }
+
+        for (int j = 0; j < nNewCols; j++){
+            pOutputLine[j] = dNoData;
+            if (pWeight[j] <= 0)
+                continue;
+
+            if (eMethod == RESAMPLE_MODE){
+                // Largest area wins. Ties go to the lowest value so the result is repeatable.
+                double dBestArea = -1;
+                QHashIterator<double, double> it(vModeAreas[j]);
+                while (it.hasNext()) {
+                    it.next();
+                    if (it.value() > dBestArea || (it.value() == dBestArea && it.key() < pOutputLine[j])){
+                        dBestArea = it.value();
+                        pOutputLine[j] = it.key();
+                    }
+                }
+            }
+            else
+                pOutputLine[j] = pSum[j] / pWeight[j];
+        }
+
+        pRBOutput->RasterIO(GF_Write, 0, i, nNewCols, 1, pOutputLine, nNewCols, 1, GDT_Float64, 0, 0);
+        pStats->AddLine(pOutputLine, nNewCols);
+    }
+
+    CPLFree(pInputLine);
+    CPLFree(pOutputLine);
+    CPLFree(pSum);
+    CPLFree(pWeight);
+
+    return PROCESS_OK;
+}
 
 } // Namespace
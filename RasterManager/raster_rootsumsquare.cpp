@@ -11,6 +11,7 @@
 #include "gdal.h"
 #include "gdal_priv.h"
 #include "rastermanager.h"
+#include "rasterstream.h"
 
 
 
@@ -72,7 +73,7 @@ int Raster::RasterRootSumSquares(const char * psRaster1, const char * psRaster2,
     // Create the output dataset for writing
     RasterMeta OutputMeta(InputMeta1);
     OutputMeta.SetNoDataValue(&fNoDataValue);
-    GDALDataset * pDSOutput = CreateOutputDS(psOutput, &OutputMeta);
+    GDALDataset * pDSOutput = CreateOutputDS(psOutput, &OutputMeta, true);
 
     /*****************************************************************************************
      * Allocate the memory for the input / output lines
@@ -81,6 +82,9 @@ int Raster::RasterRootSumSquares(const char * psRaster1, const char * psRaster2,
     double * pInputLine2 = (double *) CPLMalloc(sizeof(double)*cols);
     double * pOutputLine = (double *) CPLMalloc(sizeof(double)*cols);
 
+    StatsAccumulator outputStats(pDSOutput->GetRasterBand(1));
+    RasterWriter outputWriter(pDSOutput->GetRasterBand(1), &outputStats);
+
     int i, j;
     for (i = 0; i < InputMeta1.GetRows(); i++)
     {
@@ -97,18 +101,19 @@ int Raster::RasterRootSumSquares(const char * psRaster1, const char * psRaster2,
                 pOutputLine[j] = sqrt( pow(pInputLine1[j], 2) + pow(pInputLine2[j], 2) );
         }
 
-        pDSOutput->GetRasterBand(1)->RasterIO(GF_Write, 0,  i, cols, 1, pOutputLine, cols, 1, GDT_Float64, 0, 0);
+        outputWriter.WriteRow(i, pOutputLine);
     }
 
     CPLFree(pInputLine1);
     CPLFree(pInputLine2);
     CPLFree(pOutputLine);
 
-    CalculateStats(pDSOutput->GetRasterBand(1));
+    outputWriter.Finish();
+    CalculateStats(pDSOutput->GetRasterBand(1), &outputStats);
 
     GDALClose(pDS1);
     GDALClose(pDS2);
-    GDALClose(pDSOutput);
+    CloseOutputDS(pDSOutput);
 
     return PROCESS_OK;
 
@@ -5,6 +5,7 @@
 #include "rastermanager_exception.h"
 #include "gdal_priv.h"
 #include "rastermanager.h"
+#include "rasterstream.h"
 #include <QString>
 
 namespace RasterManager {
@@ -43,10 +44,13 @@ int Raster::SetNull(const char * psOutputSlope, const char * psOperator, double
     GDALRasterBand * pRBInput = pInputDS->GetRasterBand(1);
 
     // Create the output dataset for writing
-    GDALDataset * pOutputDS = CreateOutputDS(psOutputSlope, this);
+    GDALDataset * pOutputDS = CreateOutputDS(psOutputSlope, this, true);
     GDALRasterBand * pOutputRB = pOutputDS->GetRasterBand(1);
     pOutputRB->SetNoDataValue(dNodataValue);
 
+    StatsAccumulator outputStats(pOutputDS->GetRasterBand(1));
+    RasterWriter outputWriter(pOutputDS->GetRasterBand(1), &outputStats);
+
     // Assign our buffers
     double * pInputLine = (double*) CPLMalloc(sizeof(double) * GetCols());
     double * pOutputLine = (double*) CPLMalloc(sizeof(double) * GetCols());
@@ -73,18 +77,19 @@ int Raster::SetNull(const char * psOutputSlope, const char * psOperator, double
 
         }
         // Write the row
-        pOutputRB->RasterIO(GF_Write, 0, i, GetCols(), 1, pOutputLine, GetCols(), 1, GDT_Float64, 0, 0 );
+        outputWriter.WriteRow(i, pOutputLine);
     }
 
     CPLFree(pOutputLine);
     CPLFree(pInputLine);
 
-    CalculateStats(pOutputDS->GetRasterBand(1));
+    outputWriter.Finish();
+    CalculateStats(pOutputDS->GetRasterBand(1), &outputStats);
 
     if ( pInputDS != NULL)
         GDALClose(pInputDS);
     if ( pOutputDS != NULL)
-        GDALClose(pOutputDS);
+        CloseOutputDS(pOutputDS);
 
     return PROCESS_OK;
 
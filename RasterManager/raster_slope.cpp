@@ -24,7 +24,7 @@ int Raster::Slope(const char * psOutputSlope, const char * psSlpType){
         throw RasterManagerException( MISSING_ARGUMENT, "Could not detect a valid slope type. must be either \"degrees\" or \"percent\"");
     }
 
-    GDALDataset * pSlopeDS = CreateOutputDS(psOutputSlope, this);
+    GDALDataset * pSlopeDS = CreateOutputDS(psOutputSlope, this, true);
     GDALDataset * pDemDS = (GDALDataset*) GDALOpen(m_sFilePath, GA_ReadOnly);
 
     const double PI = 3.14159265;
@@ -35,6 +35,8 @@ int Raster::Slope(const char * psOutputSlope, const char * psSlpType){
     double* fElev = (double*) CPLMalloc(sizeof(double) * 9);
     double* fSlope = (double*) CPLMalloc(sizeof(double) * GetCols());
 
+    StatsAccumulator outputStats(pSlopeDS->GetRasterBand(1));
+
     //Loop through each DEM cell to do the slope calculation,do not loop through edge cells
     for (int i=1; i< GetRows() -1; i++)
     {
@@ -78,13 +80,18 @@ int Raster::Slope(const char * psOutputSlope, const char * psSlpType){
             }
         }
         pSlopeDS->GetRasterBand(1)->RasterIO(GF_Write,0,i,GetCols(),1,fSlope,GetCols(),1,GDT_Float64,0,0);
+        outputStats.AddLine(fSlope, GetCols());
     }
 
-    CalculateStats(pSlopeDS->GetRasterBand(1));
+    // The edge rows are the only ones the loop doesn't write
+    FillOutputRows(pSlopeDS->GetRasterBand(1), 0, 1, GetNoDataValue());
+    FillOutputRows(pSlopeDS->GetRasterBand(1), GetRows() - 1, 1, GetNoDataValue());
+
+    CalculateStats(pSlopeDS->GetRasterBand(1), &outputStats);
 
     //close datasets
     GDALClose(pDemDS);
-    GDALClose(pSlopeDS);
+    CloseOutputDS(pSlopeDS);
 
     //free allocated memory
     CPLFree(fElev);
@@ -8,11 +8,93 @@
 #include "rastermanager.h"
 
 #include <math.h>
+#include <vector>
+#include <algorithm>
 #include <QFile>
+#include <QHash>
+#include <QTemporaryFile>
 #include <QStringList>
 
 namespace RasterManager {
 
+// Each median refinement pass splits the current value range into this many bins
+const int MEDIAN_HISTOGRAM_BINS = 65536;
+
+// Once the bin holding the median has this few cells we pull it into memory and select
+const long long MEDIAN_MAX_IN_MEMORY = 4 * 1024 * 1024;
+
+// Distinct values we will count in memory before spilling to disk
+const int COUNT_MAX_UNIQUE = 4 * 1024 * 1024;
+
+// Spilled values are split by hash into this many files so each one fits in memory
+const int COUNT_SPILL_PARTITIONS = 64;
+const int COUNT_SPILL_BUFFER = 8192;
+
+/**
+ * @brief The StatStripReader class reads a band a strip of block-rows at a time and
+ *        hands back only the valid (not NoData, not NaN) cells packed together.
+ */
+class StatStripReader {
+public:
+    StatStripReader(GDALRasterBand * pRB){
+        m_pRB = pRB;
+        m_nCols = pRB->GetXSize();
+        m_nRows = pRB->GetYSize();
+
+        int nBlockX, nBlockY;
+        pRB->GetBlockSize(&nBlockX, &nBlockY);
+        m_nStripRows = std::max(1, std::min(nBlockY, m_nRows));
+
+        int bHasNoData = FALSE;
+        m_dNoData = pRB->GetNoDataValue(&bHasNoData);
+        m_bHasNoData = bHasNoData == TRUE;
+
+        m_pBuffer = (double *) CPLMalloc(sizeof(double) * m_nCols * m_nStripRows);
+        m_nNextRow = 0;
+    }
+    ~StatStripReader(){ CPLFree(m_pBuffer); }
+
+    void Rewind(){ m_nNextRow = 0; }
+
+    /* Returns false once the band is exhausted. nValid may be 0 for an all-NoData strip */
+    bool Next(const double ** ppValues, int * pnValid){
+
+        if (m_nNextRow >= m_nRows)
+            return false;
+
+        int nRows = std::min(m_nStripRows, m_nRows - m_nNextRow);
+        CPLErr err = m_pRB->RasterIO(GF_Read, 0, m_nNextRow, m_nCols, nRows, m_pBuffer, m_nCols, nRows, GDT_Float64, 0, 0);
+        if (err == CE_Failure || err == CE_Fatal)
+            throw RasterManagerException(INPUT_FILE_ERROR, CPLGetLastErrorMsg());
+        m_nNextRow += nRows;
+
+        int nValid = 0;
+        int nCells = m_nCols * nRows;
+        for (int i = 0; i < nCells; i++){
+            double dValue = m_pBuffer[i];
+            if (CPLIsNan(dValue) || (m_bHasNoData && dValue == m_dNoData))
+                continue;
+            m_pBuffer[nValid++] = dValue;
+        }
+
+        *ppValues = m_pBuffer;
+        *pnValid = nValid;
+        return true;
+    }
+
+    double GetNoDataValue(){ return m_dNoData; }
+
+private:
+    GDALRasterBand * m_pRB;
+    int m_nCols;
+    int m_nRows;
+    int m_nStripRows;
+    int m_nNextRow;
+    bool m_bHasNoData;
+    double m_dNoData;
+    double * m_pBuffer;
+};
+
 int Raster::RasterStat(Raster_Stats_Operation eOperation, double * pdResult){
 
     // Get the easy stuff out of the way first
@@ -37,92 +119,351 @@ int Raster::RasterStat(Raster_Stats_Operation eOperation, double * pdResult){
         *pdResult = m_dRasterMax - m_dRasterMin;
         return PROCESS_OK;
         break;
-    default: break;
+    case STATS_MEDIAN:
+    case STATS_MAJORITY:
+    case STATS_MINORITY:
+    case STATS_SUM:
+    case STATS_VARIETY:
+    case STATS_COUNT:
+        break;
+    default:
+        throw RasterManagerException(ARGUMENT_VALIDATION, "Unknown statistic operation.");
     }
 
-    // TODO: Everything below this point is unimplemented
-    throw RasterManagerException(OTHER_ERROR, "Feature not implemented");
-
-    // Some of these take a little more math.
-    int nNumCells = GetCols() * GetRows();
-    std::vector<double> RasterArray;
-    RasterArray.resize(nNumCells);
-
-    // Setup our Read buffer and read the entire raster into an array
+    // The rest need a look at every cell.
     GDALDataset * pDSInput = (GDALDataset*) GDALOpen(FilePath(), GA_ReadOnly);
     if (pDSInput == NULL)
         throw RasterManagerException(INPUT_FILE_ERROR, "Could not open input Raster");
 
     GDALRasterBand * pRBInput = pDSInput->GetRasterBand(1);
 
-    double * pInputLine = (double *) CPLMalloc(sizeof(double)*GetCols());
-    for (int nRow = 0; nRow < pRBInput->GetYSize(); nRow++){
-        pRBInput->RasterIO(GF_Read, 0,  nRow, pRBInput->GetXSize(), 1, pInputLine, pRBInput->GetXSize(), 1, GDT_Float64, 0, 0);
-        for (int nCol = 0; nCol < pRBInput->GetXSize(); nCol++){
-            RasterArray.at( (nRow * GetCols() ) + nCol) = pInputLine[nCol];
+    try {
+        switch (eOperation) {
+        case STATS_MEDIAN:   *pdResult = RasterStatMedian(pRBInput); break;
+        case STATS_MAJORITY:
+        case STATS_MINORITY:
+        case STATS_VARIETY:  *pdResult = RasterStatCount(pRBInput, eOperation); break;
+        case STATS_SUM:      *pdResult = RasterStatSum(pRBInput, false); break;
+        case STATS_COUNT:    *pdResult = RasterStatSum(pRBInput, true); break;
+        default: break;
         }
     }
-    CPLFree(pInputLine);
-
-    switch (eOperation) {
-    case STATS_MEDIAN:   return RasterStatMedian(&RasterArray); break;
-    case STATS_MAJORITY: return RasterStatMajority(&RasterArray); break;
-    case STATS_MINORITY: return RasterStatMinority(&RasterArray); break;
-    case STATS_SUM:      return RasterStatSum(&RasterArray); break;
-    case STATS_VARIETY:  return RasterStatVariety(&RasterArray); break;
-    case STATS_RANGE:    return RasterStatRange(&RasterArray); break;
-    default: break;
+    catch (RasterManagerException e){
+        GDALClose(pDSInput);
+        throw;
     }
 
+    GDALClose(pDSInput);
+    return PROCESS_OK;
+}
+
+double Raster::RasterStatSum(GDALRasterBand * pRB, bool bCount){
+
+    StatStripReader reader(pRB);
+    const double * pValues;
+    int nValid;
+
+    long long nCount = 0;
+    double dSum = 0;
+    double dCompensation = 0;
+
+    while (reader.Next(&pValues, &nValid)){
+        nCount += nValid;
+        // Kahan summation so big rasters don't lose the small values
+        for (int i = 0; i < nValid; i++){
+            double y = pValues[i] - dCompensation;
+            double t = dSum + y;
+            dCompensation = (t - dSum) - y;
+            dSum = t;
+        }
+    }
 
+    if (bCount)
+        return (double) nCount;
+    return dSum;
 }
 
+/* Which histogram bin a value falls in for one refinement level */
+struct MedianLevel {
+    double dLo;
+    double dWidth;
+    int nBin;
+};
 
-double Raster::RasterStatMedian(std::vector<double> * RasterArray){
-    // Allocate an array of the same size and sort it.
-//    for (int i = 0; i < iSize; ++i) {
-//        dpSorted[i] = daArray[i];
-//    }
-//    for (int i = iSize - 1; i > 0; --i) {
-//        for (int j = 0; j < i; ++j) {
-//            if (dpSorted[j] > dpSorted[j+1]) {
-//                double dTemp = dpSorted[j];
-//                dpSorted[j] = dpSorted[j+1];
-//                dpSorted[j+1] = dTemp;
-//            }
-//        }
-//    }
-
-//    // Middle or average of middle values in the sorted array.
-//    double dMedian = 0.0;
-//    if ((iSize % 2) == 0) {
-//        dMedian = (dpSorted[iSize/2] + dpSorted[(iSize/2) - 1])/2.0;
-//    } else {
-//        dMedian = dpSorted[iSize/2];
-//    }
-//    delete [] dpSorted;
-//    return dMedian;
-    return -1;
+static inline int MedianBin(double dValue, double dLo, double dWidth){
+    if (dWidth <= 0)
+        return 0;
+    int nBin = (int) ((dValue - dLo) / dWidth);
+    return std::min(MEDIAN_HISTOGRAM_BINS - 1, std::max(0, nBin));
 }
 
-double Raster::RasterStatMajority(std::vector<double> * RasterArray){
-    return -1;
+/* A value belongs to the current range only if every previous level put it in the chosen bin */
+static inline bool InMedianRange(double dValue, const std::vector<MedianLevel> & vLevels){
+    for (size_t l = 0; l < vLevels.size(); l++){
+        if (MedianBin(dValue, vLevels[l].dLo, vLevels[l].dWidth) != vLevels[l].nBin)
+            return false;
+    }
+    return true;
 }
-double Raster::RasterStatMinority(std::vector<double> * RasterArray){
-    return -1;
+
+double Raster::RasterStatMedian(GDALRasterBand * pRB){
+
+    StatStripReader reader(pRB);
+    const double * pValues;
+    int nValid;
+
+    // First pass: exact count and range. The cached GDAL stats can be approximate.
+    long long nCount = 0;
+    double dMin = 0, dMax = 0;
+    while (reader.Next(&pValues, &nValid)){
+        for (int i = 0; i < nValid; i++){
+            if (nCount == 0){
+                dMin = pValues[i];
+                dMax = pValues[i];
+            }
+            else {
+                if (pValues[i] < dMin) dMin = pValues[i];
+                if (pValues[i] > dMax) dMax = pValues[i];
+            }
+            nCount++;
+        }
+    }
+
+    if (nCount == 0)
+        return reader.GetNoDataValue();
+
+    double dLower = RasterStatRank(pRB, (nCount - 1) / 2, dMin, dMax);
+    if (nCount % 2 == 1)
+        return dLower;
+
+    // Even count: the upper middle is either another copy of the lower one
+    // or the smallest value above it. One more pass tells us which.
+    long long nAtOrBelow = 0;
+    bool bFoundAbove = false;
+    double dAbove = dMax;
+    reader.Rewind();
+    while (reader.Next(&pValues, &nValid)){
+        for (int i = 0; i < nValid; i++){
+            if (pValues[i] <= dLower)
+                nAtOrBelow++;
+            else if (!bFoundAbove || pValues[i] < dAbove){
+                dAbove = pValues[i];
+                bFoundAbove = true;
+            }
+        }
+    }
+
+    double dUpper = (nAtOrBelow > nCount / 2 || !bFoundAbove) ? dLower : dAbove;
+    return (dLower + dUpper) / 2.0;
+}
+
+double Raster::RasterStatRank(GDALRasterBand * pRB, long long nRank, double dMin, double dMax){
+
+    StatStripReader reader(pRB);
+    const double * pValues;
+    int nValid;
+
+    std::vector<MedianLevel> vLevels;
+    std::vector<long long> vCounts(MEDIAN_HISTOGRAM_BINS);
+    std::vector<double> vBinMin(MEDIAN_HISTOGRAM_BINS);
+    std::vector<double> vBinMax(MEDIAN_HISTOGRAM_BINS);
+
+    double dLo = dMin;
+    double dHi = dMax;
+
+    // Narrow the range down with histogram passes until the bin holding our rank fits in memory
+    while (true){
+
+        if (dHi <= dLo)
+            return dLo;
+
+        MedianLevel level;
+        level.dLo = dLo;
+        level.dWidth = (dHi - dLo) / MEDIAN_HISTOGRAM_BINS;
+
+        std::fill(vCounts.begin(), vCounts.end(), 0);
+
+        reader.Rewind();
+        while (reader.Next(&pValues, &nValid)){
+            for (int i = 0; i < nValid; i++){
+                if (!InMedianRange(pValues[i], vLevels))
+                    continue;
+                int nBin = MedianBin(pValues[i], level.dLo, level.dWidth);
+                if (vCounts[nBin] == 0){
+                    vBinMin[nBin] = pValues[i];
+                    vBinMax[nBin] = pValues[i];
+                }
+                else {
+                    if (pValues[i] < vBinMin[nBin]) vBinMin[nBin] = pValues[i];
+                    if (pValues[i] > vBinMax[nBin]) vBinMax[nBin] = pValues[i];
+                }
+                vCounts[nBin]++;
+            }
+        }
+
+        int nBin = 0;
+        while (nBin < MEDIAN_HISTOGRAM_BINS - 1 && nRank >= vCounts[nBin]){
+            nRank -= vCounts[nBin];
+            nBin++;
+        }
+
+        level.nBin = nBin;
+        vLevels.push_back(level);
+
+        // Every value in the bin is the same so we already have our answer
+        if (vBinMin[nBin] == vBinMax[nBin])
+            return vBinMin[nBin];
+
+        if (vCounts[nBin] <= MEDIAN_MAX_IN_MEMORY)
+            break;
+
+        dLo = vBinMin[nBin];
+        dHi = vBinMax[nBin];
+    }
+
+    // Final pass: collect just the cells in the chosen bin and select from them
+    std::vector<double> vBin;
+    reader.Rewind();
+    while (reader.Next(&pValues, &nValid)){
+        for (int i = 0; i < nValid; i++){
+            if (InMedianRange(pValues[i], vLevels))
+                vBin.push_back(pValues[i]);
+        }
+    }
+
+    std::nth_element(vBin.begin(), vBin.begin() + nRank, vBin.end());
+    return vBin[nRank];
 }
-double Raster::RasterStatSum(std::vector<double> * RasterArray){
-    double total = 0;
-    for (int i = 0; i < (int)RasterArray->size(); i++){
-        total += RasterArray->at(i);
+
+/**
+ * @brief The ValueTally class folds value counts into the running majority,
+ *        minority and variety. Ties go to the smallest value.
+ */
+class ValueTally {
+public:
+    ValueTally(){ m_nVariety = 0; m_dMajority = 0; m_dMinority = 0; m_nMajority = 0; m_nMinority = 0; }
+
+    void Add(const QHash<double, long long> & hCounts){
+        QHash<double, long long>::const_iterator it;
+        for (it = hCounts.constBegin(); it != hCounts.constEnd(); ++it){
+            if (m_nVariety == 0 || it.value() > m_nMajority || (it.value() == m_nMajority && it.key() < m_dMajority)){
+                m_dMajority = it.key();
+                m_nMajority = it.value();
+            }
+            if (m_nVariety == 0 || it.value() < m_nMinority || (it.value() == m_nMinority && it.key() < m_dMinority)){
+                m_dMinority = it.key();
+                m_nMinority = it.value();
+            }
+            m_nVariety++;
+        }
     }
-    return total;
+
+    double Result(Raster_Stats_Operation eOperation, double dNoData){
+        if (eOperation == STATS_VARIETY)
+            return (double) m_nVariety;
+        if (m_nVariety == 0)
+            return dNoData;
+        return eOperation == STATS_MAJORITY ? m_dMajority : m_dMinority;
+    }
+
+private:
+    long long m_nVariety;
+    double m_dMajority;
+    double m_dMinority;
+    long long m_nMajority;
+    long long m_nMinority;
+};
+
+double Raster::RasterStatCount(GDALRasterBand * pRB, Raster_Stats_Operation eOperation){
+
+    StatStripReader reader(pRB);
+    const double * pValues;
+    int nValid;
+
+    QHash<double, long long> hCounts;
+    while (reader.Next(&pValues, &nValid)){
+        for (int i = 0; i < nValid; i++)
+            hCounts[pValues[i]]++;
+
+        // Too many distinct values to hold. Start over and count from disk instead.
+        if (hCounts.size() > COUNT_MAX_UNIQUE){
+            hCounts.clear();
+            return RasterStatCountSpilled(pRB, eOperation);
+        }
+    }
+
+    ValueTally tally;
+    tally.Add(hCounts);
+    return tally.Result(eOperation, reader.GetNoDataValue());
 }
-double Raster::RasterStatVariety(std::vector<double> * RasterArray){
-    return -1;
+
+/* Write out one partition's buffered values and empty the buffer */
+static void SpillValues(QTemporaryFile * pFile, std::vector<double> & vBuffer){
+    if (vBuffer.size() == 0)
+        return;
+    qint64 nBytes = (qint64) (sizeof(double) * vBuffer.size());
+    if (pFile->write((const char *) &vBuffer[0], nBytes) != nBytes)
+        throw RasterManagerException(OUTPUT_FILE_ERROR, "Could not write raster values to temporary file: " + pFile->errorString());
+    vBuffer.clear();
 }
-double Raster::RasterStatRange(std::vector<double> * RasterArray){
-    return -1;
+
+double Raster::RasterStatCountSpilled(GDALRasterBand * pRB, Raster_Stats_Operation eOperation){
+
+    StatStripReader reader(pRB);
+    const double * pValues;
+    int nValid;
+
+    // Every copy of a value hashes to the same partition so each one can be counted on its own
+    std::vector<QTemporaryFile *> vFiles(COUNT_SPILL_PARTITIONS, (QTemporaryFile *) NULL);
+    std::vector< std::vector<double> > vBuffers(COUNT_SPILL_PARTITIONS);
+    ValueTally tally;
+
+    try {
+        for (int p = 0; p < COUNT_SPILL_PARTITIONS; p++){
+            vFiles[p] = new QTemporaryFile();
+            if (!vFiles[p]->open())
+                throw RasterManagerException(OUTPUT_FILE_ERROR, "Could not create a temporary file to count raster values.");
+            vBuffers[p].reserve(COUNT_SPILL_BUFFER);
+        }
+
+        while (reader.Next(&pValues, &nValid)){
+            for (int i = 0; i < nValid; i++){
+                // -0 and 0 compare equal so they have to land together
+                double dValue = pValues[i] == 0 ? 0.0 : pValues[i];
+                int p = qHash(dValue) % COUNT_SPILL_PARTITIONS;
+                vBuffers[p].push_back(dValue);
+                if ((int) vBuffers[p].size() == COUNT_SPILL_BUFFER)
+                    SpillValues(vFiles[p], vBuffers[p]);
+            }
+        }
+
+        std::vector<double> vChunk(COUNT_SPILL_BUFFER);
+        for (int p = 0; p < COUNT_SPILL_PARTITIONS; p++){
+
+            SpillValues(vFiles[p], vBuffers[p]);
+            std::vector<double>().swap(vBuffers[p]);
+
+            QHash<double, long long> hCounts;
+            vFiles[p]->seek(0);
+            qint64 nRead;
+            while ((nRead = vFiles[p]->read((char *) &vChunk[0], sizeof(double) * vChunk.size())) > 0){
+                int nValues = (int) (nRead / sizeof(double));
+                for (int i = 0; i < nValues; i++)
+                    hCounts[vChunk[i]]++;
+            }
+            tally.Add(hCounts);
+
+            delete vFiles[p];
+            vFiles[p] = NULL;
+        }
+    }
+    catch (RasterManagerException e){
+        for (int p = 0; p < COUNT_SPILL_PARTITIONS; p++)
+            delete vFiles[p];
+        throw;
+    }
+
+    return tally.Result(eOperation, reader.GetNoDataValue());
 }
 
 }
@@ -3,6 +3,8 @@
 #include <gdal_priv.h>
 #include <gdal_alg.h>
 #include <ogr_api.h>
+#include <ogr_geometry.h>
+#include <cpl_string.h>
 #include <QDebug>
 
 #include "raster.h"
@@ -12,16 +14,610 @@
 #include "rastermanager_exception.h"
 #include <QDir>
 #include <QTextStream>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QThread>
+#include <QtConcurrent>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <limits>
 #include <math.h>
 
 namespace RasterManager {
 
+// Output is burned in strips of whole block rows, at least this many rows tall
+const int VECTOR_MIN_STRIP_ROWS = 128;
+
+/* What the burn workers share. Everything but the write lock and the strip counter is read-only. */
+struct VectorBurnJob
+{
+    std::string sVector;
+    std::string sField;
+    bool bBurnFID;
+    Raster_Rasterize_Mode eMode;
+    int nCols;
+    int nRows;
+    int nStripRows;
+    double transform[6];
+    double fNoData;
+
+    // Features whose envelope reaches each strip, in layer order
+    const std::vector< std::vector<GIntBig> > * pStripFeatures;
+
+    GDALRasterBand * pRBOutput;
+    QMutex * pWriteLock;
+    QAtomicInt * pNextStrip;
+};
+
+struct VectorBurnPartial
+{
+    StatsAccumulator * pStats;
+    int nErrorCode;
+    QString sError;
+};
+
+/* A window of cells in pixel space: where its top left corner is and how big its cells are.
+ * Cell sizes keep their sign so north-up and south-up grids both work. */
+struct CoverageWindow
+{
+    double fOriginX;
+    double fOriginY;
+    double fCellX;
+    double fCellY;
+    int nCols;
+    int nRows;
+};
+
+/* Add one edge, in pixel coordinates, to a coverage area buffer. Each cell collects
+ * the signed area the edge sweeps across it and every cell to its right collects the
+ * rest, so a running sum along the row comes out as the exact area covered. x must
+ * already be inside [0, nCols]. Rows outside the window are dropped. The buffer has
+ * two spare cells on every row for whatever spills off the right hand side. */
+static void CoverageLine(double x0, double y0, double x1, double y1, double fSign,
+                         int nCols, int nRows, double * pArea){
+
+    if (y0 == y1)
+        return;
+
+    double fDir = fSign;
+    if (y0 > y1){
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+        fDir = -fDir;
+    }
+    if (y1 <= 0 || y0 >= nRows)
+        return;
+
+    double fRight = nCols;
+    double dxdy = (x1 - x0) / (y1 - y0);
+    double x = x0;
+    int nRowStart = (int) floor(y0);
+    if (y0 < 0){
+        x = std::min(fRight, std::max(0.0, x0 - y0 * dxdy));
+        nRowStart = 0;
+    }
+    int nRowEnd = std::min(nRows, (int) ceil(y1));
+    int nStride = nCols + 2;
+
+    for (int y = nRowStart; y < nRowEnd; y++){
+        double dy = std::min((double) (y + 1), y1) - std::max((double) y, y0);
+        double xNext = std::min(fRight, std::max(0.0, x + dxdy * dy));
+        double d = dy * fDir;
+        double xa = std::min(x, xNext);
+        double xb = std::max(x, xNext);
+        double xaFloor = floor(xa);
+        int xai = (int) xaFloor;
+        int xbi = (int) ceil(xb);
+        double * pLine = pArea + (qint64) y * nStride;
+
+        if (xbi <= xai + 1){
+            // Stays inside one column. What's right of its midpoint is covered.
+            double xMid = 0.5 * (x + xNext) - xaFloor;
+            pLine[xai] += d - d * xMid;
+            pLine[xai + 1] += d * xMid;
+        }
+        else {
+            // Crosses columns: a triangle in the first and last, even slices between
+            double s = 1.0 / (xb - xa);
+            double xaFrac = xa - xaFloor;
+            double a0 = 0.5 * s * (1.0 - xaFrac) * (1.0 - xaFrac);
+            double xbFrac = xb - xbi + 1.0;
+            double am = 0.5 * s * xbFrac * xbFrac;
+            pLine[xai] += d * a0;
+            if (xbi == xai + 2)
+                pLine[xai + 1] += d * (1.0 - a0 - am);
+            else {
+                double a1 = s * (1.5 - xaFrac);
+                pLine[xai + 1] += d * (a1 - a0);
+                for (int xi = xai + 2; xi < xbi - 1; xi++)
+                    pLine[xi] += d * s;
+                double a2 = a1 + (xbi - xai - 3) * s;
+                pLine[xbi - 1] += d * (1.0 - a2 - am);
+            }
+            pLine[xbi] += d * am;
+        }
+        x = xNext;
+    }
+}
+
+/* Squash an edge into the window's columns. Whatever lies left or right of the window
+ * winds every cell in the row the same way, so it can run straight down the side as
+ * long as the edge is split where it crosses. */
+static void CoverageEdge(double x0, double y0, double x1, double y1, double fSign,
+                         int nCols, int nRows, double * pArea){
+
+    double fRight = nCols;
+    double t[4];
+    int nT = 0;
+    t[nT++] = 0;
+    if (x0 != x1){
+        double tLeft = -x0 / (x1 - x0);
+        double tRight = (fRight - x0) / (x1 - x0);
+        if (tLeft > 0 && tLeft < 1)
+            t[nT++] = tLeft;
+        if (tRight > 0 && tRight < 1)
+            t[nT++] = tRight;
+        if (nT == 3 && t[1] > t[2])
+            std::swap(t[1], t[2]);
+    }
+    t[nT++] = 1;
+
+    double xa = x0, ya = y0;
+    for (int i = 1; i < nT; i++){
+        double xb = i == nT - 1 ? x1 : x0 + (x1 - x0) * t[i];
+        double yb = i == nT - 1 ? y1 : y0 + (y1 - y0) * t[i];
+        CoverageLine(std::min(fRight, std::max(0.0, xa)), ya,
+                     std::min(fRight, std::max(0.0, xb)), yb,
+                     fSign, nCols, nRows, pArea);
+        xa = xb;
+        ya = yb;
+    }
+}
+
+static void CoverageAddRing(const OGRLinearRing * pRing, bool bExterior, const CoverageWindow & win, double * pArea){
+
+    int nPoints = pRing->getNumPoints();
+    if (nPoints < 3)
+        return;
+
+    std::vector<double> vX(nPoints), vY(nPoints);
+    double fTwiceArea = 0;
+    for (int i = 0; i < nPoints; i++){
+        vX[i] = (pRing->getX(i) - win.fOriginX) / win.fCellX;
+        vY[i] = (pRing->getY(i) - win.fOriginY) / win.fCellY;
+    }
+    for (int i = 0; i < nPoints; i++){
+        int j = (i + 1) % nPoints;
+        fTwiceArea += vX[i] * vY[j] - vX[j] * vY[i];
+    }
+    if (fTwiceArea == 0)
+        return;
+
+    // Exteriors add one to the winding and holes take one away, whichever way the file wound them
+    double fSign = ((fTwiceArea < 0) == bExterior) ? 1.0 : -1.0;
+
+    for (int i = 0; i < nPoints; i++){
+        int j = (i + 1) % nPoints;
+        CoverageEdge(vX[i], vY[i], vX[j], vY[j], fSign, win.nCols, win.nRows, pArea);
+    }
+}
+
+static void CoverageAddGeometry(const OGRGeometry * pGeom, const CoverageWindow & win, double * pArea){
+
+    switch (wkbFlatten(pGeom->getGeometryType())){
+    case wkbPolygon:{
+        const OGRPolygon * pPolygon = (const OGRPolygon *) pGeom;
+        if (pPolygon->getExteriorRing() == NULL)
+            break;
+        CoverageAddRing(pPolygon->getExteriorRing(), true, win, pArea);
+        for (int r = 0; r < pPolygon->getNumInteriorRings(); r++)
+            CoverageAddRing(pPolygon->getInteriorRing(r), false, win, pArea);
+        break;
+    }
+    case wkbMultiPolygon:
+    case wkbGeometryCollection:{
+        const OGRGeometryCollection * pCollection = (const OGRGeometryCollection *) pGeom;
+        for (int g = 0; g < pCollection->getNumGeometries(); g++)
+            CoverageAddGeometry(pCollection->getGeometryRef(g), win, pArea);
+        break;
+    }
+    case wkbCurvePolygon:
+    case wkbMultiSurface:{
+        OGRGeometry * pLinear = pGeom->getLinearGeometry();
+        if (pLinear != NULL){
+            CoverageAddGeometry(pLinear, win, pArea);
+            delete pLinear;
+        }
+        break;
+    }
+    default:
+        // Points and lines don't cover any area
+        break;
+    }
+}
+
+/* Flatten a geometry down to the plain polygons it's made of so they can be unioned */
+static void CoverageCollectPolygons(const OGRGeometry * pGeom, OGRMultiPolygon * pPolygons){
+
+    switch (wkbFlatten(pGeom->getGeometryType())){
+    case wkbPolygon:
+        pPolygons->addGeometry(pGeom);
+        break;
+    case wkbMultiPolygon:
+    case wkbGeometryCollection:{
+        const OGRGeometryCollection * pCollection = (const OGRGeometryCollection *) pGeom;
+        for (int g = 0; g < pCollection->getNumGeometries(); g++)
+            CoverageCollectPolygons(pCollection->getGeometryRef(g), pPolygons);
+        break;
+    }
+    case wkbCurvePolygon:
+    case wkbMultiSurface:{
+        OGRGeometry * pLinear = pGeom->getLinearGeometry();
+        if (pLinear != NULL){
+            CoverageCollectPolygons(pLinear, pPolygons);
+            delete pLinear;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/* Cut a strip's polygons down to the strip plus a cell either side. A big polygon that runs
+ * through many strips only brings the part that lands in this one to the union. */
+static void CoverageClipPolygons(const OGRMultiPolygon & polygons, const OGREnvelope & clip, OGRMultiPolygon * pClipped){
+
+    OGRLinearRing ring;
+    ring.addPoint(clip.MinX, clip.MinY);
+    ring.addPoint(clip.MaxX, clip.MinY);
+    ring.addPoint(clip.MaxX, clip.MaxY);
+    ring.addPoint(clip.MinX, clip.MaxY);
+    ring.closeRings();
+    OGRPolygon clipPolygon;
+    clipPolygon.addRing(&ring);
+
+    for (int g = 0; g < polygons.getNumGeometries(); g++){
+        const OGRGeometry * pPolygon = polygons.getGeometryRef(g);
+        OGREnvelope envelope;
+        pPolygon->getEnvelope(&envelope);
+        if (!envelope.Intersects(clip))
+            continue;
+        if (clip.Contains(envelope)){
+            pClipped->addGeometry(pPolygon);
+            continue;
+        }
+
+        CPLPushErrorHandler(CPLQuietErrorHandler);
+        OGRGeometry * pPart = pPolygon->Intersection(&clipPolygon);
+        CPLPopErrorHandler();
+        if (pPart != NULL){
+            CoverageCollectPolygons(pPart, pClipped);
+            delete pPart;
+        }
+        else
+            // The sweep only ever touches the strip's cells, so the whole polygon burns the same
+            pClipped->addGeometry(pPolygon);
+    }
+}
+
+static int CoverageFindCluster(std::vector<int> & vParent, int i){
+
+    while (vParent[i] != i){
+        vParent[i] = vParent[vParent[i]];
+        i = vParent[i];
+    }
+    return i;
+}
+
+/* Sweep the strip's polygons so overlaps count once. Only polygons that actually intersect are
+ * grouped and unioned; everything else is swept as it is. If GEOS can't union a group we fall
+ * back to adding its polygons up, which caps overlaps at 1 but overstates cells that are only
+ * partly covered by more than one of them. */
+static void CoverageAddDissolved(const OGRMultiPolygon & polygons, const CoverageWindow & win, double * pArea){
+
+    int nPolygons = polygons.getNumGeometries();
+    std::vector<OGREnvelope> vEnvelopes(nPolygons);
+    std::vector< std::pair<double, int> > vOrder(nPolygons);
+    std::vector<int> vParent(nPolygons);
+    for (int i = 0; i < nPolygons; i++){
+        polygons.getGeometryRef(i)->getEnvelope(&vEnvelopes[i]);
+        vOrder[i] = std::make_pair(vEnvelopes[i].MinX, i);
+        vParent[i] = i;
+    }
+
+    // Sorted by left edge, each polygon only has to be tested against the ones that start before it ends
+    std::sort(vOrder.begin(), vOrder.end());
+    for (int a = 0; a < nPolygons; a++){
+        int i = vOrder[a].second;
+        for (int b = a + 1; b < nPolygons && vOrder[b].first <= vEnvelopes[i].MaxX; b++){
+            int j = vOrder[b].second;
+            if (!vEnvelopes[i].Intersects(vEnvelopes[j]))
+                continue;
+            int nRootI = CoverageFindCluster(vParent, i), nRootJ = CoverageFindCluster(vParent, j);
+            if (nRootI != nRootJ && polygons.getGeometryRef(i)->Intersects(polygons.getGeometryRef(j)))
+                vParent[nRootJ] = nRootI;
+        }
+    }
+
+    std::vector< std::vector<int> > vClusters(nPolygons);
+    for (int i = 0; i < nPolygons; i++)
+        vClusters[CoverageFindCluster(vParent, i)].push_back(i);
+
+    for (int c = 0; c < nPolygons; c++){
+        if (vClusters[c].size() == 1){
+            CoverageAddGeometry(polygons.getGeometryRef(vClusters[c][0]), win, pArea);
+            continue;
+        }
+        if (vClusters[c].empty())
+            continue;
+
+        OGRMultiPolygon cluster;
+        for (size_t m = 0; m < vClusters[c].size(); m++)
+            cluster.addGeometry(polygons.getGeometryRef(vClusters[c][m]));
+
+        CPLPushErrorHandler(CPLQuietErrorHandler);
+        OGRGeometry * pUnion = cluster.UnionCascaded();
+        CPLPopErrorHandler();
+        if (pUnion != NULL){
+            CoverageAddGeometry(pUnion, win, pArea);
+            delete pUnion;
+        }
+        else
+            CoverageAddGeometry(&cluster, win, pArea);
+    }
+}
+
+/* Running sums along each row turn the swept areas into the fraction of each cell covered */
+static void CoverageResolve(const CoverageWindow & win, const double * pArea, double * pCoverage){
+
+    int nStride = win.nCols + 2;
+    for (int r = 0; r < win.nRows; r++){
+        const double * pLine = pArea + (qint64) r * nStride;
+        double * pOut = pCoverage + (qint64) r * win.nCols;
+        double fAcc = 0;
+        for (int c = 0; c < win.nCols; c++){
+            fAcc += pLine[c];
+            // A polygon that overlaps itself winds past one and rounding leaves slivers around zero
+            pOut[c] = fAcc < 1e-12 ? 0 : std::min(1.0, fAcc);
+        }
+    }
+}
+
+/* Exact area coverage of a strip's polygons, straight into the strip's cells */
+static void CoverageBurnStrip(const VectorBurnJob * pJob, const double * tileTransform, int nRows,
+                              const std::vector<OGRGeometryH> & vGeometries,
+                              const std::vector<double> & vValues, double * pStrip){
+
+    int nCols = pJob->nCols;
+    qint64 nCells = (qint64) nCols * nRows;
+
+    if (pJob->eMode == RASTERIZE_COVERAGE){
+        CoverageWindow win = { tileTransform[0], tileTransform[3], tileTransform[1], tileTransform[5], nCols, nRows };
+        std::vector<double> vArea((qint64) (nCols + 2) * nRows, 0.0);
+        OGRMultiPolygon polygons, clipped;
+        for (size_t g = 0; g < vGeometries.size(); g++)
+            CoverageCollectPolygons((const OGRGeometry *) vGeometries[g], &polygons);
+
+        // The margin keeps the clip's own edges out of the cells along the strip's border
+        OGREnvelope clip;
+        double fCellX = fabs(tileTransform[1]), fCellY = fabs(tileTransform[5]);
+        clip.MinX = std::min(tileTransform[0], tileTransform[0] + nCols * tileTransform[1]) - fCellX;
+        clip.MaxX = std::max(tileTransform[0], tileTransform[0] + nCols * tileTransform[1]) + fCellX;
+        clip.MinY = std::min(tileTransform[3], tileTransform[3] + nRows * tileTransform[5]) - fCellY;
+        clip.MaxY = std::max(tileTransform[3], tileTransform[3] + nRows * tileTransform[5]) + fCellY;
+        CoverageClipPolygons(polygons, clip, &clipped);
+
+        CoverageAddDissolved(clipped, win, &vArea[0]);
+        CoverageResolve(win, &vArea[0], pStrip);
+        for (qint64 i = 0; i < nCells; i++){
+            if (pStrip[i] == 0)
+                pStrip[i] = pJob->fNoData;
+        }
+        return;
+    }
+
+    // Each polygon gets a window of its own so its value is weighted by its own coverage
+    std::vector<double> vSum(nCells, 0.0), vWeight(nCells, 0.0);
+    std::vector<double> vArea, vCoverage;
+    for (size_t g = 0; g < vGeometries.size(); g++){
+        OGREnvelope envelope;
+        OGR_G_GetEnvelope(vGeometries[g], &envelope);
+
+        double px0 = (envelope.MinX - tileTransform[0]) / tileTransform[1];
+        double px1 = (envelope.MaxX - tileTransform[0]) / tileTransform[1];
+        double py0 = (envelope.MinY - tileTransform[3]) / tileTransform[5];
+        double py1 = (envelope.MaxY - tileTransform[3]) / tileTransform[5];
+        int c0 = (int) std::max(0.0, floor(std::min(px0, px1)));
+        int c1 = (int) std::min((double) nCols, ceil(std::max(px0, px1)));
+        int r0 = (int) std::max(0.0, floor(std::min(py0, py1)));
+        int r1 = (int) std::min((double) nRows, ceil(std::max(py0, py1)));
+        if (c1 <= c0 || r1 <= r0)
+            continue;
+
+        CoverageWindow win = { tileTransform[0] + c0 * tileTransform[1], tileTransform[3] + r0 * tileTransform[5],
+                               tileTransform[1], tileTransform[5], c1 - c0, r1 - r0 };
+        vArea.assign((qint64) (win.nCols + 2) * win.nRows, 0.0);
+        vCoverage.resize((qint64) win.nCols * win.nRows);
+        CoverageAddGeometry((const OGRGeometry *) vGeometries[g], win, &vArea[0]);
+        CoverageResolve(win, &vArea[0], &vCoverage[0]);
+
+        for (int r = 0; r < win.nRows; r++){
+            const double * pCoverage = &vCoverage[0] + (qint64) r * win.nCols;
+            qint64 nCell = (qint64) (r0 + r) * nCols + c0;
+            for (int c = 0; c < win.nCols; c++){
+                if (pCoverage[c] > 0){
+                    vSum[nCell + c] += pCoverage[c] * vValues[g];
+                    vWeight[nCell + c] += pCoverage[c];
+                }
+            }
+        }
+    }
+
+    for (qint64 i = 0; i < nCells; i++)
+        pStrip[i] = vWeight[i] > 0 ? vSum[i] / vWeight[i] : pJob->fNoData;
+}
+
+/* Burn one strip's features into an in-memory tile and hand back its cells */
+static void BurnVectorStrip(OGRLayer * poLayer, const VectorBurnJob * pJob, int nStrip, double * pStrip){
+
+    int nRow = nStrip * pJob->nStripRows;
+    int nRows = std::min(pJob->nStripRows, pJob->nRows - nRow);
+    const std::vector<GIntBig> & vFeatures = (*pJob->pStripFeatures)[nStrip];
+
+    double tileTransform[6];
+    for (int i = 0; i < 6; i++)
+        tileTransform[i] = pJob->transform[i];
+    tileTransform[3] = pJob->transform[3] + nRow * pJob->transform[5];
+
+    std::vector<OGRGeometryH> ogrBurnGeometries;
+    std::vector<double> dBurnValues;
+    ogrBurnGeometries.reserve(vFeatures.size());
+    dBurnValues.reserve(vFeatures.size());
+
+    /* Only the features the index says can reach this strip. Drivers without
+     * fast random reads would rescan the layer for every FID so they get a
+     * spatial filter over the strip instead. */
+    bool bRandomRead = poLayer->TestCapability(OLCRandomRead) != FALSE;
+    if (!bRandomRead){
+        double dLeft = tileTransform[0];
+        double dRight = tileTransform[0] + pJob->nCols * tileTransform[1];
+        double dTop = tileTransform[3];
+        double dBottom = tileTransform[3] + nRows * tileTransform[5];
+        poLayer->SetSpatialFilterRect(std::min(dLeft, dRight), std::min(dTop, dBottom),
+                                      std::max(dLeft, dRight), std::max(dTop, dBottom));
+        poLayer->ResetReading();
+    }
+
+    size_t nNext = 0;
+    while (true){
+        OGRFeature * ogrFeat;
+        if (bRandomRead){
+            if (nNext == vFeatures.size())
+                break;
+            ogrFeat = poLayer->GetFeature(vFeatures[nNext++]);
+            if (ogrFeat == NULL)
+                continue;
+        }
+        else if ((ogrFeat = poLayer->GetNextFeature()) == NULL)
+            break;
+
+        OGRGeometry * ogrGeom = ogrFeat->GetGeometryRef();
+        if (ogrGeom != NULL){
+            // We own the feature so the geometry can just be taken
+            ogrBurnGeometries.push_back( (OGRGeometryH) ogrFeat->StealGeometry() );
+            if (pJob->bBurnFID)
+                dBurnValues.push_back( (double) ogrFeat->GetFID() );
+            else
+                dBurnValues.push_back( ogrFeat->GetFieldAsDouble(pJob->sField.c_str()) );
+        }
+        OGRFeature::DestroyFeature( ogrFeat );
+    }
+
+    CPLErr err = CE_None;
+    if (pJob->eMode == RASTERIZE_COVERAGE || pJob->eMode == RASTERIZE_COVERAGE_MEAN){
+        CoverageBurnStrip(pJob, tileTransform, nRows, ogrBurnGeometries, dBurnValues, pStrip);
+    }
+    else {
+        GDALDriver * pMemDriver = GetGDALDriverManager()->GetDriverByName("MEM");
+        GDALDataset * pDSTile = pMemDriver->Create("", pJob->nCols, nRows, 1, GDT_Float64, NULL);
+        if (pDSTile == NULL){
+            for (size_t g = 0; g < ogrBurnGeometries.size(); g++)
+                OGR_G_DestroyGeometry(ogrBurnGeometries[g]);
+            throw RasterManagerException(OTHER_ERROR, CPLGetLastErrorMsg());
+        }
+        pDSTile->SetGeoTransform(tileTransform);
+        pDSTile->GetRasterBand(1)->Fill(pJob->fNoData);
+
+        if (ogrBurnGeometries.size() > 0){
+            char ** papszOptions = NULL;
+            if (pJob->eMode == RASTERIZE_ALL_TOUCHED)
+                papszOptions = CSLSetNameValue(papszOptions, "ALL_TOUCHED", "TRUE");
+            int band = 1;
+            err = GDALRasterizeGeometries( pDSTile, 1, &band,
+                                           (int) ogrBurnGeometries.size(),
+                                           &(ogrBurnGeometries[0]),
+                                           NULL, NULL,
+                                           &(dBurnValues[0]),
+                                           papszOptions, NULL, NULL );
+            CSLDestroy(papszOptions);
+        }
+
+        if (err == CE_None)
+            err = pDSTile->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, pJob->nCols, nRows, pStrip, pJob->nCols, nRows, GDT_Float64, 0, 0);
+
+        GDALClose(pDSTile);
+    }
+
+    for (size_t g = 0; g < ogrBurnGeometries.size(); g++)
+        OGR_G_DestroyGeometry(ogrBurnGeometries[g]);
+
+    if (err == CE_Failure || err == CE_Fatal)
+        throw RasterManagerException(OTHER_ERROR, CPLGetLastErrorMsg());
+}
+
+/* Worker: keep taking the next strip until there are none left. Strips
+ * are small so busy and empty parts of the layer even out across threads. */
+static void BurnVectorPartial(const VectorBurnJob * pJob, VectorBurnPartial * pPartial){
+
+    GDALDataset * pDSVector = NULL;
+    double * pStrip = (double *) CPLMalloc(sizeof(double) * pJob->nCols * pJob->nStripRows);
+    int nStrips = (int) pJob->pStripFeatures->size();
+
+    pPartial->nErrorCode = PROCESS_OK;
+
+    try {
+        // Every worker gets its own handle. OGR layers can't be shared between threads.
+        pDSVector = (GDALDataset*) GDALOpenEx(pJob->sVector.c_str(), GDAL_OF_VECTOR, NULL, NULL, NULL);
+        if (pDSVector == NULL)
+            throw RasterManagerException(INPUT_FILE_ERROR, CPLGetLastErrorMsg());
+        OGRLayer * poLayer = pDSVector->GetLayer(0);
+        if (poLayer == NULL)
+            throw RasterManagerException(VECTOR_LAYER_NOT_FOUND, pJob->sVector.c_str());
+
+        for (int nStrip = pJob->pNextStrip->fetchAndAddOrdered(1); nStrip < nStrips;
+             nStrip = pJob->pNextStrip->fetchAndAddOrdered(1)){
+
+            int nRow = nStrip * pJob->nStripRows;
+            int nRows = std::min(pJob->nStripRows, pJob->nRows - nRow);
+
+            // Nothing reaches this strip. The output wasn't pre-filled so it still needs its NoData.
+            if ((*pJob->pStripFeatures)[nStrip].empty()){
+                QMutexLocker lock(pJob->pWriteLock);
+                FillOutputRows(pJob->pRBOutput, nRow, nRows, pJob->fNoData);
+                continue;
+            }
+
+            BurnVectorStrip(poLayer, pJob, nStrip, pStrip);
+
+            CPLErr err;
+            {
+                QMutexLocker lock(pJob->pWriteLock);
+                err = pJob->pRBOutput->RasterIO(GF_Write, 0, nRow, pJob->nCols, nRows, pStrip, pJob->nCols, nRows, GDT_Float64, 0, 0);
+            }
+            if (err == CE_Failure || err == CE_Fatal)
+                throw RasterManagerException(OUTPUT_FILE_ERROR, CPLGetLastErrorMsg());
+
+            for (int i = 0; i < nRows; i++)
+                pPartial->pStats->AddLine(pStrip + (qint64) i * pJob->nCols, pJob->nCols);
+        }
+    }
+    catch (RasterManagerException e){
+        pPartial->nErrorCode = e.GetErrorCode();
+        pPartial->sError = e.GetEvidence();
+    }
+
+    CPLFree(pStrip);
+    if (pDSVector != NULL)
+        GDALClose(pDSVector);
+}
+
 int Raster::VectortoRaster(const char * sVectorSourcePath,
                    const char * sRasterOutputPath,
                    const char * psFieldName,
-                   RasterMeta * p_rastermeta ){
+                   RasterMeta * p_rastermeta,
+                   Raster_Rasterize_Mode eMode ){
 
     OGRRegisterAll();
 
@@ -31,15 +627,24 @@ int Raster::VectortoRaster(const char * sVectorSourcePath,
         return INPUT_FILE_ERROR;
 
     OGRLayer * poLayer = pDSVectorInput->GetLayer(0);
+    if (poLayer == NULL){
+        GDALClose(pDSVectorInput);
+        return VECTOR_LAYER_NOT_FOUND;
+    }
 
     // The type of the field.
-    OGRFeature * feat1 = poLayer->GetFeature(0);
-    int fieldindex = feat1->GetFieldIndex(psFieldName);
-    OGRFieldType fieldType = feat1->GetFieldDefnRef(fieldindex)->GetType();
-    OGRFeature::DestroyFeature( feat1 );
+    int fieldindex = poLayer->GetLayerDefn()->GetFieldIndex(psFieldName);
+    if (fieldindex < 0){
+        GDALClose(pDSVectorInput);
+        throw RasterManagerException(VECTOR_FIELD_NOT_VALID, QString("Field '%1' not found.").arg(psFieldName));
+    }
+    OGRFieldType fieldType = poLayer->GetLayerDefn()->GetFieldDefn(fieldindex)->GetType();
 
-    // The data type we're going to use for the file
-    GDALDataType OutputDataType = GDT_Byte;
+    // String fields are burned as FIDs and there's no sense averaging those
+    if (fieldType == OFTString && eMode == RASTERIZE_COVERAGE_MEAN){
+        GDALClose(pDSVectorInput);
+        throw RasterManagerException(VECTOR_FIELD_NOT_VALID, "Coverage weighted values need a numeric field.");
+    }
 
     // Handle field types according to their type:
     switch (fieldType) {
@@ -47,95 +652,136 @@ int Raster::VectortoRaster(const char * sVectorSourcePath,
         CSVWriteVectorValues(poLayer, psFieldName, sRasterOutputPath);
         break;
     case OFTInteger:
-        break;
+    case OFTInteger64:
     case OFTReal:
-        OutputDataType = GDT_Float64;
+        break;
     default:
+        GDALClose(pDSVectorInput);
         throw RasterManagerException(VECTOR_FIELD_NOT_VALID, "Type of field not recognized.");
         break;
     }
 
-    // Get our projection and set the rastermeta accordingly.
+    // Get our projection and set the rastermeta accordingly. The layer owns its spatial reference.
     // -------------------------------------------------------
-    char *pszWKT = NULL;
-
     OGRSpatialReference* poSRS = poLayer->GetSpatialRef();
+    if (poSRS != NULL){
+        char *pszWKT = NULL;
+        poSRS->exportToWkt(&pszWKT);
+        p_rastermeta->SetProjectionRef(pszWKT);
+        CPLFree(pszWKT);
+    }
 
-    poSRS->exportToWkt(&pszWKT);
-    p_rastermeta->SetProjectionRef(pszWKT);
-    CPLFree(pszWKT);
-    OSRDestroySpatialReference(poSRS);
+    // Coverage comes out fractional whatever the template says
+    if (eMode == RASTERIZE_COVERAGE || eMode == RASTERIZE_COVERAGE_MEAN){
+        GDALDataType nDType = *p_rastermeta->GetGDALDataType();
+        if (nDType != GDT_Float32 && nDType != GDT_Float64){
+            nDType = GDT_Float32;
+            p_rastermeta->SetGDALDataType(&nDType);
+        }
+    }
 
     // Create the output dataset for writing
-    GDALDataset * pDSOutput = CreateOutputDS(sRasterOutputPath, p_rastermeta);
-
-    // Create a list of burn-in values
-    // -------------------------------------------------------
-
-
-    std::vector<OGRGeometryH> ogrBurnGeometries;
-    std::vector<double> dBurnValues;
-
+    // Every strip gets written, burned or not, so skip the NoData pre-fill
+    GDALDataset * pDSOutput = CreateOutputDS(sRasterOutputPath, p_rastermeta, true);
+    if (pDSOutput == NULL){
+        GDALClose(pDSVectorInput);
+        throw RasterManagerException(OUTPUT_FILE_ERROR, "Could not create the output raster.");
+    }
+    GDALRasterBand * pRBOutput = pDSOutput->GetRasterBand(1);
+
+    VectorBurnJob job;
+    job.sVector = sVectorSourcePath;
+    job.sField = psFieldName;
+    job.bBurnFID = fieldType == OFTString;
+    job.eMode = eMode;
+    job.nCols = p_rastermeta->GetCols();
+    job.nRows = p_rastermeta->GetRows();
+    job.fNoData = p_rastermeta->GetNoDataValue();
+    pDSOutput->GetGeoTransform(job.transform);
+
+    int nBlockX, nBlockY;
+    pRBOutput->GetBlockSize(&nBlockX, &nBlockY);
+    job.nStripRows = std::max(1, nBlockY);
+    while (job.nStripRows < VECTOR_MIN_STRIP_ROWS)
+        job.nStripRows += std::max(1, nBlockY);
+    job.nStripRows = std::max(1, std::min(job.nStripRows, job.nRows));
+    int nStrips = (job.nRows + job.nStripRows - 1) / job.nStripRows;
+
+    /* Index the feature envelopes by the strips they reach. Only the FIDs are
+     * kept, never the geometries, so memory doesn't grow with their size.
+     * A row of slack each way keeps edge-touching features in. */
+    std::vector< std::vector<GIntBig> > vStripFeatures(nStrips);
+
+    double dLeft = job.transform[0];
+    double dRight = job.transform[0] + job.nCols * job.transform[1];
+    double dCellHeight = fabs(job.transform[5]);
+
+    poLayer->SetSpatialFilter(NULL);
     poLayer->ResetReading();
-    OGRFeature * ogrFeat = poLayer->GetNextFeature();   // <------- DRMEM!!! UNADDRESSABLE ACCESS of freed memory
-
-    while( ogrFeat != NULL ){
+    OGRFeature * ogrFeat;
+    while( (ogrFeat = poLayer->GetNextFeature()) != NULL ){
 
         OGRGeometry * ogrGeom = ogrFeat->GetGeometryRef();
 
         // No geometry found. Move along.
-        if( ogrGeom == NULL )
-        {
-            OGRFeature::DestroyFeature( ogrFeat );
-            continue;
-        }
-
-        OGRGeometry * geoClone = ogrGeom->clone();  // <------- DRMEM!!! UNADDRESSABLE ACCESS of freed memory AND LEAK 20 direct bytes
-
-        // Push a clone of this geometry onto the list of shapes to burn
-        ogrBurnGeometries.push_back( (OGRGeometryH) geoClone );
-
-        if (fieldType == OFTString){
-            // If it's a string type we burn the FID. The value is then placed in a CSV file
-            dBurnValues.push_back( ogrFeat->GetFID() );
-        }
-        else {
-            // If it's a float type or a byte type we write it directly.
-            dBurnValues.push_back( ogrFeat->GetFieldAsDouble(psFieldName) );
+        if( ogrGeom != NULL ){
+            OGREnvelope envelope;
+            ogrGeom->getEnvelope(&envelope);
+
+            if (envelope.MaxX >= std::min(dLeft, dRight) && envelope.MinX <= std::max(dLeft, dRight)){
+                int nFirstRow = (int) floor((job.transform[3] - envelope.MaxY) / dCellHeight) - 1;
+                int nLastRow = (int) floor((job.transform[3] - envelope.MinY) / dCellHeight) + 1;
+                nFirstRow = std::max(0, nFirstRow);
+                nLastRow = std::min(job.nRows - 1, nLastRow);
+                for (int s = nFirstRow / job.nStripRows; nFirstRow <= nLastRow && s <= nLastRow / job.nStripRows; s++)
+                    vStripFeatures[s].push_back(ogrFeat->GetFID());
+            }
         }
         // GetNextFeature() creates a clone so we must delete it.
-        OGRFeature::DestroyFeature( ogrFeat );      // <------- DRMEM!!! UNADDRESSABLE ACCESS beyond heap bounds:
-        ogrFeat = poLayer->GetNextFeature();        // <------- DRMEM!!! UNADDRESSABLE ACCESS of freed memory
+        OGRFeature::DestroyFeature( ogrFeat );
     }
 
-    // Do the Actual Burning of Geometries.
-    // -------------------------------------------------------
-
-    int band = 1;
-    char **papszRasterizeOptions = NULL;
-    papszRasterizeOptions =
-        CSLSetNameValue( papszRasterizeOptions, "ALL_TOUCHED", "TRUE" );
-
-    CPLErr err = GDALRasterizeGeometries( pDSOutput, 1, &band,
-                                          ogrBurnGeometries.size(),
-                                          &(ogrBurnGeometries[0]),
-                                          NULL, NULL,
-                                          &(dBurnValues[0]),
-                                          NULL,
-                                          NULL, NULL );
+    // Strips go to whichever worker is free next
+    QMutex writeLock;
+    QAtomicInt nextStrip(0);
+    job.pStripFeatures = &vStripFeatures;
+    job.pRBOutput = pRBOutput;
+    job.pWriteLock = &writeLock;
+    job.pNextStrip = &nextStrip;
+
+    int nWorkers = std::max(1, std::min(QThread::idealThreadCount(), nStrips));
+    std::vector<VectorBurnPartial> partials(nWorkers);
+    QList< QFuture<void> > lFutures;
+    for (int w = 0; w < nWorkers; w++){
+        partials[w].pStats = new StatsAccumulator(pRBOutput);
+        lFutures.append(QtConcurrent::run(BurnVectorPartial, &job, &partials[w]));
+    }
+    for (int w = 0; w < lFutures.size(); w++)
+        lFutures[w].waitForFinished();
+
+    StatsAccumulator outputStats(pRBOutput);
+    int nErrorCode = PROCESS_OK;
+    QString sError;
+    for (int w = 0; w < nWorkers; w++){
+        if (partials[w].nErrorCode != PROCESS_OK && nErrorCode == PROCESS_OK){
+            nErrorCode = partials[w].nErrorCode;
+            sError = partials[w].sError;
+        }
+        outputStats.Merge(*partials[w].pStats);
+        delete partials[w].pStats;
+    }
 
-    if (err) { }
-    ogrBurnGeometries.clear();
-    dBurnValues.clear();
+    if (nErrorCode == PROCESS_OK){
+        // Done. Calculate stats and close file
+        CalculateStats(pRBOutput, &outputStats);
+    }
 
-    // Done. Calculate stats and close file
-    CalculateStats(pDSOutput->GetRasterBand(1));
+    CloseOutputDS(pDSOutput);
+    GDALClose(pDSVectorInput);
 
-    CSLDestroy(papszRasterizeOptions);
-    GDALClose(pDSOutput);
-    pDSVectorInput->Release();  // <------- DRMEM!!! UNADDRESSABLE ACCESS beyond heap bounds:
+    if (nErrorCode != PROCESS_OK)
+        throw RasterManagerException(nErrorCode, sError);
 
-    //This is where the implementation actually goes
     return PROCESS_OK;
 
 }
@@ -143,17 +789,19 @@ int Raster::VectortoRaster(const char * sVectorSourcePath,
 int Raster::VectortoRaster(const char * sVectorSourcePath,
                            const char * sRasterOutputPath,
                            const char * sRasterTemplate,
-                           const char * psFieldName){
+                           const char * psFieldName,
+                           Raster_Rasterize_Mode eMode){
 
     RasterMeta TemplateRaster(sRasterTemplate);
-    return VectortoRaster(sVectorSourcePath, sRasterOutputPath, psFieldName, &TemplateRaster);
+    return VectortoRaster(sVectorSourcePath, sRasterOutputPath, psFieldName, &TemplateRaster, eMode);
 
 }
 
 int Raster::VectortoRaster(const char * sVectorSourcePath,
                            const char * sRasterOutputPath,
                            double dCellWidth,
-                           const char * psFieldName){
+                           const char * psFieldName,
+                           Raster_Rasterize_Mode eMode){
 
     OGRRegisterAll();
     GDALDataset * pDSVectorInput;
@@ -192,7 +840,7 @@ int Raster::VectortoRaster(const char * sVectorSourcePath,
     RasterMeta TemplateRaster(psExtent.MaxY, psExtent.MinX, nRows, nCols, &dCellHeight, &dCellWidth, &fNoDataValue, "GTiff", &nDType, "", "");
 
     pDSVectorInput->Release();
-    return VectortoRaster(sVectorSourcePath, sRasterOutputPath, psFieldName, &TemplateRaster);
+    return VectortoRaster(sVectorSourcePath, sRasterOutputPath, psFieldName, &TemplateRaster, eMode);
 
 }
 
@@ -0,0 +1,597 @@
+#define MY_DLL_EXPORT
+
+#include <gdal_priv.h>
+#include <gdal_alg.h>
+#include <ogr_api.h>
+#include <ogrsf_frmts.h>
+
+#include "raster.h"
+#include "rastermanager.h"
+#include "rastermanager_interface.h"
+#include "rastermanager_exception.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMap>
+#include <QStringList>
+#include <QTextStream>
+#include <QThread>
+#include <QtConcurrent>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+namespace RasterManager {
+
+// Zones with up to this many cells keep every value so their percentiles are exact.
+// Bigger zones get a second pass that bins them into a histogram over their own range,
+// which keeps memory fixed per zone no matter how many cells it has.
+const int ZONAL_EXACT_VALUES = 4096;
+const int ZONAL_PERCENTILE_BINS = 1024;
+
+// Burn value for cells no polygon covers
+const double ZONAL_NO_ZONE = -1;
+
+/* Everything a worker needs to know. Shared read-only between all of them. */
+struct ZonalJob
+{
+    std::string sValues;
+    std::string sZones;
+    bool bVectorZones;
+    int nCols;
+    int nStripRows;
+    double transform[6];
+    bool bPercentiles;
+
+    // Second pass only: the zones too big for exact percentiles, each binned over its own range
+    bool bHistogramPass;
+    QHash<qint64, int> hHistZones;
+    std::vector<double> vHistMin;
+    std::vector<double> vHistWidth;
+};
+
+/* One worker's rows. Zones get a slot the first time the worker sees them.
+ * In the histogram pass the slots are the job's hHistZones instead. */
+struct ZonalPartial
+{
+    int nFirstRow;
+    int nLastRow;
+    QHash<qint64, int> hZoneSlots;
+    std::vector<qint64> vSlotZones;
+    std::vector<StatsAccumulator> vStats;
+    std::vector< std::vector<double> > vValues;
+    std::vector< std::vector<quint32> > vHistograms;
+    int nErrorCode;
+    QString sError;
+};
+
+/* A worker's polygons, read from the layer once and reused for every strip it burns */
+struct ZonalGeometries
+{
+    std::vector<OGRGeometryH> vGeometries;
+    std::vector<OGREnvelope> vEnvelopes;
+    std::vector<double> vFIDs;
+
+    ~ZonalGeometries(){
+        for (size_t g = 0; g < vGeometries.size(); g++)
+            OGR_G_DestroyGeometry(vGeometries[g]);
+    }
+};
+
+/* Clone every polygon that touches the worker's rows, in layer order */
+static void LoadZoneGeometries(OGRLayer * poLayer, const ZonalJob * pJob, int nFirstRow, int nLastRow,
+                               ZonalGeometries * pGeometries){
+
+    double dLeft = pJob->transform[0];
+    double dRight = pJob->transform[0] + pJob->nCols * pJob->transform[1];
+    double dTop = pJob->transform[3] + nFirstRow * pJob->transform[5];
+    double dBottom = pJob->transform[3] + nLastRow * pJob->transform[5];
+    poLayer->SetSpatialFilterRect(std::min(dLeft, dRight), std::min(dTop, dBottom),
+                                  std::max(dLeft, dRight), std::max(dTop, dBottom));
+
+    poLayer->ResetReading();
+    OGRFeature * ogrFeat;
+    while( (ogrFeat = poLayer->GetNextFeature()) != NULL ){
+        OGRGeometry * ogrGeom = ogrFeat->GetGeometryRef();
+        if (ogrGeom != NULL){
+            OGREnvelope envelope;
+            ogrGeom->getEnvelope(&envelope);
+            pGeometries->vGeometries.push_back( (OGRGeometryH) ogrGeom->clone() );
+            pGeometries->vEnvelopes.push_back(envelope);
+            pGeometries->vFIDs.push_back( (double) ogrFeat->GetFID() );
+        }
+        OGRFeature::DestroyFeature( ogrFeat );
+    }
+}
+
+/* Burn the worker's polygons that touch this strip into a temporary in-memory raster and read it back.
+ * Where polygons overlap, the one that comes last in the layer owns the cell. */
+static void RasterizeZoneStrip(const ZonalGeometries & geometries, const ZonalJob * pJob, int nRow, int nRows, double * pZones){
+
+    GDALDriver * pMemDriver = GetGDALDriverManager()->GetDriverByName("MEM");
+    GDALDataset * pDSTile = pMemDriver->Create("", pJob->nCols, nRows, 1, GDT_Float64, NULL);
+    if (pDSTile == NULL)
+        throw RasterManagerException(OTHER_ERROR, CPLGetLastErrorMsg());
+
+    double tileTransform[6];
+    for (int i = 0; i < 6; i++)
+        tileTransform[i] = pJob->transform[i];
+    tileTransform[3] = pJob->transform[3] + nRow * pJob->transform[5];
+    pDSTile->SetGeoTransform(tileTransform);
+    pDSTile->GetRasterBand(1)->Fill(ZONAL_NO_ZONE);
+
+    double dLeft = tileTransform[0];
+    double dRight = tileTransform[0] + pJob->nCols * tileTransform[1];
+    double dTop = tileTransform[3];
+    double dBottom = tileTransform[3] + nRows * tileTransform[5];
+    OGREnvelope strip;
+    strip.MinX = std::min(dLeft, dRight);
+    strip.MaxX = std::max(dLeft, dRight);
+    strip.MinY = std::min(dTop, dBottom);
+    strip.MaxY = std::max(dTop, dBottom);
+
+    std::vector<OGRGeometryH> ogrBurnGeometries;
+    std::vector<double> dBurnValues;
+    for (size_t g = 0; g < geometries.vGeometries.size(); g++){
+        if (geometries.vEnvelopes[g].Intersects(strip)){
+            ogrBurnGeometries.push_back(geometries.vGeometries[g]);
+            dBurnValues.push_back(geometries.vFIDs[g]);
+        }
+    }
+
+    CPLErr err = CE_None;
+    if (ogrBurnGeometries.size() > 0){
+        int band = 1;
+        err = GDALRasterizeGeometries( pDSTile, 1, &band,
+                                       (int) ogrBurnGeometries.size(),
+                                       &(ogrBurnGeometries[0]),
+                                       NULL, NULL,
+                                       &(dBurnValues[0]),
+                                       NULL, NULL, NULL );
+    }
+
+    if (err == CE_None)
+        err = pDSTile->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, pJob->nCols, nRows, pZones, pJob->nCols, nRows, GDT_Float64, 0, 0);
+
+    GDALClose(pDSTile);
+
+    if (err == CE_Failure || err == CE_Fatal)
+        throw RasterManagerException(OTHER_ERROR, CPLGetLastErrorMsg());
+}
+
+/* The worker's slot for a zone, added the first time the worker sees it */
+static int ZonalSlot(ZonalPartial * pPartial, qint64 nZone, GDALRasterBand * pRBValues, bool bPercentiles){
+
+    QHash<qint64, int>::const_iterator it = pPartial->hZoneSlots.constFind(nZone);
+    if (it != pPartial->hZoneSlots.constEnd())
+        return it.value();
+
+    int nSlot = (int) pPartial->vSlotZones.size();
+    pPartial->hZoneSlots.insert(nZone, nSlot);
+    pPartial->vSlotZones.push_back(nZone);
+    pPartial->vStats.push_back(StatsAccumulator(pRBValues));
+    if (bPercentiles)
+        pPartial->vValues.push_back(std::vector<double>());
+    return nSlot;
+}
+
+static void ZonalStatsPartial(const ZonalJob * pJob, ZonalPartial * pPartial){
+
+    GDALDataset * pDSValues = NULL;
+    GDALDataset * pDSZones = NULL;
+    int nStripCells = pJob->nCols * pJob->nStripRows;
+    double * pValues = (double *) CPLMalloc(sizeof(double) * nStripCells);
+    double * pZones = (double *) CPLMalloc(sizeof(double) * nStripCells);
+    ZonalGeometries geometries;
+
+    pPartial->nErrorCode = PROCESS_OK;
+
+    try {
+        // Every worker gets its own handles. Neither GDAL datasets nor OGR layers can be shared between threads.
+        pDSValues = (GDALDataset*) GDALOpen(pJob->sValues.c_str(), GA_ReadOnly);
+        if (pDSValues == NULL)
+            throw RasterManagerException(INPUT_FILE_ERROR, CPLGetLastErrorMsg());
+        GDALRasterBand * pRBValues = pDSValues->GetRasterBand(1);
+
+        int bHasNoData = FALSE;
+        double fNoData = pRBValues->GetNoDataValue(&bHasNoData);
+
+        GDALRasterBand * pRBZones = NULL;
+        bool bZoneNoData = true;
+        double fZoneNoData = ZONAL_NO_ZONE;
+
+        if (pJob->bVectorZones){
+            pDSZones = (GDALDataset*) GDALOpenEx(pJob->sZones.c_str(), GDAL_OF_VECTOR, NULL, NULL, NULL);
+            if (pDSZones == NULL)
+                throw RasterManagerException(INPUT_FILE_ERROR, CPLGetLastErrorMsg());
+            OGRLayer * poLayer = pDSZones->GetLayer(0);
+            if (poLayer == NULL)
+                throw RasterManagerException(VECTOR_LAYER_NOT_FOUND, pJob->sZones.c_str());
+            LoadZoneGeometries(poLayer, pJob, pPartial->nFirstRow, pPartial->nLastRow, &geometries);
+        }
+        else {
+            pDSZones = (GDALDataset*) GDALOpen(pJob->sZones.c_str(), GA_ReadOnly);
+            if (pDSZones == NULL)
+                throw RasterManagerException(INPUT_FILE_ERROR, CPLGetLastErrorMsg());
+            pRBZones = pDSZones->GetRasterBand(1);
+            int bHasZoneNoData = FALSE;
+            fZoneNoData = pRBZones->GetNoDataValue(&bHasZoneNoData);
+            bZoneNoData = bHasZoneNoData == TRUE;
+        }
+
+        for (int nRow = pPartial->nFirstRow; nRow < pPartial->nLastRow; nRow += pJob->nStripRows){
+
+            int nRows = std::min(pJob->nStripRows, pPartial->nLastRow - nRow);
+            int nCells = nRows * pJob->nCols;
+
+            CPLErr err = pRBValues->RasterIO(GF_Read, 0, nRow, pJob->nCols, nRows, pValues, pJob->nCols, nRows, GDT_Float64, 0, 0);
+            if (err == CE_Failure || err == CE_Fatal)
+                throw RasterManagerException(INPUT_FILE_ERROR, CPLGetLastErrorMsg());
+
+            if (pJob->bVectorZones)
+                RasterizeZoneStrip(geometries, pJob, nRow, nRows, pZones);
+            else {
+                err = pRBZones->RasterIO(GF_Read, 0, nRow, pJob->nCols, nRows, pZones, pJob->nCols, nRows, GDT_Float64, 0, 0);
+                if (err == CE_Failure || err == CE_Fatal)
+                    throw RasterManagerException(INPUT_FILE_ERROR, CPLGetLastErrorMsg());
+            }
+
+            // Zones come in runs so remembering the last one saves most of the hash lookups
+            bool bLastZone = false;
+            qint64 nLastZone = 0;
+            int nLastSlot = -1;
+            for (int i = 0; i < nCells; i++){
+
+                double fValue = pValues[i];
+                double fZone = pZones[i];
+                if ((bHasNoData && fValue == fNoData) || CPLIsNan(fValue))
+                    continue;
+                if ((bZoneNoData && fZone == fZoneNoData) || CPLIsNan(fZone))
+                    continue;
+
+                qint64 nZone = (qint64) fZone;
+                if (!bLastZone || nZone != nLastZone){
+                    if (pJob->bHistogramPass)
+                        nLastSlot = pJob->hHistZones.value(nZone, -1);
+                    else
+                        nLastSlot = ZonalSlot(pPartial, nZone, pRBValues, pJob->bPercentiles);
+                    nLastZone = nZone;
+                    bLastZone = true;
+                }
+                if (nLastSlot < 0)
+                    continue;
+
+                if (pJob->bHistogramPass){
+                    std::vector<quint32> & vHistogram = pPartial->vHistograms[nLastSlot];
+                    if (vHistogram.empty())
+                        vHistogram.assign(ZONAL_PERCENTILE_BINS, 0);
+                    int nBin = 0;
+                    if (pJob->vHistWidth[nLastSlot] > 0)
+                        nBin = std::min(ZONAL_PERCENTILE_BINS - 1,
+                                        std::max(0, (int) ((fValue - pJob->vHistMin[nLastSlot]) / pJob->vHistWidth[nLastSlot])));
+                    vHistogram[nBin]++;
+                    continue;
+                }
+
+                StatsAccumulator & stats = pPartial->vStats[nLastSlot];
+                long long nCount = stats.GetCount();
+                stats.Add(fValue);
+                if (!pJob->bPercentiles || stats.GetCount() == nCount)
+                    continue;
+
+                // Keep values until the zone is too big for them, then let them go
+                std::vector<double> & vValues = pPartial->vValues[nLastSlot];
+                if (stats.GetCount() <= ZONAL_EXACT_VALUES)
+                    vValues.push_back(fValue);
+                else if (vValues.capacity() > 0)
+                    std::vector<double>().swap(vValues);
+            }
+        }
+    }
+    catch (RasterManagerException e){
+        pPartial->nErrorCode = e.GetErrorCode();
+        pPartial->sError = e.GetEvidence();
+    }
+
+    CPLFree(pValues);
+    CPLFree(pZones);
+    if (pDSValues != NULL)
+        GDALClose(pDSValues);
+    if (pDSZones != NULL)
+        GDALClose(pDSZones);
+}
+
+/* Hand out whole strips of block rows, one run per thread, and wait for all of them */
+static void RunZonalPass(const ZonalJob & job, int nRows, std::vector<ZonalPartial> & vPartials){
+
+    int nStrips = (nRows + job.nStripRows - 1) / job.nStripRows;
+    int nWorkers = std::max(1, std::min(QThread::idealThreadCount(), nStrips));
+
+    vPartials.clear();
+    vPartials.resize(nWorkers);
+    QList< QFuture<void> > futures;
+    for (int w = 0; w < nWorkers; w++){
+        vPartials[w].nFirstRow = std::min(nRows, (int) ((long long) nStrips * w / nWorkers) * job.nStripRows);
+        vPartials[w].nLastRow = std::min(nRows, (int) ((long long) nStrips * (w + 1) / nWorkers) * job.nStripRows);
+        if (job.bHistogramPass)
+            vPartials[w].vHistograms.resize(job.vHistMin.size());
+        futures.append(QtConcurrent::run(ZonalStatsPartial, &job, &vPartials[w]));
+    }
+    for (int w = 0; w < futures.size(); w++)
+        futures[w].waitForFinished();
+
+    for (int w = 0; w < nWorkers; w++){
+        if (vPartials[w].nErrorCode != PROCESS_OK)
+            throw RasterManagerException(vPartials[w].nErrorCode, vPartials[w].sError);
+    }
+}
+
+/* Percentile of a zone small enough to have kept all its values, interpolated between ranks */
+static double ZonalExactPercentile(std::vector<double> & vValues, double fPercentile){
+
+    if (vValues.empty())
+        return 0;
+
+    double fRank = fPercentile / 100.0 * (vValues.size() - 1);
+    size_t nLo = (size_t) floor(fRank);
+    size_t nHi = std::min(vValues.size() - 1, nLo + 1);
+    std::nth_element(vValues.begin(), vValues.begin() + nLo, vValues.end());
+    double fLo = vValues[nLo];
+    if (nHi == nLo)
+        return fLo;
+    // Everything after nLo is at least as big so the next rank is the smallest of them
+    double fHi = *std::min_element(vValues.begin() + nHi, vValues.end());
+    return fLo + (fRank - nLo) * (fHi - fLo);
+}
+
+/* Percentile from a zone's histogram, interpolated inside the bin it lands in */
+static double ZonalPercentile(const std::vector<quint32> & vHistogram, long long nCount,
+                              double fPercentile, double fHistMin, double fHistWidth,
+                              double fZoneMin, double fZoneMax){
+
+    double fRank = fPercentile / 100.0 * (nCount - 1);
+    long long nBefore = 0;
+    for (size_t b = 0; b < vHistogram.size(); b++){
+        if (vHistogram[b] == 0)
+            continue;
+        if (fRank < nBefore + vHistogram[b]){
+            double fLo = fHistMin + b * fHistWidth;
+            double fValue = fLo + fHistWidth * (fRank - nBefore + 0.5) / vHistogram[b];
+            return std::min(fZoneMax, std::max(fZoneMin, fValue));
+        }
+        nBefore += vHistogram[b];
+    }
+    return fZoneMax;
+}
+
+int Raster::ZonalStats(const char * psValueRaster, const char * psZones,
+                       const char * psOutput, const char * psPercentiles){
+
+    CheckFile(psValueRaster, true);
+    CheckFile(psZones, true);
+
+    if (psOutput == NULL)
+        throw RasterManagerException(MISSING_ARGUMENT, "An output path is required.");
+
+    // Which percentiles the caller wants, if any
+    std::vector<double> vPercentiles;
+    if (psPercentiles != NULL){
+        QStringList lPercentiles = QString(psPercentiles).split(",", QString::SkipEmptyParts);
+        foreach (QString sPercentile, lPercentiles) {
+            bool bOk = false;
+            double fPercentile = sPercentile.trimmed().toDouble(&bOk);
+            if (!bOk || fPercentile < 0 || fPercentile > 100)
+                throw RasterManagerException(ARGUMENT_VALIDATION, QString("Invalid percentile: %1").arg(sPercentile));
+            vPercentiles.push_back(fPercentile);
+        }
+    }
+
+    ZonalJob job;
+    job.sValues = std::string(psValueRaster);
+    job.sZones = std::string(psZones);
+    job.bPercentiles = vPercentiles.size() > 0;
+    job.bHistogramPass = false;
+
+    GDALDataset * pDSValues = (GDALDataset*) GDALOpen(psValueRaster, GA_ReadOnly);
+    if (pDSValues == NULL)
+        throw RasterManagerException(INPUT_FILE_ERROR, CPLGetLastErrorMsg());
+
+    GDALRasterBand * pRBValues = pDSValues->GetRasterBand(1);
+    job.nCols = pDSValues->GetRasterXSize();
+    int nRows = pDSValues->GetRasterYSize();
+    pDSValues->GetGeoTransform(job.transform);
+
+    int nBlockX, nBlockY;
+    pRBValues->GetBlockSize(&nBlockX, &nBlockY);
+    job.nStripRows = std::max(1, std::min(nBlockY, nRows));
+    GDALClose(pDSValues);
+
+    // Zones are either a raster lined up with the values or a polygon layer
+    GDALDataset * pDSZones = (GDALDataset*) GDALOpenEx(psZones, GDAL_OF_RASTER, NULL, NULL, NULL);
+    if (pDSZones != NULL){
+        job.bVectorZones = false;
+        int nZoneCols = pDSZones->GetRasterXSize();
+        int nZoneRows = pDSZones->GetRasterYSize();
+        GDALClose(pDSZones);
+        if (nZoneCols != job.nCols)
+            throw RasterManagerException(COLS_ERROR, "The zone raster does not have the same number of columns as the value raster.");
+        if (nZoneRows != nRows)
+            throw RasterManagerException(ROWS_ERROR, "The zone raster does not have the same number of rows as the value raster.");
+    }
+    else {
+        OGRRegisterAll();
+        pDSZones = (GDALDataset*) GDALOpenEx(psZones, GDAL_OF_VECTOR, NULL, NULL, NULL);
+        if (pDSZones == NULL)
+            throw RasterManagerException(INPUT_FILE_ERROR, QString("Could not open zones as a raster or a vector: %1").arg(psZones));
+        if (pDSZones->GetLayer(0) == NULL){
+            GDALClose(pDSZones);
+            throw RasterManagerException(VECTOR_LAYER_NOT_FOUND, psZones);
+        }
+        GDALClose(pDSZones);
+        job.bVectorZones = true;
+    }
+
+    std::vector<ZonalPartial> vPartials;
+    RunZonalPass(job, nRows, vPartials);
+
+    // Line every worker's zones up by zone id and merge them
+    QMap<qint64, int> mZones;
+    std::vector<StatsAccumulator> vStats;
+    std::vector< std::vector<double> > vValues;
+
+    for (size_t w = 0; w < vPartials.size(); w++){
+        ZonalPartial & partial = vPartials[w];
+        for (size_t slot = 0; slot < partial.vSlotZones.size(); slot++){
+            QMap<qint64, int>::const_iterator it = mZones.constFind(partial.vSlotZones[slot]);
+            if (it == mZones.constEnd()){
+                mZones.insert(partial.vSlotZones[slot], (int) vStats.size());
+                vStats.push_back(partial.vStats[slot]);
+                if (job.bPercentiles)
+                    vValues.push_back(partial.vValues[slot]);
+            }
+            else {
+                int nZone = it.value();
+                vStats[nZone].Merge(partial.vStats[slot]);
+                if (job.bPercentiles){
+                    if (vStats[nZone].GetCount() <= ZONAL_EXACT_VALUES)
+                        vValues[nZone].insert(vValues[nZone].end(), partial.vValues[slot].begin(), partial.vValues[slot].end());
+                    else
+                        std::vector<double>().swap(vValues[nZone]);
+                }
+            }
+        }
+    }
+    vPartials.clear();
+
+    // Zones too big to have kept their values get binned over their own range in a second pass
+    std::vector< std::vector<quint32> > vHistograms;
+    if (job.bPercentiles){
+        for (QMap<qint64, int>::const_iterator it = mZones.constBegin(); it != mZones.constEnd(); ++it){
+            const StatsAccumulator & stats = vStats[it.value()];
+            if (stats.GetCount() <= ZONAL_EXACT_VALUES)
+                continue;
+            job.hHistZones.insert(it.key(), (int) job.vHistMin.size());
+            job.vHistMin.push_back(stats.GetMinimum());
+            job.vHistWidth.push_back((stats.GetMaximum() - stats.GetMinimum()) / ZONAL_PERCENTILE_BINS);
+        }
+
+        if (job.hHistZones.size() > 0){
+            job.bHistogramPass = true;
+            RunZonalPass(job, nRows, vPartials);
+            vHistograms.resize(job.vHistMin.size(), std::vector<quint32>(ZONAL_PERCENTILE_BINS, 0));
+            for (size_t w = 0; w < vPartials.size(); w++){
+                for (size_t h = 0; h < vHistograms.size(); h++){
+                    const std::vector<quint32> & vPartialHistogram = vPartials[w].vHistograms[h];
+                    for (size_t b = 0; b < vPartialHistogram.size(); b++)
+                        vHistograms[h][b] += vPartialHistogram[b];
+                }
+            }
+        }
+    }
+
+    // Column names double as field names when appending so keep them short enough for shapefiles
+    QStringList lColumns;
+    lColumns << "count" << "sum" << "mean" << "min" << "max" << "std";
+    for (size_t p = 0; p < vPercentiles.size(); p++)
+        lColumns << QString("p%1").arg(vPercentiles[p]).replace(".", "_");
+
+    // One row of results per zone, in zone order
+    QMap<qint64, std::vector<double> > mResults;
+    for (QMap<qint64, int>::const_iterator it = mZones.constBegin(); it != mZones.constEnd(); ++it){
+        const StatsAccumulator & stats = vStats[it.value()];
+        std::vector<double> vRow;
+        vRow.push_back((double) stats.GetCount());
+        vRow.push_back(stats.GetSum());
+        vRow.push_back(stats.GetMean());
+        vRow.push_back(stats.GetMinimum());
+        vRow.push_back(stats.GetMaximum());
+        vRow.push_back(stats.GetStdDev());
+        int nHist = job.hHistZones.value(it.key(), -1);
+        for (size_t p = 0; p < vPercentiles.size(); p++){
+            if (nHist < 0)
+                vRow.push_back(ZonalExactPercentile(vValues[it.value()], vPercentiles[p]));
+            else
+                vRow.push_back(ZonalPercentile(vHistograms[nHist], stats.GetCount(), vPercentiles[p],
+                                               job.vHistMin[nHist], job.vHistWidth[nHist],
+                                               stats.GetMinimum(), stats.GetMaximum()));
+        }
+        mResults.insert(it.key(), vRow);
+    }
+
+    // Writing back to the polygon layer itself appends the stats as attributes
+    if (job.bVectorZones && QFileInfo(psOutput) == QFileInfo(psZones))
+        ZonalStatsAppendFields(psZones, lColumns, mResults);
+    else
+        ZonalStatsWriteCSV(psOutput, lColumns, mResults);
+
+    return PROCESS_OK;
+}
+
+void Raster::ZonalStatsWriteCSV(const char * psOutput, const QStringList & lColumns,
+                                const QMap<qint64, std::vector<double> > & mResults){
+
+    QFile csvFile(psOutput);
+    if (!csvFile.open(QFile::WriteOnly|QFile::Truncate))
+        throw RasterManagerException(OUTPUT_FILE_ERROR, QString("Could not open output CSV: %1").arg(psOutput));
+
+    QTextStream stream(&csvFile);
+    stream << "zone," << lColumns.join(",") << "\n";
+
+    for (QMap<qint64, std::vector<double> >::const_iterator it = mResults.constBegin(); it != mResults.constEnd(); ++it){
+        stream << it.key();
+        const std::vector<double> & vRow = it.value();
+        stream << "," << (qint64) vRow[0];
+        for (size_t c = 1; c < vRow.size(); c++)
+            stream << "," << QString::number(vRow[c], 'g', 15);
+        stream << "\n";
+    }
+    csvFile.close();
+}
+
+void Raster::ZonalStatsAppendFields(const char * psZones, const QStringList & lColumns,
+                                    const QMap<qint64, std::vector<double> > & mResults){
+
+    GDALDataset * pDSZones = (GDALDataset*) GDALOpenEx(psZones, GDAL_OF_VECTOR | GDAL_OF_UPDATE, NULL, NULL, NULL);
+    if (pDSZones == NULL)
+        throw RasterManagerException(OUTPUT_FILE_ERROR, QString("Could not open the zones for writing: %1").arg(psZones));
+
+    OGRLayer * poLayer = pDSZones->GetLayer(0);
+
+    // Add any fields the layer doesn't have yet
+    std::vector<int> vFieldIndices;
+    for (int c = 0; c < lColumns.size(); c++){
+        QByteArray qbName = lColumns[c].toLatin1();
+        int nField = poLayer->GetLayerDefn()->GetFieldIndex(qbName.data());
+        if (nField < 0){
+            OGRFieldDefn oField(qbName.data(), c == 0 ? OFTInteger64 : OFTReal);
+            if (poLayer->CreateField(&oField) != OGRERR_NONE){
+                GDALClose(pDSZones);
+                throw RasterManagerException(OUTPUT_FILE_ERROR, QString("Could not add field %1 to %2").arg(lColumns[c]).arg(psZones));
+            }
+            nField = poLayer->GetLayerDefn()->GetFieldIndex(qbName.data());
+        }
+        vFieldIndices.push_back(nField);
+    }
+
+    poLayer->ResetReading();
+    poLayer->SetSpatialFilter(NULL);
+    OGRFeature * poFeature;
+    while( (poFeature = poLayer->GetNextFeature()) != NULL ){
+        QMap<qint64, std::vector<double> >::const_iterator it = mResults.constFind((qint64) poFeature->GetFID());
+        for (size_t c = 0; c < vFieldIndices.size(); c++){
+            if (it == mResults.constEnd())
+                poFeature->UnsetField(vFieldIndices[c]);
+            else if (c == 0)
+                poFeature->SetField(vFieldIndices[c], (GIntBig) it.value()[c]);
+            else
+                poFeature->SetField(vFieldIndices[c], it.value()[c]);
+        }
+        poLayer->SetFeature(poFeature);
+        OGRFeature::DestroyFeature( poFeature );
+    }
+
+    GDALClose(pDSZones);
+}
+
+}
@@ -1,5 +1,6 @@
 #include "rasterarray.h"
 #include "rastermanager_exception.h"
+#include "rastermanager.h"
 #include <QDebug>
 
 namespace RasterManager {
@@ -97,10 +98,12 @@ void RasterArray::WriteArraytoRaster(QString sOutputPath, std::vector<double> *v
     Output.SetGDALDataType(dataType);
 
     // Set the bounds and nodata to be the same as the input
-    GDALDataset * pDSOutput = CreateOutputDS(csOutput.data(), &Output);
+    GDALDataset * pDSOutput = CreateOutputDS(csOutput.data(), &Output, true);
 
     double * pOutputLine = (double *) CPLMalloc(sizeof(double)*GetCols());
 
+    StatsAccumulator outputStats(pDSOutput->GetRasterBand(1));
+
     // Write rows and columns
     for (int i = 0; i < GetRows(); i++)
     {
@@ -108,9 +111,12 @@ void RasterArray::WriteArraytoRaster(QString sOutputPath, std::vector<double> *v
             pOutputLine[j] = vPointArray->at(i*GetCols() + j);
         }
         pDSOutput->GetRasterBand(1)->RasterIO(GF_Write, 0,  i, GetCols(), 1, pOutputLine, GetCols(), 1, GDT_Float64, 0, 0);
+        outputStats.AddLine(pOutputLine, GetCols());
     }
     CPLFree(pOutputLine);
-    GDALClose(pDSOutput);
+
+    CalculateStats(pDSOutput->GetRasterBand(1), &outputStats);
+    CloseOutputDS(pDSOutput);
 
 }
 void RasterArray::WriteArraytoRaster(QString sOutputPath, std::vector<int> *vPointArray, GDALDataType * dataType){
@@ -3,15 +3,281 @@
 #include "gdal_priv.h"
 #include "rastermanager_exception.h"
 #include "rastermanager_global.h"
+#include "rastermanager.h"
+#include "ogr_spatialref.h"
 #include <QFile>
 #include <QDir>
 #include <QFileInfo>
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
 #include <QDebug>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <math.h>
 
 namespace RasterManager {
 
-void RM_DLL_API CalculateStats(GDALRasterBand * pRasterBand){
-    pRasterBand->ComputeStatistics(0, NULL, NULL, NULL, NULL, NULL, NULL);
+// Overviews stop once a level is no bigger than this in either direction
+const int OVERVIEW_MIN_SIZE = 256;
+
+// Band metadata item with the resampling our own overviews were built with
+const char * const OVERVIEW_RESAMPLING_ITEM = "RASTERMAN_OVERVIEW_RESAMPLING";
+
+// Empty means we don't build overviews automatically. Worker and batch threads read it
+// while writing their outputs so it is only touched under the mutex.
+static QMutex mxAutoOverviews;
+static QString sAutoOverviewResampling;
+
+// Headers read while the cache is on, by absolute path. An entry only counts while the
+// file still has the size and modified time it had when the header was read.
+struct CachedRasterHeader
+{
+    RasterHeader header;
+    QDateTime dtModified;
+    qint64 nSize;
+};
+static QMutex mxHeaderCache;
+static QHash<QString, CachedRasterHeader> hHeaderCache;
+static bool bHeaderCacheOn = false;
+
+StatsAccumulator::StatsAccumulator(GDALRasterBand * pRasterBand){
+    int bHasNoData = FALSE;
+    m_eDataType = pRasterBand->GetRasterDataType();
+    m_dNoData = pRasterBand->GetNoDataValue(&bHasNoData);
+    m_bHasNoData = bHasNoData == TRUE;
+
+    m_nCount = 0;
+    m_dMin = 0;
+    m_dMax = 0;
+    m_dSum = 0;
+    m_dMean = 0;
+    m_dM2 = 0;
+}
+
+/* Round and clamp a value the same way GDAL does when it writes it to the band */
+static inline double StoredValue(double dValue, GDALDataType eType){
+    switch (eType) {
+    case GDT_Float64:
+        return dValue;
+    case GDT_Float32:
+        return (double) (float) dValue;
+    case GDT_Byte:
+        return std::min(255.0, std::max(0.0, floor(dValue + 0.5)));
+    case GDT_UInt16:
+        return std::min(65535.0, std::max(0.0, floor(dValue + 0.5)));
+    case GDT_Int16:
+        return std::min(32767.0, std::max(-32768.0, floor(dValue + 0.5)));
+    case GDT_UInt32:
+        return std::min(4294967295.0, std::max(0.0, floor(dValue + 0.5)));
+    case GDT_Int32:
+        return std::min(2147483647.0, std::max(-2147483648.0, floor(dValue + 0.5)));
+    default:
+        return dValue;
+    }
+}
+
+void StatsAccumulator::Add(double dValue){
+
+    if (CPLIsNan(dValue))
+        return;
+
+    dValue = StoredValue(dValue, m_eDataType);
+
+    if (m_bHasNoData && (dValue == m_dNoData ||
+                         (m_eDataType == GDT_Float32 && (float) dValue == (float) m_dNoData)))
+        return;
+
+    m_nCount++;
+    if (m_nCount == 1){
+        m_dMin = dValue;
+        m_dMax = dValue;
+    }
+    else {
+        if (dValue < m_dMin)
+            m_dMin = dValue;
+        if (dValue > m_dMax)
+            m_dMax = dValue;
+    }
+
+    m_dSum += dValue;
+    double dDelta = dValue - m_dMean;
+    m_dMean += dDelta / m_nCount;
+    m_dM2 += dDelta * (dValue - m_dMean);
+}
+
+void StatsAccumulator::AddLine(const double * pLine, int nCount){
+    for (int i = 0; i < nCount; i++)
+        Add(pLine[i]);
+}
+
+void StatsAccumulator::Merge(const StatsAccumulator & other){
+
+    if (other.m_nCount == 0)
+        return;
+
+    if (m_nCount == 0){
+        m_nCount = other.m_nCount;
+        m_dMin = other.m_dMin;
+        m_dMax = other.m_dMax;
+        m_dSum = other.m_dSum;
+        m_dMean = other.m_dMean;
+        m_dM2 = other.m_dM2;
+        return;
+    }
+
+    // Chan et al. parallel combination of two sets of moments
+    long long nTotal = m_nCount + other.m_nCount;
+    double dDelta = other.m_dMean - m_dMean;
+    m_dMean += dDelta * other.m_nCount / nTotal;
+    m_dM2 += other.m_dM2 + dDelta * dDelta * ((double) m_nCount * other.m_nCount / nTotal);
+    m_nCount = nTotal;
+    m_dSum += other.m_dSum;
+
+    m_dMin = std::min(m_dMin, other.m_dMin);
+    m_dMax = std::max(m_dMax, other.m_dMax);
+}
+
+void RM_DLL_API CalculateStats(GDALRasterBand * pRasterBand, StatsAccumulator * pStats){
+
+    // Writers that can't track their cells (or wrote nothing valid) fall back on a full scan
+    if (pStats != NULL && pStats->GetCount() > 0)
+        pRasterBand->SetStatistics(pStats->GetMinimum(), pStats->GetMaximum(),
+                                   pStats->GetMean(), pStats->GetStdDev());
+    else
+        pRasterBand->ComputeStatistics(0, NULL, NULL, NULL, NULL, NULL, NULL);
+
+    QByteArray qbResampling;
+    {
+        QMutexLocker lock(&mxAutoOverviews);
+        qbResampling = sAutoOverviewResampling.toLatin1();
+    }
+
+    // The output itself is fine without them so a failed build is only a warning
+    if (!qbResampling.isEmpty() && pRasterBand->GetDataset() != NULL){
+        try {
+            BuildDatasetOverviews(pRasterBand->GetDataset(), qbResampling.data());
+        }
+        catch (RasterManagerException e){
+            const QByteArray qbErr = e.GetEvidence().toLocal8Bit();
+            CPLError(CE_Warning, CPLE_AppDefined, "%s", qbErr.data());
+        }
+    }
+}
+
+void BuildDatasetOverviews(GDALDataset * pDS, const char * psResampling){
+
+    if (psResampling == NULL || strlen(psResampling) == 0)
+        psResampling = "AVERAGE";
+
+    int nXSize = pDS->GetRasterXSize();
+    int nYSize = pDS->GetRasterYSize();
+
+    // Each level halves the one before it. Stop once the previous level is small enough.
+    std::vector<int> vLevels;
+    for (int nFactor = 2;
+         (nXSize + nFactor/2 - 1) / (nFactor/2) > OVERVIEW_MIN_SIZE
+         || (nYSize + nFactor/2 - 1) / (nFactor/2) > OVERVIEW_MIN_SIZE;
+         nFactor *= 2){
+        vLevels.push_back(nFactor);
+    }
+
+    if (vLevels.size() == 0)
+        return;
+
+    // Passing every level at once lets GDAL generate them all from a single pass over the data
+    CPLErr err = pDS->BuildOverviews(psResampling, (int) vLevels.size(), &vLevels[0], 0, NULL, NULL, NULL);
+    if (err == CE_Failure || err == CE_Fatal){
+        QString sErr = QString("Could not build overviews (%1): %2").arg(psResampling).arg(CPLGetLastErrorMsg());
+        throw RasterManagerException(OUTPUT_FILE_ERROR, sErr);
+    }
+
+    // GDAL doesn't record how most overviews were made, so we do
+    for (int b = 1; b <= pDS->GetRasterCount(); b++)
+        pDS->GetRasterBand(b)->SetMetadataItem(OVERVIEW_RESAMPLING_ITEM, psResampling);
+}
+
+bool OverviewIsAveraged(GDALRasterBand * pBand, GDALRasterBand * pOverview){
+
+    const char * psResampling = pOverview->GetMetadataItem("RESAMPLING");
+    if (psResampling == NULL)
+        psResampling = pBand->GetMetadataItem(OVERVIEW_RESAMPLING_ITEM);
+    return psResampling != NULL && STARTS_WITH_CI(psResampling, "AVERAGE");
+}
+
+void RM_DLL_API SetAutoOverviews(const char * psResampling){
+    QString sResampling = QString(psResampling).trimmed();
+    if (sResampling.compare("none", Qt::CaseInsensitive) == 0)
+        sResampling.clear();
+
+    QMutexLocker lock(&mxAutoOverviews);
+    sAutoOverviewResampling = sResampling;
+}
+
+void RM_DLL_API ReadRasterHeader(const char * psFilePath, RasterHeader & header){
+
+    QFileInfo fileInfo(QString::fromLocal8Bit(psFilePath));
+    QString sKey = fileInfo.absoluteFilePath();
+    bool bCache = false;
+    {
+        QMutexLocker lock(&mxHeaderCache);
+        bCache = bHeaderCacheOn && fileInfo.isFile();
+        if (bCache){
+            QHash<QString, CachedRasterHeader>::const_iterator it = hHeaderCache.constFind(sKey);
+            if (it != hHeaderCache.constEnd() && it->nSize == fileInfo.size() && it->dtModified == fileInfo.lastModified()){
+                header = it->header;
+                return;
+            }
+        }
+    }
+
+    GDALDataset * pDS = (GDALDataset*) GDALOpen(psFilePath, GA_ReadOnly);
+    if (pDS == NULL)
+        throw RasterManagerException(INPUT_FILE_NOT_VALID, QString("Error opening raster file: %1 %2").arg(psFilePath).arg(CPLGetLastErrorMsg()));
+
+    GDALRasterBand * pBand = pDS->GetRasterBand(1);
+    header.nCols = pBand->GetXSize();
+    header.nRows = pBand->GetYSize();
+    pDS->GetGeoTransform(header.adfGeoTransform);
+
+    int nSuccess = 0;
+    header.fNoData = pBand->GetNoDataValue(&nSuccess);
+    header.bHasNoData = nSuccess != 0;
+    header.eDataType = pBand->GetRasterDataType();
+    header.sDriver = QByteArray(pDS->GetDriver()->GetDescription());
+    header.sProjection = QByteArray(pDS->GetProjectionRef());
+
+    OGRSpatialReference poSRS;
+    char * psWKT = header.sProjection.data();
+    char * psUnit = NULL;
+    poSRS.importFromWkt(&psWKT);
+    poSRS.GetLinearUnits(&psUnit);
+    header.sUnit = QByteArray(psUnit);
+
+    GDALClose(pDS);
+
+    if (bCache){
+        CachedRasterHeader cached;
+        cached.header = header;
+        cached.dtModified = fileInfo.lastModified();
+        cached.nSize = fileInfo.size();
+        QMutexLocker lock(&mxHeaderCache);
+        hHeaderCache.insert(sKey, cached);
+    }
+}
+
+void RM_DLL_API SetHeaderCache(bool bEnabled){
+    QMutexLocker lock(&mxHeaderCache);
+    bHeaderCacheOn = bEnabled;
+    if (!bEnabled)
+        hHeaderCache.clear();
+}
+
+void RM_DLL_API ForgetRasterHeader(const char * psFilePath){
+    QString sKey = QFileInfo(QString::fromLocal8Bit(psFilePath)).absoluteFilePath();
+    QMutexLocker lock(&mxHeaderCache);
+    hHeaderCache.remove(sKey);
 }
 
 void RM_DLL_API LibCheck(){
@@ -5,15 +5,125 @@
 #include "gdal_priv.h"
 #include "benchmark.h"
 #include <QString>
+#include <QByteArray>
+#include <math.h>
 
 
 namespace RasterManager {
 
+/**
+ * @brief The StatsAccumulator class keeps running min, max, sum, mean and std (Welford) for the
+ *        cells written to an output band so we don't have to read it back to get its stats.
+ *        Values are converted to the band's data type first so the stats match what GDAL
+ *        stores on disk. NoData and NaN cells are skipped.
+ */
+class RM_DLL_API StatsAccumulator
+{
+public:
+    StatsAccumulator(GDALRasterBand * pRasterBand);
+
+    /**
+     * @brief AddLine Add a buffer of values exactly as it is passed to RasterIO(GF_Write...)
+     * @param pLine
+     * @param nCount
+     */
+    void AddLine(const double * pLine, int nCount);
+    void Add(double dValue);
+
+    /**
+     * @brief Merge Combine another accumulator (e.g. from another thread) into this one
+     * @param other
+     */
+    void Merge(const StatsAccumulator & other);
+
+    inline long long GetCount() const { return m_nCount; }
+    inline double GetMinimum() const { return m_dMin; }
+    inline double GetMaximum() const { return m_dMax; }
+    inline double GetSum() const { return m_dSum; }
+    inline double GetMean() const { return m_dMean; }
+    inline double GetStdDev() const { return m_nCount > 0 ? sqrt(m_dM2 / m_nCount) : 0; }
+
+private:
+    GDALDataType m_eDataType;
+    bool m_bHasNoData;
+    double m_dNoData;
+
+    long long m_nCount;
+    double m_dMin;
+    double m_dMax;
+    double m_dSum;
+    double m_dMean;
+    double m_dM2;
+};
+
 /**
  * @brief CalculateStats
  * @param pRasterBand
+ * @param pStats Stats accumulated while writing. When it has values they are stored
+ *               with SetStatistics instead of reading the band back.
+ */
+void CalculateStats(GDALRasterBand * pRasterBand, StatsAccumulator * pStats = NULL);
+
+/**
+ * @brief BuildDatasetOverviews Build internal overviews (2, 4, 8...) until the smallest
+ *        level fits inside OVERVIEW_MIN_SIZE. All levels are generated together.
+ * @param pDS Dataset opened for update
+ * @param psResampling GDAL overview resampling (AVERAGE, NEAREST, MODE...). NULL means AVERAGE
+ */
+void BuildDatasetOverviews(GDALDataset * pDS, const char * psResampling);
+
+/**
+ * @brief OverviewIsAveraged True when an overview is known to have been built by averaging,
+ *        either from its own RESAMPLING metadata or because BuildDatasetOverviews made it.
+ *        Overviews from anywhere else (gdaladdo defaults to NEAREST) are treated as decimated.
+ * @param pBand Full resolution band
+ * @param pOverview One of its overviews
+ */
+bool OverviewIsAveraged(GDALRasterBand * pBand, GDALRasterBand * pOverview);
+
+/**
+ * @brief SetAutoOverviews Build overviews for every output dataset when its stats are calculated.
+ *        A build that fails only raises a CPLError warning, the output is still written.
+ * @param psResampling GDAL overview resampling. NULL, "" or "none" turns it off.
+ */
+void RM_DLL_API SetAutoOverviews(const char * psResampling);
+
+/**
+ * @brief The RasterHeader struct is everything ExtentRectangle and RasterMeta take from an existing raster
+ */
+struct RasterHeader
+{
+    int nCols;
+    int nRows;
+    double adfGeoTransform[6];
+    bool bHasNoData;
+    double fNoData;
+    GDALDataType eDataType;
+    QByteArray sDriver;
+    QByteArray sProjection;
+    QByteArray sUnit; // Null when the projection has no linear unit
+};
+
+/**
+ * @brief ReadRasterHeader Open a raster just long enough to read its header. With the header
+ *        cache on, a file that hasn't changed on disk since it was last read isn't opened again.
+ * @param psFilePath
+ * @param header
+ */
+void RM_DLL_API ReadRasterHeader(const char * psFilePath, RasterHeader & header);
+
+/**
+ * @brief SetHeaderCache Keep raster headers between reads. Off by default since a one-shot
+ *        command gains nothing from it. Long running batches turn it on. Turning it off empties it.
+ * @param bEnabled
+ */
+void RM_DLL_API SetHeaderCache(bool bEnabled);
+
+/**
+ * @brief ForgetRasterHeader Drop one raster from the header cache, e.g. once it's been rewritten
+ * @param psFilePath
  */
-void CalculateStats(GDALRasterBand * pRasterBand);
+void RM_DLL_API ForgetRasterHeader(const char * psFilePath);
 
 /**
  * @brief CheckFile
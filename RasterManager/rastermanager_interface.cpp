@@ -19,6 +19,11 @@
 
 #include <algorithm>
 #include <iostream>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QHash>
+#include <QFileInfo>
+#include <QDir>
 
 namespace RasterManager {
 
@@ -40,43 +45,210 @@ RM_DLL_API GDALDataset * CreateOutputDS(const char * pOutputRaster,
 }
 
 
-RM_DLL_API GDALDataset * CreateOutputDS(QString sOutputRaster, RasterMeta * pTemplateRasterMeta){
+RM_DLL_API GDALDataset * CreateOutputDS(QString sOutputRaster, RasterMeta * pTemplateRasterMeta, bool bFullCoverage){
     const QByteArray qbFileName = sOutputRaster.toLocal8Bit();
-    return CreateOutputDS(qbFileName.data(), pTemplateRasterMeta);
+    return CreateOutputDS(qbFileName.data(), pTemplateRasterMeta, bFullCoverage);
 }
 
-RM_DLL_API GDALDataset * CreateOutputDS(const char * pOutputRaster, RasterMeta * pTemplateRastermeta){
+// Output creation profile. -1 until it's set or read from RASTERMAN_PROFILE.
+static QAtomicInt nCreateProfile(-1);
 
-    // Make sure the file doesn't exist. Throws an exception if it does.
-    CheckFile(pOutputRaster, false);
+// COG outputs are built in a temporary GeoTIFF. This maps each one to where it finally goes.
+static QMutex mxPendingCOG;
+static QHash<GDALDataset *, QString> hPendingCOG;
 
-    /* Create the new dataset. Determine the driver from the output file extension.
-     * Enforce LZW compression for TIFs. The predictor 3 is used for floating point prediction.
-     * Not using this value defaults the LZW to prediction to 1 which causes striping.
-     */
+static int CurrentCreateProfile(){
+    int nProfile = nCreateProfile.loadAcquire();
+    if (nProfile < 0){
+        const char * psProfile = CPLGetConfigOption("RASTERMAN_PROFILE", "default");
+        nProfile = GetCreateProfileFromString(psProfile);
+        if (nProfile < 0)
+            throw RasterManagerException(ARGUMENT_VALIDATION, QString("RASTERMAN_PROFILE was invalid: %1").arg(psProfile));
+        nCreateProfile.testAndSetOrdered(-1, nProfile);
+    }
+    return nProfile;
+}
+
+static bool DriverHasCompression(GDALDriver * pDR, const char * psCompression){
+    const char * psOptions = pDR->GetMetadataItem(GDAL_DMD_CREATIONOPTIONLIST);
+    return psOptions != NULL && strstr(psOptions, psCompression) != NULL;
+}
+
+static bool IsFloatType(GDALDataType eDataType){
+    return eDataType == GDT_Float32 || eDataType == GDT_Float64;
+}
+
+/* Creation options for a profile. Floats use the floating point predictor and
+ * integers horizontal differencing. Without one LZW/DEFLATE/ZSTD stripe badly. */
+static char ** GetCreateOptions(GDALDriver * pDR, GDALDataType eDataType, int eProfile){
 
     char **papszOptions = NULL;
-    GDALDriver * pDR = NULL;
+
+    if (strcmp( pDR->GetDescription() , "GTiff") != 0){
+        if (eProfile != PROFILE_FAST)
+            papszOptions = CSLSetNameValue(papszOptions, "COMPRESS", "PACKBITS");
+        return papszOptions;
+    }
+
+    // Classic TIFF tops out at 4GB. GDAL works out whether we'll get there.
+    papszOptions = CSLSetNameValue(papszOptions, "BIGTIFF", "IF_SAFER");
+
+    switch (eProfile){
+    case PROFILE_FAST:
+    case PROFILE_COG:
+        papszOptions = CSLSetNameValue(papszOptions, "TILED", "YES");
+        papszOptions = CSLSetNameValue(papszOptions, "BLOCKXSIZE", eProfile == PROFILE_COG ? "512" : "256");
+        papszOptions = CSLSetNameValue(papszOptions, "BLOCKYSIZE", eProfile == PROFILE_COG ? "512" : "256");
+        if (DriverHasCompression(pDR, "ZSTD")){
+            papszOptions = CSLSetNameValue(papszOptions, "COMPRESS", "ZSTD");
+            papszOptions = CSLSetNameValue(papszOptions, "ZSTD_LEVEL", "1");
+            papszOptions = CSLSetNameValue(papszOptions, "NUM_THREADS", "ALL_CPUS");
+        }
+        break;
+    case PROFILE_COMPACT:
+        papszOptions = CSLSetNameValue(papszOptions, "TILED", "YES");
+        if (DriverHasCompression(pDR, "ZSTD")){
+            papszOptions = CSLSetNameValue(papszOptions, "COMPRESS", "ZSTD");
+            papszOptions = CSLSetNameValue(papszOptions, "ZSTD_LEVEL", "9");
+        }
+        else {
+            papszOptions = CSLSetNameValue(papszOptions, "COMPRESS", "DEFLATE");
+            papszOptions = CSLSetNameValue(papszOptions, "ZLEVEL", "9");
+        }
+        papszOptions = CSLSetNameValue(papszOptions, "PREDICTOR", IsFloatType(eDataType) ? "3" : "2");
+        papszOptions = CSLSetNameValue(papszOptions, "NUM_THREADS", "ALL_CPUS");
+        break;
+    default:
+        papszOptions = CSLSetNameValue(papszOptions, "COMPRESS", "LZW");
+        // GDAL compresses whole blocks on worker threads. RasterWriter hands it whole blocks.
+        papszOptions = CSLSetNameValue(papszOptions, "NUM_THREADS", "ALL_CPUS");
+        break;
+    }
+    return papszOptions;
+}
+
+RM_DLL_API GDALDataset * CreateProfiledDS(const char * pOutputRaster, int nCols, int nRows, GDALDataType eDataType){
 
     // Always set the driver to the output Raster name (tiff, tif, img)
-    pDR = GetGDALDriverManager()->GetDriverByName(GetDriverFromFileName(pOutputRaster));
+    GDALDriver * pDR = GetGDALDriverManager()->GetDriverByName(GetDriverFromFileName(pOutputRaster));
+    if (pDR == NULL)
+        throw RasterManagerException(OUTPUT_FILE_ERROR, QString("No driver for: %1").arg(pOutputRaster));
 
-    if (strcmp( pDR->GetDescription() , "GTiff") == 0){
-        papszOptions = CSLSetNameValue(papszOptions, "COMPRESS", "LZW");
+    int eProfile = CurrentCreateProfile();
+
+    // A COG can only be made by copying, so write a working GeoTIFF beside it for now
+    bool bCOG = eProfile == PROFILE_COG && strcmp( pDR->GetDescription() , "GTiff") == 0;
+    QByteArray qbPath(pOutputRaster);
+    if (bCOG){
+        QFileInfo sOutputInfo(pOutputRaster);
+        qbPath = QDir(sOutputInfo.absolutePath()).filePath(sOutputInfo.completeBaseName() + ".cogtmp.tif").toLocal8Bit();
     }
-    else {
-        papszOptions = CSLSetNameValue(papszOptions, "COMPRESS", "PACKBITS");
+
+    char **papszOptions = GetCreateOptions(pDR, eDataType, eProfile);
+    GDALDataset * pDSOutput = pDR->Create(qbPath.data(), nCols, nRows, 1, eDataType, papszOptions);
+    CSLDestroy( papszOptions );
+
+    if (pDSOutput != NULL && bCOG){
+        QMutexLocker lock(&mxPendingCOG);
+        hPendingCOG.insert(pDSOutput, QString(pOutputRaster));
     }
+    return pDSOutput;
+}
+
+/* Copy a finished working GeoTIFF into its final COG and get rid of it */
+static void ConvertToCOG(const char * psWorking, const char * psOutput){
 
-    GDALDataset * pDSOutput =  pDR->Create(pOutputRaster,
-                                           pTemplateRastermeta->GetCols(),
-                                           pTemplateRastermeta->GetRows(),
-                                           1,
-                                           *pTemplateRastermeta->GetGDALDataType(),
-                                           papszOptions);
+    GDALDriver * pCOGDriver = GetGDALDriverManager()->GetDriverByName("COG");
+    GDALDriver * pTiffDriver = GetGDALDriverManager()->GetDriverByName("GTiff");
+
+    GDALDataset * pDSWorking = (GDALDataset*) GDALOpen(psWorking, pCOGDriver != NULL ? GA_ReadOnly : GA_Update);
+    if (pDSWorking == NULL)
+        throw RasterManagerException(OUTPUT_FILE_ERROR, CPLGetLastErrorMsg());
+
+    GDALDataType eDataType = pDSWorking->GetRasterBand(1)->GetRasterDataType();
+    const char * psCompress = DriverHasCompression(pTiffDriver, "ZSTD") ? "ZSTD" : "DEFLATE";
+    char **papszOptions = NULL;
+    papszOptions = CSLSetNameValue(papszOptions, "COMPRESS", psCompress);
+    papszOptions = CSLSetNameValue(papszOptions, "NUM_THREADS", "ALL_CPUS");
+    papszOptions = CSLSetNameValue(papszOptions, "BIGTIFF", "IF_SAFER");
 
+    GDALDataset * pDSOutput = NULL;
+    try {
+        if (pCOGDriver != NULL){
+            // Any overviews already on the working file are reused
+            papszOptions = CSLSetNameValue(papszOptions, "PREDICTOR", "YES");
+            papszOptions = CSLSetNameValue(papszOptions, "BLOCKSIZE", "512");
+            papszOptions = CSLSetNameValue(papszOptions, "OVERVIEWS", "AUTO");
+            papszOptions = CSLSetNameValue(papszOptions, "RESAMPLING", "AVERAGE");
+            pDSOutput = pCOGDriver->CreateCopy(psOutput, pDSWorking, FALSE, papszOptions, NULL, NULL);
+        }
+        else {
+            // Older GDAL: the same layout by hand. Overviews first, then copied in ahead of the data.
+            if (pDSWorking->GetRasterBand(1)->GetOverviewCount() == 0)
+                BuildDatasetOverviews(pDSWorking, "AVERAGE");
+            papszOptions = CSLSetNameValue(papszOptions, "PREDICTOR", IsFloatType(eDataType) ? "3" : "2");
+            papszOptions = CSLSetNameValue(papszOptions, "TILED", "YES");
+            papszOptions = CSLSetNameValue(papszOptions, "BLOCKXSIZE", "512");
+            papszOptions = CSLSetNameValue(papszOptions, "BLOCKYSIZE", "512");
+            papszOptions = CSLSetNameValue(papszOptions, "COPY_SRC_OVERVIEWS", "YES");
+            pDSOutput = pTiffDriver->CreateCopy(psOutput, pDSWorking, FALSE, papszOptions, NULL, NULL);
+        }
+    }
+    catch (RasterManagerException e){
+        CSLDestroy( papszOptions );
+        GDALClose(pDSWorking);
+        throw;
+    }
     CSLDestroy( papszOptions );
 
+    QString sError = CPLGetLastErrorMsg();
+    GDALClose(pDSWorking);
+    pTiffDriver->Delete(psWorking);
+
+    if (pDSOutput == NULL)
+        throw RasterManagerException(OUTPUT_FILE_ERROR, QString("Could not write the COG: %1").arg(sError));
+    GDALClose(pDSOutput);
+}
+
+RM_DLL_API void CloseOutputDS(GDALDataset * pDSOutput){
+
+    if (pDSOutput == NULL)
+        return;
+
+    QString sOutput;
+    {
+        QMutexLocker lock(&mxPendingCOG);
+        sOutput = hPendingCOG.take(pDSOutput);
+    }
+
+    // A cached header for the path we just rewrote would be stale
+    const QByteArray qbWorking = QByteArray(pDSOutput->GetDescription());
+    ForgetRasterHeader(qbWorking.data());
+
+    if (sOutput.isEmpty()){
+        GDALClose(pDSOutput);
+        return;
+    }
+
+    const QByteArray qbOutput = sOutput.toLocal8Bit();
+    ForgetRasterHeader(qbOutput.data());
+    GDALClose(pDSOutput);
+    ConvertToCOG(qbWorking.data(), qbOutput.data());
+}
+
+RM_DLL_API GDALDataset * CreateOutputDS(const char * pOutputRaster, RasterMeta * pTemplateRastermeta, bool bFullCoverage){
+
+    // Make sure the file doesn't exist. Throws an exception if it does.
+    CheckFile(pOutputRaster, false);
+
+    /* Create the new dataset. Determine the driver from the output file extension.
+     * The compression, tiling and so on come from the creation profile.
+     */
+    GDALDataset * pDSOutput = CreateProfiledDS(pOutputRaster,
+                                               pTemplateRastermeta->GetCols(),
+                                               pTemplateRastermeta->GetRows(),
+                                               *pTemplateRastermeta->GetGDALDataType());
+
     if (pDSOutput == NULL)
         return NULL;
 
@@ -94,8 +266,10 @@ RM_DLL_API GDALDataset * CreateOutputDS(const char * pOutputRaster, RasterMeta *
     double * newTransform = pTemplateRastermeta->GetGeoTransform();
     char * projectionRef = pTemplateRastermeta->GetProjectionRef();
 
-    // Fill the new raster set with nodatavalue
-    pDSOutput->GetRasterBand(1)->Fill(pTemplateRastermeta->GetNoDataValue());
+    /* Fill the new raster set with nodatavalue. Callers that write every cell
+     * skip this. Otherwise every block gets written, and compressed, twice. */
+    if (!bFullCoverage)
+        pDSOutput->GetRasterBand(1)->Fill(pTemplateRastermeta->GetNoDataValue());
 
     if (newTransform != NULL)
         pDSOutput->SetGeoTransform(newTransform);
@@ -105,6 +279,30 @@ RM_DLL_API GDALDataset * CreateOutputDS(const char * pOutputRaster, RasterMeta *
 
 }
 
+RM_DLL_API void FillOutputRows(GDALRasterBand * pRasterBand, int nRow, int nRows, double fValue){
+
+    if (nRows <= 0)
+        return;
+
+    int nCols = pRasterBand->GetXSize();
+    int nBlockX, nBlockY;
+    pRasterBand->GetBlockSize(&nBlockX, &nBlockY);
+    int nChunkRows = std::max(1, std::min(nBlockY, nRows));
+
+    double * pBuffer = (double *) CPLMalloc(sizeof(double) * nCols * nChunkRows);
+    std::fill(pBuffer, pBuffer + (qint64) nCols * nChunkRows, fValue);
+
+    CPLErr err = CE_None;
+    for (int i = nRow; i < nRow + nRows && err == CE_None; i += nChunkRows){
+        int nChunk = std::min(nChunkRows, nRow + nRows - i);
+        err = pRasterBand->RasterIO(GF_Write, 0, i, nCols, nChunk, pBuffer, nCols, nChunk, GDT_Float64, 0, 0);
+    }
+    CPLFree(pBuffer);
+
+    if (err == CE_Failure || err == CE_Fatal)
+        throw RasterManagerException(OUTPUT_FILE_ERROR, CPLGetLastErrorMsg());
+}
+
 extern "C" RM_DLL_API int DeleteDataset(const char * pOutputRaster, char * sErr){
 
     InitCInterfaceError(sErr);
@@ -117,6 +315,49 @@ extern "C" RM_DLL_API int DeleteDataset(const char * pOutputRaster, char * sErr)
     }
 }
 
+extern "C" RM_DLL_API int BuildOverviews(const char * psRaster, const char * psResampling, char * sErr){
+
+    InitCInterfaceError(sErr);
+    try {
+        return Raster::BuildOverviews(psRaster, psResampling);
+    }
+    catch (RasterManagerException e){
+        SetCInterfaceError(e, sErr);
+        return e.GetErrorCode();
+    }
+}
+
+extern "C" RM_DLL_API int ZonalStats(const char * psValueRaster, const char * psZones,
+                                     const char * psOutput, const char * psPercentiles, char * sErr){
+
+    InitCInterfaceError(sErr);
+    try {
+        return Raster::ZonalStats(psValueRaster, psZones, psOutput, psPercentiles);
+    }
+    catch (RasterManagerException e){
+        SetCInterfaceError(e, sErr);
+        return e.GetErrorCode();
+    }
+}
+
+extern "C" RM_DLL_API void SetCreateOverviews(const char * psResampling) { SetAutoOverviews(psResampling); }
+
+extern "C" RM_DLL_API int SetCreateProfile(const char * psProfile, char * sErr){
+
+    InitCInterfaceError(sErr);
+    try {
+        int eProfile = GetCreateProfileFromString(psProfile);
+        if (eProfile < 0)
+            throw RasterManagerException(ARGUMENT_VALIDATION, QString("Creation profile was invalid: %1").arg(psProfile));
+        nCreateProfile.storeRelease(eProfile);
+        return PROCESS_OK;
+    }
+    catch (RasterManagerException e){
+        SetCInterfaceError(e, sErr);
+        return e.GetErrorCode();
+    }
+}
+
 extern "C" RM_DLL_API void RegisterGDAL() { GDALAllRegister();}
 extern "C" RM_DLL_API void DestroyGDAL() { GDALDestroyDriverManager();}
 
@@ -222,6 +463,40 @@ extern "C" RM_DLL_API int RasterFromCSVandTemplate(const char * sCSVSourcePath,
 }
 
 
+extern "C" RM_DLL_API int RasterFromCSVandTemplateGridded(const char * sCSVSourcePath,
+                                                          const char * psOutput,
+                                                          const char * sRasterTemplate,
+                                                          const char * sXField,
+                                                          const char * sYField,
+                                                          const char * sDataField,
+                                                          const char * psMethod,
+                                                          double fIDWRadius,
+                                                          double fIDWPower,
+                                                          char * sErr){
+
+    InitCInterfaceError(sErr);
+    try {
+        int eMethod = GetGridMethodFromString(psMethod);
+        if (eMethod < 0)
+            throw RasterManagerException(ARGUMENT_VALIDATION, QString("Gridding method was invalid: %1").arg(psMethod));
+
+        return  RasterManager::Raster::CSVtoRaster(sCSVSourcePath,
+                                                   psOutput,
+                                                   sRasterTemplate,
+                                                   sXField,
+                                                   sYField,
+                                                   sDataField,
+                                                   (Raster_Grid_Method) eMethod,
+                                                   fIDWRadius,
+                                                   fIDWPower);
+    }
+    catch (RasterManagerException e){
+        SetCInterfaceError(e, sErr);
+        return e.GetErrorCode();
+    }
+
+}
+
 extern "C" RM_DLL_API int RasterToCSV(const char * sRasterSourcePath,
                                       const char * sOutputCSVPath,
                                       char * sErr){
@@ -238,6 +513,24 @@ extern "C" RM_DLL_API int RasterToCSV(const char * sRasterSourcePath,
 
 }
 
+extern "C" RM_DLL_API int RasterToCSVNoData(const char * sRasterSourcePath,
+                                            const char * sOutputCSVPath,
+                                            int bIncludeNoData,
+                                            char * sErr){
+
+    InitCInterfaceError(sErr);
+    try {
+        return  RasterManager::Raster::RasterToCSV(sRasterSourcePath,
+                                                   sOutputCSVPath,
+                                                   bIncludeNoData == 0);
+    }
+    catch (RasterManagerException e){
+        SetCInterfaceError(e, sErr);
+        return e.GetErrorCode();
+    }
+
+}
+
 extern "C" RM_DLL_API int CalcSimpleHistograms(const char * psRasterPath,
                                                const char * psHistogramPath,
                                                int nNumBins,
@@ -321,6 +614,49 @@ extern "C" RM_DLL_API int RasterFromCSVandExtents(const char * sCSVSourcePath,
     }
 }
 
+extern "C" RM_DLL_API int RasterFromCSVandExtentsGridded(const char * sCSVSourcePath,
+                                                         const char * sOutput,
+                                                         double dTop,
+                                                         double dLeft,
+                                                         int nRows,
+                                                         int nCols,
+                                                         double dCellWidth,
+                                                         double dNoDataVal,
+                                                         const char * sXField,
+                                                         const char * sYField,
+                                                         const char * sDataField,
+                                                         const char * psMethod,
+                                                         double fIDWRadius,
+                                                         double fIDWPower,
+                                                         char * sErr){
+
+    InitCInterfaceError(sErr);
+    try {
+        int eMethod = GetGridMethodFromString(psMethod);
+        if (eMethod < 0)
+            throw RasterManagerException(ARGUMENT_VALIDATION, QString("Gridding method was invalid: %1").arg(psMethod));
+
+        return  RasterManager::Raster::CSVtoRaster(sCSVSourcePath,
+                                                   sOutput,
+                                                   dTop,
+                                                   dLeft,
+                                                   nRows,
+                                                   nCols,
+                                                   dCellWidth,
+                                                   dNoDataVal,
+                                                   sXField,
+                                                   sYField,
+                                                   sDataField,
+                                                   (Raster_Grid_Method) eMethod,
+                                                   fIDWRadius,
+                                                   fIDWPower);
+    }
+    catch (RasterManagerException e){
+        SetCInterfaceError(e, sErr);
+        return e.GetErrorCode();
+    }
+}
+
 extern "C" RM_DLL_API int ExtractRasterPoints(const char * sCSVInputSourcePath,
                                               const char * sRasterInputSourcePath,
                                               const char * sCSVOutputPath,
@@ -345,6 +681,68 @@ extern "C" RM_DLL_API int ExtractRasterPoints(const char * sCSVInputSourcePath,
     }
 }
 
+extern "C" RM_DLL_API int ExtractRasterPointsInterpolated(const char * sCSVInputSourcePath,
+                                                          const char * sRasterInputSourcePath,
+                                                          const char * sCSVOutputPath,
+                                                          const char * sXField,
+                                                          const char * sYField,
+                                                          const char * sNodata,
+                                                          const char * psInterpolation,
+                                                          char * sErr)
+{
+    InitCInterfaceError(sErr);
+    try {
+        QString sInterpolation(psInterpolation);
+        bool bBilinear = QString::compare(sInterpolation, "bilinear", Qt::CaseInsensitive) == 0;
+        if (!bBilinear && QString::compare(sInterpolation, "nearest", Qt::CaseInsensitive) != 0)
+            throw RasterManagerException(ARGUMENT_VALIDATION, QString("Interpolation was invalid: %1").arg(sInterpolation));
+
+        return Raster::ExtractPoints(
+                    sCSVInputSourcePath,
+                    sRasterInputSourcePath,
+                    sCSVOutputPath,
+                    QString(sXField),
+                    QString(sYField),
+                    QString(sNodata),
+                    bBilinear );
+    }
+    catch (RasterManagerException e){
+        SetCInterfaceError(e, sErr);
+        return e.GetErrorCode();
+    }
+}
+
+extern "C" RM_DLL_API int ExtractRasterPointsMulti(const char * sCSVInputSourcePath,
+                                                   const char * psRasters,
+                                                   const char * sCSVOutputPath,
+                                                   const char * sXField,
+                                                   const char * sYField,
+                                                   const char * sNodata,
+                                                   const char * psInterpolation,
+                                                   char * sErr)
+{
+    InitCInterfaceError(sErr);
+    try {
+        QString sInterpolation(psInterpolation);
+        bool bBilinear = QString::compare(sInterpolation, "bilinear", Qt::CaseInsensitive) == 0;
+        if (!bBilinear && QString::compare(sInterpolation, "nearest", Qt::CaseInsensitive) != 0)
+            throw RasterManagerException(ARGUMENT_VALIDATION, QString("Interpolation was invalid: %1").arg(sInterpolation));
+
+        return Raster::ExtractPointsMulti(
+                    sCSVInputSourcePath,
+                    psRasters,
+                    sCSVOutputPath,
+                    QString(sXField),
+                    QString(sYField),
+                    QString(sNodata),
+                    bBilinear );
+    }
+    catch (RasterManagerException e){
+        SetCInterfaceError(e, sErr);
+        return e.GetErrorCode();
+    }
+}
+
 
 
 extern "C" RM_DLL_API int RasterNormalize(const char * psRaster1,
@@ -562,6 +960,32 @@ extern "C" RM_DLL_API int vector2raster(const char * sVectorSourcePath,
 
 }
 
+extern "C" RM_DLL_API int vector2rasterMode(const char * sVectorSourcePath,
+                                            const char * sRasterOutputPath,
+                                            const char * sRasterTemplate,
+                                            double dCellWidth,
+                                            const char * psFieldName,
+                                            const char * psMode,
+                                            char * sErr)
+{
+    InitCInterfaceError(sErr);
+    try{
+        int eMode = GetRasterizeModeFromString(psMode);
+        if (eMode < 0)
+            throw RasterManagerException(ARGUMENT_VALIDATION, QString("Rasterize mode was invalid: %1").arg(psMode));
+
+        if (dCellWidth)
+            return Raster::VectortoRaster(sVectorSourcePath, sRasterOutputPath, dCellWidth, psFieldName, (Raster_Rasterize_Mode) eMode);
+        else
+            return Raster::VectortoRaster(sVectorSourcePath, sRasterOutputPath, sRasterTemplate, psFieldName, (Raster_Rasterize_Mode) eMode);
+    }
+    catch (RasterManagerException e){
+        SetCInterfaceError(e, sErr);
+        return e.GetErrorCode();
+    }
+
+}
+
 extern "C" RM_DLL_API int Fill(const char * sRasterInput, const char * sRasterOutput, char * sErr){
 
 
@@ -676,17 +1100,34 @@ extern "C" RM_DLL_API int GetRasterProperties(const char * ppszRaster,
 extern "C" RM_DLL_API int RasterCompare(const char * ppszRaster1, const char * ppszRaster2, char * sErr){
     InitCInterfaceError(sErr);
     try{
-        RasterManager::RasterArray rRasterArray1(ppszRaster1);
-        RasterManager::RasterArray rRasterArray2(ppszRaster2);
+        // Stops at the first difference. Nothing is held in memory beyond a few strips.
+        RasterDiffReport report;
+        return RasterManager::Raster::CompareRasters(ppszRaster1, ppszRaster2, 0, NULL, false, &report);
+    }
+    catch (RasterManagerException e){
+        SetCInterfaceError(e, sErr);
+        return e.GetErrorCode();
+    }
+}
 
-        if (rRasterArray1 != rRasterArray2)
-            return RASTER_COMPARISON;
+extern "C" RM_DLL_API int RasterDiff(const char * ppszRaster1, const char * ppszRaster2, double dTolerance,
+                                     const char * psDiffRaster, int nFullReport,
+                                     double * pdDiffCells, double * pdMaxAbsDiff, char * sErr){
+    InitCInterfaceError(sErr);
+    try{
+        RasterDiffReport report;
+        int eResult = RasterManager::Raster::CompareRasters(ppszRaster1, ppszRaster2, dTolerance,
+                                                            psDiffRaster, nFullReport != 0, &report);
+        if (pdDiffCells != NULL)
+            *pdDiffCells = (double) report.nDiffCells;
+        if (pdMaxAbsDiff != NULL)
+            *pdMaxAbsDiff = report.fMaxAbsDiff;
+        return eResult;
     }
     catch (RasterManagerException e){
         SetCInterfaceError(e, sErr);
         return e.GetErrorCode();
     }
-    return PROCESS_OK;
 }
 
 extern "C" RM_DLL_API void PrintRasterProperties(const char * ppszRaster)
@@ -867,6 +1308,28 @@ extern "C" RM_DLL_API int BiLinearResample(const char * ppszOriginalRaster,
     }
 }
 
+extern "C" RM_DLL_API int Resample(const char * ppszOriginalRaster,
+                                   const char *ppszOutputRaster,
+                                   const char * psMethod,
+                                   double fNewCellSize,
+                                   double fLeft, double fTop, int nRows, int nCols,
+                                   char * sErr)
+{
+    InitCInterfaceError(sErr);
+    try{
+        int eMethod = GetResampleMethodFromString(psMethod);
+        if (eMethod < 0)
+            throw RasterManagerException(ARGUMENT_VALIDATION, QString("Resample method was invalid: %1").arg(psMethod));
+
+        RasterManager::Raster ra(ppszOriginalRaster);
+        return ra.ReSample(ppszOutputRaster, fNewCellSize, fLeft, fTop, nRows, nCols, (Raster_Resample_Method) eMethod);
+    }
+    catch (RasterManagerException e){
+        SetCInterfaceError(e, sErr);
+        return e.GetErrorCode();
+    }
+}
+
 extern "C" RM_DLL_API const char * ExtractFileExt(const char * FileName)
 {
     for (int i = strlen(FileName); i >= 0; i--) {
@@ -975,6 +1438,26 @@ extern "C" RM_DLL_API int GetStatOperationFromString(const char * psStats)
         return -1;
 }
 
+extern "C" RM_DLL_API int GetResampleMethodFromString(const char * psMethod)
+{
+    QString sMethod(psMethod);
+
+    if (QString::compare(sMethod , "nearest", Qt::CaseInsensitive) == 0)
+        return RESAMPLE_NEAREST;
+    else if (QString::compare(sMethod , "bilinear", Qt::CaseInsensitive) == 0)
+        return RESAMPLE_BILINEAR;
+    else if (QString::compare(sMethod , "cubic", Qt::CaseInsensitive) == 0)
+        return RESAMPLE_CUBIC;
+    else if (QString::compare(sMethod , "lanczos", Qt::CaseInsensitive) == 0)
+        return RESAMPLE_LANCZOS;
+    else if (QString::compare(sMethod , "average", Qt::CaseInsensitive) == 0)
+        return RESAMPLE_AVERAGE;
+    else if (QString::compare(sMethod , "mode", Qt::CaseInsensitive) == 0)
+        return RESAMPLE_MODE;
+    else
+        return -1;
+}
+
 extern "C" RM_DLL_API int GetFillMethodFromString(const char * psMethod)
 {
     QString sMethod(psMethod);
@@ -989,6 +1472,60 @@ extern "C" RM_DLL_API int GetFillMethodFromString(const char * psMethod)
         return -1;
 }
 
+extern "C" RM_DLL_API int GetGridMethodFromString(const char * psMethod)
+{
+    QString sMethod(psMethod);
+
+    if (QString::compare(sMethod , "last", Qt::CaseInsensitive) == 0)
+        return GRID_LAST;
+    else if (QString::compare(sMethod , "mean", Qt::CaseInsensitive) == 0)
+        return GRID_MEAN;
+    else if (QString::compare(sMethod , "min", Qt::CaseInsensitive) == 0
+             || QString::compare(sMethod , "minimum", Qt::CaseInsensitive) == 0)
+        return GRID_MINIMUM;
+    else if (QString::compare(sMethod , "max", Qt::CaseInsensitive) == 0
+             || QString::compare(sMethod , "maximum", Qt::CaseInsensitive) == 0)
+        return GRID_MAXIMUM;
+    else if (QString::compare(sMethod , "count", Qt::CaseInsensitive) == 0)
+        return GRID_COUNT;
+    else if (QString::compare(sMethod , "idw", Qt::CaseInsensitive) == 0)
+        return GRID_IDW;
+    else
+        return -1;
+}
+
+extern "C" RM_DLL_API int GetCreateProfileFromString(const char * psProfile)
+{
+    QString sProfile(psProfile);
+
+    if (QString::compare(sProfile , "default", Qt::CaseInsensitive) == 0)
+        return PROFILE_DEFAULT;
+    else if (QString::compare(sProfile , "fast", Qt::CaseInsensitive) == 0)
+        return PROFILE_FAST;
+    else if (QString::compare(sProfile , "compact", Qt::CaseInsensitive) == 0)
+        return PROFILE_COMPACT;
+    else if (QString::compare(sProfile , "cog", Qt::CaseInsensitive) == 0)
+        return PROFILE_COG;
+    else
+        return -1;
+}
+
+extern "C" RM_DLL_API int GetRasterizeModeFromString(const char * psMode)
+{
+    QString sMode(psMode);
+
+    if (QString::compare(sMode , "center", Qt::CaseInsensitive) == 0)
+        return RASTERIZE_CENTER;
+    else if (QString::compare(sMode , "alltouched", Qt::CaseInsensitive) == 0)
+        return RASTERIZE_ALL_TOUCHED;
+    else if (QString::compare(sMode , "coverage", Qt::CaseInsensitive) == 0)
+        return RASTERIZE_COVERAGE;
+    else if (QString::compare(sMode , "coveragemean", Qt::CaseInsensitive) == 0)
+        return RASTERIZE_COVERAGE_MEAN;
+    else
+        return -1;
+}
+
 extern "C" RM_DLL_API int GetMathOpFromString(const char * psOp)
 {
     QString sOp(psOp);
@@ -1037,6 +1574,8 @@ extern "C" RM_DLL_API int GetStatFromString(const char * psStat)
         return STATS_VARIETY;
     else if (QString::compare(sMethod , "range", Qt::CaseInsensitive) == 0)
         return STATS_RANGE;
+    else if (QString::compare(sMethod , "count", Qt::CaseInsensitive) == 0)
+        return STATS_COUNT;
     else
         return -1;
 }
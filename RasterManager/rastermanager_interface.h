@@ -78,6 +78,39 @@ enum Raster_Stats_Operation{
     STATS_SUM,
     STATS_VARIETY,
     STATS_RANGE,
+    STATS_COUNT,
+};
+
+enum Raster_Grid_Method{
+    GRID_LAST,      // Last point in the file wins
+    GRID_MEAN,
+    GRID_MINIMUM,
+    GRID_MAXIMUM,
+    GRID_COUNT,     // Points with a value (not NoData or NaN)
+    GRID_IDW,       // Inverse distance weighted from cell centres
+};
+
+enum Raster_Create_Profile{
+    PROFILE_DEFAULT,    // LZW GeoTIFFs compressed on all cores, PACKBITS for everything else
+    PROFILE_FAST,       // Tiled with ZSTD level 1 (or nothing) so writing and reading are quick
+    PROFILE_COMPACT,    // Tiled ZSTD or DEFLATE with a predictor to suit the data type
+    PROFILE_COG,        // Cloud-Optimized GeoTIFF with overviews
+};
+
+enum Raster_Rasterize_Mode{
+    RASTERIZE_CENTER,           // Cells whose centre falls inside the geometry
+    RASTERIZE_ALL_TOUCHED,      // Every cell the geometry touches at all
+    RASTERIZE_COVERAGE,         // Exact fraction (0-1) of each cell covered, overlaps counted once
+    RASTERIZE_COVERAGE_MEAN,    // Field values weighted by how much of the cell each polygon covers
+};
+
+enum Raster_Resample_Method{
+    RESAMPLE_NEAREST,
+    RESAMPLE_BILINEAR,
+    RESAMPLE_CUBIC,
+    RESAMPLE_LANCZOS,
+    RESAMPLE_AVERAGE,
+    RESAMPLE_MODE,
 };
 
 extern "C" RM_DLL_API const char * GetLibVersion();
@@ -127,6 +160,22 @@ extern "C" RM_DLL_API int GetStatFromString(const char * psStat);
  */
 extern "C" RM_DLL_API int RasterCompare(const char * ppszRaster1, const char * ppszRaster2, char * sErr);
 
+/**
+ * @brief RasterDiff Compare two rasters with a tolerance and report how different they are
+ * @param ppszRaster1
+ * @param ppszRaster2
+ * @param dTolerance Largest difference still counted as equal. 0 means a fuzzy compare.
+ * @param psDiffRaster Optional path for a raster1 - raster2 difference raster. NULL for none.
+ * @param nFullReport 0 stops at the first difference. Anything else counts them all.
+ * @param pdDiffCells Number of differing cells. Optional.
+ * @param pdMaxAbsDiff Largest absolute difference between cells with data. Optional.
+ * @param sErr
+ * @return PROCESS_OK if they match, RASTER_COMPARISON if they don't
+ */
+extern "C" RM_DLL_API int RasterDiff(const char * ppszRaster1, const char * ppszRaster2, double dTolerance,
+                                     const char * psDiffRaster, int nFullReport,
+                                     double * pdDiffCells, double * pdMaxAbsDiff, char * sErr);
+
 /**
  * @brief Retrieves the plain english words for a particular raster manager error code
  *
@@ -205,6 +254,23 @@ extern "C" RM_DLL_API int BiLinearResample(const char * ppszOriginalRaster,
                                            const char *ppszOutputRaster, double fNewCellSize,
                                            double fLeft, double fTop, int nRows, int nCols, char *sErr);
 
+/**
+ * @brief Resample a raster onto a new grid using one of the resampling methods
+ *
+ * @param ppszOriginalRaster
+ * @param ppszOutputRaster
+ * @param psMethod nearest, bilinear, cubic, lanczos, average or mode
+ * @param fNewCellSize
+ * @param fLeft
+ * @param fTop
+ * @param nRows
+ * @param nCols
+ * @return int
+ */
+extern "C" RM_DLL_API int Resample(const char * ppszOriginalRaster,
+                                   const char *ppszOutputRaster, const char * psMethod, double fNewCellSize,
+                                   double fLeft, double fTop, int nRows, int nCols, char *sErr);
+
 
 /**
  * @brief RasterPitRemoval
@@ -223,6 +289,42 @@ extern "C" RM_DLL_API int Fill(const char * sRasterInput, const char * sRasterOu
  */
 extern "C" RM_DLL_API int DeleteDataset(const char * pOutputRaster, char * sErr);
 
+/**
+ * @brief ZonalStats Count, sum, mean, min, max, std and percentiles of a raster for every zone
+ * @param psValueRaster
+ * @param psZones Zone raster (same size as the value raster) or polygon layer keyed by FID
+ * @param psOutput CSV path, or the polygon layer's own path to append the stats as attributes
+ * @param psPercentiles Comma separated percentiles (e.g. "10,50,90"). NULL or "" for none.
+ * @param sErr
+ * @return
+ */
+extern "C" RM_DLL_API int ZonalStats(const char * psValueRaster, const char * psZones,
+                                     const char * psOutput, const char * psPercentiles, char * sErr);
+
+/**
+ * @brief BuildOverviews Add internal overviews (image pyramid) to an existing raster
+ * @param psRaster
+ * @param psResampling GDAL overview resampling (AVERAGE, NEAREST, MODE...). NULL means AVERAGE
+ * @param sErr
+ * @return
+ */
+extern "C" RM_DLL_API int BuildOverviews(const char * psRaster, const char * psResampling, char * sErr);
+
+/**
+ * @brief SetCreateOverviews Build overviews on every raster we write from now on.
+ * @param psResampling GDAL overview resampling. NULL, "" or "none" turns it off.
+ */
+extern "C" RM_DLL_API void SetCreateOverviews(const char * psResampling);
+
+/**
+ * @brief SetCreateProfile Choose how every raster we write from now on is created.
+ *        Until this is called the RASTERMAN_PROFILE environment variable decides.
+ * @param psProfile default, fast, compact or cog
+ * @param sErr
+ * @return
+ */
+extern "C" RM_DLL_API int SetCreateProfile(const char * psProfile, char * sErr);
+
 /**
  * @brief CreateDrain
  * @param sRasterInput
@@ -301,6 +403,25 @@ extern "C" RM_DLL_API int vector2raster(const char * sVectorSourcePath,
                                         const char * psFieldName,
                                         char * sErr);
 
+/**
+ * @brief vector2rasterMode vector2raster with a choice of how cells are burned
+ * @param sVectorSourcePath
+ * @param sRasterOutputPath
+ * @param sRasterTemplate
+ * @param dCellWidth
+ * @param psFieldName
+ * @param psMode center, alltouched, coverage or coveragemean
+ * @param sErr
+ * @return
+ */
+extern "C" RM_DLL_API int vector2rasterMode(const char * sVectorSourcePath,
+                                            const char * sRasterOutputPath,
+                                            const char * sRasterTemplate,
+                                            double dCellWidth,
+                                            const char * psFieldName,
+                                            const char * psMode,
+                                            char * sErr);
+
 /**
  * @brief CreateOutputDS
  * @param pOutputRaster
@@ -313,9 +434,44 @@ RM_DLL_API GDALDataset * CreateOutputDS(const char * pOutputRaster,
                                         double fNoDataValue,
                                         int nCols, int nRows, double * newTransform, const char * projectionRef, const char * unit);
 
-RM_DLL_API GDALDataset * CreateOutputDS(const char * pOutputRaster, RasterMeta * pTemplateRastermeta);
+/**
+ * @brief CreateOutputDS
+ * @param pOutputRaster
+ * @param pTemplateRastermeta
+ * @param bFullCoverage The caller promises to write every cell itself so the
+ *        new raster isn't filled with NoData first. Anything it doesn't reach
+ *        should go through FillOutputRows.
+ * @return
+ */
+RM_DLL_API GDALDataset * CreateOutputDS(const char * pOutputRaster, RasterMeta * pTemplateRastermeta, bool bFullCoverage = false);
+
+RM_DLL_API GDALDataset * CreateOutputDS(QString sOutputRaster, RasterMeta * pTemplateRasterMeta, bool bFullCoverage = false);
 
-RM_DLL_API GDALDataset * CreateOutputDS(QString sOutputRaster, RasterMeta * pTemplateRasterMeta);
+/**
+ * @brief CreateProfiledDS Create an empty single band dataset using the current creation profile
+ * @param pOutputRaster The driver comes from the extension
+ * @param nCols
+ * @param nRows
+ * @param eDataType
+ * @return NULL if the driver couldn't create it. Close it with CloseOutputDS.
+ */
+RM_DLL_API GDALDataset * CreateProfiledDS(const char * pOutputRaster, int nCols, int nRows, GDALDataType eDataType);
+
+/**
+ * @brief CloseOutputDS Close a dataset from CreateOutputDS or CreateProfiledDS. Under the
+ *        COG profile this is when the working GeoTIFF is copied into the final COG.
+ * @param pDSOutput
+ */
+RM_DLL_API void CloseOutputDS(GDALDataset * pDSOutput);
+
+/**
+ * @brief FillOutputRows Write a single value across a run of whole rows, a block height at a time
+ * @param pRasterBand
+ * @param nRow First row to fill
+ * @param nRows How many rows
+ * @param fValue Usually the NoData value
+ */
+RM_DLL_API void FillOutputRows(GDALRasterBand * pRasterBand, int nRow, int nRows, double fValue);
 
 /**
  * @brief
@@ -553,6 +709,47 @@ extern "C" RM_DLL_API int ExtractRasterPoints(const char * sCSVInputSourcePath,
                                               const char * sNodata,
                                               char *sErr);
 
+/**
+ * @brief ExtractRasterPointsInterpolated
+ * @param sCSVInputSourcePath
+ * @param sRasterInputSourcePath
+ * @param sCSVOutputPath
+ * @param sXField
+ * @param sYField
+ * @param sNodata
+ * @param psInterpolation "nearest" (the cell's value) or "bilinear"
+ * @return
+ */
+extern "C" RM_DLL_API int ExtractRasterPointsInterpolated(const char * sCSVInputSourcePath,
+                                                          const char * sRasterInputSourcePath,
+                                                          const char * sCSVOutputPath,
+                                                          const char * sXField,
+                                                          const char * sYField,
+                                                          const char * sNodata,
+                                                          const char * psInterpolation,
+                                                          char *sErr);
+
+/**
+ * @brief ExtractRasterPointsMulti Sample one point file against several rasters and write
+ *        a single CSV with one value column per raster.
+ * @param sCSVInputSourcePath
+ * @param psRasters Semicolon delimited list of rasters
+ * @param sCSVOutputPath
+ * @param sXField
+ * @param sYField
+ * @param sNodata
+ * @param psInterpolation "nearest" or "bilinear"
+ * @return
+ */
+extern "C" RM_DLL_API int ExtractRasterPointsMulti(const char * sCSVInputSourcePath,
+                                                   const char * psRasters,
+                                                   const char * sCSVOutputPath,
+                                                   const char * sXField,
+                                                   const char * sYField,
+                                                   const char * sNodata,
+                                                   const char * psInterpolation,
+                                                   char *sErr);
+
 /**
  * @brief CreatePNG
  * @param psInputRaster
@@ -599,6 +796,27 @@ extern "C" RM_DLL_API int GetSymbologyStyleFromString(const char * psStyle);
  */
 extern "C" RM_DLL_API int GetFillMethodFromString(const char * psMethod);
 
+/**
+ * @brief GetGridMethodFromString
+ * @param psMethod last, mean, min, max, count or idw
+ * @return Raster_Grid_Method or -1 if it isn't recognized
+ */
+extern "C" RM_DLL_API int GetGridMethodFromString(const char * psMethod);
+
+/**
+ * @brief GetCreateProfileFromString
+ * @param psProfile default, fast, compact or cog
+ * @return Raster_Create_Profile or -1 if it isn't recognized
+ */
+extern "C" RM_DLL_API int GetCreateProfileFromString(const char * psProfile);
+
+/**
+ * @brief GetRasterizeModeFromString
+ * @param psMode center, alltouched, coverage or coveragemean
+ * @return Raster_Rasterize_Mode or -1 if it isn't recognized
+ */
+extern "C" RM_DLL_API int GetRasterizeModeFromString(const char * psMode);
+
 /**
  * @brief RasterStat
  * @param psOperation
@@ -613,6 +831,13 @@ extern "C" RM_DLL_API int RasterGetStat(const char * psOperation, double * pdVal
  */
 extern "C" RM_DLL_API int GetStatOperationFromString(const char * psStats);
 
+/**
+ * @brief GetResampleMethodFromString
+ * @param psMethod
+ * @return
+ */
+extern "C" RM_DLL_API int GetResampleMethodFromString(const char * psMethod);
+
 /**
  * @brief RasterFromCSVandTemplate
  * @param sCSVSourcePath
@@ -631,6 +856,32 @@ extern "C" RM_DLL_API int RasterFromCSVandTemplate(const char * sCSVSourcePath,
                                                    const char * sDataField ,
                                                    char *sErr);
 
+/**
+ * @brief RasterFromCSVandTemplateGridded Same as RasterFromCSVandTemplate but every point
+ *        falling in a cell is combined with the gridding method instead of the last one winning.
+ * @param sCSVSourcePath
+ * @param psOutput
+ * @param sRasterTemplate
+ * @param sXField
+ * @param sYField
+ * @param sDataField
+ * @param psMethod last, mean, min, max, count or idw
+ * @param fIDWRadius Search radius for idw. 0 means a point only feeds the cell it falls in.
+ * @param fIDWPower Distance exponent for idw
+ * @param sErr
+ * @return
+ */
+extern "C" RM_DLL_API int RasterFromCSVandTemplateGridded(const char * sCSVSourcePath,
+                                                          const char * psOutput,
+                                                          const char * sRasterTemplate,
+                                                          const char * sXField,
+                                                          const char * sYField,
+                                                          const char * sDataField,
+                                                          const char * psMethod,
+                                                          double fIDWRadius,
+                                                          double fIDWPower,
+                                                          char * sErr);
+
 /**
  * @brief RasterToCSVandTemplate
  * @param sRasterSourcePath
@@ -642,6 +893,20 @@ extern "C" RM_DLL_API int RasterToCSV(const char * sRasterSourcePath,
                                       const char * sOutputCSVPath,
                                       char * sErr);
 
+/**
+ * @brief RasterToCSVNoData Same as RasterToCSV but NoData cells can be kept.
+ *        An output path ending in .bin gets the columnar binary layout instead of text.
+ * @param sRasterSourcePath
+ * @param sOutputCSVPath
+ * @param bIncludeNoData Non zero writes NoData cells too
+ * @param sErr
+ * @return
+ */
+extern "C" RM_DLL_API int RasterToCSVNoData(const char * sRasterSourcePath,
+                                            const char * sOutputCSVPath,
+                                            int bIncludeNoData,
+                                            char * sErr);
+
 /**
  * @brief RasterFromCSVandExtents
  * @param sCSVSourcePath
@@ -670,6 +935,30 @@ extern "C" RM_DLL_API int RasterFromCSVandExtents(const char * sCSVSourcePath,
                                                   const char * sDataField,
                                                   char *sErr);
 
+/**
+ * @brief RasterFromCSVandExtentsGridded Same as RasterFromCSVandExtents but every point
+ *        falling in a cell is combined with the gridding method instead of the last one winning.
+ * @param psMethod last, mean, min, max, count or idw
+ * @param fIDWRadius Search radius for idw. 0 means a point only feeds the cell it falls in.
+ * @param fIDWPower Distance exponent for idw
+ * @return
+ */
+extern "C" RM_DLL_API int RasterFromCSVandExtentsGridded(const char * sCSVSourcePath,
+                                                         const char * sOutput,
+                                                         double dTop,
+                                                         double dLeft,
+                                                         int nRows,
+                                                         int nCols,
+                                                         double dCellWidth,
+                                                         double dNoDataVal,
+                                                         const char * sXField,
+                                                         const char * sYField,
+                                                         const char * sDataField,
+                                                         const char * psMethod,
+                                                         double fIDWRadius,
+                                                         double fIDWPower,
+                                                         char * sErr);
+
 /**
  * @brief RasterEuclideanDistance
  * @param psRaster1
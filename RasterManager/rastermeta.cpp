@@ -99,39 +99,18 @@ void RasterMeta::GetPropertiesFromExistingRaster(const char * psFilePath)
     // Open the original dataset
     b_HasNoData = true;
 
-    GDALDataset * pDS = (GDALDataset*) GDALOpen(psFilePath, GA_ReadOnly);
-    if (pDS  == NULL)
-        throw RasterManagerException(INPUT_FILE_NOT_VALID, "Error opening raster file: " + QString(psFilePath) );
+    RasterHeader header;
+    ReadRasterHeader(psFilePath, header);
 
-    int nSuccess;
+    GDALDataType gdDataType = header.eDataType;
+    double dNoData = header.fNoData;
 
-    GDALDataType gdDataType =  pDS->GetRasterBand(1)->GetRasterDataType();
-
-    double dNoData =  pDS->GetRasterBand(1)->GetNoDataValue(&nSuccess);
-
-    const char * psDriver = pDS->GetDriver()->GetDescription();
-
-    const char * psProjection = pDS->GetProjectionRef();
-    char * psUnit = NULL;
-    char * psWKT = NULL;
-    psWKT = (char *) psProjection;
-
-    OGRSpatialReference poSRS;
-    poSRS.importFromWkt(&psWKT);
-    poSRS.GetLinearUnits(&psUnit);
-
-    if (nSuccess == 0){
+    if (!header.bHasNoData){
         b_HasNoData = false;
         dNoData = DEFAULT_NO_DATA;
     }
-    Init(&dNoData, psDriver, &gdDataType, psProjection, psUnit);
-
-//    if (psUnit)
-//        CPLFree(psUnit);
-//    if (psWKT)
-//        CPLFree(psWKT);
-
-    GDALClose(pDS);
+    Init(&dNoData, header.sDriver.constData(), &gdDataType, header.sProjection.constData(),
+         header.sUnit.isNull() ? NULL : header.sUnit.constData());
 
 }
 
@@ -0,0 +1,292 @@
+#define MY_DLL_EXPORT
+
+#include "rasterstream.h"
+#include "rastermanager.h"
+#include "rastermanager_interface.h"
+#include "rastermanager_exception.h"
+#include <QThread>
+#include <cstring>
+#include <algorithm>
+
+namespace RasterManager {
+
+// Writer strips are whole blocks and at least this many rows tall
+const int WRITER_MIN_STRIP_ROWS = 64;
+
+// Strips being filled, queued or written at once. This is all the memory the writer holds.
+const int WRITER_STRIPS = 4;
+
+// Reader strips are sized the same way. One is with the caller and the rest are read ahead.
+const int READER_MIN_STRIP_ROWS = 64;
+const int READER_STRIPS = 4;
+
+/* The writer gets its own thread rather than one from the global pool. A kernel already
+ * using every pool thread would otherwise block on a full queue nothing is draining. */
+class RasterWriterThread : public QThread
+{
+public:
+    RasterWriterThread(RasterWriter * pWriter) : m_pWriter(pWriter) {}
+
+protected:
+    void run() { m_pWriter->Drain(); }
+
+private:
+    RasterWriter * m_pWriter;
+};
+
+class RasterReaderThread : public QThread
+{
+public:
+    RasterReaderThread(RasterReader * pReader) : m_pReader(pReader) {}
+
+protected:
+    void run() { m_pReader->Fill(); }
+
+private:
+    RasterReader * m_pReader;
+};
+
+RasterWriter::RasterWriter(GDALRasterBand * pRasterBand, StatsAccumulator * pStats)
+    : m_pRasterBand(pRasterBand), m_pStats(pStats), m_pCurrent(NULL),
+      m_bClosing(false), m_nErrorCode(PROCESS_OK)
+{
+    m_nCols = pRasterBand->GetXSize();
+
+    int nBlockX, nBlockY;
+    pRasterBand->GetBlockSize(&nBlockX, &nBlockY);
+    m_nStripRows = std::max(1, nBlockY);
+    while (m_nStripRows < WRITER_MIN_STRIP_ROWS)
+        m_nStripRows += std::max(1, nBlockY);
+    m_nStripRows = std::max(1, std::min(m_nStripRows, pRasterBand->GetYSize()));
+
+    for (int s = 0; s < WRITER_STRIPS; s++){
+        Strip * pStrip = new Strip;
+        pStrip->nRow = 0;
+        pStrip->nRows = 0;
+        pStrip->pData = (double *) CPLMalloc(sizeof(double) * m_nCols * m_nStripRows);
+        m_lAll.append(pStrip);
+        m_lFree.append(pStrip);
+    }
+
+    m_pThread = new RasterWriterThread(this);
+    m_pThread->start();
+}
+
+RasterWriter::~RasterWriter()
+{
+    // Something threw before Finish(). Stop the thread but never throw from here.
+    try {
+        Finish();
+    }
+    catch (RasterManagerException e){ }
+
+    foreach (Strip * pStrip, m_lAll){
+        CPLFree(pStrip->pData);
+        delete pStrip;
+    }
+}
+
+void RasterWriter::WriteRow(int nRow, const double * pLine){
+
+    if (m_pThread == NULL)
+        return;
+
+    // A row that doesn't carry on from the last one starts a strip of its own
+    if (m_pCurrent != NULL && nRow != m_pCurrent->nRow + m_pCurrent->nRows){
+        Enqueue(m_pCurrent);
+        m_pCurrent = NULL;
+    }
+    if (m_pCurrent == NULL){
+        m_pCurrent = TakeFree();
+        m_pCurrent->nRow = nRow;
+        m_pCurrent->nRows = 0;
+    }
+
+    memcpy(m_pCurrent->pData + (qint64) m_pCurrent->nRows * m_nCols, pLine, sizeof(double) * m_nCols);
+    m_pCurrent->nRows++;
+
+    // Hand it over as soon as it's full or ends on a strip boundary so GDAL gets whole blocks
+    if (m_pCurrent->nRows == m_nStripRows || (nRow + 1) % m_nStripRows == 0){
+        Enqueue(m_pCurrent);
+        m_pCurrent = NULL;
+    }
+}
+
+void RasterWriter::Finish(){
+
+    if (m_pThread == NULL)
+        return;
+
+    if (m_pCurrent != NULL){
+        Enqueue(m_pCurrent);
+        m_pCurrent = NULL;
+    }
+    {
+        QMutexLocker lock(&m_mxQueue);
+        m_bClosing = true;
+        m_wcQueued.wakeAll();
+    }
+    m_pThread->wait();
+    delete m_pThread;
+    m_pThread = NULL;
+
+    if (m_nErrorCode != PROCESS_OK)
+        throw RasterManagerException(m_nErrorCode, m_sError);
+}
+
+RasterWriter::Strip * RasterWriter::TakeFree(){
+    QMutexLocker lock(&m_mxQueue);
+    while (m_lFree.isEmpty())
+        m_wcFree.wait(&m_mxQueue);
+    return m_lFree.takeFirst();
+}
+
+void RasterWriter::Enqueue(Strip * pStrip){
+    QMutexLocker lock(&m_mxQueue);
+    m_qFull.enqueue(pStrip);
+    m_wcQueued.wakeOne();
+}
+
+/* Writer thread: write strips in the order they were queued until Finish() says stop */
+void RasterWriter::Drain(){
+
+    while (true){
+        Strip * pStrip;
+        {
+            QMutexLocker lock(&m_mxQueue);
+            while (m_qFull.isEmpty() && !m_bClosing)
+                m_wcQueued.wait(&m_mxQueue);
+            if (m_qFull.isEmpty())
+                return;
+            pStrip = m_qFull.dequeue();
+        }
+
+        // After a failure the rest are just handed back so the caller never blocks
+        if (m_nErrorCode == PROCESS_OK){
+            CPLErr err = m_pRasterBand->RasterIO(GF_Write, 0, pStrip->nRow, m_nCols, pStrip->nRows,
+                                                 pStrip->pData, m_nCols, pStrip->nRows, GDT_Float64, 0, 0);
+            if (err == CE_Failure || err == CE_Fatal){
+                m_nErrorCode = OUTPUT_FILE_ERROR;
+                m_sError = CPLGetLastErrorMsg();
+            }
+            else if (m_pStats != NULL){
+                for (int i = 0; i < pStrip->nRows; i++)
+                    m_pStats->AddLine(pStrip->pData + (qint64) i * m_nCols, m_nCols);
+            }
+        }
+
+        QMutexLocker lock(&m_mxQueue);
+        m_lFree.append(pStrip);
+        m_wcFree.wakeOne();
+    }
+}
+
+RasterReader::RasterReader(GDALRasterBand * pRasterBand)
+    : m_pRasterBand(pRasterBand), m_pCurrent(NULL), m_bStopping(false)
+{
+    m_nCols = pRasterBand->GetXSize();
+    m_nRows = pRasterBand->GetYSize();
+
+    int nBlockX, nBlockY;
+    pRasterBand->GetBlockSize(&nBlockX, &nBlockY);
+    m_nStripRows = std::max(1, nBlockY);
+    while (m_nStripRows < READER_MIN_STRIP_ROWS)
+        m_nStripRows += std::max(1, nBlockY);
+    m_nStripRows = std::max(1, std::min(m_nStripRows, m_nRows));
+
+    for (int s = 0; s < READER_STRIPS; s++){
+        Strip * pStrip = new Strip;
+        pStrip->nRow = 0;
+        pStrip->nRows = 0;
+        pStrip->bFailed = false;
+        pStrip->pData = (double *) CPLMalloc(sizeof(double) * m_nCols * m_nStripRows);
+        m_lAll.append(pStrip);
+        m_lFree.append(pStrip);
+    }
+
+    m_pThread = new RasterReaderThread(this);
+    m_pThread->start();
+}
+
+RasterReader::~RasterReader()
+{
+    Stop();
+    foreach (Strip * pStrip, m_lAll){
+        CPLFree(pStrip->pData);
+        delete pStrip;
+    }
+}
+
+void RasterReader::Stop(){
+    if (m_pThread == NULL)
+        return;
+    {
+        QMutexLocker lock(&m_mxQueue);
+        m_bStopping = true;
+        m_wcFree.wakeAll();
+    }
+    m_pThread->wait();
+    delete m_pThread;
+    m_pThread = NULL;
+}
+
+const double * RasterReader::ReadRow(int nRow){
+
+    if (nRow < 0 || nRow >= m_nRows)
+        throw RasterManagerException(INPUT_FILE_ERROR, QString("Row %1 is outside the raster.").arg(nRow));
+
+    while (m_pCurrent == NULL || nRow >= m_pCurrent->nRow + m_pCurrent->nRows){
+
+        QMutexLocker lock(&m_mxQueue);
+        if (m_pCurrent != NULL){
+            m_lFree.append(m_pCurrent);
+            m_pCurrent = NULL;
+            m_wcFree.wakeOne();
+        }
+        while (m_qFilled.isEmpty())
+            m_wcFilled.wait(&m_mxQueue);
+        m_pCurrent = m_qFilled.dequeue();
+
+        if (m_pCurrent->bFailed)
+            throw RasterManagerException(INPUT_FILE_ERROR, m_sError);
+    }
+
+    if (nRow < m_pCurrent->nRow)
+        throw RasterManagerException(INPUT_FILE_ERROR, QString("Row %1 was asked for after a later row.").arg(nRow));
+
+    return m_pCurrent->pData + (qint64) (nRow - m_pCurrent->nRow) * m_nCols;
+}
+
+/* Reader thread: decode strips top to bottom whenever a buffer is free */
+void RasterReader::Fill(){
+
+    for (int nRow = 0; nRow < m_nRows; nRow += m_nStripRows){
+        Strip * pStrip;
+        {
+            QMutexLocker lock(&m_mxQueue);
+            while (m_lFree.isEmpty() && !m_bStopping)
+                m_wcFree.wait(&m_mxQueue);
+            if (m_bStopping)
+                return;
+            pStrip = m_lFree.takeFirst();
+        }
+
+        pStrip->nRow = nRow;
+        pStrip->nRows = std::min(m_nStripRows, m_nRows - nRow);
+        CPLErr err = m_pRasterBand->RasterIO(GF_Read, 0, nRow, m_nCols, pStrip->nRows,
+                                             pStrip->pData, m_nCols, pStrip->nRows, GDT_Float64, 0, 0);
+        pStrip->bFailed = err == CE_Failure || err == CE_Fatal;
+
+        QMutexLocker lock(&m_mxQueue);
+        if (pStrip->bFailed)
+            m_sError = CPLGetLastErrorMsg();
+        m_qFilled.enqueue(pStrip);
+        m_wcFilled.wakeOne();
+
+        // Nothing after a failed strip is any use
+        if (pStrip->bFailed)
+            return;
+    }
+}
+
+}
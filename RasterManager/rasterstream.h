@@ -0,0 +1,143 @@
+#ifndef RASTERSTREAM_H
+#define RASTERSTREAM_H
+
+#include "rastermanager_global.h"
+#include "gdal_priv.h"
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QList>
+#include <QString>
+
+namespace RasterManager {
+
+class StatsAccumulator;
+class RasterWriterThread;
+class RasterReaderThread;
+
+/**
+ * @brief The RasterWriter class is a write-behind stage for an output band. Rows are copied
+ *        into strips a whole number of blocks tall and a background thread writes each
+ *        strip once it's full, so compression overlaps with whatever computes the next rows.
+ *        Only a few strips are ever queued. WriteRow blocks when the writer falls behind.
+ */
+class RM_DLL_API RasterWriter
+{
+public:
+    /**
+     * @brief RasterWriter
+     * @param pRasterBand Output band. Nothing else should write to it until Finish().
+     * @param pStats Optional. Every row written is added to it on the writer thread.
+     */
+    RasterWriter(GDALRasterBand * pRasterBand, StatsAccumulator * pStats = NULL);
+    ~RasterWriter();
+
+    /**
+     * @brief WriteRow Queue one full width row. The line is copied so it can be reused straight away.
+     *        Rows don't have to be in order but runs of consecutive rows share strips.
+     * @param nRow
+     * @param pLine
+     */
+    void WriteRow(int nRow, const double * pLine);
+
+    /**
+     * @brief Finish Write whatever is still queued and wait for it. Throws if any write failed.
+     */
+    void Finish();
+
+private:
+    struct Strip
+    {
+        int nRow;
+        int nRows;
+        double * pData;
+    };
+
+    friend class RasterWriterThread;
+    void Drain();
+    void Enqueue(Strip * pStrip);
+    Strip * TakeFree();
+
+    GDALRasterBand * m_pRasterBand;
+    StatsAccumulator * m_pStats;
+    int m_nCols;
+    int m_nStripRows;
+
+    // The strip WriteRow is filling, only touched by the caller's thread
+    Strip * m_pCurrent;
+
+    QMutex m_mxQueue;
+    QWaitCondition m_wcQueued;
+    QWaitCondition m_wcFree;
+    QQueue<Strip *> m_qFull;
+    QList<Strip *> m_lFree;
+    QList<Strip *> m_lAll;
+    bool m_bClosing;
+
+    int m_nErrorCode;
+    QString m_sError;
+
+    RasterWriterThread * m_pThread;
+};
+
+/**
+ * @brief The RasterReader class is a read-ahead stage for an input band. A background thread
+ *        decodes the next few strips (whole blocks, full width) while the caller works on the
+ *        current one. Rows have to be asked for top to bottom, though rows can be skipped.
+ */
+class RM_DLL_API RasterReader
+{
+public:
+    /**
+     * @brief RasterReader
+     * @param pRasterBand Input band. Nothing else should read it while the reader is alive.
+     */
+    RasterReader(GDALRasterBand * pRasterBand);
+    ~RasterReader();
+
+    /**
+     * @brief ReadRow One full width row as doubles
+     * @param nRow Must not be above the last row asked for
+     * @return Valid until the next call. Throws if the row couldn't be read.
+     */
+    const double * ReadRow(int nRow);
+
+    inline int GetCols() const { return m_nCols; }
+    inline int GetRows() const { return m_nRows; }
+
+private:
+    struct Strip
+    {
+        int nRow;
+        int nRows;
+        double * pData;
+        bool bFailed;
+    };
+
+    friend class RasterReaderThread;
+    void Fill();
+    void Stop();
+
+    GDALRasterBand * m_pRasterBand;
+    int m_nCols;
+    int m_nRows;
+    int m_nStripRows;
+
+    // The strip ReadRow is handing out rows from, only touched by the caller's thread
+    Strip * m_pCurrent;
+
+    QMutex m_mxQueue;
+    QWaitCondition m_wcFilled;
+    QWaitCondition m_wcFree;
+    QQueue<Strip *> m_qFilled;
+    QList<Strip *> m_lFree;
+    QList<Strip *> m_lAll;
+    bool m_bStopping;
+    QString m_sError;
+
+    RasterReaderThread * m_pThread;
+};
+
+}
+
+#endif // RASTERSTREAM_H